@@ -0,0 +1,821 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Xmms::AutoEq: apply equalizer presets automatically on track change.
+ *
+ * Rules map file name globs or ranges of playlist positions to
+ * presets; the first rule that matches the current entry wins.  A
+ * native thread polls the playlist position (one cheap request every
+ * few milliseconds, without the interpreter lock) and, when it
+ * changes, fetches the entry's file name, runs it past the rules, and
+ * applies the winning preset with a single request -- unless it's the
+ * one that's already applied.
+ *
+ * Globs are compiled when the rule is added, and matching works on
+ * the file name in place, so nothing on the polling thread allocates
+ * (apart from the file name libxmms hands back).
+ *
+ * Glob syntax: '*' matches anything but '/', '?' any one character but
+ * '/', '[a-z]' and '[!a-z]' character classes, '\' quotes the next
+ * character, and a '**' path component matches any number of
+ * directories.  A glob without a '/' is matched against the base name
+ * only.
+ */
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include "xmms_ruby.h"
+
+/* defaults */
+#define DEFAULT_INTERVAL 0.005
+
+/* recheck the current entry's file name this often, in seconds, in
+ * case the playlist was edited under it */
+#define RECHECK_INTERVAL 1.0
+
+/* one path component of a glob */
+typedef struct {
+  const char *pat;
+  int len,
+      any;                  /* "**" */
+} glob_seg;
+
+typedef struct {
+  char *pat;                /* owned copy of the pattern */
+  glob_seg *segs;
+  int num_segs,
+      base_only;
+} glob;
+
+typedef struct {
+  glob glob;                /* unused if this is a position rule */
+  int is_range,
+      lo,
+      hi;                   /* inclusive */
+  gfloat eq[XR_EQ_LEN];
+  VALUE name;               /* the preset's name, for #match */
+} rule;
+
+typedef struct {
+  int session;
+  double interval;
+
+  /* rules; the polling thread reads them with the lock held */
+  rule *rules;
+  int num_rules,
+      rules_cap,
+      has_default;
+  gfloat def[XR_EQ_LEN];
+  VALUE def_name;
+
+  /* polling thread */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int running,
+      stop,
+      orphan,               /* collected while running (see autoeq_free()) */
+      gen;
+
+  /* polling state (only touched by the thread, or with it stopped) */
+  int last_pos,
+      applied;
+  gfloat last_eq[XR_EQ_LEN];
+
+  /* statistics */
+  unsigned long num_polls,
+                num_changes,
+                num_applied;
+} xr_autoeq;
+
+static VALUE cAutoEq;
+static ID id_name, id_set_name;
+
+/*********/
+/* GLOBS */
+/*********/
+
+/*
+ * Match one path component against one glob component.  The usual
+ * two-pointer wildcard match: on a mismatch, go back to just after the
+ * last '*' and let it swallow one more character.
+ */
+static int seg_match(const char *p, int plen, const char *s, int slen) {
+  int pi = 0, si = 0, star_p = -1, star_s = 0;
+
+  while (si < slen) {
+    if (pi < plen && p[pi] == '*') {
+      star_p = ++pi;
+      star_s = si;
+      continue;
+    }
+
+    if (pi < plen) {
+      int ok = 0, n = 1;
+
+      if (p[pi] == '?') {
+        ok = 1;
+      } else if (p[pi] == '[') {
+        /* character class */
+        int neg = 0, j = pi + 1, c = (unsigned char) s[si];
+
+        if (j < plen && (p[j] == '!' || p[j] == '^')) {
+          neg = 1;
+          j++;
+        }
+        for (; j < plen && (p[j] != ']' || j == pi + 1 + neg); j++) {
+          if (j + 2 < plen && p[j + 1] == '-' && p[j + 2] != ']') {
+            if (c >= (unsigned char) p[j] && c <= (unsigned char) p[j + 2])
+              ok = 1;
+            j += 2;
+          } else if (c == (unsigned char) p[j]) {
+            ok = 1;
+          }
+        }
+
+        if (j >= plen) {
+          /* no closing bracket; it's just a '[' */
+          ok = (s[si] == '[');
+        } else {
+          ok ^= neg;
+          n = j - pi + 1;
+        }
+      } else if (p[pi] == '\\' && pi + 1 < plen) {
+        ok = (p[pi + 1] == s[si]);
+        n = 2;
+      } else {
+        ok = (p[pi] == s[si]);
+      }
+
+      if (ok) {
+        pi += n;
+        si++;
+        continue;
+      }
+    }
+
+    if (star_p < 0)
+      return 0;
+    pi = star_p;
+    si = ++star_s;
+  }
+
+  while (pi < plen && p[pi] == '*')
+    pi++;
+  return pi == plen;
+}
+
+/*
+ * Find the end of the path component starting at s.
+ */
+static const char *seg_end(const char *s) {
+  const char *e = strchr(s, '/');
+  return e ? e : s + strlen(s);
+}
+
+/*
+ * Match a path against a glob.  The same two-pointer walk as
+ * seg_match(), a component at a time, with "**" as the star.
+ */
+static int glob_match(glob *g, const char *path) {
+  const char *s = path, *end = path + strlen(path), *star_s = NULL, *e;
+  int i = 0, star_i = -1;
+
+  if (g->base_only) {
+    const char *slash = strrchr(path, '/');
+    s = slash ? slash + 1 : path;
+    return seg_match(g->segs[0].pat, g->segs[0].len, s, end - s);
+  }
+
+  /* s is past the end once every component has been matched */
+  while (s <= end) {
+    if (i < g->num_segs && g->segs[i].any) {
+      star_i = ++i;
+      star_s = s;
+      continue;
+    }
+
+    e = seg_end(s);
+    if (i < g->num_segs && seg_match(g->segs[i].pat, g->segs[i].len, s, e - s)) {
+      i++;
+      s = e + 1;
+      continue;
+    }
+
+    if (star_i < 0)
+      return 0;
+
+    /* let the last "**" swallow one more component */
+    star_s = seg_end(star_s) + 1;
+    i = star_i;
+    s = star_s;
+  }
+
+  while (i < g->num_segs && g->segs[i].any)
+    i++;
+  return i == g->num_segs;
+}
+
+static void glob_compile(glob *g, const char *pat, long len) {
+  const char *p, *e, *end;
+  int n;
+
+  g->pat = ALLOC_N(char, len + 1);
+  memcpy(g->pat, pat, len);
+  g->pat[len] = '\0';
+  end = g->pat + len;
+  g->base_only = (memchr(g->pat, '/', len) == NULL);
+
+  for (n = 1, p = g->pat; p < end; p++)
+    if (*p == '/')
+      n++;
+  g->segs = ALLOC_N(glob_seg, n);
+  g->num_segs = 0;
+
+  for (p = g->pat; ; p = e + 1) {
+    if ((e = memchr(p, '/', end - p)) == NULL)
+      e = end;
+
+    g->segs[g->num_segs].pat = p;
+    g->segs[g->num_segs].len = e - p;
+    g->segs[g->num_segs].any = (e - p == 2 && p[0] == '*' && p[1] == '*');
+    g->num_segs++;
+
+    if (e == end)
+      break;
+  }
+}
+
+static void glob_free(glob *g) {
+  xfree(g->pat);
+  xfree(g->segs);
+}
+
+/*********/
+/* RULES */
+/*********/
+
+/*
+ * Find the preset for an entry.  Call with the lock held.  Returns
+ * NULL if no rule matches and there's no default.
+ */
+static const gfloat *find_preset(xr_autoeq *a, int pos, const char *file,
+                                 VALUE *name) {
+  int i;
+
+  for (i = 0; i < a->num_rules; i++) {
+    rule *r = &a->rules[i];
+
+    if (r->is_range ? (pos >= r->lo && pos <= r->hi)
+                    : (file && glob_match(&r->glob, file))) {
+      if (name)
+        *name = r->name;
+      return r->eq;
+    }
+  }
+
+  if (name)
+    *name = a->def_name;
+  return a->has_default ? a->def : NULL;
+}
+
+/***************/
+/* POLL THREAD */
+/***************/
+
+/*
+ * Sleep for the polling interval, or until stopped.  Returns 0 once
+ * stopped.
+ */
+static int poll_wait(xr_autoeq *a) {
+  struct timespec ts;
+  double t;
+  int ret;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  t = ts.tv_sec + ts.tv_nsec / 1e9 + a->interval;
+  ts.tv_sec = (time_t) t;
+  ts.tv_nsec = (long) ((t - (time_t) t) * 1e9);
+
+  pthread_mutex_lock(&a->lock);
+  while (!a->stop)
+    if (pthread_cond_timedwait(&a->wake, &a->lock, &ts))
+      break;
+  ret = !a->stop;
+  pthread_mutex_unlock(&a->lock);
+
+  return ret;
+}
+
+static void poll_once(xr_autoeq *a, double *last_check) {
+  xr_cmd cmd;
+  const gfloat *preset;
+  gchar *file;
+  double now = xr_now();
+  int pos, last;
+
+  a->num_polls++;
+  pos = xmms_remote_get_playlist_pos(a->session);
+  pthread_mutex_lock(&a->lock);
+  last = a->last_pos;
+  pthread_mutex_unlock(&a->lock);
+  if (pos == last && now - *last_check < RECHECK_INTERVAL)
+    return;
+
+  /* libxmms says 0 when it can't reach XMMS */
+  if (pos == 0 && !xmms_remote_is_running(a->session)) {
+    pthread_mutex_lock(&a->lock);
+    a->last_pos = -1;
+    pthread_mutex_unlock(&a->lock);
+    return;
+  }
+
+  if (pos != last)
+    a->num_changes++;
+  *last_check = now;
+
+  file = xmms_remote_get_playlist_file(a->session, pos);
+
+  memset(&cmd, 0, sizeof(cmd));
+  pthread_mutex_lock(&a->lock);
+  a->last_pos = pos;
+  if ((preset = find_preset(a, pos, file, NULL)) != NULL)
+    memcpy(cmd.farg, preset, sizeof(cmd.farg));
+  pthread_mutex_unlock(&a->lock);
+
+  if (file)
+    g_free(file);
+
+  if (!preset || (a->applied && !memcmp(cmd.farg, a->last_eq, sizeof(cmd.farg))))
+    return;
+
+  /*
+   * Send it as a late edit, so remotes whose cached equalizer settings
+   * are now stale (see eq.c) know to write theirs again.
+   */
+  cmd.op = XR_CMD_SET_EQ;
+  cmd.session = a->session;
+  cmd.late = 1;
+  xr_cmd_run(&cmd);
+  memcpy(a->last_eq, cmd.farg, sizeof(cmd.farg));
+  a->applied = 1;
+  a->num_applied++;
+}
+
+static void *poll_thread(void *data) {
+  xr_autoeq *a = data;
+  double last_check = 0;
+  int orphan;
+
+  do {
+    poll_once(a, &last_check);
+  } while (poll_wait(a));
+
+  /* the object was collected while we ran: the struct is ours now */
+  pthread_mutex_lock(&a->lock);
+  orphan = a->orphan;
+  pthread_mutex_unlock(&a->lock);
+  if (orphan) {
+    pthread_mutex_destroy(&a->lock);
+    pthread_cond_destroy(&a->wake);
+    free(a);
+  }
+
+  return NULL;
+}
+
+static void *autoeq_stop(void *data) {
+  xr_autoeq *a = data;
+
+  /* the thread doesn't exist in a forked child */
+  if (!a->running || a->gen != xr_fork_gen) {
+    a->running = 0;
+    return NULL;
+  }
+
+  pthread_mutex_lock(&a->lock);
+  a->stop = 1;
+  pthread_cond_signal(&a->wake);
+  pthread_mutex_unlock(&a->lock);
+  pthread_join(a->thread, NULL);
+  a->running = 0;
+
+  return NULL;
+}
+
+/*
+ * Make sure the lock is usable (it may have been held by another
+ * thread when we forked).
+ */
+static void autoeq_check_fork(xr_autoeq *a) {
+  if (a->gen == xr_fork_gen)
+    return;
+
+  pthread_mutex_init(&a->lock, NULL);
+  pthread_cond_init(&a->wake, NULL);
+  a->running = 0;
+  a->gen = xr_fork_gen;
+}
+
+static void autoeq_mark(xr_autoeq *a) {
+  int i;
+
+  for (i = 0; i < a->num_rules; i++)
+    rb_gc_mark(a->rules[i].name);
+  rb_gc_mark(a->def_name);
+}
+
+static void autoeq_free(xr_autoeq *a) {
+  int i, detach;
+
+  /*
+   * Don't wait for the polling thread here (it may be in the middle of
+   * a slow libxmms call, and the GC shouldn't block on that): drop the
+   * rules, tell it to stop, and let it free the rest on its way out.
+   */
+  detach = a->running && a->gen == xr_fork_gen;
+  if (detach)
+    pthread_mutex_lock(&a->lock);
+  for (i = 0; i < a->num_rules; i++)
+    if (!a->rules[i].is_range)
+      glob_free(&a->rules[i].glob);
+  free(a->rules);
+  a->rules = NULL;
+  a->num_rules = a->has_default = 0;
+
+  if (detach) {
+    a->stop = a->orphan = 1;
+    pthread_cond_signal(&a->wake);
+    pthread_mutex_unlock(&a->lock);
+    pthread_detach(a->thread);
+    return;
+  }
+
+  /* see engine_free() */
+  if (a->gen == xr_fork_gen) {
+    pthread_mutex_destroy(&a->lock);
+    pthread_cond_destroy(&a->wake);
+  }
+  free(a);
+}
+
+static xr_autoeq *get_autoeq(VALUE self) {
+  xr_autoeq *a;
+
+  Data_Get_Struct(self, xr_autoeq, a);
+  autoeq_check_fork(a);
+  return a;
+}
+
+/****************/
+/* RUBY METHODS */
+/****************/
+
+/*
+ * Create a new (stopped) automatic equalizer for a session (an
+ * Xmms::Remote or a session number).
+ *
+ * Options:
+ *   :interval   how often to check for a track change, in seconds
+ *               (default 0.005)
+ *
+ * This method raises an ArgumentError exception if the number of
+ * arguments isn't 0, 1, or 2, or if the interval isn't positive.
+ *
+ * Examples:
+ *   auto = Xmms::AutoEq.new(remote)
+ *   auto = Xmms::AutoEq.new(1, :interval => 0.02)
+ *
+ */
+static VALUE xra_new(int argc, VALUE *argv, VALUE klass) {
+  VALUE self, opts = Qnil, v;
+  xr_autoeq *a;
+  int n = argc, *session;
+
+  if (argc > 2)
+    rb_raise(rb_eArgError, "invalid argument count (not 0, 1, or 2)");
+  if (argc > 0 && TYPE(argv[argc - 1]) == T_HASH)
+    opts = argv[--n];
+
+  /*
+   * Not Data_Make_Struct(): the polling thread may outlive the object,
+   * and free the struct itself (see autoeq_free()).
+   */
+  self = Data_Wrap_Struct(klass, autoeq_mark, autoeq_free, NULL);
+  if ((a = calloc(1, sizeof(xr_autoeq))) == NULL)
+    rb_memerror();
+  DATA_PTR(self) = a;
+  pthread_mutex_init(&a->lock, NULL);
+  pthread_cond_init(&a->wake, NULL);
+  a->gen = xr_fork_gen;
+  a->interval = DEFAULT_INTERVAL;
+  a->last_pos = -1;
+  a->def_name = Qnil;
+
+  if (n > 0 && rb_obj_is_kind_of(argv[0], cRemote)) {
+    session = XR_SESSION(argv[0]);
+    a->session = *session;
+  } else if (n > 0) {
+    a->session = NUM2INT(argv[0]);
+  }
+
+  if (opts != Qnil && (v = rb_hash_aref(opts, ID2SYM(rb_intern("interval")))) != Qnil)
+    a->interval = NUM2DBL(v);
+  if (a->interval <= 0)
+    rb_raise(rb_eArgError, "invalid interval (not positive)");
+
+  rb_obj_call_init(self, argc, argv);
+  return self;
+}
+
+/*
+ * Xmms::AutoEq constructor.
+ *
+ * This function is currently just a placeholder.
+ *
+ */
+static VALUE xra_init(int argc, VALUE *argv, VALUE self) {
+  UNUSED(argc);
+  UNUSED(argv);
+  return self;
+}
+
+/*
+ * Add a rule: entries whose file name matches a glob (a String), or
+ * whose playlist position is in a Range, get the given preset.  Rules
+ * are tried in the order they were added.  The preset's values are
+ * copied, so later changes to it don't affect the rule.  Rules can be
+ * added while the equalizer is running.
+ *
+ * This method raises a TypeError exception if the preset isn't an
+ * Xmms::EqPreset, or if the match isn't a String or a Range.
+ *
+ * Examples:
+ *   auto.rule '*.m4b', speech
+ *   auto.rule '*.ogg', vorbis
+ *   auto.rule 0..9, loud
+ *
+ */
+static VALUE xra_rule(VALUE self, VALUE match, VALUE preset) {
+  xr_autoeq *a = get_autoeq(self);
+  const gfloat *eq = xr_eq_values(preset);
+  VALUE beg, end;
+  int excl;
+  rule r;
+
+  memset(&r, 0, sizeof(r));
+  memcpy(r.eq, eq, sizeof(r.eq));
+  r.name = rb_funcall(preset, id_name, 0);
+
+  if (rb_range_values(match, &beg, &end, &excl)) {
+    r.is_range = 1;
+    r.lo = NUM2INT(beg);
+    r.hi = NUM2INT(end) - (excl ? 1 : 0);
+  } else if (TYPE(match) == T_STRING) {
+    glob_compile(&r.glob, RSTRING_PTR(match), RSTRING_LEN(match));
+  } else {
+    rb_raise(rb_eTypeError, "invalid argument type (not String or Range)");
+  }
+
+  pthread_mutex_lock(&a->lock);
+  if (a->num_rules == a->rules_cap) {
+    rule *rules;
+    int cap = a->rules_cap ? a->rules_cap * 2 : 8;
+
+    if ((rules = realloc(a->rules, sizeof(rule) * cap)) == NULL) {
+      pthread_mutex_unlock(&a->lock);
+      if (!r.is_range)
+        glob_free(&r.glob);
+      rb_raise(rb_eNoMemError, "couldn't allocate rule");
+    }
+    a->rules = rules;
+    a->rules_cap = cap;
+  }
+  a->rules[a->num_rules++] = r;
+
+  /* make the next poll look at the current entry again */
+  a->last_pos = -1;
+  pthread_mutex_unlock(&a->lock);
+
+  return self;
+}
+
+/*
+ * Set the preset for entries that no rule matches (nil to leave the
+ * equalizer alone for them, which is the default).
+ *
+ * This method raises a TypeError exception if the preset isn't an
+ * Xmms::EqPreset or nil.
+ *
+ * Example:
+ *   auto.default = flat
+ *
+ */
+static VALUE xra_set_default(VALUE self, VALUE preset) {
+  xr_autoeq *a = get_autoeq(self);
+  gfloat eq[XR_EQ_LEN];
+  VALUE name = Qnil;
+
+  if (preset != Qnil) {
+    memcpy(eq, xr_eq_values(preset), sizeof(eq));
+    name = rb_funcall(preset, id_name, 0);
+  }
+
+  pthread_mutex_lock(&a->lock);
+  a->has_default = (preset != Qnil);
+  a->def_name = name;
+  if (a->has_default)
+    memcpy(a->def, eq, sizeof(eq));
+  a->last_pos = -1;
+  pthread_mutex_unlock(&a->lock);
+
+  return preset;
+}
+
+/*
+ * Remove all of the rules and the default.
+ *
+ * Example:
+ *   auto.clear
+ *
+ */
+static VALUE xra_clear(VALUE self) {
+  xr_autoeq *a = get_autoeq(self);
+  rule *rules;
+  int i, n;
+
+  pthread_mutex_lock(&a->lock);
+  rules = a->rules;
+  n = a->num_rules;
+  a->rules = NULL;
+  a->num_rules = a->rules_cap = 0;
+  a->has_default = 0;
+  a->def_name = Qnil;
+  pthread_mutex_unlock(&a->lock);
+
+  for (i = 0; i < n; i++)
+    if (!rules[i].is_range)
+      glob_free(&rules[i].glob);
+  free(rules);
+
+  return self;
+}
+
+/*
+ * Find the preset the rules pick for a file name and playlist
+ * position, without touching XMMS.  Returns a copy of the
+ * Xmms::EqPreset, or nil if nothing matches and there's no default.
+ *
+ * Example:
+ *   p auto.match('/srv/podcasts/show/ep1.mp3')
+ *
+ */
+static VALUE xra_match(int argc, VALUE *argv, VALUE self) {
+  xr_autoeq *a = get_autoeq(self);
+  gfloat eq[XR_EQ_LEN];
+  const gfloat *preset;
+  const char *path;
+  VALUE file, pos, name, ret;
+  int i;
+
+  rb_scan_args(argc, argv, "11", &file, &pos);
+  path = (file == Qnil) ? NULL : StringValueCStr(file);
+  i = (pos == Qnil) ? -1 : NUM2INT(pos);
+
+  pthread_mutex_lock(&a->lock);
+  if ((preset = find_preset(a, i, path, &name)) != NULL)
+    memcpy(eq, preset, sizeof(eq));
+  pthread_mutex_unlock(&a->lock);
+
+  if (!preset)
+    return Qnil;
+  ret = xr_eq_new(eq);
+  rb_funcall(ret, id_set_name, 1, name);
+  return ret;
+}
+
+/*
+ * Start watching for track changes.  The current entry's preset is
+ * applied right away.
+ *
+ * This method raises an Xmms::Error exception if the watcher thread
+ * can't be created.
+ *
+ * Example:
+ *   auto.start
+ *
+ */
+static VALUE xra_start(VALUE self) {
+  xr_autoeq *a = get_autoeq(self);
+  sigset_t all, old;
+  int err;
+
+  if (a->running)
+    return self;
+
+  a->stop = 0;
+  a->last_pos = -1;
+  a->applied = 0;
+
+  /* ruby's signals are for ruby's threads */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  err = pthread_create(&a->thread, NULL, poll_thread, a);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (err)
+    rb_raise(eError, "couldn't create watcher thread: %s", strerror(err));
+  a->running = 1;
+
+  return self;
+}
+
+/*
+ * Stop watching for track changes.  The equalizer is left as it is.
+ *
+ * Example:
+ *   auto.stop
+ *
+ */
+static VALUE xra_stop(VALUE self) {
+  xr_nogvl(autoeq_stop, get_autoeq(self), NULL);
+  return self;
+}
+
+/*
+ * Is the equalizer watching for track changes?
+ *
+ * Example:
+ *   auto.start unless auto.running?
+ *
+ */
+static VALUE xra_running(VALUE self) {
+  return get_autoeq(self)->running ? Qtrue : Qfalse;
+}
+
+/*
+ * Get statistics, as a hash: :polls (position checks), :changes (track
+ * changes seen), :applied (presets sent to XMMS), and :rules.
+ *
+ * Example:
+ *   s = auto.stats
+ *   puts "#{s[:applied]} presets applied for #{s[:changes]} tracks"
+ *
+ */
+static VALUE xra_stats(VALUE self) {
+  xr_autoeq *a = get_autoeq(self);
+  VALUE ret = rb_hash_new();
+
+  rb_hash_aset(ret, ID2SYM(rb_intern("polls")),
+               ULONG2NUM(__atomic_load_n(&a->num_polls, __ATOMIC_RELAXED)));
+  rb_hash_aset(ret, ID2SYM(rb_intern("changes")),
+               ULONG2NUM(__atomic_load_n(&a->num_changes, __ATOMIC_RELAXED)));
+  rb_hash_aset(ret, ID2SYM(rb_intern("applied")),
+               ULONG2NUM(__atomic_load_n(&a->num_applied, __ATOMIC_RELAXED)));
+  rb_hash_aset(ret, ID2SYM(rb_intern("rules")), INT2FIX(a->num_rules));
+
+  return ret;
+}
+
+void Init_xmms_autoeq(void) {
+  id_name = rb_intern("name");
+  id_set_name = rb_intern("name=");
+
+  cAutoEq = rb_define_class_under(mXmms, "AutoEq", rb_cObject);
+  rb_undef_alloc_func(cAutoEq);
+  rb_define_singleton_method(cAutoEq, "new", xra_new, -1);
+  rb_define_method(cAutoEq, "initialize", xra_init, -1);
+
+  rb_define_method(cAutoEq, "rule", xra_rule, 2);
+  rb_define_method(cAutoEq, "default=", xra_set_default, 1);
+  rb_define_method(cAutoEq, "clear", xra_clear, 0);
+  rb_define_method(cAutoEq, "match", xra_match, -1);
+  rb_define_method(cAutoEq, "start", xra_start, 0);
+  rb_define_method(cAutoEq, "stop", xra_stop, 0);
+  rb_define_method(cAutoEq, "running?", xra_running, 0);
+  rb_define_method(cAutoEq, "stats", xra_stats, 0);
+}
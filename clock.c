@@ -0,0 +1,551 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Xmms::PositionClock: the playback position, without a request per
+ * read.
+ *
+ * A clock samples XMMS now and then from a native thread (the output
+ * time, the playlist position, and whether it's playing or paused) and
+ * interpolates between samples with the monotonic clock.  A sample that
+ * disagrees with the interpolation by more than the tolerance (a seek),
+ * or a change of track, or of the playing or paused state, resyncs the
+ * clock; smaller differences are drift, and are folded in without ever
+ * letting the time go backwards.
+ *
+ * Commands sent through any remote in this process that move the
+ * playback position (play, pause, jump_to_time, next, ...) wake the
+ * clocks for that session so they resample right away (see
+ * xr_clock_poke()); changes made by other clients are picked up by the
+ * next regular sample.
+ */
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include "xmms_ruby.h"
+
+/* defaults */
+#define DEFAULT_INTERVAL  0.5
+#define DEFAULT_TOLERANCE 150   /* ms */
+
+/* size of the poke counter table (a power of two) */
+#define NUM_POKES 64
+
+typedef struct {
+  int session;
+  double interval,
+         tolerance;
+
+  /* sampling thread */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  int running,
+      stop,
+      gen;
+  unsigned int seen;          /* poke count at the last sample */
+
+  /* the last sample (with the lock held) */
+  int valid,
+      pos,
+      playing,
+      paused,
+      length;                 /* of the current entry, in ms, or <= 0 */
+  double base_ms,             /* output time ... */
+         base_t,              /* ... at this point on the monotonic clock */
+         last_ms;             /* the last time read (reads never go back) */
+
+  /* statistics */
+  unsigned long num_samples,
+                num_resyncs,
+                num_pokes,
+                num_reads;
+  double max_drift;
+} xr_clock;
+
+static VALUE cPositionClock;
+
+/* pokes, counted per session, and the condition the samplers wait on */
+static unsigned int pokes[NUM_POKES];
+static pthread_mutex_t poke_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poke_cond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Wake the clocks for a session (and, harmlessly, any session that
+ * shares its slot).  Safe to call from any thread.
+ */
+void xr_clock_poke(int session) {
+  pthread_mutex_lock(&poke_lock);
+  pokes[session & (NUM_POKES - 1)]++;
+  pthread_cond_broadcast(&poke_cond);
+  pthread_mutex_unlock(&poke_lock);
+}
+
+static void poke_prepare(void) {
+  pthread_mutex_lock(&poke_lock);
+}
+
+static void poke_release(void) {
+  pthread_mutex_unlock(&poke_lock);
+}
+
+/************/
+/* SAMPLING */
+/************/
+
+/*
+ * Interpolate the output time at monotonic time t.  Call with the
+ * lock held.
+ */
+static double clock_at(xr_clock *c, double t) {
+  double ms = c->base_ms;
+
+  if (c->playing && !c->paused)
+    ms += (t - c->base_t) * 1000.0;
+  if (c->length > 0 && ms > c->length)
+    ms = c->length;
+
+  return ms;
+}
+
+/*
+ * Sample XMMS and fold the sample into the clock.
+ */
+static void clock_sample(xr_clock *c) {
+  int s = c->session, pos, playing, paused, ms, length, resync;
+  double t0, t1, err;
+
+  pos = xmms_remote_get_playlist_pos(s);
+
+  /* libxmms says 0 when it can't reach XMMS */
+  if (pos == 0 && !xmms_remote_is_running(s)) {
+    pthread_mutex_lock(&c->lock);
+    c->valid = 0;
+    pthread_mutex_unlock(&c->lock);
+    return;
+  }
+
+  playing = xmms_remote_is_playing(s) ? 1 : 0;
+  paused = xmms_remote_is_paused(s) ? 1 : 0;
+
+  /* the sample was taken somewhere during the request; call it the
+   * middle */
+  t0 = xr_now();
+  ms = xmms_remote_get_output_time(s);
+  t1 = xr_now();
+
+  /* the length only changes with the track */
+  pthread_mutex_lock(&c->lock);
+  length = (c->valid && pos == c->pos) ? c->length : -1;
+  pthread_mutex_unlock(&c->lock);
+  if (length < 0)
+    length = xmms_remote_get_playlist_time(s, pos);
+
+  pthread_mutex_lock(&c->lock);
+  err = ms - clock_at(c, (t0 + t1) / 2);
+  if (err < 0)
+    err = -err;
+
+  resync = !c->valid || pos != c->pos || playing != c->playing ||
+           paused != c->paused || err > c->tolerance;
+  if (resync) {
+    c->num_resyncs++;
+    c->last_ms = 0;
+  } else if (err > c->max_drift) {
+    c->max_drift = err;
+  }
+
+  c->base_ms = ms;
+  c->base_t = (t0 + t1) / 2;
+  c->pos = pos;
+  c->playing = playing;
+  c->paused = paused;
+  c->length = length;
+  c->valid = 1;
+  c->num_samples++;
+  pthread_mutex_unlock(&c->lock);
+}
+
+static void *clock_thread(void *data) {
+  xr_clock *c = data;
+  unsigned int *poke = &pokes[c->session & (NUM_POKES - 1)];
+  struct timespec ts;
+  double t;
+
+  for (;;) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    t = ts.tv_sec + ts.tv_nsec / 1e9 + c->interval;
+    ts.tv_sec = (time_t) t;
+    ts.tv_nsec = (long) ((t - (time_t) t) * 1e9);
+
+    pthread_mutex_lock(&poke_lock);
+    while (!c->stop && *poke == c->seen)
+      if (pthread_cond_timedwait(&poke_cond, &poke_lock, &ts))
+        break;
+    if (c->stop) {
+      pthread_mutex_unlock(&poke_lock);
+      break;
+    }
+    if (*poke != c->seen) {
+      c->seen = *poke;
+      c->num_pokes++;
+    }
+    pthread_mutex_unlock(&poke_lock);
+
+    clock_sample(c);
+  }
+
+  return NULL;
+}
+
+static void clock_start(xr_clock *c) {
+  sigset_t all, old;
+  int err;
+
+  c->stop = 0;
+  c->seen = pokes[c->session & (NUM_POKES - 1)];
+
+  /* ruby's signals are for ruby's threads */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  err = pthread_create(&c->thread, NULL, clock_thread, c);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (err)
+    rb_raise(eError, "couldn't create clock thread: %s", strerror(err));
+  c->running = 1;
+}
+
+static void *clock_stop(void *data) {
+  xr_clock *c = data;
+
+  /* the thread doesn't exist in a forked child */
+  if (!c->running || c->gen != xr_fork_gen) {
+    c->running = 0;
+    return NULL;
+  }
+
+  pthread_mutex_lock(&poke_lock);
+  c->stop = 1;
+  pthread_cond_broadcast(&poke_cond);
+  pthread_mutex_unlock(&poke_lock);
+  pthread_join(c->thread, NULL);
+  c->running = 0;
+
+  return NULL;
+}
+
+static void *clock_sync(void *data) {
+  clock_sample(data);
+  return NULL;
+}
+
+static void clock_free(xr_clock *c) {
+  clock_stop(c);
+
+  /* see engine_free() */
+  if (c->gen == xr_fork_gen)
+    pthread_mutex_destroy(&c->lock);
+  xfree(c);
+}
+
+/*
+ * Get a clock, restarting its thread in a forked child.
+ */
+static xr_clock *get_clock(VALUE self) {
+  xr_clock *c;
+
+  Data_Get_Struct(self, xr_clock, c);
+
+  if (c->gen != xr_fork_gen) {
+    int running = c->running;
+
+    pthread_mutex_init(&c->lock, NULL);
+    c->running = 0;
+    c->gen = xr_fork_gen;
+    if (running)
+      clock_start(c);
+  }
+
+  return c;
+}
+
+/*
+ * Read the clock, in milliseconds.  Returns a negative number if XMMS
+ * wasn't running at the last sample.
+ */
+static double clock_read(xr_clock *c) {
+  double ms;
+
+  pthread_mutex_lock(&c->lock);
+  if (c->valid) {
+    ms = clock_at(c, xr_now());
+    if (ms < c->last_ms)
+      ms = c->last_ms;
+    c->last_ms = ms;
+  } else {
+    ms = -1;
+  }
+  c->num_reads++;
+  pthread_mutex_unlock(&c->lock);
+
+  return ms;
+}
+
+/****************/
+/* RUBY METHODS */
+/****************/
+
+/*
+ * Get a clock that tracks the output time of the current song, for
+ * reading it often (for lyrics or a visualization, say) without a
+ * request per read.  The clock samples XMMS every so often from a
+ * native thread and interpolates in between.
+ *
+ * Options:
+ *   :interval    how often to sample, in seconds (default 0.5)
+ *   :tolerance   how far, in milliseconds, a sample may be off from
+ *                the interpolated time before it's taken as a seek and
+ *                the clock jumps to it (default 150)
+ *
+ * This method raises an Xmms::Error exception if XMMS is not running,
+ * and an ArgumentError exception if the interval or tolerance isn't
+ * positive.
+ *
+ * Examples:
+ *   clock = remote.position_clock
+ *   clock = remote.position_clock(:interval => 0.25)
+ *
+ */
+static VALUE xr_position_clock(int argc, VALUE *argv, VALUE self) {
+  VALUE ret, opts, v;
+  xr_clock *c;
+  int *session;
+
+  rb_scan_args(argc, argv, "01", &opts);
+  session = XR_SESSION(self);
+  CHECK_SESSION(session);
+
+  ret = Data_Make_Struct(cPositionClock, xr_clock, 0, clock_free, c);
+  pthread_mutex_init(&c->lock, NULL);
+  c->session = *session;
+  c->gen = xr_fork_gen;
+  c->interval = DEFAULT_INTERVAL;
+  c->tolerance = DEFAULT_TOLERANCE;
+
+  if (opts != Qnil) {
+    Check_Type(opts, T_HASH);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("interval")))) != Qnil)
+      c->interval = NUM2DBL(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("tolerance")))) != Qnil)
+      c->tolerance = NUM2DBL(v);
+  }
+  if (c->interval <= 0 || c->tolerance <= 0)
+    rb_raise(rb_eArgError, "invalid interval or tolerance (not positive)");
+
+  xr_nogvl(clock_sync, c, NULL);
+  XR_CHECK_INTS();
+  clock_start(c);
+
+  return ret;
+}
+
+/*
+ * Get the (interpolated) output time of the current song, in
+ * milliseconds, like Xmms::Remote#time.  This doesn't talk to XMMS.
+ *
+ * This method raises an Xmms::Error exception if XMMS wasn't running
+ * at the last sample.
+ *
+ * Example:
+ *   show_lyric(lyrics.at(clock.time))
+ *
+ */
+static VALUE xrc_time(VALUE self) {
+  double ms = clock_read(get_clock(self));
+
+  if (ms < 0)
+    rb_raise(eError, "XMMS is not running");
+  return INT2NUM((int) ms);
+}
+
+/*
+ * Get the (interpolated) output time of the current song, in seconds.
+ *
+ * This method raises an Xmms::Error exception if XMMS wasn't running
+ * at the last sample.
+ *
+ * Example:
+ *   printf "%.3f\n", clock.seconds
+ *
+ */
+static VALUE xrc_seconds(VALUE self) {
+  double ms = clock_read(get_clock(self));
+
+  if (ms < 0)
+    rb_raise(eError, "XMMS is not running");
+  return rb_float_new(ms / 1000.0);
+}
+
+/*
+ * Get the playlist position at the last sample (or nil if XMMS wasn't
+ * running).
+ *
+ * Example:
+ *   redraw if clock.playlist_pos != shown
+ *
+ */
+static VALUE xrc_pos(VALUE self) {
+  xr_clock *c = get_clock(self);
+  VALUE ret;
+
+  pthread_mutex_lock(&c->lock);
+  ret = c->valid ? INT2NUM(c->pos) : Qnil;
+  pthread_mutex_unlock(&c->lock);
+
+  return ret;
+}
+
+/*
+ * Was XMMS playing at the last sample?
+ *
+ * Example:
+ *   draw_frame if clock.playing?
+ *
+ */
+static VALUE xrc_playing(VALUE self) {
+  xr_clock *c = get_clock(self);
+  int ret;
+
+  pthread_mutex_lock(&c->lock);
+  ret = c->valid && c->playing;
+  pthread_mutex_unlock(&c->lock);
+
+  return ret ? Qtrue : Qfalse;
+}
+
+/*
+ * Was XMMS paused at the last sample?
+ *
+ * Example:
+ *   puts 'paused' if clock.paused?
+ *
+ */
+static VALUE xrc_paused(VALUE self) {
+  xr_clock *c = get_clock(self);
+  int ret;
+
+  pthread_mutex_lock(&c->lock);
+  ret = c->valid && c->paused;
+  pthread_mutex_unlock(&c->lock);
+
+  return ret ? Qtrue : Qfalse;
+}
+
+/*
+ * Sample XMMS right now, rather than waiting for the next sample.
+ * Returns the clock.
+ *
+ * Example:
+ *   clock.sync
+ *
+ */
+static VALUE xrc_sync(VALUE self) {
+  xr_nogvl(clock_sync, get_clock(self), NULL);
+  XR_CHECK_INTS();
+  return self;
+}
+
+/*
+ * Stop sampling.  The clock carries on interpolating from the last
+ * sample; #sync still works.
+ *
+ * Example:
+ *   clock.stop
+ *
+ */
+static VALUE xrc_stop(VALUE self) {
+  xr_nogvl(clock_stop, get_clock(self), NULL);
+  return self;
+}
+
+/*
+ * Is the clock sampling?
+ *
+ * Example:
+ *   clock.stop if clock.running?
+ *
+ */
+static VALUE xrc_running(VALUE self) {
+  return get_clock(self)->running ? Qtrue : Qfalse;
+}
+
+/*
+ * Get statistics, as a hash: :samples, :resyncs (seeks, track changes,
+ * and starts, stops and pauses), :pokes (samples taken early because
+ * of a command from this process), :reads, and :max_drift (the largest
+ * difference, in milliseconds, between a sample and the interpolated
+ * time that wasn't a resync).
+ *
+ * Example:
+ *   p clock.stats
+ *
+ */
+static VALUE xrc_stats(VALUE self) {
+  xr_clock *c = get_clock(self);
+  VALUE ret = rb_hash_new();
+
+  pthread_mutex_lock(&c->lock);
+  rb_hash_aset(ret, ID2SYM(rb_intern("samples")), ULONG2NUM(c->num_samples));
+  rb_hash_aset(ret, ID2SYM(rb_intern("resyncs")), ULONG2NUM(c->num_resyncs));
+  rb_hash_aset(ret, ID2SYM(rb_intern("pokes")),
+               ULONG2NUM(__atomic_load_n(&c->num_pokes, __ATOMIC_RELAXED)));
+  rb_hash_aset(ret, ID2SYM(rb_intern("reads")), ULONG2NUM(c->num_reads));
+  rb_hash_aset(ret, ID2SYM(rb_intern("max_drift")), rb_float_new(c->max_drift));
+  pthread_mutex_unlock(&c->lock);
+
+  return ret;
+}
+
+void Init_xmms_clock(void) {
+  pthread_atfork(poke_prepare, poke_release, poke_release);
+
+  rb_define_method(cRemote, "position_clock", xr_position_clock, -1);
+
+  cPositionClock = rb_define_class_under(mXmms, "PositionClock", rb_cObject);
+  rb_undef_alloc_func(cPositionClock);
+  rb_undef_method(CLASS_OF(cPositionClock), "new");
+
+  rb_define_method(cPositionClock, "time", xrc_time, 0);
+  rb_define_alias(cPositionClock, "output_time", "time");
+  rb_define_method(cPositionClock, "seconds", xrc_seconds, 0);
+  rb_define_method(cPositionClock, "playlist_pos", xrc_pos, 0);
+  rb_define_method(cPositionClock, "playing?", xrc_playing, 0);
+  rb_define_method(cPositionClock, "paused?", xrc_paused, 0);
+  rb_define_method(cPositionClock, "sync", xrc_sync, 0);
+  rb_define_method(cPositionClock, "stop", xrc_stop, 0);
+  rb_define_method(cPositionClock, "running?", xrc_running, 0);
+  rb_define_method(cPositionClock, "stats", xrc_stats, 0);
+}
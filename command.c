@@ -0,0 +1,541 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+
+/*
+ * Remote commands.
+ *
+ * Each single-request Xmms::Remote method fills in an xr_cmd and hands
+ * it to xr_call(), which either runs it right away (without holding the
+ * interpreter lock) or passes it to the remote's I/O thread if the
+ * remote is in pipelined mode (see engine.c).
+ */
+#include <pthread.h>
+#include "xmms_ruby.h"
+
+/* size of the liveness cache (see xr_session_check()) */
+#define NUM_ALIVE 64
+
+/* late edits are counted in this many slots (see xr_late_edits()) */
+#define NUM_LATE 64
+
+/*
+ * Command names (as Xmms::Remote methods), flags, and result types,
+ * indexed by xr_cmd_op.
+ */
+const xr_cmd_def xr_cmd_defs[XR_NUM_CMDS] = {
+  { "version",           XR_CMD_READ,                     XR_RET_INT },
+  { "play",              XR_CMD_MOVES,                    XR_RET_SELF },
+  { "pause",             XR_CMD_MOVES,                    XR_RET_SELF },
+  { "stop",              XR_CMD_MOVES,                    XR_RET_SELF },
+  { "eject",             0,                               XR_RET_SELF },
+  { "quit",              0,                               XR_RET_SELF },
+  { "play_pause",        XR_CMD_MOVES,                    XR_RET_SELF },
+  { "playing?",          XR_CMD_READ,                     XR_RET_BOOL },
+  { "paused?",           XR_CMD_READ,                     XR_RET_BOOL },
+  { "add",               XR_CMD_EDITS,                    XR_RET_SELF },
+  { "add_url",           XR_CMD_EDITS,                    XR_RET_SELF },
+  { "ins_url",           XR_CMD_EDITS,                    XR_RET_SELF },
+  { "delete",            XR_CMD_MOVES | XR_CMD_EDITS,     XR_RET_SELF },
+  { "clear",             XR_CMD_MOVES | XR_CMD_EDITS,     XR_RET_SELF },
+  { "playlist_length",   XR_CMD_READ,                     XR_RET_INT },
+  { "playlist_pos",      XR_CMD_READ,                     XR_RET_INT },
+  { "set_playlist_pos",  XR_CMD_MOVES,                    XR_RET_SELF },
+  { "playlist_file",     XR_CMD_READ,                     XR_RET_PATH },
+  { "playlist_title",    XR_CMD_READ,                     XR_RET_STR },
+  { "playlist_time",     XR_CMD_READ,                     XR_RET_INT },
+  { "time",              XR_CMD_READ,                     XR_RET_INT },
+  { "jump_to_time",      XR_CMD_MOVES,                    XR_RET_SELF },
+  { "playlist_prev",     XR_CMD_MOVES,                    XR_RET_SELF },
+  { "playlist_next",     XR_CMD_MOVES,                    XR_RET_SELF },
+  { "stereo_volume",     XR_CMD_READ,                     XR_RET_INT2 },
+  { "main_volume",       XR_CMD_READ,                     XR_RET_INT },
+  { "set_stereo_volume", 0,                               XR_RET_SELF },
+  { "set_main_volume",   0,                               XR_RET_SELF },
+  { "balance",           XR_CMD_READ,                     XR_RET_INT },
+  { "set_balance",       0,                               XR_RET_SELF },
+  { "skin",              XR_CMD_READ,                     XR_RET_PATH },
+  { "set_skin",          0,                               XR_RET_SELF },
+  { "main_win_toggle",   0,                               XR_RET_SELF },
+  { "is_main_win?",      XR_CMD_READ,                     XR_RET_BOOL },
+  { "pl_win_toggle",     0,                               XR_RET_SELF },
+  { "is_pl_win?",        XR_CMD_READ,                     XR_RET_BOOL },
+  { "eq_win_toggle",     0,                               XR_RET_SELF },
+  { "is_eq_win?",        XR_CMD_READ,                     XR_RET_BOOL },
+  { "show_prefs",        0,                               XR_RET_SELF },
+  { "toggle_aot",        0,                               XR_RET_SELF },
+  { "toggle_repeat",     0,                               XR_RET_SELF },
+  { "is_repeat?",        XR_CMD_READ,                     XR_RET_BOOL },
+  { "toggle_shuffle",    0,                               XR_RET_SELF },
+  { "is_shuffle?",       XR_CMD_READ,                     XR_RET_BOOL },
+  { "info",              XR_CMD_READ,                     XR_RET_INT3 },
+  { "running?",          XR_CMD_READ | XR_CMD_NO_CHECK,   XR_RET_BOOL },
+  { "eq",                XR_CMD_READ,                     XR_RET_EQ },
+  { "eq_preamp",         XR_CMD_READ,                     XR_RET_FLOAT },
+  { "eq_band",           XR_CMD_READ,                     XR_RET_FLOAT },
+  { "set_eq",            XR_CMD_EDITS,                    XR_RET_SELF },
+  { "set_eq_preamp",     XR_CMD_EDITS,                    XR_RET_SELF },
+  { "set_eq_band",       XR_CMD_EDITS,                    XR_RET_SELF },
+};
+
+static struct {
+  int session;
+  double when;
+} alive[NUM_ALIVE];
+static pthread_mutex_t alive_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int late_edits[NUM_LATE];
+
+/*
+ * Check that XMMS is running.  If ttl is positive and the session was
+ * seen running less than ttl seconds ago, the check is skipped (saving
+ * a round trip to XMMS).  Safe to call without the interpreter lock.
+ */
+int xr_session_check(int session, double ttl) {
+  int i = (unsigned int) session % NUM_ALIVE, ret;
+  double t;
+
+  if (ttl > 0) {
+    pthread_mutex_lock(&alive_lock);
+    ret = alive[i].session == session && alive[i].when > 0 &&
+          xr_now() - alive[i].when < ttl;
+    pthread_mutex_unlock(&alive_lock);
+
+    if (ret)
+      return 1;
+  }
+
+  if (!(ret = xmms_remote_is_running(session)))
+    return 0;
+
+  t = xr_now();
+  pthread_mutex_lock(&alive_lock);
+  alive[i].session = session;
+  alive[i].when = t;
+  pthread_mutex_unlock(&alive_lock);
+
+  return 1;
+}
+
+/*
+ * Set up a command for the given remote.
+ */
+void xr_cmd_init(xr_cmd *cmd, VALUE self, xr_cmd_op op) {
+  xr_remote *r = xr_remote_get(self);
+
+  memset(cmd, 0, sizeof(xr_cmd));
+  cmd->op = op;
+  cmd->session = r->session;
+  cmd->ttl = r->alive_ttl;
+}
+
+/*
+ * Append a (copied) string argument to a command.
+ */
+void xr_cmd_add_str(xr_cmd *cmd, VALUE str) {
+  /* convert first: if it raises, nothing has been allocated yet */
+  StringValue(str);
+  cmd->str = g_realloc(cmd->str, sizeof(gchar*) * (cmd->num_str + 1));
+  cmd->str[cmd->num_str++] = g_strdup(RSTRING_PTR(str));
+}
+
+/*
+ * Free a command's arguments and any unclaimed results.
+ */
+void xr_cmd_free(xr_cmd *cmd) {
+  int i;
+
+  for (i = 0; i < cmd->num_str; i++)
+    g_free(cmd->str[i]);
+  if (cmd->str)
+    g_free(cmd->str);
+  if (cmd->sret)
+    g_free(cmd->sret);
+
+  cmd->str = NULL;
+  cmd->num_str = 0;
+  cmd->sret = NULL;
+}
+
+/*
+ * Are two commands the same request?  (Results aren't compared.)
+ */
+int xr_cmd_same(xr_cmd *a, xr_cmd *b) {
+  int i;
+
+  if (a->op != b->op || a->session != b->session || a->num_str != b->num_str ||
+      a->cur != b->cur || a->arg[0] != b->arg[0] || a->arg[1] != b->arg[1] ||
+      memcmp(a->farg, b->farg, sizeof(a->farg)))
+    return 0;
+
+  for (i = 0; i < a->num_str; i++)
+    if (strcmp(a->str[i], b->str[i]))
+      return 0;
+
+  return 1;
+}
+
+/*
+ * Copy the results of one command to another (equivalent) one.
+ */
+void xr_cmd_copy_result(xr_cmd *dst, xr_cmd *src) {
+  dst->ok = src->ok;
+  memcpy(dst->ret, src->ret, sizeof(dst->ret));
+  memcpy(dst->fret, src->fret, sizeof(dst->fret));
+  dst->sret = src->sret ? g_strdup(src->sret) : NULL;
+}
+
+/*
+ * Run a command, without checking that XMMS is running first.  This
+ * doesn't touch any Ruby objects, so it's safe to call from any thread.
+ */
+void xr_cmd_run(xr_cmd *cmd) {
+  int s = cmd->session, i, pos;
+  double start = xr_tracing ? xr_now() : 0;
+  gfloat *bands;
+
+  cmd->ok = 1;
+  pos = cmd->cur ? xmms_remote_get_playlist_pos(s) : cmd->arg[0];
+
+  switch (cmd->op) {
+    case XR_CMD_GET_VERSION:
+      cmd->ret[0] = xmms_remote_get_version(s);
+      break;
+    case XR_CMD_PLAY:
+      xmms_remote_play(s);
+      break;
+    case XR_CMD_PAUSE:
+      xmms_remote_pause(s);
+      break;
+    case XR_CMD_STOP:
+      xmms_remote_stop(s);
+      break;
+    case XR_CMD_EJECT:
+      xmms_remote_eject(s);
+      break;
+    case XR_CMD_QUIT:
+      xmms_remote_quit(s);
+      break;
+    case XR_CMD_PLAY_PAUSE:
+      xmms_remote_play_pause(s);
+      break;
+    case XR_CMD_IS_PLAYING:
+      cmd->ret[0] = xmms_remote_is_playing(s);
+      break;
+    case XR_CMD_IS_PAUSED:
+      cmd->ret[0] = xmms_remote_is_paused(s);
+      break;
+    case XR_CMD_PLAYLIST_ADD:
+      xmms_remote_playlist(s, cmd->str, cmd->num_str, cmd->arg[0]);
+      break;
+    case XR_CMD_PLAYLIST_ADD_URL:
+      xmms_remote_playlist_add_url_string(s, cmd->str[0]);
+      break;
+    case XR_CMD_PLAYLIST_INS_URL:
+      xmms_remote_playlist_ins_url_string(s, cmd->str[0], cmd->arg[0]);
+      break;
+    case XR_CMD_PLAYLIST_DELETE:
+      xmms_remote_playlist_delete(s, cmd->arg[0]);
+      break;
+    case XR_CMD_PLAYLIST_CLEAR:
+      xmms_remote_playlist_clear(s);
+      break;
+    case XR_CMD_GET_PLAYLIST_LENGTH:
+      cmd->ret[0] = xmms_remote_get_playlist_length(s);
+      break;
+    case XR_CMD_GET_PLAYLIST_POS:
+      cmd->ret[0] = xmms_remote_get_playlist_pos(s);
+      break;
+    case XR_CMD_SET_PLAYLIST_POS:
+      xmms_remote_set_playlist_pos(s, cmd->arg[0]);
+      break;
+    case XR_CMD_GET_PLAYLIST_FILE:
+      cmd->sret = xmms_remote_get_playlist_file(s, pos);
+      break;
+    case XR_CMD_GET_PLAYLIST_TITLE:
+      cmd->sret = xmms_remote_get_playlist_title(s, pos);
+      break;
+    case XR_CMD_GET_PLAYLIST_TIME:
+      cmd->ret[0] = xmms_remote_get_playlist_time(s, pos);
+      break;
+    case XR_CMD_GET_OUTPUT_TIME:
+      cmd->ret[0] = xmms_remote_get_output_time(s);
+      break;
+    case XR_CMD_JUMP_TO_TIME:
+      xmms_remote_jump_to_time(s, cmd->arg[0]);
+      break;
+    case XR_CMD_PLAYLIST_PREV:
+      xmms_remote_playlist_prev(s);
+      break;
+    case XR_CMD_PLAYLIST_NEXT:
+      xmms_remote_playlist_next(s);
+      break;
+    case XR_CMD_GET_VOLUME:
+      xmms_remote_get_volume(s, cmd->ret, cmd->ret + 1);
+      break;
+    case XR_CMD_GET_MAIN_VOLUME:
+      cmd->ret[0] = xmms_remote_get_main_volume(s);
+      break;
+    case XR_CMD_SET_VOLUME:
+      xmms_remote_set_volume(s, cmd->arg[0], cmd->arg[1]);
+      break;
+    case XR_CMD_SET_MAIN_VOLUME:
+      xmms_remote_set_main_volume(s, cmd->arg[0]);
+      break;
+    case XR_CMD_GET_BALANCE:
+      cmd->ret[0] = xmms_remote_get_balance(s);
+      break;
+    case XR_CMD_SET_BALANCE:
+      xmms_remote_set_balance(s, cmd->arg[0]);
+      break;
+    case XR_CMD_GET_SKIN:
+      cmd->sret = xmms_remote_get_skin(s);
+      break;
+    case XR_CMD_SET_SKIN:
+      xmms_remote_set_skin(s, cmd->str[0]);
+      break;
+    case XR_CMD_MAIN_WIN_TOGGLE:
+      xmms_remote_main_win_toggle(s, cmd->arg[0]);
+      break;
+    case XR_CMD_IS_MAIN_WIN:
+      cmd->ret[0] = xmms_remote_is_main_win(s);
+      break;
+    case XR_CMD_PL_WIN_TOGGLE:
+      xmms_remote_pl_win_toggle(s, cmd->arg[0]);
+      break;
+    case XR_CMD_IS_PL_WIN:
+      cmd->ret[0] = xmms_remote_is_pl_win(s);
+      break;
+    case XR_CMD_EQ_WIN_TOGGLE:
+      xmms_remote_eq_win_toggle(s, cmd->arg[0]);
+      break;
+    case XR_CMD_IS_EQ_WIN:
+      cmd->ret[0] = xmms_remote_is_eq_win(s);
+      break;
+    case XR_CMD_SHOW_PREFS_BOX:
+      xmms_remote_show_prefs_box(s);
+      break;
+    case XR_CMD_TOGGLE_AOT:
+      xmms_remote_toggle_aot(s, cmd->arg[0]);
+      break;
+    case XR_CMD_TOGGLE_REPEAT:
+      xmms_remote_toggle_repeat(s);
+      break;
+    case XR_CMD_IS_REPEAT:
+      cmd->ret[0] = xmms_remote_is_repeat(s);
+      break;
+    case XR_CMD_TOGGLE_SHUFFLE:
+      xmms_remote_toggle_shuffle(s);
+      break;
+    case XR_CMD_IS_SHUFFLE:
+      cmd->ret[0] = xmms_remote_is_shuffle(s);
+      break;
+    case XR_CMD_GET_INFO:
+      xmms_remote_get_info(s, cmd->ret, cmd->ret + 1, cmd->ret + 2);
+      break;
+    case XR_CMD_IS_RUNNING:
+      cmd->ret[0] = xmms_remote_is_running(s);
+      break;
+    case XR_CMD_GET_EQ:
+      bands = NULL;
+      xmms_remote_get_eq(s, cmd->fret, &bands);
+      if (bands) {
+        for (i = 0; i < NUM_BANDS; i++)
+          cmd->fret[i + 1] = bands[i];
+        g_free(bands);
+      }
+      break;
+    case XR_CMD_GET_EQ_PREAMP:
+      cmd->fret[0] = xmms_remote_get_eq_preamp(s);
+      break;
+    case XR_CMD_GET_EQ_BAND:
+      cmd->fret[0] = xmms_remote_get_eq_band(s, cmd->arg[0]);
+      break;
+    case XR_CMD_SET_EQ:
+      xmms_remote_set_eq(s, cmd->farg[0], cmd->farg + 1);
+      break;
+    case XR_CMD_SET_EQ_PREAMP:
+      xmms_remote_set_eq_preamp(s, cmd->farg[0]);
+      break;
+    case XR_CMD_SET_EQ_BAND:
+      xmms_remote_set_eq_band(s, cmd->arg[0], cmd->farg[0]);
+      break;
+    case XR_NUM_CMDS:
+      break;
+  }
+
+  if (start > 0)
+    xr_trace_cmd(cmd, start, xr_now());
+
+  /* let position clocks know (see clock.c) */
+  if (xr_cmd_defs[cmd->op].flags & XR_CMD_MOVES)
+    xr_clock_poke(s);
+
+  /* and caches, if the caller couldn't */
+  if (cmd->late && (xr_cmd_defs[cmd->op].flags & XR_CMD_EDITS))
+    __atomic_add_fetch(&late_edits[s & (NUM_LATE - 1)], 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Get the number of late edits for a session.  See xmms_ruby.h.
+ */
+unsigned int xr_late_edits(int session) {
+  return __atomic_load_n(&late_edits[session & (NUM_LATE - 1)], __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Run a command, if XMMS is running.
+ */
+void xr_cmd_exec(xr_cmd *cmd) {
+  if (!(xr_cmd_defs[cmd->op].flags & XR_CMD_NO_CHECK) &&
+      !xr_session_check(cmd->session, cmd->ttl)) {
+    cmd->ok = 0;
+    return;
+  }
+
+  xr_cmd_run(cmd);
+}
+
+/*
+ * Convert the result of a command to a ruby value (see xr_ret_type).
+ * String results are claimed (and freed).
+ *
+ * This raises an Xmms::Error exception if XMMS wasn't running (or the
+ * command was lost in a fork).
+ */
+VALUE xr_cmd_result(VALUE self, xr_cmd *cmd) {
+  VALUE ret, bands;
+  int i;
+
+  if (cmd->ok < 0)
+    rb_raise(eError, "command was queued before a fork");
+  if (!cmd->ok)
+    rb_raise(eError, "XMMS is not running");
+
+  switch (xr_cmd_defs[cmd->op].ret) {
+    case XR_RET_BOOL:
+      return cmd->ret[0] ? Qtrue : Qfalse;
+    case XR_RET_INT:
+      return INT2FIX(cmd->ret[0]);
+    case XR_RET_INT2:
+      return rb_ary_new3(2, INT2FIX(cmd->ret[0]), INT2FIX(cmd->ret[1]));
+    case XR_RET_INT3:
+      return rb_ary_new3(3, INT2FIX(cmd->ret[0]), INT2FIX(cmd->ret[1]),
+                         INT2FIX(cmd->ret[2]));
+    case XR_RET_FLOAT:
+      return rb_float_new(cmd->fret[0]);
+    case XR_RET_EQ:
+      bands = rb_ary_new();
+      for (i = 0; i < NUM_BANDS; i++)
+        rb_ary_push(bands, rb_float_new(cmd->fret[i + 1]));
+      return rb_ary_new3(2, rb_float_new(cmd->fret[0]), bands);
+    case XR_RET_STR:
+    case XR_RET_PATH:
+      /* a missing string (e.g. an out of range playlist entry) comes
+       * back as an empty one */
+      ret = xr_str_take(cmd->sret, xr_cmd_defs[cmd->op].ret == XR_RET_PATH ?
+                                   XR_STR_PATH : XR_STR_TEXT);
+      cmd->sret = NULL;
+      return ret;
+    case XR_RET_SELF:
+      break;
+  }
+
+  return self;
+}
+
+static void *exec_nogvl(void *cmd) {
+  xr_cmd_exec(cmd);
+  return NULL;
+}
+
+/*
+ * Run a command for the given remote, free its arguments, and return
+ * its result (see xr_cmd_result()).  If the command was issued by one
+ * of the *_async methods, it's queued instead, and an Xmms::Future is
+ * returned, and if it's being recorded for a scheduler cue, the remote
+ * is.  Either way it runs later, and cmd->late is set: the caller
+ * mustn't tell any caches about it (see xr_late_edits()).
+ *
+ * This raises an Xmms::Error exception if XMMS is not running.
+ */
+VALUE xr_call(VALUE self, xr_cmd *cmd) {
+  xr_engine *engine;
+  xr_flight *flight;
+  int i;
+
+  /* recording a cue for an Xmms::Scheduler, or queueing for a future? */
+  cmd->late = 1;
+  if (xr_sched_capture(cmd))
+    return self;
+  if (xr_async_pending(self))
+    return xr_future_new(self, xr_engine_submit(xr_engine_start(self), cmd));
+  cmd->late = 0;
+
+  /* answered by the remote's prefetcher? */
+  if (xr_prefetch_lookup(self, cmd))
+    return xr_cmd_result(self, cmd);
+
+  /* answered by an identical read already in flight? */
+  if (xr_flight_board(self, cmd, &flight))
+    return xr_cmd_result(self, cmd);
+
+  if ((engine = xr_engine_get(self)) != NULL)
+    xr_engine_call(engine, cmd);
+  else
+    xr_nogvl(exec_nogvl, cmd, NULL);
+
+  if (flight)
+    xr_flight_land(flight, cmd);
+  else if (!(xr_cmd_defs[cmd->op].flags & XR_CMD_READ))
+    xr_flight_wrote(cmd->session);
+
+  /* the arguments aren't needed any more (but any result is) */
+  for (i = 0; i < cmd->num_str; i++)
+    g_free(cmd->str[i]);
+  if (cmd->str)
+    g_free(cmd->str);
+  cmd->str = NULL;
+  cmd->num_str = 0;
+
+  return xr_cmd_result(self, cmd);
+}
+
+/*
+ * Hold the liveness cache lock across fork(), so the child never
+ * inherits it locked by a thread that doesn't exist there.
+ */
+static void alive_prepare(void) {
+  pthread_mutex_lock(&alive_lock);
+}
+
+static void alive_release(void) {
+  pthread_mutex_unlock(&alive_lock);
+}
+
+void Init_xmms_command(void) {
+  pthread_atfork(alive_prepare, alive_release, alive_release);
+}
@@ -0,0 +1,422 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Xmms.crossfade: fade one session out and another in, from one timing
+ * loop.
+ *
+ * The loop runs without the interpreter lock, ticking on the monotonic
+ * clock.  Each tick works out both volumes from the same point in time,
+ * then hands them to two deck threads, one per session, so the two
+ * writes go out at the same time instead of one after the other; the
+ * loop waits for both before sleeping until the next tick.  The
+ * difference between when the two writes finish is the skew.
+ */
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include "xmms_ruby.h"
+
+/* defaults */
+#define DEFAULT_OVER 4.0
+#define DEFAULT_RATE 50.0
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef enum {
+  CURVE_LINEAR,
+  CURVE_EQUAL_POWER
+} fade_curve;
+
+typedef struct xfade xfade;
+
+typedef struct {
+  xfade *x;
+  pthread_t thread;
+  int session,
+      vol,                    /* to send this tick (-1: nothing) */
+      sent;                   /* last volume sent */
+  double done;                /* when the write finished */
+} deck;
+
+struct xfade {
+  deck a, b;
+  fade_curve curve;
+  double over,
+         rate,
+         start_b;             /* seconds in to play the B deck */
+  int from_vol,               /* A's volume at the start */
+      to_vol,                 /* B's volume at the end */
+      stop_a,
+      restore_a;
+
+  pthread_mutex_t lock;
+  pthread_cond_t go,
+                 done;
+  unsigned int tick;          /* bumped for each round of writes */
+  int pending,                /* decks still writing this round */
+      quit;
+  volatile int cancel;
+
+  /* results */
+  int steps,
+      writes,
+      started_b,
+      cancelled;
+  double elapsed,
+         skew_sum,
+         skew_max,
+         late_max;
+};
+
+static ID id_from, id_to, id_over, id_curve, id_rate, id_volume, id_start,
+          id_stop, id_restore, id_linear, id_equal_power;
+
+/*********/
+/* DECKS */
+/*********/
+
+static void *deck_thread(void *data) {
+  deck *d = data;
+  xfade *x = d->x;
+  unsigned int seen = 0;
+
+  pthread_mutex_lock(&x->lock);
+  for (;;) {
+    while (!x->quit && x->tick == seen)
+      pthread_cond_wait(&x->go, &x->lock);
+    if (x->quit)
+      break;
+    seen = x->tick;
+
+    if (d->vol >= 0) {
+      int vol = d->vol;
+
+      pthread_mutex_unlock(&x->lock);
+      xmms_remote_set_main_volume(d->session, vol);
+      pthread_mutex_lock(&x->lock);
+      d->sent = vol;
+    }
+    d->done = xr_now();
+
+    if (--x->pending == 0)
+      pthread_cond_signal(&x->done);
+  }
+  pthread_mutex_unlock(&x->lock);
+
+  return NULL;
+}
+
+/*
+ * Send both decks' volumes at once, and wait for them.  Returns the
+ * skew between the two writes, in seconds.
+ */
+static double decks_write(xfade *x, int vol_a, int vol_b) {
+  double skew;
+
+  pthread_mutex_lock(&x->lock);
+  x->a.vol = (vol_a != x->a.sent) ? vol_a : -1;
+  x->b.vol = (vol_b != x->b.sent) ? vol_b : -1;
+  x->writes += (x->a.vol >= 0) + (x->b.vol >= 0);
+  x->pending = 2;
+  x->tick++;
+  pthread_cond_broadcast(&x->go);
+  while (x->pending > 0)
+    pthread_cond_wait(&x->done, &x->lock);
+
+  /* only a round with two writes has a skew */
+  skew = (x->a.vol >= 0 && x->b.vol >= 0) ? fabs(x->a.done - x->b.done) : 0;
+  pthread_mutex_unlock(&x->lock);
+
+  return skew;
+}
+
+/********/
+/* LOOP */
+/********/
+
+static void gains(fade_curve curve, double t, double *a, double *b) {
+  if (curve == CURVE_EQUAL_POWER) {
+    *a = cos(t * M_PI / 2);
+    *b = sin(t * M_PI / 2);
+  } else {
+    *a = 1 - t;
+    *b = t;
+  }
+}
+
+static void sleep_until(double t) {
+  struct timespec ts;
+
+  ts.tv_sec = (time_t) t;
+  ts.tv_nsec = (long) ((t - (time_t) t) * 1e9);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+static void *xfade_run(void *data) {
+  xfade *x = data;
+  double t0, now, due, t, ga, gb, skew;
+  int i;
+
+  t0 = xr_now();
+  for (i = 0; ; i++) {
+    due = t0 + i / x->rate;
+    sleep_until(due);
+    if (x->cancel) {
+      x->cancelled = 1;
+      break;
+    }
+
+    now = xr_now();
+    if (now - due > x->late_max)
+      x->late_max = now - due;
+
+    if (!x->started_b && now - t0 >= x->start_b) {
+      if (!xmms_remote_is_playing(x->b.session))
+        xmms_remote_play(x->b.session);
+      x->started_b = 1;
+    }
+
+    t = (now - t0) / x->over;
+    if (t > 1)
+      t = 1;
+    gains(x->curve, t, &ga, &gb);
+
+    skew = decks_write(x, (int) (x->from_vol * ga + 0.5), (int) (x->to_vol * gb + 0.5));
+    x->skew_sum += skew;
+    if (skew > x->skew_max)
+      x->skew_max = skew;
+    x->steps++;
+
+    if (t >= 1)
+      break;
+  }
+  x->elapsed = xr_now() - t0;
+
+  if (!x->cancelled && x->stop_a) {
+    xmms_remote_stop(x->a.session);
+    if (x->restore_a)
+      xmms_remote_set_main_volume(x->a.session, x->from_vol);
+  }
+
+  return NULL;
+}
+
+/****************/
+/* RUBY METHODS */
+/****************/
+
+static int session_of(VALUE v) {
+  int *session;
+
+  if (rb_obj_is_kind_of(v, cRemote)) {
+    session = XR_SESSION(v);
+    return *session;
+  }
+
+  return NUM2INT(v);
+}
+
+static VALUE opt(VALUE opts, ID key) {
+  return rb_hash_aref(opts, ID2SYM(key));
+}
+
+static int start_deck(deck *d, xfade *x) {
+  sigset_t all, old;
+  int err;
+
+  d->x = x;
+  d->sent = -1;
+
+  /* ruby's signals are for ruby's threads */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  err = pthread_create(&d->thread, NULL, deck_thread, d);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  return err;
+}
+
+static void stop_decks(xfade *x, int num) {
+  pthread_mutex_lock(&x->lock);
+  x->quit = 1;
+  pthread_cond_broadcast(&x->go);
+  pthread_mutex_unlock(&x->lock);
+
+  if (num > 0)
+    pthread_join(x->a.thread, NULL);
+  if (num > 1)
+    pthread_join(x->b.thread, NULL);
+}
+
+/*
+ * Crossfade from one XMMS session to another: the :from session's
+ * volume goes down to 0 while the :to session's comes up, both driven
+ * by one native timing loop, with the two volume writes of each step
+ * sent at the same time.  The :to session is started (if it isn't
+ * playing) with its volume at 0.  When the fade is done, the :from
+ * session is stopped and its volume put back.  Blocks until the fade
+ * is done, and returns a hash of how it went: :steps, :writes, :rate
+ * (steps per second achieved), :skew and :max_skew (milliseconds
+ * between the two writes of a step, on average and at worst),
+ * :max_late (milliseconds a step started late, at worst), and
+ * :elapsed (seconds).
+ *
+ * Sessions can be given as Xmms::Remote objects or session numbers.
+ *
+ * Options:
+ *   :from      the session to fade out (required)
+ *   :to        the session to fade in (required)
+ *   :over      the length of the fade, in seconds (default 4.0)
+ *   :curve     :linear or :equal_power (the default, which keeps the
+ *              loudness even)
+ *   :rate      volume updates per second (default 50)
+ *   :volume    the :to session's final volume (default: the :from
+ *              session's volume at the start)
+ *   :start     seconds into the fade to start the :to session playing
+ *              (default 0)
+ *   :stop      stop the :from session at the end (default true)
+ *   :restore   then put its volume back (default true)
+ *
+ * This method raises an ArgumentError exception if :from or :to is
+ * missing, if they're the same session, or if an option is out of
+ * range, and an Xmms::Error exception if either session isn't running.
+ *
+ * Examples:
+ *   Xmms.crossfade(:from => deck_a, :to => deck_b)
+ *   stats = Xmms.crossfade(:from => 0, :to => 1, :over => 8.0, :curve => :linear)
+ *   puts "%.1f updates/s, %.2fms skew" % [stats[:rate], stats[:skew]]
+ *
+ */
+static VALUE xr_crossfade(VALUE self, VALUE opts) {
+  VALUE v, ret;
+  xfade x;
+  int err, num_decks;
+
+  UNUSED(self);
+  Check_Type(opts, T_HASH);
+  if (opt(opts, id_from) == Qnil || opt(opts, id_to) == Qnil)
+    rb_raise(rb_eArgError, "missing :from or :to session");
+
+  memset(&x, 0, sizeof(x));
+  x.a.session = session_of(opt(opts, id_from));
+  x.b.session = session_of(opt(opts, id_to));
+  x.over = DEFAULT_OVER;
+  x.rate = DEFAULT_RATE;
+  x.curve = CURVE_EQUAL_POWER;
+  x.stop_a = x.restore_a = 1;
+  x.to_vol = -1;
+
+  if ((v = opt(opts, id_over)) != Qnil)
+    x.over = NUM2DBL(v);
+  if ((v = opt(opts, id_rate)) != Qnil)
+    x.rate = NUM2DBL(v);
+  if ((v = opt(opts, id_curve)) != Qnil) {
+    if (v == ID2SYM(id_linear))
+      x.curve = CURVE_LINEAR;
+    else if (v != ID2SYM(id_equal_power))
+      rb_raise(rb_eArgError, "invalid curve (not :linear or :equal_power)");
+  }
+  if ((v = opt(opts, id_volume)) != Qnil)
+    x.to_vol = NUM2INT(v);
+  if ((v = opt(opts, id_start)) != Qnil)
+    x.start_b = NUM2DBL(v);
+  if ((v = opt(opts, id_stop)) != Qnil)
+    x.stop_a = RTEST(v);
+  if ((v = opt(opts, id_restore)) != Qnil)
+    x.restore_a = RTEST(v);
+
+  if (x.a.session == x.b.session)
+    rb_raise(rb_eArgError, "can't crossfade a session into itself");
+  if (x.over <= 0 || x.rate <= 0 || x.start_b < 0 || x.to_vol > 100)
+    rb_raise(rb_eArgError, "invalid option (out of range)");
+  if (!xmms_remote_is_running(x.a.session) || !xmms_remote_is_running(x.b.session))
+    rb_raise(eError, "XMMS is not running");
+
+  x.from_vol = xmms_remote_get_main_volume(x.a.session);
+  if (x.to_vol < 0)
+    x.to_vol = x.from_vol;
+  xmms_remote_set_main_volume(x.b.session, 0);
+
+  pthread_mutex_init(&x.lock, NULL);
+  pthread_cond_init(&x.go, NULL);
+  pthread_cond_init(&x.done, NULL);
+
+  num_decks = 0;
+  if ((err = start_deck(&x.a, &x)) == 0) {
+    num_decks++;
+    if ((err = start_deck(&x.b, &x)) == 0)
+      num_decks++;
+  }
+  x.b.sent = 0;
+
+  if (!err)
+    xr_nogvl(xfade_run, &x, &x.cancel);
+
+  stop_decks(&x, num_decks);
+  pthread_mutex_destroy(&x.lock);
+  pthread_cond_destroy(&x.go);
+  pthread_cond_destroy(&x.done);
+
+  if (err)
+    rb_raise(eError, "couldn't create deck thread: %s", strerror(err));
+  if (x.cancelled)
+    XR_CHECK_INTS();
+
+  ret = rb_hash_new();
+  rb_hash_aset(ret, ID2SYM(rb_intern("steps")), INT2NUM(x.steps));
+  rb_hash_aset(ret, ID2SYM(rb_intern("writes")), INT2NUM(x.writes));
+  rb_hash_aset(ret, ID2SYM(rb_intern("rate")),
+               rb_float_new(x.elapsed > 0 ? x.steps / x.elapsed : 0.0));
+  rb_hash_aset(ret, ID2SYM(rb_intern("skew")),
+               rb_float_new(x.steps ? x.skew_sum * 1000.0 / x.steps : 0.0));
+  rb_hash_aset(ret, ID2SYM(rb_intern("max_skew")), rb_float_new(x.skew_max * 1000.0));
+  rb_hash_aset(ret, ID2SYM(rb_intern("max_late")), rb_float_new(x.late_max * 1000.0));
+  rb_hash_aset(ret, ID2SYM(rb_intern("elapsed")), rb_float_new(x.elapsed));
+
+  return ret;
+}
+
+void Init_xmms_crossfade(void) {
+  id_from = rb_intern("from");
+  id_to = rb_intern("to");
+  id_over = rb_intern("over");
+  id_curve = rb_intern("curve");
+  id_rate = rb_intern("rate");
+  id_volume = rb_intern("volume");
+  id_start = rb_intern("start");
+  id_stop = rb_intern("stop");
+  id_restore = rb_intern("restore");
+  id_linear = rb_intern("linear");
+  id_equal_power = rb_intern("equal_power");
+
+  rb_define_module_function(mXmms, "crossfade", xr_crossfade, 1);
+}
@@ -0,0 +1,644 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+
+/*
+ * Bulk playlist edits.
+ *
+ * XMMS only knows how to delete or insert one entry at a time, so bulk
+ * edits work out the full set of changes natively and then send them
+ * to XMMS in a single batch without holding the interpreter lock.
+ * Deletes are sent highest index first, so no entry moves before it is
+ * deleted.
+ */
+#include <pthread.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include "xmms_ruby.h"
+
+/*
+ * Get the single optional argument of a bulk edit method, which may
+ * be passed either on its own or as a hash value (e.g. ":by => :file").
+ */
+static VALUE opt_arg(int argc, VALUE *argv, const char *key) {
+  VALUE ret;
+
+  switch (argc) {
+    case 0:
+      return Qnil;
+    case 1:
+      ret = argv[0];
+      if (TYPE(ret) == T_HASH)
+        ret = rb_hash_aref(ret, ID2SYM(rb_intern(key)));
+      return ret;
+    default:
+      rb_raise(rb_eArgError, "invalid argument count (not 0 or 1)");
+  }
+
+  return Qnil;
+}
+
+/***********************/
+/* DELETING IN BATCHES */
+/***********************/
+
+typedef struct {
+  int session,
+      *pos,
+      num_pos;
+  volatile int cancel;
+} delete_args;
+
+static void *delete_nogvl(void *data) {
+  delete_args *args = data;
+  int i;
+
+  for (i = 0; i < args->num_pos && !args->cancel; i++)
+    xmms_remote_playlist_delete(args->session, args->pos[i]);
+
+  /* only report the deletes which actually happened */
+  args->num_pos = i;
+  return NULL;
+}
+
+/*
+ * Delete the given playlist positions (which must be in descending
+ * order), then tell any caches about it.
+ */
+static void delete_batch(VALUE self, int session, int *pos, int num_pos) {
+  delete_args args;
+  VALUE *ary;
+  int i;
+
+  args.session = session;
+  args.pos = pos;
+  args.num_pos = num_pos;
+  args.cancel = 0;
+  xr_nogvl(delete_nogvl, &args, &args.cancel);
+
+  if (args.num_pos > 0) {
+    ary = ALLOC_N(VALUE, args.num_pos);
+    for (i = 0; i < args.num_pos; i++)
+      ary[i] = INT2FIX(pos[i]);
+    xr_pl_notify(self, XR_PL_DELETE, -1, args.num_pos, ary);
+    xfree(ary);
+  }
+
+  if (args.cancel)
+    XR_CHECK_INTS();
+}
+
+/**************/
+/* DUPLICATES */
+/**************/
+
+typedef enum {
+  DEDUPE_FILE,
+  DEDUPE_NORMALIZED_PATH,
+  DEDUPE_TITLE_AND_TIME
+} dedupe_by;
+
+/*
+ * Normalize a local path in place: strip any file:// prefix, squeeze
+ * repeated slashes, and resolve "." and ".." components.  Anything
+ * that doesn't look like a local path is left alone.
+ */
+static char *normalize_path(char *path) {
+  char *src, *dst, *start;
+
+  if (!strncmp(path, "file://", 7))
+    memmove(path, path + 7, strlen(path + 7) + 1);
+  if (*path != '/')
+    return path;
+
+  for (src = dst = start = path; *src; ) {
+    if (*src == '/') {
+      /* squeeze slashes */
+      while (*src == '/')
+        src++;
+
+      if (src[0] == '.' && (src[1] == '/' || !src[1])) {
+        /* "." */
+        src++;
+        continue;
+      } else if (src[0] == '.' && src[1] == '.' && (src[2] == '/' || !src[2])) {
+        /* "..": back up to the previous slash */
+        src += 2;
+        while (dst > start && *(--dst) != '/');
+        continue;
+      }
+
+      *(dst++) = '/';
+    } else {
+      *(dst++) = *(src++);
+    }
+  }
+
+  /* drop a trailing slash (but keep "/") */
+  if (dst > start + 1 && dst[-1] == '/')
+    dst--;
+  if (dst == start)
+    *(dst++) = '/';
+  *dst = '\0';
+
+  return path;
+}
+
+static unsigned long long hash_key(const char *str, gint num) {
+  unsigned long long h = 14695981039346656037ULL;
+
+  for (; *str; str++)
+    h = (h ^ (unsigned char) *str) * 1099511628211ULL;
+  h = (h ^ (unsigned int) num) * 1099511628211ULL;
+
+  return h;
+}
+
+/*
+ * Find duplicate entries in a snapshot.  Returns the number found, and
+ * writes their positions in descending order to ret.  The first entry
+ * of each group of duplicates is kept, unless one of the others is the
+ * current song, in which case that one is kept instead.
+ */
+static int find_dupes(xr_snap *snap, dedupe_by by, int current, int *ret) {
+  unsigned long long *hashes;
+  int i, j, num_ret = 0, mask, num_slots, *slots;
+  char **keys, *dupe;
+  gint *nums;
+
+  /* pick the key columns */
+  keys = (by == DEDUPE_TITLE_AND_TIME) ? snap->titles : snap->files;
+  nums = (by == DEDUPE_TITLE_AND_TIME) ? snap->times : NULL;
+  if (by == DEDUPE_NORMALIZED_PATH)
+    for (i = 0; i < snap->len; i++)
+      if (keys[i])
+        normalize_path(keys[i]);
+
+  for (num_slots = 16; num_slots < snap->len * 2; num_slots *= 2);
+  mask = num_slots - 1;
+  slots = ALLOC_N(int, num_slots);
+  memset(slots, 0xff, sizeof(int) * num_slots);
+  hashes = ALLOC_N(unsigned long long, snap->len + 1);
+  dupe = ALLOC_N(char, snap->len + 1);
+  memset(dupe, 0, snap->len + 1);
+
+  for (i = 0; i < snap->len; i++) {
+    /* skip entries that vanished during the fetch */
+    if (!keys[i])
+      continue;
+
+    hashes[i] = hash_key(keys[i], nums ? nums[i] : 0);
+    for (j = hashes[i] & mask; slots[j] >= 0; j = (j + 1) & mask) {
+      int k = slots[j];
+
+      if (hashes[k] == hashes[i] && !strcmp(keys[k], keys[i]) &&
+          (!nums || nums[k] == nums[i])) {
+        if (i == current) {
+          /* keep the current song instead of the earlier copy */
+          dupe[k] = 1;
+          slots[j] = i;
+        } else {
+          dupe[i] = 1;
+        }
+        break;
+      }
+    }
+
+    if (slots[j] < 0)
+      slots[j] = i;
+  }
+
+  for (i = snap->len - 1; i >= 0; i--)
+    if (dupe[i])
+      ret[num_ret++] = i;
+
+  xfree(slots);
+  xfree(hashes);
+  xfree(dupe);
+
+  return num_ret;
+}
+
+/*
+ * Remove duplicate entries from the playlist.
+ *
+ * Entries are compared by one of the following (the default is :file):
+ *
+ * :file::            the path or URL of the entry.
+ * :normalized_path:: the path, with any file:// prefix stripped,
+ *                    repeated slashes squeezed, and "." and ".."
+ *                    resolved.
+ * :title_and_time::  the title and the duration of the entry.
+ *
+ * The first entry of each set of duplicates is kept, except that the
+ * current song is never removed.  Duplicates are found natively from a
+ * single fetch of the needed columns, and then removed in a single
+ * batch (highest index first).
+ *
+ * Returns the number of entries removed.
+ *
+ * This method raises an Xmms::Error exception if XMMS is not running,
+ * or an ArgumentError exception if the comparison is unknown or it's
+ * called while recording an Xmms::Scheduler cue.
+ *
+ * Examples:
+ *   remote.dedupe!
+ *   remote.dedupe! :title_and_time
+ *   removed = remote.dedupe!(:by => :normalized_path)
+ *
+ */
+static VALUE xr_dedupe(int argc, VALUE *argv, VALUE self) {
+  VALUE by = opt_arg(argc, argv, "by");
+  dedupe_by how;
+  int *session, num_dupes, *dupes, cur;
+  xr_snap snap;
+
+  if (by == Qnil || by == ID2SYM(rb_intern("file")))
+    how = DEDUPE_FILE;
+  else if (by == ID2SYM(rb_intern("normalized_path")))
+    how = DEDUPE_NORMALIZED_PATH;
+  else if (by == ID2SYM(rb_intern("title_and_time")))
+    how = DEDUPE_TITLE_AND_TIME;
+  else
+    rb_raise(rb_eArgError, "unknown comparison (not :file, :normalized_path, or :title_and_time)");
+
+  xr_sched_refuse("dedupe!");
+  session = XR_SESSION(self);
+  CHECK_SESSION(session);
+
+  cur = xmms_remote_get_playlist_pos(*session);
+  if (xr_snap_fetch(&snap, *session, (how == DEDUPE_TITLE_AND_TIME) ? (XR_COL_TITLE | XR_COL_TIME) : XR_COL_FILE)) {
+    XR_CHECK_INTS();
+    rb_raise(eError, "playlist fetch interrupted");
+  }
+
+  dupes = ALLOC_N(int, snap.len + 1);
+  num_dupes = find_dupes(&snap, how, cur, dupes);
+  xr_snap_free(&snap);
+
+  delete_batch(self, *session, dupes, num_dupes);
+  xfree(dupes);
+
+  return INT2FIX(num_dupes);
+}
+
+/**************/
+/* REORDERING */
+/**************/
+
+/*
+ * XMMS can't move entries, so a reorder is done by deleting the entries
+ * which are out of place and inserting them again where they belong.
+ * The entries left alone are a longest increasing subsequence of the
+ * target order (always including the current song, so playback isn't
+ * interrupted), which keeps the number of moves to a minimum.  Moved
+ * entries which belong after the last entry left alone are appended
+ * with a single request.
+ */
+
+typedef struct {
+  int session,
+      *del,             /* positions to delete, descending */
+      num_del,
+      *ins,             /* target positions to insert at, ascending */
+      num_ins,
+      num_append;       /* trailing entries of ins to append in one go */
+  gchar **files;        /* path to insert, by target position */
+} reorder_args;
+
+/* inserted for entries whose path couldn't be read */
+static gchar no_file[] = "";
+
+static void *reorder_nogvl(void *data) {
+  reorder_args *args = data;
+  gchar **list;
+  int i, num_single = args->num_ins - args->num_append;
+
+  for (i = 0; i < args->num_del; i++)
+    xmms_remote_playlist_delete(args->session, args->del[i]);
+
+  for (i = 0; i < num_single; i++)
+    xmms_remote_playlist_ins_url_string(args->session,
+                                        args->files[args->ins[i]],
+                                        args->ins[i]);
+
+  if (args->num_append > 0) {
+    list = g_malloc(sizeof(gchar*) * args->num_append);
+    for (i = 0; i < args->num_append; i++)
+      list[i] = args->files[args->ins[num_single + i]];
+    xmms_remote_playlist(args->session, list, args->num_append, TRUE);
+    g_free(list);
+  }
+
+  return NULL;
+}
+
+/*
+ * Mark a longest increasing subsequence (by rank) of the given entries
+ * in keep.
+ */
+static void mark_lis(int *entries, int num, int *rank, char *keep) {
+  int *tails, *prev, len = 0, i, lo, hi, mid;
+
+  if (num <= 0)
+    return;
+
+  tails = ALLOC_N(int, num);
+  prev = ALLOC_N(int, num);
+
+  /* patience sort; tails[k] is the index (into entries) of the smallest
+   * tail of any increasing subsequence of length k + 1 */
+  for (i = 0; i < num; i++) {
+    for (lo = 0, hi = len; lo < hi; ) {
+      mid = (lo + hi) / 2;
+      if (rank[entries[tails[mid]]] < rank[entries[i]])
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+    prev[i] = lo ? tails[lo - 1] : -1;
+    tails[lo] = i;
+    if (lo == len)
+      len++;
+  }
+
+  for (i = tails[len - 1]; i >= 0; i = prev[i])
+    keep[entries[i]] = 1;
+
+  xfree(tails);
+  xfree(prev);
+}
+
+/*
+ * Reorder the playlist so that the entry at position order[k] ends up
+ * at position k.  Returns the number of entries moved.
+ */
+static int reorder(VALUE self, int session, xr_snap *snap, int *order) {
+  reorder_args args;
+  int i, k, n = snap->len, cur, last_kept = -1, *rank, *entries, num;
+  char *keep;
+  VALUE *ary;
+
+  rank = ALLOC_N(int, n + 1);
+  entries = ALLOC_N(int, n + 1);
+  keep = ALLOC_N(char, n + 1);
+  memset(keep, 0, n + 1);
+  for (k = 0; k < n; k++)
+    rank[order[k]] = k;
+
+  /* pick the entries to leave alone */
+  cur = xmms_remote_get_playlist_pos(session);
+  if (cur >= 0 && cur < n) {
+    keep[cur] = 1;
+    for (i = num = 0; i < cur; i++)
+      if (rank[i] < rank[cur])
+        entries[num++] = i;
+    mark_lis(entries, num, rank, keep);
+    for (i = cur + 1, num = 0; i < n; i++)
+      if (rank[i] > rank[cur])
+        entries[num++] = i;
+    mark_lis(entries, num, rank, keep);
+  } else {
+    for (i = 0; i < n; i++)
+      entries[i] = i;
+    mark_lis(entries, n, rank, keep);
+  }
+
+  /* build the edit script */
+  memset(&args, 0, sizeof(args));
+  args.session = session;
+  args.del = ALLOC_N(int, n + 1);
+  args.ins = ALLOC_N(int, n + 1);
+  args.files = ALLOC_N(gchar*, n + 1);
+  for (i = n - 1; i >= 0; i--)
+    if (!keep[i])
+      args.del[args.num_del++] = i;
+  for (k = 0; k < n; k++) {
+    args.files[k] = snap->files[order[k]] ? snap->files[order[k]] : no_file;
+    if (keep[order[k]])
+      last_kept = k;
+    else
+      args.ins[args.num_ins++] = k;
+  }
+  for (i = args.num_ins - 1; i >= 0 && args.ins[i] > last_kept; i--)
+    args.num_append++;
+
+  /* this isn't interruptible; stopping half way through would leave
+   * the deleted entries out of the playlist */
+  if (args.num_del > 0)
+    xr_nogvl(reorder_nogvl, &args, NULL);
+
+  /* tell the caches about the new order */
+  if (args.num_del > 0) {
+    ary = ALLOC_N(VALUE, n + 1);
+    for (k = 0; k < n; k++)
+      ary[k] = INT2FIX(order[k]);
+    xr_pl_notify(self, XR_PL_REORDER, -1, n, ary);
+    xfree(ary);
+  }
+
+  xfree(rank);
+  xfree(entries);
+  xfree(keep);
+  xfree(args.del);
+  xfree(args.ins);
+  xfree(args.files);
+
+  return args.num_del;
+}
+
+/* sort state (shared by every Ractor, so guarded by sort_lock) */
+static xr_snap *sort_snap;
+static int sort_col;
+static pthread_mutex_t sort_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int sort_cmp(const void *a, const void *b) {
+  int i = *((const int*) a), j = *((const int*) b), ret = 0;
+  const char *x, *y;
+
+  switch (sort_col) {
+    case XR_COL_TITLE:
+      x = sort_snap->titles[i] ? sort_snap->titles[i] : "";
+      y = sort_snap->titles[j] ? sort_snap->titles[j] : "";
+      ret = strcasecmp(x, y);
+      break;
+    case XR_COL_FILE:
+      x = sort_snap->files[i] ? sort_snap->files[i] : "";
+      y = sort_snap->files[j] ? sort_snap->files[j] : "";
+      ret = strcmp(x, y);
+      break;
+    case XR_COL_TIME:
+      ret = (sort_snap->times[i] > sort_snap->times[j]) -
+            (sort_snap->times[i] < sort_snap->times[j]);
+      break;
+  }
+
+  /* keep the sort stable */
+  return ret ? ret : (i - j);
+}
+
+static void fetch_or_raise(xr_snap *snap, int session, int cols) {
+  if (xr_snap_fetch(snap, session, cols)) {
+    XR_CHECK_INTS();
+    rb_raise(eError, "playlist fetch interrupted");
+  }
+}
+
+/*
+ * Sort the playlist in place.
+ *
+ * Entries can be sorted by :title (case-insensitive; the default),
+ * :file, or :time.  Equal entries keep their relative order.
+ *
+ * Since XMMS can't move playlist entries, entries which are out of
+ * place are deleted and inserted again.  As few entries are moved as
+ * possible, and the current song is never moved, so playback isn't
+ * interrupted.
+ *
+ * Returns the number of entries moved.
+ *
+ * This method raises an Xmms::Error exception if XMMS is not running,
+ * or an ArgumentError exception if the sort key is unknown or it's
+ * called while recording an Xmms::Scheduler cue.
+ *
+ * Examples:
+ *   remote.sort!
+ *   remote.sort! :file
+ *   moved = remote.sort!(:by => :time)
+ *
+ */
+static VALUE xr_sort(int argc, VALUE *argv, VALUE self) {
+  VALUE by = opt_arg(argc, argv, "by");
+  int i, col, *session, *order, ret;
+  xr_snap snap;
+
+  if (by == Qnil || by == ID2SYM(rb_intern("title")))
+    col = XR_COL_TITLE;
+  else if (by == ID2SYM(rb_intern("file")))
+    col = XR_COL_FILE;
+  else if (by == ID2SYM(rb_intern("time")))
+    col = XR_COL_TIME;
+  else
+    rb_raise(rb_eArgError, "unknown sort key (not :title, :file, or :time)");
+
+  xr_sched_refuse("sort!");
+  session = XR_SESSION(self);
+  CHECK_SESSION(session);
+  fetch_or_raise(&snap, *session, XR_COL_FILE | col);
+
+  order = ALLOC_N(int, snap.len + 1);
+  for (i = 0; i < snap.len; i++)
+    order[i] = i;
+  pthread_mutex_lock(&sort_lock);
+  sort_snap = &snap;
+  sort_col = col;
+  qsort(order, snap.len, sizeof(int), sort_cmp);
+  pthread_mutex_unlock(&sort_lock);
+
+  ret = reorder(self, *session, &snap, order);
+
+  xfree(order);
+  xr_snap_free(&snap);
+
+  return INT2FIX(ret);
+}
+
+/*
+ * Shuffle the playlist in place.
+ *
+ * If a seed (an Integer) is given, the same seed always produces the
+ * same order for the same playlist.
+ *
+ * Like Xmms::Remote#sort!, this moves as few entries as possible and
+ * never moves the current song.  Note that almost every entry moves in
+ * a shuffle, so for a large playlist this costs about two round trips
+ * to XMMS per entry.
+ *
+ * Returns the number of entries moved.
+ *
+ * This method raises an Xmms::Error exception if XMMS is not running,
+ * or an ArgumentError exception if it's called while recording an
+ * Xmms::Scheduler cue.
+ *
+ * Examples:
+ *   remote.shuffle!
+ *   remote.shuffle! 42
+ *   remote.shuffle!(:seed => 42)
+ *
+ */
+static VALUE xr_shuffle_pl(int argc, VALUE *argv, VALUE self) {
+  VALUE seed = opt_arg(argc, argv, "seed");
+  unsigned long long x;
+  int i, j, tmp, *session, *order, ret;
+  xr_snap snap;
+
+  if (seed == Qnil)
+    x = ((unsigned long long) time(NULL) << 20) ^ getpid();
+  else
+    x = NUM2ULONG(seed);
+  x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+  if (!x)
+    x = 1;
+
+  xr_sched_refuse("shuffle!");
+  session = XR_SESSION(self);
+  CHECK_SESSION(session);
+  fetch_or_raise(&snap, *session, XR_COL_FILE);
+
+  /* fisher-yates, driven by xorshift64* */
+  order = ALLOC_N(int, snap.len + 1);
+  for (i = 0; i < snap.len; i++)
+    order[i] = i;
+  for (i = snap.len - 1; i > 0; i--) {
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    j = (int) (((x * 2685821657736338717ULL) >> 33) % (unsigned int) (i + 1));
+    tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  ret = reorder(self, *session, &snap, order);
+
+  xfree(order);
+  xr_snap_free(&snap);
+
+  return INT2FIX(ret);
+}
+
+void Init_xmms_edit(void) {
+  rb_define_method(cRemote, "dedupe!", xr_dedupe, -1);
+  rb_define_alias(cRemote, "uniq!", "dedupe!");
+
+  rb_define_method(cRemote, "sort!", xr_sort, -1);
+  rb_define_alias(cRemote, "playlist_sort", "sort!");
+
+  rb_define_method(cRemote, "shuffle!", xr_shuffle_pl, -1);
+  rb_define_alias(cRemote, "playlist_shuffle", "shuffle!");
+}
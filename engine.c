@@ -0,0 +1,627 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Pipelined I/O mode.
+ *
+ * A remote in pipelined mode (see Xmms::Remote#pipeline=) owns a
+ * native I/O thread.  Calling threads push commands onto a lock-free
+ * multiple-producer, single-consumer queue and wait (without the
+ * interpreter lock) for the result; the I/O thread drains the queue in
+ * batches.  Each batch costs a single "is XMMS running?" round trip
+ * instead of one per command, and identical reads in the same batch
+ * (with no write between them) are only sent to XMMS once, which is a
+ * big win when lots of threads are polling the same remote.
+ *
+ * The queue is Dmitry Vyukov's intrusive MPSC queue: producers only
+ * ever do one atomic exchange, and the consumer never blocks them.
+ */
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include "xmms_ruby.h"
+
+/* maximum number of commands handled per batch */
+#define MAX_BATCH 64
+
+/* longest wait without checking for interrupts, in seconds */
+#define WAIT_SLICE 0.1
+
+struct xr_job {
+  struct xr_job *next;
+  xr_cmd cmd;
+
+  int done,
+      refs,
+      gen;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+struct xr_engine {
+  int session;
+
+  /* queue; head is pushed to by producers, tail is only touched by
+   * the I/O thread */
+  xr_job *head,
+         *tail,
+         stub;
+
+  pthread_t thread;
+  int gen,
+      stop,
+      sleeping,
+      joined;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+
+  /* statistics (only written by the I/O thread) */
+  unsigned long num_batches,
+                num_cmds,
+                num_sent,
+                num_checks;
+};
+
+static VALUE cEngine;
+
+/*********/
+/* QUEUE */
+/*********/
+
+static void queue_push(xr_engine *e, xr_job *job) {
+  xr_job *prev;
+
+  __atomic_store_n(&job->next, NULL, __ATOMIC_RELAXED);
+  prev = __atomic_exchange_n(&e->head, job, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&prev->next, job, __ATOMIC_RELEASE);
+}
+
+/*
+ * Pop the oldest job.  Returns NULL if the queue is empty, or if a
+ * producer is half way through a push (see queue_empty()).
+ */
+static xr_job *queue_pop(xr_engine *e) {
+  xr_job *tail = e->tail,
+         *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+  if (tail == &e->stub) {
+    if (!next)
+      return NULL;
+    e->tail = tail = next;
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  }
+
+  if (next) {
+    e->tail = next;
+    return tail;
+  }
+
+  if (tail != __atomic_load_n(&e->head, __ATOMIC_ACQUIRE))
+    return NULL;
+
+  queue_push(e, &e->stub);
+  next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  if (next) {
+    e->tail = next;
+    return tail;
+  }
+
+  return NULL;
+}
+
+static int queue_empty(xr_engine *e) {
+  return e->tail == &e->stub &&
+         __atomic_load_n(&e->head, __ATOMIC_SEQ_CST) == &e->stub;
+}
+
+/********/
+/* JOBS */
+/********/
+
+static xr_job *job_new(xr_cmd *cmd) {
+  xr_job *job = malloc(sizeof(xr_job));
+  pthread_condattr_t attr;
+
+  if (!job)
+    rb_raise(rb_eNoMemError, "couldn't allocate command");
+
+  /* the job takes over the command's arguments */
+  job->cmd = *cmd;
+  cmd->str = NULL;
+  cmd->num_str = 0;
+
+  job->next = NULL;
+  job->done = 0;
+  job->refs = 2; /* caller and I/O thread */
+  job->gen = xr_fork_gen;
+  pthread_mutex_init(&job->lock, NULL);
+
+  /* timed waits are against the monotonic clock */
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&job->cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  return job;
+}
+
+/*
+ * Drop a reference to a job.
+ */
+void xr_job_unref(xr_job *job) {
+  if (__atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL))
+    return;
+
+  xr_cmd_free(&job->cmd);
+  pthread_mutex_destroy(&job->lock);
+  pthread_cond_destroy(&job->cond);
+  free(job);
+}
+
+static void job_finish(xr_job *job) {
+  pthread_mutex_lock(&job->lock);
+  __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&job->cond);
+  pthread_mutex_unlock(&job->lock);
+
+  xr_job_unref(job);
+}
+
+/**************/
+/* I/O THREAD */
+/**************/
+
+/*
+ * Run a batch of jobs.
+ */
+static void run_batch(xr_engine *e, xr_job **jobs, int len) {
+  int i, j, running = 1, checked = 0, last_write = -1;
+
+  for (i = 0; i < len; i++) {
+    xr_cmd *cmd = &jobs[i]->cmd;
+    int flags = xr_cmd_defs[cmd->op].flags;
+
+    /* one liveness check per batch */
+    if (!(flags & XR_CMD_NO_CHECK) && !checked) {
+      running = xr_session_check(e->session, cmd->ttl);
+      checked = 1;
+      e->num_checks++;
+    }
+
+    if (!(flags & XR_CMD_NO_CHECK) && !running) {
+      cmd->ok = 0;
+      continue;
+    }
+
+    /* reuse the result of an identical read since the last write */
+    if (flags & XR_CMD_READ) {
+      for (j = i - 1; j > last_write; j--)
+        if (jobs[j]->cmd.ok && xr_cmd_same(&jobs[j]->cmd, cmd))
+          break;
+
+      if (j > last_write) {
+        xr_cmd_copy_result(cmd, &jobs[j]->cmd);
+        continue;
+      }
+    } else {
+      last_write = i;
+    }
+
+    xr_cmd_run(cmd);
+    e->num_sent++;
+  }
+
+  for (i = 0; i < len; i++)
+    job_finish(jobs[i]);
+
+  e->num_batches++;
+  e->num_cmds += len;
+}
+
+/*
+ * Wait for work.  Returns 0 once the engine has been stopped and the
+ * queue is empty.
+ */
+static int wait_for_work(xr_engine *e) {
+  int ret = 1;
+
+  /*
+   * A producer pushes, then checks the sleeping flag; we set the flag,
+   * then check the queue.  Both sides are sequentially consistent, so
+   * at least one of us sees the other.  The mutex makes sure a wakeup
+   * can't slip in between our check and the wait.
+   */
+  __atomic_store_n(&e->sleeping, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&e->lock);
+  while (queue_empty(e)) {
+    if (__atomic_load_n(&e->stop, __ATOMIC_SEQ_CST)) {
+      ret = 0;
+      break;
+    }
+    pthread_cond_wait(&e->wake, &e->lock);
+  }
+  pthread_mutex_unlock(&e->lock);
+  __atomic_store_n(&e->sleeping, 0, __ATOMIC_SEQ_CST);
+
+  return ret;
+}
+
+static void *io_thread(void *data) {
+  xr_engine *e = data;
+  xr_job *jobs[MAX_BATCH];
+  int len;
+
+  for (;;) {
+    for (len = 0; len < MAX_BATCH; len++)
+      if ((jobs[len] = queue_pop(e)) == NULL)
+        break;
+
+    if (len > 0) {
+      run_batch(e, jobs, len);
+    } else if (!queue_empty(e)) {
+      /* a producer is in the middle of a push */
+      sched_yield();
+    } else if (!wait_for_work(e)) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+/**********/
+/* ENGINE */
+/**********/
+
+static void engine_wake(xr_engine *e) {
+  if (__atomic_load_n(&e->sleeping, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&e->lock);
+    pthread_cond_signal(&e->wake);
+    pthread_mutex_unlock(&e->lock);
+  }
+}
+
+static void *engine_stop(void *data) {
+  xr_engine *e = data;
+
+  /* the thread doesn't exist in a forked child */
+  if (e->joined || e->gen != xr_fork_gen)
+    return NULL;
+
+  __atomic_store_n(&e->stop, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&e->lock);
+  pthread_cond_signal(&e->wake);
+  pthread_mutex_unlock(&e->lock);
+  pthread_join(e->thread, NULL);
+  e->joined = 1;
+
+  return NULL;
+}
+
+static void engine_free(xr_engine *e) {
+  engine_stop(e);
+
+  /*
+   * An engine inherited from the parent may still have the parent's
+   * I/O thread registered as a waiter on the condition variable, and
+   * destroying it would wait for that thread forever.
+   */
+  if (e->gen == xr_fork_gen) {
+    pthread_mutex_destroy(&e->lock);
+    pthread_cond_destroy(&e->wake);
+  }
+
+  xfree(e);
+}
+
+/*
+ * Start (or, in a forked child, restart) the I/O thread with an empty
+ * queue.  Returns 0 or an error number.
+ */
+static int engine_spawn(xr_engine *e) {
+  sigset_t all, old;
+  int err;
+
+  e->gen = xr_fork_gen;
+  e->stop = e->sleeping = e->joined = 0;
+  e->stub.next = NULL;
+  e->head = e->tail = &e->stub;
+  pthread_mutex_init(&e->lock, NULL);
+  pthread_cond_init(&e->wake, NULL);
+
+  /* signals belong to ruby's threads, not ours */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  err = pthread_create(&e->thread, NULL, io_thread, e);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  /* don't try to join a thread that doesn't exist */
+  if (err)
+    e->joined = 1;
+
+  return err;
+}
+
+static VALUE engine_new(VALUE self) {
+  xr_engine *e;
+  int *session, err;
+  VALUE ret;
+
+  session = XR_SESSION(self);
+
+  ret = Data_Make_Struct(cEngine, xr_engine, 0, engine_free, e);
+  e->session = *session;
+  if ((err = engine_spawn(e)) != 0)
+    rb_raise(eError, "couldn't create I/O thread: %s", strerror(err));
+
+  return ret;
+}
+
+/*
+ * Get the I/O engine for a remote, or NULL if it isn't in pipelined
+ * mode.
+ */
+xr_engine *xr_engine_get(VALUE self) {
+  VALUE obj;
+  xr_engine *e;
+
+  if ((obj = xr_remote_slot(self, XR_SLOT_ENGINE)) == Qnil)
+    return NULL;
+
+  Data_Get_Struct(obj, xr_engine, e);
+
+  /*
+   * In a forked child, the I/O thread is gone, and whatever was queued
+   * belongs to the parent.  Start over.
+   */
+  if (e->gen != xr_fork_gen && !e->joined) {
+    int err = engine_spawn(e);
+    if (err)
+      rb_raise(eError, "couldn't create I/O thread: %s", strerror(err));
+  }
+
+  return e;
+}
+
+/*
+ * Get the I/O engine for a remote, putting it in pipelined mode if
+ * necessary.
+ */
+xr_engine *xr_engine_start(VALUE self) {
+  xr_engine *e = xr_engine_get(self);
+
+  if (!e) {
+    xr_remote_set(self, XR_SLOT_ENGINE, engine_new(self));
+    e = xr_engine_get(self);
+  }
+
+  return e;
+}
+
+/*
+ * Queue a command on the I/O thread.  The job takes over the command's
+ * arguments.
+ */
+xr_job *xr_engine_submit(xr_engine *e, xr_cmd *cmd) {
+  xr_job *job = job_new(cmd);
+
+  queue_push(e, job);
+  engine_wake(e);
+
+  return job;
+}
+
+/*
+ * Has a job finished?
+ */
+int xr_job_done(xr_job *job) {
+  return __atomic_load_n(&job->done, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Get a job's command (and, once it's done, results).
+ */
+xr_cmd *xr_job_cmd(xr_job *job) {
+  return &job->cmd;
+}
+
+typedef struct {
+  xr_job *job;
+  double timeout;
+} wait_args;
+
+static void *wait_nogvl(void *data) {
+  wait_args *args = data;
+  xr_job *job = args->job;
+  struct timespec ts;
+
+  pthread_mutex_lock(&job->lock);
+  if (args->timeout < 0) {
+    while (!job->done)
+      pthread_cond_wait(&job->cond, &job->lock);
+  } else if (!job->done) {
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += (time_t) args->timeout;
+    ts.tv_nsec += (long) ((args->timeout - (time_t) args->timeout) * 1e9);
+    if (ts.tv_nsec >= 1000000000) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000;
+    }
+
+    while (!job->done)
+      if (pthread_cond_timedwait(&job->cond, &job->lock, &ts))
+        break;
+  }
+  pthread_mutex_unlock(&job->lock);
+
+  return NULL;
+}
+
+/*
+ * Wait up to timeout seconds (forever if timeout is negative) for a job
+ * to finish, without the interpreter lock.  Returns non-zero if the job
+ * is done.  The wait can be interrupted (e.g. by Thread#raise).
+ */
+int xr_job_wait(xr_job *job, double timeout) {
+  double end = xr_now() + timeout, left;
+  volatile int cancel;
+  wait_args args;
+
+  args.job = job;
+  while (!xr_job_done(job)) {
+    /* queued before a fork; it's never going to run in this process */
+    if (job->gen != xr_fork_gen) {
+      job->cmd.ok = -1;
+      __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+      break;
+    }
+
+    left = end - xr_now();
+    if (timeout >= 0 && left <= 0)
+      return 0;
+
+    args.timeout = (timeout < 0 || left > WAIT_SLICE) ? WAIT_SLICE : left;
+    cancel = 0;
+    xr_nogvl(wait_nogvl, &args, &cancel);
+    if (cancel)
+      XR_CHECK_INTS();
+  }
+
+  return 1;
+}
+
+/*
+ * Queue a command on the I/O thread and wait for it to finish.  The
+ * wait isn't interruptible; commands are a single round trip to XMMS.
+ */
+void xr_engine_call(xr_engine *e, xr_cmd *cmd) {
+  xr_job *job = xr_engine_submit(e, cmd);
+  wait_args args;
+
+  args.job = job;
+  args.timeout = -1;
+  xr_nogvl(wait_nogvl, &args, NULL);
+
+  /* claim the results */
+  cmd->ok = job->cmd.ok;
+  memcpy(cmd->ret, job->cmd.ret, sizeof(cmd->ret));
+  memcpy(cmd->fret, job->cmd.fret, sizeof(cmd->fret));
+  cmd->sret = job->cmd.sret;
+  job->cmd.sret = NULL;
+
+  xr_job_unref(job);
+}
+
+/******************/
+/* REMOTE METHODS */
+/******************/
+
+/*
+ * Turn pipelined mode on or off.
+ *
+ * In pipelined mode, every command sent through this remote is handed
+ * to a dedicated I/O thread, and the calling thread waits for the
+ * result without holding the interpreter lock.  This is useful when
+ * several threads share one remote: commands are sent in batches, with
+ * one liveness check per batch, and identical reads (e.g. several
+ * threads polling Xmms::Remote#time) are only sent once per batch.
+ *
+ * Calling any of the *_async methods (see Xmms::Future) also puts the
+ * remote in pipelined mode.  Turning pipelined mode off waits for any
+ * queued commands to finish.
+ *
+ * Examples:
+ *   remote.pipeline = true
+ *   8.times { Thread.new { loop { p remote.time; sleep 0.1 } } }
+ *
+ */
+static VALUE xr_set_pipeline(VALUE self, VALUE on) {
+  xr_engine *e = xr_engine_get(self);
+
+  if (RTEST(on)) {
+    xr_engine_start(self);
+  } else if (!RTEST(on) && e) {
+    xr_remote_set(self, XR_SLOT_ENGINE, Qnil);
+    xr_nogvl(engine_stop, e, NULL);
+  }
+
+  return on;
+}
+
+/*
+ * Is this remote in pipelined mode?
+ *
+ * Example:
+ *   puts 'pipelined' if remote.pipeline?
+ *
+ */
+static VALUE xr_pipeline(VALUE self) {
+  return xr_engine_get(self) ? Qtrue : Qfalse;
+}
+
+/*
+ * Get statistics for this remote's I/O thread, as a hash: the number
+ * of batches and commands handled, the number of commands actually
+ * sent to XMMS (the rest were coalesced), and the number of liveness
+ * checks.  Returns nil if the remote isn't in pipelined mode.
+ *
+ * Example:
+ *   stats = remote.pipeline_stats
+ *   puts "#{stats[:commands]} commands in #{stats[:batches]} batches"
+ *
+ */
+static VALUE xr_pipeline_stats(VALUE self) {
+  xr_engine *e = xr_engine_get(self);
+  VALUE ret;
+
+  if (!e)
+    return Qnil;
+
+  ret = rb_hash_new();
+  rb_hash_aset(ret, ID2SYM(rb_intern("batches")),
+               ULONG2NUM(__atomic_load_n(&e->num_batches, __ATOMIC_RELAXED)));
+  rb_hash_aset(ret, ID2SYM(rb_intern("commands")),
+               ULONG2NUM(__atomic_load_n(&e->num_cmds, __ATOMIC_RELAXED)));
+  rb_hash_aset(ret, ID2SYM(rb_intern("sent")),
+               ULONG2NUM(__atomic_load_n(&e->num_sent, __ATOMIC_RELAXED)));
+  rb_hash_aset(ret, ID2SYM(rb_intern("checks")),
+               ULONG2NUM(__atomic_load_n(&e->num_checks, __ATOMIC_RELAXED)));
+
+  return ret;
+}
+
+void Init_xmms_engine(void) {
+  rb_define_method(cRemote, "pipeline=", xr_set_pipeline, 1);
+  rb_define_method(cRemote, "pipeline?", xr_pipeline, 0);
+  rb_define_alias(cRemote, "pipelined?", "pipeline?");
+  rb_define_method(cRemote, "pipeline_stats", xr_pipeline_stats, 0);
+
+  /* opaque holder for the I/O thread */
+  cEngine = rb_define_class_under(cRemote, "Engine", rb_cObject);
+  rb_undef_alloc_func(cEngine);
+  rb_undef_method(CLASS_OF(cEngine), "new");
+}
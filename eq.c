@@ -0,0 +1,718 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Xmms::EqPreset: an equalizer setting (preamp and bands) as a value.
+ *
+ * The values are kept packed, preamp first, in a float array padded to
+ * a multiple of four, so blending two presets is a fixed-length loop
+ * the compiler can vectorize.  Presets can be read from and written to
+ * Winamp EQF files and XMMS's own preset files.
+ *
+ * Applying a preset is a single xmms_remote_set_eq() call, and each
+ * remote remembers the last preset it applied, so applying the same
+ * values again (e.g. at the ends of a crossfade) doesn't go to XMMS
+ * at all.
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include "xmms_ruby.h"
+
+/* EQF files */
+#define EQF_MAGIC     "Winamp EQ library file v1.1\x1a!--"
+#define EQF_MAGIC_LEN 31
+#define EQF_NAME_LEN  257
+
+typedef struct {
+  gfloat v[XR_EQ_LEN] __attribute__ ((aligned(16)));  /* preamp, bands */
+  VALUE name;
+} xr_eq;
+
+VALUE cEqPreset;
+
+static void eq_mark(xr_eq *eq) {
+  rb_gc_mark(eq->name);
+}
+
+static void eq_free(xr_eq *eq) {
+  xfree(eq);
+}
+
+static xr_eq *get_eq(VALUE self) {
+  xr_eq *eq;
+
+  if (!rb_obj_is_kind_of(self, cEqPreset))
+    rb_raise(rb_eTypeError, "invalid argument type (not Xmms::EqPreset)");
+  Data_Get_Struct(self, xr_eq, eq);
+  return eq;
+}
+
+static VALUE eq_alloc(VALUE klass, xr_eq **ret) {
+  VALUE self = Data_Make_Struct(klass, xr_eq, eq_mark, eq_free, *ret);
+  memset((*ret)->v, 0, sizeof((*ret)->v));
+  (*ret)->name = Qnil;
+  return self;
+}
+
+static VALUE eq_alloc_func(VALUE klass) {
+  xr_eq *eq;
+  return eq_alloc(klass, &eq);
+}
+
+/*
+ * Create a preset from preamp, then bands, values.
+ */
+VALUE xr_eq_new(const gfloat *v) {
+  xr_eq *eq;
+  VALUE self = eq_alloc(cEqPreset, &eq);
+
+  memcpy(eq->v, v, sizeof(gfloat) * (NUM_BANDS + 1));
+  return self;
+}
+
+/*
+ * Get a preset's values: preamp, then bands.
+ */
+const gfloat *xr_eq_values(VALUE preset) {
+  return get_eq(preset)->v;
+}
+
+/*
+ * Blend two sets of values.  Fixed length and aligned, so this is a
+ * few vector instructions.
+ */
+static void eq_lerp(gfloat *dst, const gfloat *a, const gfloat *b, gfloat t) {
+  int i;
+
+  for (i = 0; i < XR_EQ_LEN; i++)
+    dst[i] = a[i] + (b[i] - a[i]) * t;
+}
+
+static void set_bands(xr_eq *eq, VALUE bands) {
+  int i;
+
+  Check_Type(bands, T_ARRAY);
+  if (RARRAY_LEN(bands) != NUM_BANDS)
+    rb_raise(rb_eArgError, "invalid band count (not %d)", NUM_BANDS);
+
+  for (i = 0; i < NUM_BANDS; i++)
+    eq->v[i + 1] = NUM2DBL(rb_ary_entry(bands, i));
+}
+
+static int band_index(VALUE band) {
+  int b = NUM2INT(band);
+
+  if (b < 0 || b >= NUM_BANDS)
+    rb_raise(rb_eArgError, "band index out of range (band < 0 or band >= 10)");
+  return b;
+}
+
+/****************/
+/* PRESET FILES */
+/****************/
+
+/*
+ * EQF values run from 0 (+20dB) down to 63 (just under -20dB), in
+ * steps of 0.625dB; this is how XMMS reads them.  (XMMS writes them
+ * with a slightly different scale, so its files drift a little on
+ * every load and save; ours round to the nearest step instead, which
+ * keeps 0dB at 0dB.)
+ */
+static gfloat eqf_to_db(unsigned char c) {
+  return 20.0 - (c * 40.0) / 64.0;
+}
+
+static unsigned char db_to_eqf(gfloat db) {
+  int c = (int) floor((20.0 - db) * 64.0 / 40.0 + 0.5);
+  return (c < 0) ? 0 : (c > 63) ? 63 : c;
+}
+
+static VALUE eqf_load(const char *buf, long len) {
+  const unsigned char *p = (const unsigned char*) buf + EQF_MAGIC_LEN;
+  const unsigned char *end = (const unsigned char*) buf + len;
+  VALUE ret = rb_ary_new(), obj;
+  xr_eq *eq;
+  int i;
+
+  while (end - p >= EQF_NAME_LEN + NUM_BANDS + 1) {
+    obj = eq_alloc(cEqPreset, &eq);
+    eq->name = rb_str_new((const char*) p, strnlen((const char*) p, EQF_NAME_LEN));
+    p += EQF_NAME_LEN;
+
+    for (i = 0; i < NUM_BANDS; i++)
+      eq->v[i + 1] = eqf_to_db(*p++);
+    eq->v[0] = eqf_to_db(*p++);
+
+    rb_ary_push(ret, obj);
+  }
+
+  return ret;
+}
+
+static VALUE eqf_save(VALUE presets) {
+  VALUE ret = rb_str_new(EQF_MAGIC, EQF_MAGIC_LEN);
+  char rec[EQF_NAME_LEN + NUM_BANDS + 1];
+  xr_eq *eq;
+  long i;
+  int j;
+
+  for (i = 0; i < RARRAY_LEN(presets); i++) {
+    eq = get_eq(rb_ary_entry(presets, i));
+
+    memset(rec, 0, sizeof(rec));
+    if (eq->name != Qnil)
+      strncpy(rec, StringValueCStr(eq->name), EQF_NAME_LEN - 1);
+    for (j = 0; j < NUM_BANDS; j++)
+      rec[EQF_NAME_LEN + j] = db_to_eqf(eq->v[j + 1]);
+    rec[EQF_NAME_LEN + NUM_BANDS] = db_to_eqf(eq->v[0]);
+
+    rb_str_cat(ret, rec, sizeof(rec));
+  }
+
+  return ret;
+}
+
+/*
+ * Find the preset called name in an XMMS preset file (an ini file with
+ * one [section] per preset), or add it.
+ */
+static xr_eq *xmms_preset(VALUE ary, const char *name, long len) {
+  xr_eq *eq;
+  VALUE obj;
+  long i;
+
+  for (i = 0; i < RARRAY_LEN(ary); i++) {
+    eq = get_eq(rb_ary_entry(ary, i));
+    if (RSTRING_LEN(eq->name) == len && !memcmp(RSTRING_PTR(eq->name), name, len))
+      return eq;
+  }
+
+  obj = eq_alloc(cEqPreset, &eq);
+  eq->name = rb_str_new(name, len);
+  rb_ary_push(ary, obj);
+  return eq;
+}
+
+static VALUE xmms_load(const char *buf, long len) {
+  const char *p = buf, *end = buf + len, *eol, *eq_sign, *key;
+  VALUE ret = rb_ary_new();
+  xr_eq *eq = NULL;
+  long key_len;
+  char num[64];
+  int band;
+
+  for (; p < end; p = eol + 1) {
+    if ((eol = memchr(p, '\n', end - p)) == NULL)
+      eol = end;
+
+    while (p < eol && isspace((unsigned char) *p))
+      p++;
+    key = p;
+    key_len = eol - p;
+    while (key_len > 0 && isspace((unsigned char) key[key_len - 1]))
+      key_len--;
+
+    if (key_len >= 2 && key[0] == '[' && key[key_len - 1] == ']') {
+      /* the [Presets] section is just the list of names */
+      if (key_len - 2 == 7 && !memcmp(key + 1, "Presets", 7))
+        eq = NULL;
+      else
+        eq = xmms_preset(ret, key + 1, key_len - 2);
+      continue;
+    }
+
+    if (!eq || (eq_sign = memchr(key, '=', key_len)) == NULL)
+      continue;
+
+    len = key + key_len - (eq_sign + 1);
+    if (len >= (long) sizeof(num))
+      continue;
+    memcpy(num, eq_sign + 1, len);
+    num[len] = '\0';
+
+    if (eq_sign - key == 6 && !memcmp(key, "Preamp", 6))
+      eq->v[0] = rb_cstr_to_dbl(num, 0);
+    else if (sscanf(key, "Band%d=", &band) == 1 && band >= 0 && band < NUM_BANDS)
+      eq->v[band + 1] = rb_cstr_to_dbl(num, 0);
+  }
+
+  return ret;
+}
+
+static VALUE xmms_save(VALUE presets) {
+  VALUE ret = rb_str_new2("[Presets]\n");
+  char line[64];
+  xr_eq *eq;
+  long i;
+  int j;
+
+  for (i = 0; i < RARRAY_LEN(presets); i++) {
+    eq = get_eq(rb_ary_entry(presets, i));
+    snprintf(line, sizeof(line), "Preset%ld=", i);
+    rb_str_cat2(ret, line);
+    rb_str_append(ret, eq->name == Qnil ? rb_str_new2("Preset") : eq->name);
+    rb_str_cat2(ret, "\n");
+  }
+
+  for (i = 0; i < RARRAY_LEN(presets); i++) {
+    eq = get_eq(rb_ary_entry(presets, i));
+    rb_str_cat2(ret, "\n[");
+    rb_str_append(ret, eq->name == Qnil ? rb_str_new2("Preset") : eq->name);
+    rb_str_cat2(ret, "]\n");
+
+    /* ruby leaves LC_NUMERIC alone, so this is always a '.' */
+    snprintf(line, sizeof(line), "Preamp=%g\n", eq->v[0]);
+    rb_str_cat2(ret, line);
+    for (j = 0; j < NUM_BANDS; j++) {
+      snprintf(line, sizeof(line), "Band%d=%g\n", j, eq->v[j + 1]);
+      rb_str_cat2(ret, line);
+    }
+  }
+
+  return ret;
+}
+
+static VALUE read_file(VALUE path) {
+  VALUE ret = rb_str_new(NULL, 0);
+  char buf[4096];
+  size_t len;
+  FILE *fh;
+
+  if ((fh = fopen(StringValueCStr(path), "rb")) == NULL)
+    rb_sys_fail(RSTRING_PTR(path));
+  while ((len = fread(buf, 1, sizeof(buf), fh)) > 0)
+    rb_str_cat(ret, buf, len);
+  if (ferror(fh)) {
+    int err = errno;
+    fclose(fh);
+    errno = err;
+    rb_sys_fail(RSTRING_PTR(path));
+  }
+  fclose(fh);
+
+  return ret;
+}
+
+static void write_file(VALUE path, VALUE data) {
+  FILE *fh;
+
+  if ((fh = fopen(StringValueCStr(path), "wb")) == NULL)
+    rb_sys_fail(RSTRING_PTR(path));
+  if (fwrite(RSTRING_PTR(data), 1, RSTRING_LEN(data), fh) != (size_t) RSTRING_LEN(data) ||
+      fclose(fh)) {
+    rb_sys_fail(RSTRING_PTR(path));
+  }
+}
+
+/* .eqf files are Winamp's; anything else is XMMS's format */
+static int is_eqf(VALUE path) {
+  long len = RSTRING_LEN(path);
+  const char *p = RSTRING_PTR(path);
+
+  return len >= 4 && p[len - 4] == '.' && tolower((unsigned char) p[len - 3]) == 'e' &&
+         tolower((unsigned char) p[len - 2]) == 'q' && tolower((unsigned char) p[len - 1]) == 'f';
+}
+
+/****************/
+/* RUBY METHODS */
+/****************/
+
+/*
+ * Create a new equalizer preset.  The preamp and bands default to 0.0
+ * (flat), and bands is an array of 10 values, as returned by
+ * Xmms::Remote#eq.
+ *
+ * This method raises an ArgumentError exception if the number of
+ * arguments isn't 0 to 3, or if there aren't 10 bands.
+ *
+ * Examples:
+ *   flat = Xmms::EqPreset.new
+ *   loud = Xmms::EqPreset.new(3.0, [6, 4, 2, 0, 0, 0, 0, 2, 4, 6], 'Loud')
+ *   current = Xmms::EqPreset.new(*remote.eq)
+ *
+ */
+static VALUE xre_init(int argc, VALUE *argv, VALUE self) {
+  xr_eq *eq = get_eq(self);
+  VALUE preamp, bands, name;
+
+  rb_scan_args(argc, argv, "03", &preamp, &bands, &name);
+  if (preamp != Qnil)
+    eq->v[0] = NUM2DBL(preamp);
+  if (bands != Qnil)
+    set_bands(eq, bands);
+  if (name != Qnil)
+    eq->name = rb_str_new4(StringValue(name));
+
+  return self;
+}
+
+static VALUE xre_init_copy(VALUE self, VALUE orig) {
+  xr_eq *eq = get_eq(self), *src = get_eq(orig);
+
+  if (self != orig) {
+    memcpy(eq->v, src->v, sizeof(eq->v));
+    eq->name = src->name;
+  }
+
+  return self;
+}
+
+/*
+ * Read the presets in a file.  Both Winamp EQF files (which start with
+ * "Winamp EQ library file") and XMMS preset files (such as
+ * ~/.xmms/eq.preset) are understood.  Returns an array of presets.
+ *
+ * This method raises a SystemCallError exception if the file can't be
+ * read.
+ *
+ * Example:
+ *   presets = Xmms::EqPreset.load(File.expand_path('~/.xmms/eq.preset'))
+ *   rock = presets.find { |p| p.name == 'Rock' }
+ *
+ */
+static VALUE xre_s_load(VALUE klass, VALUE path) {
+  VALUE data = read_file(path);
+
+  UNUSED(klass);
+  if (RSTRING_LEN(data) >= EQF_MAGIC_LEN && !memcmp(RSTRING_PTR(data), EQF_MAGIC, 27))
+    return eqf_load(RSTRING_PTR(data), RSTRING_LEN(data));
+  return xmms_load(RSTRING_PTR(data), RSTRING_LEN(data));
+}
+
+/*
+ * Write presets to a file: a Winamp EQF file if the name ends in
+ * ".eqf", or an XMMS preset file otherwise.  EQF files only hold 64
+ * steps per value, so values are rounded.
+ *
+ * This method raises a TypeError exception if presets contains
+ * something other than Xmms::EqPreset objects, or a SystemCallError
+ * exception if the file can't be written.
+ *
+ * Example:
+ *   Xmms::EqPreset.save('mine.eqf', [loud, flat])
+ *
+ */
+static VALUE xre_s_save(VALUE klass, VALUE path, VALUE presets) {
+  UNUSED(klass);
+  StringValue(path);
+  presets = rb_Array(presets);
+  write_file(path, is_eqf(path) ? eqf_save(presets) : xmms_save(presets));
+  return Qnil;
+}
+
+/*
+ * Write this preset to a file (see Xmms::EqPreset.save).
+ *
+ * Example:
+ *   loud.save('loud.eqf')
+ *
+ */
+static VALUE xre_save(VALUE self, VALUE path) {
+  return xre_s_save(cEqPreset, path, rb_ary_new3(1, self));
+}
+
+/*
+ * Get the preamp value.
+ *
+ * Example:
+ *   puts preset.preamp
+ *
+ */
+static VALUE xre_preamp(VALUE self) {
+  return rb_float_new(get_eq(self)->v[0]);
+}
+
+/*
+ * Set the preamp value.
+ *
+ * Example:
+ *   preset.preamp = 2.5
+ *
+ */
+static VALUE xre_set_preamp(VALUE self, VALUE val) {
+  get_eq(self)->v[0] = NUM2DBL(val);
+  return val;
+}
+
+/*
+ * Get the band values, as an array of 10 floats.
+ *
+ * Example:
+ *   bass = preset.bands.first
+ *
+ */
+static VALUE xre_bands(VALUE self) {
+  xr_eq *eq = get_eq(self);
+  VALUE ret = rb_ary_new2(NUM_BANDS);
+  int i;
+
+  for (i = 0; i < NUM_BANDS; i++)
+    rb_ary_push(ret, rb_float_new(eq->v[i + 1]));
+
+  return ret;
+}
+
+/*
+ * Set the band values from an array of 10 numbers.
+ *
+ * This method raises an ArgumentError exception if there aren't 10
+ * values.
+ *
+ * Example:
+ *   preset.bands = [0] * 10
+ *
+ */
+static VALUE xre_set_bands(VALUE self, VALUE bands) {
+  set_bands(get_eq(self), bands);
+  return bands;
+}
+
+/*
+ * Get a band value (bands are numbered 0 to 9).
+ *
+ * This method raises an ArgumentError exception if the band index is
+ * out of range.
+ *
+ * Example:
+ *   treble = preset[9]
+ *
+ */
+static VALUE xre_aref(VALUE self, VALUE band) {
+  return rb_float_new(get_eq(self)->v[band_index(band) + 1]);
+}
+
+/*
+ * Set a band value (bands are numbered 0 to 9).
+ *
+ * This method raises an ArgumentError exception if the band index is
+ * out of range.
+ *
+ * Example:
+ *   preset[0] = 6.0
+ *
+ */
+static VALUE xre_aset(VALUE self, VALUE band, VALUE val) {
+  get_eq(self)->v[band_index(band) + 1] = NUM2DBL(val);
+  return val;
+}
+
+/*
+ * Get the name of the preset (nil if it doesn't have one).
+ *
+ * Example:
+ *   puts preset.name
+ *
+ */
+static VALUE xre_name(VALUE self) {
+  return get_eq(self)->name;
+}
+
+/*
+ * Set the name of the preset.
+ *
+ * Example:
+ *   preset.name = 'Speech'
+ *
+ */
+static VALUE xre_set_name(VALUE self, VALUE name) {
+  get_eq(self)->name = (name == Qnil) ? Qnil : rb_str_new4(StringValue(name));
+  return name;
+}
+
+/*
+ * Get the preset as [preamp, bands], the same form as Xmms::Remote#eq.
+ *
+ * Example:
+ *   remote.set_eq(*preset.to_a)
+ *
+ */
+static VALUE xre_to_a(VALUE self) {
+  return rb_ary_new3(2, xre_preamp(self), xre_bands(self));
+}
+
+/*
+ * Do two presets have the same values?  Names aren't compared.
+ *
+ * Example:
+ *   puts 'flat' if preset == Xmms::EqPreset.new
+ *
+ */
+static VALUE xre_equal(VALUE self, VALUE other) {
+  if (!rb_obj_is_kind_of(other, cEqPreset))
+    return Qfalse;
+  return memcmp(get_eq(self)->v, get_eq(other)->v,
+                sizeof(gfloat) * (NUM_BANDS + 1)) ? Qfalse : Qtrue;
+}
+
+/*
+ * Blend two presets: returns a new preset t of the way from this one to
+ * other (t = 0.0 is this preset, 1.0 is other).  t isn't clamped.
+ *
+ * This method raises a TypeError exception if other isn't an
+ * Xmms::EqPreset.
+ *
+ * Example:
+ *   # crossfade over two seconds
+ *   0.upto(120) { |i| remote.apply_eq(a.lerp(b, i / 120.0)); sleep 1 / 60.0 }
+ *
+ */
+static VALUE xre_lerp(VALUE self, VALUE other, VALUE t) {
+  xr_eq *a = get_eq(self), *b = get_eq(other), *dst;
+  VALUE ret = eq_alloc(cEqPreset, &dst);
+
+  eq_lerp(dst->v, a->v, b->v, NUM2DBL(t));
+  return ret;
+}
+
+static VALUE xre_inspect(VALUE self) {
+  xr_eq *eq = get_eq(self);
+  VALUE ret = rb_str_new2("#<Xmms::EqPreset ");
+  char buf[32];
+  int i;
+
+  if (eq->name != Qnil) {
+    rb_str_append(ret, rb_inspect(eq->name));
+    rb_str_cat2(ret, " ");
+  }
+
+  snprintf(buf, sizeof(buf), "preamp=%g bands=[", eq->v[0]);
+  rb_str_cat2(ret, buf);
+  for (i = 0; i < NUM_BANDS; i++) {
+    snprintf(buf, sizeof(buf), "%s%g", i ? ", " : "", eq->v[i + 1]);
+    rb_str_cat2(ret, buf);
+  }
+  rb_str_cat2(ret, "]>");
+
+  return ret;
+}
+
+/******************/
+/* REMOTE METHODS */
+/******************/
+
+/*
+ * Forget the last preset applied through a remote (because its
+ * equalizer was changed some other way).
+ */
+void xr_eq_forget(VALUE self) {
+  xr_remote_get(self)->eq_known = 0;
+}
+
+/*
+ * Get the current equalizer settings as an Xmms::EqPreset.
+ *
+ * This method raises an Xmms::Error exception if XMMS is not running.
+ *
+ * Example:
+ *   saved = remote.eq_preset
+ *
+ */
+static VALUE xr_eq_preset(VALUE self) {
+  xr_cmd cmd;
+  VALUE ret, eq;
+
+  xr_cmd_init(&cmd, self, XR_CMD_GET_EQ);
+  eq = xr_call(self, &cmd);
+
+  ret = rb_class_new_instance(2, RARRAY_PTR(eq), cEqPreset);
+  return ret;
+}
+
+/*
+ * Apply an equalizer preset, with a single request to XMMS.  If the
+ * preset's values are the same as the last preset applied through this
+ * remote, nothing is sent, unless force is true.  (Changes made to the
+ * equalizer some other way, e.g. in XMMS itself, aren't noticed.)
+ *
+ * This method raises an Xmms::Error exception if XMMS is not running,
+ * or a TypeError exception if preset isn't an Xmms::EqPreset.
+ *
+ * Examples:
+ *   remote.apply_eq rock
+ *   remote.eq_preset = rock
+ *
+ */
+static VALUE xr_apply_eq(int argc, VALUE *argv, VALUE self) {
+  VALUE preset, force;
+  const gfloat *v;
+  unsigned int edits;
+  xr_remote *r;
+  xr_cmd cmd;
+
+  rb_scan_args(argc, argv, "11", &preset, &force);
+  v = xr_eq_values(preset);
+
+  r = xr_remote_get(self);
+  edits = xr_late_edits(r->session);
+  if (r->eq_known && r->eq_edits == edits && !RTEST(force) &&
+      !memcmp(r->eq, v, sizeof(gfloat) * (NUM_BANDS + 1)))
+    return self;
+
+  xr_cmd_init(&cmd, self, XR_CMD_SET_EQ);
+  memcpy(cmd.farg, v, sizeof(gfloat) * (NUM_BANDS + 1));
+  xr_call(self, &cmd);
+
+  /* not sent yet (it's for a scheduler cue, or a future) */
+  if (cmd.late)
+    return self;
+
+  /* remember what we sent (without holding on to the caller's preset,
+   * which they might change) */
+  memcpy(r->eq, v, sizeof(gfloat) * (NUM_BANDS + 1));
+  r->eq_edits = edits;
+  r->eq_known = 1;
+
+  return self;
+}
+
+void Init_xmms_eq(void) {
+  cEqPreset = rb_define_class_under(mXmms, "EqPreset", rb_cObject);
+  rb_define_alloc_func(cEqPreset, eq_alloc_func);
+  rb_define_method(cEqPreset, "initialize", xre_init, -1);
+  rb_define_method(cEqPreset, "initialize_copy", xre_init_copy, 1);
+
+  rb_define_singleton_method(cEqPreset, "load", xre_s_load, 1);
+  rb_define_singleton_method(cEqPreset, "save", xre_s_save, 2);
+  rb_define_method(cEqPreset, "save", xre_save, 1);
+
+  rb_define_method(cEqPreset, "preamp", xre_preamp, 0);
+  rb_define_method(cEqPreset, "preamp=", xre_set_preamp, 1);
+  rb_define_method(cEqPreset, "bands", xre_bands, 0);
+  rb_define_method(cEqPreset, "bands=", xre_set_bands, 1);
+  rb_define_method(cEqPreset, "[]", xre_aref, 1);
+  rb_define_method(cEqPreset, "[]=", xre_aset, 2);
+  rb_define_method(cEqPreset, "name", xre_name, 0);
+  rb_define_method(cEqPreset, "name=", xre_set_name, 1);
+  rb_define_method(cEqPreset, "to_a", xre_to_a, 0);
+  rb_define_method(cEqPreset, "==", xre_equal, 1);
+  rb_define_method(cEqPreset, "lerp", xre_lerp, 2);
+  rb_define_method(cEqPreset, "inspect", xre_inspect, 0);
+
+  rb_define_method(cRemote, "eq_preset", xr_eq_preset, 0);
+  rb_define_method(cRemote, "apply_eq", xr_apply_eq, -1);
+  rb_define_alias(cRemote, "eq_preset=", "apply_eq");
+}
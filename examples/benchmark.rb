@@ -0,0 +1,644 @@
+#!/usr/bin/env ruby
+
+########################################################################
+# benchmark.rb - time various Xmms-Ruby operations                     #
+#                                                                      #
+# Usage: benchmark.rb [test ...]                                       #
+# Runs every test if none are given.  Some tests modify the playlist,  #
+# so don't point this at a session you care about.                     #
+########################################################################
+
+require 'xmms'
+
+SESSION = (ENV['XMMS_SESSION'] || 0).to_i
+
+# time a block, returning the elapsed time in seconds
+def time
+  t = Time.now
+  yield
+  Time.now - t
+end
+
+# print a line of output for a test
+def report(test, str)
+  puts '%-10s %s' % [test, str]
+end
+
+TESTS = {}
+
+#
+# index: playlist index build time, memory use, and query latency
+# (compared with a linear scan of the playlist)
+#
+TESTS['index'] = proc do |r|
+  idx = nil
+  report 'index', 'build: %.3fs' % time { idx = r.index }
+  report 'index', 'entries: %d' % idx.length
+  report 'index', 'memory: %dk' % (idx.memsize / 1024)
+
+  queries = %w{the live remix a 01 mp3 zzzzzz}
+  n = 1000
+  secs = time { n.times { queries.each { |q| idx.lookup(q) } } }
+  report 'index', 'lookup: %.1fus/query' % (secs * 1_000_000 / (n * queries.size))
+
+  pl = nil
+  secs = time do
+    pl = r.playlist.map { |t, f, _| "#{t}\n#{f}".downcase }
+    queries.each { |q| pl.select { |s| s.include?(q) } }
+  end
+  report 'index', 'linear scan: %.3fs/query' % (secs / queries.size)
+end
+
+#
+# times: playlist duration aggregates (cold and cached) compared with
+# summing the full playlist in ruby
+#
+TESTS['times'] = proc do |r|
+  report 'times', 'ruby sum: %.3fs' % time { r.playlist.inject(0) { |s, e| s + e[2] } }
+  report 'times', 'total_time (cold): %.3fs' % time { Xmms::Remote.new(SESSION).total_time }
+  n = 100
+  secs = time { n.times { r.total_time; r.time_remaining } }
+  report 'times', 'total_time + time_remaining (cached): %.2fms' % (secs * 1000 / n)
+end
+
+#
+# dedupe: remove duplicates from a 50k entry playlist (20% duplicates),
+# natively and in ruby (NOTE: replaces the playlist)
+#
+TESTS['dedupe'] = proc do |r|
+  files = (0...40_000).map { |i| "/srv/music/artist#{i % 500}/album#{i % 40}/#{i}.mp3" }
+  files += (0...10_000).map { |i| files[(i * 7919) % files.size] }
+  files = files.sort_by { |f| f.hash }
+
+  r.add false, *files
+  report 'dedupe', 'dedupe!: %.3fs' % time { r.dedupe! }
+
+  r.add false, *files
+  secs = time do
+    seen = {}
+    dupes = []
+    r.playlist.each_with_index { |e, i| seen[e[1]] ? dupes << i : seen[e[1]] = true }
+    dupes.reverse_each { |i| r.delete i }
+  end
+  report 'dedupe', 'ruby: %.3fs' % secs
+end
+
+#
+# reorder: sort and shuffle the playlist in place, compared with
+# rebuilding it from scratch (NOTE: reorders the playlist)
+#
+TESTS['reorder'] = proc do |r|
+  n = r.playlist.size
+  moved = 0
+  secs = time { moved = r.shuffle!(1) }
+  report 'reorder', 'shuffle!: %.3fs, %d of %d entries moved' % [secs, moved, n]
+  secs = time { moved = r.sort!(:file) }
+  report 'reorder', 'sort!: %.3fs, %d of %d entries moved' % [secs, moved, n]
+  secs = time { moved = r.sort!(:file) }
+  report 'reorder', 'sort! (sorted): %.3fs, %d of %d entries moved' % [secs, moved, n]
+
+  secs = time do
+    files = r.playlist.map { |e| e[1] }.sort
+    r.add false, *files
+  end
+  report 'reorder', 'rebuild: %.3fs (%d entries re-added)' % [secs, n]
+end
+
+#
+# pipeline: many threads polling one remote, with and without the
+# pipelined I/O thread
+#
+TESTS['pipeline'] = proc do |r|
+  [1, 4, 16].each do |nthreads|
+    n = 2000 / nthreads
+    [false, true].each do |on|
+      r.pipeline = on
+      secs = time do
+        nthreads.times.map do
+          Thread.new { n.times { r.time; r.playing? } }
+        end.each { |th| th.join }
+      end
+      stats = on ? ' (%d sent, %d checks)' % r.pipeline_stats.values_at(:sent, :checks) : ''
+      report 'pipeline', '%2d threads, %s: %.1fus/call%s' % [
+        nthreads, on ? 'pipelined' : 'direct', secs * 1_000_000 / (2 * n * nthreads), stats
+      ]
+      r.pipeline = false
+    end
+  end
+end
+
+#
+# async: one status refresh (8 requests), sent one at a time and as a
+# batch of futures
+#
+TESTS['async'] = proc do |r|
+  n = 200
+  secs = time do
+    n.times do
+      [r.playlist_pos, r.time, r.main_volume, r.playing?, r.paused?,
+       r.playlist_file, r.playlist_title, r.is_shuffle?]
+    end
+  end
+  report 'async', 'serial: %.2fms/refresh' % (secs * 1000 / n)
+
+  secs = time do
+    n.times do
+      Xmms::Future.all(
+        r.playlist_pos_async, r.time_async, r.main_volume_async,
+        r.playing_async, r.paused_async, r.playlist_file_async,
+        r.playlist_title_async, r.is_shuffle_async
+      ).value
+    end
+  end
+  report 'async', 'futures: %.2fms/refresh' % (secs * 1000 / n)
+  r.pipeline = false
+end
+
+#
+# pool: 8 threads each making short "requests" (two commands), with a
+# new remote per request and with a shared Xmms::Pool
+#
+TESTS['pool'] = proc do |r|
+  nthreads, n = 8, 250
+  run = proc do |&blk|
+    time { nthreads.times.map { Thread.new { n.times(&blk) } }.each { |th| th.join } }
+  end
+
+  secs = run.call { x = Xmms::Remote.new(SESSION); x.time; x.playlist_pos }
+  report 'pool', 'new remote per request: %.1fus/request' % (secs * 1_000_000 / (nthreads * n))
+
+  pool = Xmms::Pool.new(SESSION, :size => nthreads)
+  secs = run.call { pool.with { |x| x.time; x.playlist_pos } }
+  report 'pool', 'pool: %.1fus/request (%d health checks)' % [
+    secs * 1_000_000 / (nthreads * n), pool.stats[:health_checks]
+  ]
+end
+
+#
+# fork: forked workers sharing a pipelined remote (and a pool) created
+# by the parent, while a parent thread keeps the remote busy
+#
+TESTS['fork'] = proc do |r|
+  nprocs, n = 4, 1000
+  r.pipeline = true
+  pool = Xmms::Pool.new(SESSION, :size => 2, :pipeline => true)
+  busy = Thread.new { loop { r.time } }
+
+  rd, wr = IO.pipe
+  secs = time do
+    nprocs.times do
+      fork do
+        rd.close
+        errors = 0
+        n.times do |i|
+          begin
+            i.even? ? r.time : pool.with { |x| x.time }
+          rescue Xmms::Error
+            errors += 1
+          end
+        end
+        wr.puts errors
+        exit! 0
+      end
+    end
+    wr.close
+    Process.waitall
+  end
+  busy.kill
+
+  errors = rd.read.split.map { |s| s.to_i }
+  report 'fork', '%d workers: %d calls/sec, %d errors, %d exited early' % [
+    nprocs, nprocs * n / secs, errors.inject(0) { |a, b| a + b },
+    nprocs - errors.size
+  ]
+  r.pipeline = false
+end
+
+#
+# sessions: finding the running copies of XMMS, one session at a time
+# vs. Xmms.sessions
+#
+TESTS['sessions'] = proc do |r|
+  max = 64
+  secs = time { (0...max).select { |i| Xmms::Remote.new(i).running? } }
+  report 'sessions', 'serial probe of %d sessions: %.2fms' % [max, secs * 1000]
+
+  found = nil
+  secs = time { found = Xmms.sessions(:max => max) }
+  report 'sessions', 'Xmms.sessions: %.2fms (%d running)' % [secs * 1000, found.size]
+end
+
+#
+# strings: fetch a playlist of long paths, reporting the bytes copied
+# into ruby strings and memory use across repeated fetches (NOTE:
+# replaces the playlist)
+#
+TESTS['strings'] = proc do |r|
+  n, reps = 20_000, 5
+  dir = '/srv/music/' + (1..8).map { |i| "some long directory name #{i}" }.join('/')
+  r.add false, *(0...n).map { |i| "#{dir}/#{i} - a fairly long track title.mp3" }
+
+  # resident and peak memory, in kilobytes (linux only)
+  mem = proc do
+    s = File.read('/proc/self/status') rescue ''
+    %w{VmRSS VmHWM}.map { |k| s[/^#{k}:\s+(\d+)/, 1].to_i }
+  end
+
+  GC.start
+  rss0, = mem.call
+  bytes = 0
+  secs = time do
+    reps.times do
+      r.playlist.each { |t, f, _| bytes += t.bytesize + f.bytesize }
+      GC.start
+    end
+  end
+  rss, peak = mem.call
+
+  report 'strings', 'playlist: %.3fs/fetch, %.1fMB copied/fetch' % [secs / reps, bytes / reps / 1048576.0]
+  report 'strings', 'rss growth over %d fetches: %dk (peak %dk)' % [reps, rss - rss0, peak]
+  report 'strings', 'encodings: %s' % r.playlist_file(0).encoding
+end
+
+#
+# snapshot: memory use of a snapshot's prefix-compressed paths compared
+# with the same paths as ruby strings, and directory queries (NOTE:
+# replaces the playlist)
+#
+TESTS['snapshot'] = proc do |r|
+  files = (0...50_000).map do |i|
+    '/srv/music/Artist %d/Album %d (%d)/%02d - Track number %d.mp3' % [
+      i / 120, i / 12, 1970 + i / 1000, i % 12 + 1, i
+    ]
+  end
+  r.add false, *files
+
+  snap = nil
+  report 'snapshot', 'fetch: %.3fs' % time { snap = r.snapshot(:file) }
+
+  # a ruby string costs its bytes plus an object slot (40 bytes on
+  # 64-bit rubies); ask ruby if it can tell us
+  begin
+    require 'objspace'
+    strs = files.inject(0) { |sum, f| sum + ObjectSpace.memsize_of(f) }
+  rescue LoadError, NoMethodError
+    strs = files.inject(0) { |sum, f| sum + f.bytesize + 1 + 40 }
+  end
+  report 'snapshot', 'paths: %dk as strings, %dk in the snapshot (%.1fx smaller)' % [
+    strs / 1024, snap.memsize / 1024, strs.to_f / snap.memsize
+  ]
+
+  dir, n = '/srv/music/Artist 100', 100
+  secs = time { n.times { snap.under(dir) } }
+  report 'snapshot', 'under: %.1fus/query' % (secs * 1_000_000 / n)
+  secs = time { n.times { files.each_index.select { |i| files[i].start_with?(dir + '/') } } }
+  report 'snapshot', 'ruby scan: %.1fus/query' % (secs * 1_000_000 / n)
+end
+
+#
+# eq: cost of one frame of a 60Hz equalizer crossfade, blending in ruby
+# and calling set_eq vs. EqPreset#lerp and apply_eq, and applying a
+# preset that's already set (NOTE: changes the equalizer)
+#
+TESTS['eq'] = proc do |r|
+  a = Xmms::EqPreset.new(3.0, [6, 4, 2, 0, 0, 0, 0, 2, 4, 6])
+  b = Xmms::EqPreset.new(-2.0, [-4, -2, 0, 2, 4, 4, 2, 0, -2, -4])
+  pa, ba = a.to_a
+  pb, bb = b.to_a
+  n = 1200
+
+  secs = time do
+    n.times do |i|
+      t = (i % 121) / 120.0
+      r.set_eq pa + (pb - pa) * t, ba.zip(bb).map { |x, y| x + (y - x) * t }
+    end
+  end
+  report 'eq', 'ruby blend + set_eq: %.1fus/frame' % (secs * 1_000_000 / n)
+
+  secs = time { n.times { |i| r.apply_eq a.lerp(b, (i % 121) / 120.0) } }
+  report 'eq', 'lerp + apply_eq: %.1fus/frame' % (secs * 1_000_000 / n)
+
+  secs = time { n.times { a.lerp(b, 0.5) } }
+  report 'eq', 'lerp alone: %.2fus' % (secs * 1_000_000 / n)
+
+  secs = time { n.times { r.apply_eq b } }
+  report 'eq', 'apply_eq (unchanged): %.2fus' % (secs * 1_000_000 / n)
+end
+
+#
+# autoeq: AutoEq rule matching vs. File.fnmatch in ruby, and how long
+# after a track change the preset lands (NOTE: changes the playlist
+# position and the equalizer)
+#
+TESTS['autoeq'] = proc do |r|
+  flat, loud = Xmms::EqPreset.new, Xmms::EqPreset.new(3.0, [6] * 10)
+  globs = (0...20).map { |i| "/srv/music/Genre #{i}/**" } + ['*.ogg']
+  auto = Xmms::AutoEq.new(r, :interval => 0.002)
+  globs.each { |g| auto.rule g, loud }
+  auto.default = flat
+
+  path, n = '/srv/music/Genre 19/Artist/Album/01 - Track.mp3', 10_000
+  secs = time { n.times { auto.match(path) } }
+  report 'autoeq', 'match: %.2fus' % (secs * 1_000_000 / n)
+  secs = time { n.times { globs.find { |g| File.fnmatch(g, path, File::FNM_PATHNAME) } } }
+  report 'autoeq', 'ruby fnmatch: %.2fus' % (secs * 1_000_000 / n)
+
+  r.add false, '/srv/music/Genre 3/a.mp3', '/srv/music/other/b.mp3' if r.playlist_length < 2
+  auto.start
+  lat = (0...20).map do |i|
+    r.set_playlist_pos i % 2
+    want = auto.match(r.playlist_file(i % 2))
+    time { sleep 0.0005 until r.eq_preset == want }
+  end
+  auto.stop
+  report 'autoeq', 'reaction: %.1fms avg, %.1fms max' % [
+    lat.inject(0) { |a, t| a + t } * 1000 / lat.size, lat.max * 1000
+  ]
+end
+
+#
+# clock: Remote#time vs. reading a PositionClock, and how far the clock
+# is from Remote#time over two seconds of 30Hz reads (best run while
+# XMMS is playing)
+#
+TESTS['clock'] = proc do |r|
+  clock, n = r.position_clock, 2000
+
+  secs = time { n.times { r.time } }
+  report 'clock', 'remote.time: %.2fus' % (secs * 1_000_000 / n)
+  secs = time { n.times { clock.time } }
+  report 'clock', 'clock.time: %.2fus' % (secs * 1_000_000 / n)
+
+  errs = (0...60).map do
+    sleep 1 / 30.0
+    (clock.time - r.time).abs
+  end
+  report 'clock', 'error: %.1fms avg, %dms max' % [
+    errs.inject(0) { |a, e| a + e } / errs.size.to_f, errs.max
+  ]
+  report 'clock', 'stats: %p' % [clock.stats]
+  clock.stop
+end
+
+#
+# sched: how late 50 cues 20ms apart run from a ruby sleep loop vs. an
+# Xmms::Scheduler, while another thread churns the GC (NOTE: changes
+# the balance)
+#
+TESTS['sched'] = proc do |r|
+  n, gap = 50, 0.02
+  churn = Thread.new { loop { (0...20_000).map { |i| "x#{i}" } } }
+
+  t0 = Time.now + 0.1
+  late = (0...n).map do |i|
+    due = t0 + i * gap
+    d = due - Time.now
+    sleep d if d > 0
+    l = Time.now - due
+    r.set_balance 0
+    l
+  end
+  report 'sched', 'sleep loop: %.2fms avg, %.2fms max late' % [
+    late.inject(0) { |a, l| a + l } * 1000 / n, late.max * 1000
+  ]
+
+  s = Xmms::Scheduler.new(r)
+  t0 = Time.now + 0.1
+  n.times { |i| s.at(t0 + i * gap) { |x| x.set_balance 0 } }
+  s.start
+  sleep 0.1 + n * gap + 0.05
+  st = s.stats
+  report 'sched', 'scheduler: %.2fms avg, %.2fms max late' % [st[:avg_late], st[:max_late]]
+  s.stop
+  churn.kill
+end
+
+#
+# prefetch: reading the next entry's title, file and length near the end
+# of a song, with and without a prefetcher (NOTE: changes the playlist
+# position, and needs a few entries in the playlist)
+#
+TESTS['prefetch'] = proc do |r|
+  n = [r.playlist_length - 1, 20].min
+  if n < 1
+    report 'prefetch', 'skipped (playlist too short)'
+    next
+  end
+  r.play unless r.playing?
+
+  read = proc do |pf|
+    (0...n).inject(0) do |sum, i|
+      r.set_playlist_pos i
+      r.jump_to_time [r.playlist_time(i) - 2000, 0].max
+      sleep 0.05 if pf
+      sum + time { r.title(i + 1); r.file(i + 1); r.playlist_time(i + 1) }
+    end
+  end
+
+  report 'prefetch', 'without: %.1fus/track' % (read.call(false) * 1_000_000 / n)
+  pf = r.prefetch(:interval => 0.01)
+  report 'prefetch', 'with: %.1fus/track' % (read.call(true) * 1_000_000 / n)
+  report 'prefetch', 'stats: %p' % [pf.stats]
+  r.stop_prefetch
+end
+
+#
+# crossfade: a two second crossfade from this session to the next one,
+# from a ruby loop vs. Xmms.crossfade: update rate, and the skew between
+# the two decks' writes (NOTE: needs a second XMMS session; changes the
+# volume and playing state of both)
+#
+TESTS['crossfade'] = proc do |r|
+  b = Xmms::Remote.new(SESSION + 1)
+  unless b.running?
+    report 'crossfade', 'skipped (no session %d)' % (SESSION + 1)
+    next
+  end
+  vol, over, rate = r.main_volume, 2.0, 50
+
+  r.play
+  steps, skews, t0 = 0, [], Time.now
+  while (t = (Time.now - t0) / over) < 1
+    r.set_main_volume((vol * Math.cos(t * Math::PI / 2)).round)
+    # B's write lands this long after A's
+    skews << time { b.set_main_volume((vol * Math.sin(t * Math::PI / 2)).round) }
+    steps += 1
+    sleep 1.0 / rate
+  end
+  report 'crossfade', 'ruby loop: %.1f updates/s, %.2fms avg skew, %.2fms max' % [
+    steps / (Time.now - t0), skews.inject(0) { |s, k| s + k } * 1000 / steps, skews.max * 1000
+  ]
+
+  r.set_main_volume vol
+  st = Xmms.crossfade(:from => r, :to => b, :over => over, :rate => rate)
+  report 'crossfade', 'native: %.1f updates/s, %.2fms avg skew, %.2fms max' % [
+    st[:rate], st[:skew], st[:max_skew]
+  ]
+  Xmms.crossfade(:from => b, :to => r, :over => 0.1)
+end
+
+#
+# history: appending plays to a history journal (in a scratch file), and
+# querying an hour of plays out of a year's worth
+#
+TESTS['history'] = proc do |r|
+  path = File.join(ENV['TMPDIR'] || '/tmp', 'xmms-bench-%d.hist' % $$)
+  h, n, t0 = Xmms::History.new(path), 100_000, Time.now - 365 * 86400
+  files = (0...2000).map { |i| '/srv/music/artist%d/track%d.mp3' % [i / 10, i] }
+
+  t = time { n.times { |i| h.append(files[i % files.size], t0 + i * 300, 240.0, i) } }
+  report 'history', '%d appends: %.2fus each (%.2fus native), %d bytes' % [
+    n, t * 1e6 / n, h.stats[:append_us], h.stats[:bytes]
+  ]
+
+  mid = t0 + n * 150
+  t = time { 1000.times { h.between(mid, mid + 3600) } }
+  report 'history', 'range query (12 of %d plays): %.2fus' % [n, t * 1e6 / 1000]
+
+  h.close
+  File.delete(path)
+end
+
+#
+# proxy: 32 threads polling status and the current entry, straight to
+# XMMS and through an Xmms::Proxy
+#
+TESTS['proxy'] = proc do |r|
+  poll = proc do |remote|
+    (0...32).map do
+      Thread.new do
+        50.times { remote.playing?; remote.output_time; remote.playlist_title(remote.playlist_pos) }
+      end
+    end.each { |t| t.join }
+  end
+
+  report 'proxy', 'direct: %.3fs' % time { poll.call(r) }
+
+  proxy = Xmms::Proxy.new(r)
+  report 'proxy', 'proxied: %.3fs' % time { poll.call(Xmms::Remote.new(proxy.session)) }
+  s = proxy.stats
+  report 'proxy', '%d requests, %d cached, %d merged, %d sent to XMMS' % [
+    s[:requests], s[:hits], s[:merged], s[:upstream]
+  ]
+  proxy.stop
+end
+
+#
+# flight: bursts of 20 threads reading the output time and the whole
+# playlist at once, with and without single-flight reads
+#
+TESTS['flight'] = proc do |r|
+  burst = proc do |n, &b|
+    time { (0...n).map { Thread.new(&b) }.each { |t| t.join } }
+  end
+
+  [false, true].each do |on|
+    r.single_flight = on ? [:time, :playlist] : false
+    before = Xmms.single_flight_stats
+    t = burst.call(20) { 50.times { r.time } }
+    pl = burst.call(20) { r.playlist }
+    after = Xmms.single_flight_stats
+    report 'flight', '%-3s: time %.3fs, playlist %.3fs, %d fetches shared' % [
+      on ? 'on' : 'off', t, pl, after[:joined] - before[:joined]
+    ]
+  end
+  r.single_flight = false
+end
+
+#
+# http: /status over keep-alive connections from an Xmms::HTTPServer,
+# compared with building the same status with Xmms::Remote calls (what
+# a ruby web app would do per request)
+#
+TESTS['http'] = proc do |r|
+  require 'net/http'
+  n = 2000
+
+  t = time do
+    n.times do
+      [r.playing?, r.paused?, r.playlist_pos, r.time, r.main_volume,
+       r.playlist_title(r.playlist_pos), r.playlist_file(r.playlist_pos)]
+    end
+  end
+  report 'http', 'ruby status: %.0f/s' % (n / t)
+
+  server = Xmms::HTTPServer.new(r, :port => 0)
+  sleep 0.5
+  t = time do
+    (0...4).map do
+      Thread.new do
+        Net::HTTP.start('127.0.0.1', server.port) { |h| (n / 4).times { h.get('/status') } }
+      end
+    end.each { |th| th.join }
+  end
+  report 'http', 'server /status: %.0f/s (%d polls of XMMS)' % [n / t, server.stats[:refreshes]]
+  server.stop
+end
+
+#
+# ractor: a worker per running session (SESSION and up), each fetching
+# its playlist and scanning the titles; threads share one interpreter
+# lock, Ractors run in parallel
+#
+def scan_titles(session, n)
+  x = Xmms::Remote.new(session)
+  n.times.inject(0) do |hits, i|
+    hits + x.playlist.count { |e| e[0].downcase.include?('e') } + (x.playing? ? 1 : 0)
+  end
+end
+
+TESTS['ractor'] = proc do |r|
+  unless defined?(Ractor)
+    report 'ractor', 'skipped (no Ractor in this ruby)'
+    next
+  end
+  require 'etc'
+  sessions = (SESSION...SESSION + 4).select { |s| Xmms::Remote.new(s).running? }
+  n = 20
+
+  t = time { sessions.map { |s| Thread.new { scan_titles(s, n) } }.each { |th| th.join } }
+  report 'ractor', '%d sessions, threads: %.0f fetches/s' % [sessions.size, sessions.size * n / t]
+
+  t = time { sessions.map { |s| Ractor.new(s, n) { |s, n| scan_titles(s, n) } }.each { |rc| rc.take } }
+  report 'ractor', '%d sessions, ractors: %.0f fetches/s (%d cpus)' % [
+    sessions.size, sessions.size * n / t, Etc.nprocessors
+  ]
+end
+
+#
+# trace: what capturing a trace costs per command, how big the records
+# are, and replaying it (as fast as possible, plain and pipelined)
+#
+TESTS['trace'] = proc do |r|
+  require 'tmpdir'
+  path = File.join(Dir.tmpdir, "xmms-bench-#{$$}.trace")
+  n = 20000
+  poll = proc { n.times { r.time; r.playing? } }
+
+  begin
+    off = time(&poll)
+    on = time { Xmms::Trace.capture(path, &poll) }
+    report 'trace', 'capture: %.2fus/command overhead, %.1f bytes/command' % [
+      (on - off) * 1e6 / (2 * n), File.size(path).to_f / (2 * n)
+    ]
+
+    [false, true].each do |pipelined|
+      x = Xmms::Remote.new(SESSION)
+      x.pipeline = true if pipelined
+      s = Xmms::Trace.replay(path, x, :speed => :max, :reads_only => true)
+      report 'trace', 'replay %-9s: %.0f commands/s, p50 %.3fms, p99 %.3fms' % [
+        pipelined ? 'pipelined' : 'direct', s[:requests] / s[:elapsed],
+        s[:latency][:p50], s[:latency][:p99]
+      ]
+    end
+  ensure
+    File.unlink(path) rescue nil
+  end
+end
+
+r = Xmms::Remote.new(SESSION)
+tests = ARGV.empty? ? TESTS.keys : ARGV
+tests.each do |test|
+  raise "unknown test: #{test}" unless TESTS[test]
+  TESTS[test].call(r)
+end
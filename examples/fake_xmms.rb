@@ -0,0 +1,258 @@
+#!/usr/bin/env ruby
+
+########################################################################
+# fake_xmms.rb - a stand-in XMMS for benchmarks and build training     #
+#                                                                      #
+# Usage: fake_xmms.rb [-s N | -p PATH]                                 #
+# Answers the XMMS control protocol on a session's socket, keeping a   #
+# playlist, playback clock, volume and equalizer in memory.  Nothing   #
+# is played, and there's no window.  extconf.rb --with-pgo trains its  #
+# build against one of these.                                          #
+########################################################################
+
+require 'etc'
+require 'optparse'
+require 'socket'
+
+class FakeXmms
+  # requests, in protocol order (see xmms/controlsocket.h)
+  CMDS = %w{
+    get_version playlist_add play pause stop is_playing is_paused
+    get_playlist_pos set_playlist_pos get_playlist_length playlist_clear
+    get_output_time jump_to_time get_volume set_volume get_skin set_skin
+    get_playlist_file get_playlist_title get_playlist_time get_info
+    get_eq_data set_eq_data pl_win_toggle eq_win_toggle show_prefs_box
+    toggle_aot show_about_box eject playlist_prev playlist_next ping
+    get_balance toggle_repeat toggle_shuffle main_win_toggle
+    playlist_add_url_string is_eq_win is_pl_win is_main_win
+    playlist_delete is_repeat is_shuffle get_eq get_eq_preamp get_eq_band
+    set_eq set_eq_preamp set_eq_band quit playlist_ins_url_string
+    playlist_ins play_pause
+  }.map { |c| c.to_sym }
+
+  PROTOCOL_VERSION = 1
+
+  # how many sessions to try when picking a free one
+  MAX_SEARCH = 64
+
+  Entry = Struct.new(:file, :title, :time)
+
+  attr_reader :path, :session
+
+  #
+  # Listen as the given session, or the first free one (or on the
+  # given socket path).
+  #
+  def initialize(session = nil, path = nil)
+    @list, @pos = [], 0
+    @playing, @paused, @started, @paused_at = false, false, 0, 0
+    @volume, @balance, @skin = [100, 100], 0, ''
+    @repeat = @shuffle = false
+    @eq = [0.0] * 11
+
+    if path
+      @session, @path = nil, path
+      @server = listen(path)
+    else
+      (session ? [session] : (0...MAX_SEARCH)).each do |s|
+        if (@server = listen(session_path(s)))
+          @session, @path = s, session_path(s)
+          break
+        end
+      end
+      raise "no free session to listen as" unless @server
+    end
+  end
+
+  #
+  # Answer requests (one per connection, like XMMS) until stopped or
+  # sent a quit.
+  #
+  def run
+    until @stop
+      begin
+        client = @server.accept
+      rescue IOError, Errno::EBADF
+        break
+      end
+      begin
+        serve(client)
+      rescue SystemCallError, IOError
+      ensure
+        client.close
+      end
+    end
+  ensure
+    close
+  end
+
+  # stop answering (from another thread)
+  def stop
+    @stop = true
+    close
+  end
+
+  private
+
+  def session_path(s)
+    tmp = ENV['TMPDIR']
+    tmp = '/tmp' if !tmp || tmp.empty?
+    File.join(tmp, 'xmms_%s.%d' % [Etc.getpwuid.name, s])
+  end
+
+  # listen on path, unless something's already answering there
+  def listen(path)
+    if File.exist?(path)
+      begin
+        UNIXSocket.new(path).close
+        return nil
+      rescue SystemCallError
+        File.unlink(path)
+      end
+    end
+    UNIXServer.new(path)
+  end
+
+  def close
+    return unless @server && !@server.closed?
+    @server.close
+    File.unlink(@path) rescue nil
+  end
+
+  def serve(client)
+    head = client.read(8) or return
+    _, cmd, len = head.unpack('SSL')
+    data = len > 0 ? client.read(len).to_s : ''
+
+    ret = handle(CMDS[cmd], data)
+    client.write(packet(ret)) if ret
+    client.write(packet(''))        # the acknowledgement
+  end
+
+  # server packet: version, (padding,) length, data
+  def packet(data)
+    [PROTOCOL_VERSION, data.bytesize].pack('Sx2L') + data
+  end
+
+  def int(*v);    v.map { |x| x ? (x == true ? 1 : x) : 0 }.pack('l*'); end
+  def float(*v);  v.pack('f*'); end
+  def str(s);     s ? s + "\0" : ''; end
+
+  def now_ms
+    (Process.clock_gettime(Process::CLOCK_MONOTONIC) * 1000).to_i
+  end
+
+  def output_time
+    !@playing ? 0 : @paused ? @paused_at : now_ms - @started
+  end
+
+  def entry(i)
+    i >= 0 ? @list[i] : nil
+  end
+
+  def add(file, at = nil)
+    e = Entry.new(file, File.basename(file, '.*'), file.sum(16) * 1000 % 300_000 + 60_000)
+    at = @list.size if !at || at < 0 || at > @list.size
+    @list.insert(at, e)
+    @pos += 1 if at <= @pos && @list.size > 1
+  end
+
+  def jump(pos)
+    return unless pos >= 0 && pos < @list.size
+    @pos, @started, @paused_at = pos, now_ms, 0
+  end
+
+  def handle(cmd, data)
+    a = (data + "\0" * 8).unpack('l2')
+    case cmd
+    when :get_version         then int(0x1002)
+    when :playlist_add
+      at = 0
+      while at + 4 <= data.bytesize && (n = data[at, 4].unpack('L')[0]) > 0
+        add(data[at + 4, n].unpack('Z*')[0])
+        at += 4 + (n + 3) / 4 * 4
+      end
+      nil
+    when :playlist_add_url_string then add(data.unpack('Z*')[0]); nil
+    when :playlist_ins_url_string then add(data[4..-1].unpack('Z*')[0], a[0]); nil
+    when :playlist_delete
+      if a[0] >= 0 && a[0] < @list.size
+        @list.delete_at(a[0])
+        @pos -= 1 if a[0] < @pos
+        @pos = [@pos, [@list.size - 1, 0].max].min
+      end
+      nil
+    when :playlist_clear      then @list, @pos = [], 0; nil
+    when :get_playlist_length then int(@list.size)
+    when :get_playlist_pos    then int(@pos)
+    when :set_playlist_pos    then jump(a[0]); nil
+    when :playlist_prev       then jump(@pos - 1); nil
+    when :playlist_next       then jump(@pos + 1); nil
+    when :get_playlist_file   then str(entry(a[0]) && entry(a[0]).file)
+    when :get_playlist_title  then str(entry(a[0]) && entry(a[0]).title)
+    when :get_playlist_time   then int(entry(a[0]) ? entry(a[0]).time : 0)
+    when :play
+      @started, @paused_at = now_ms, 0 unless @playing
+      @playing, @paused = true, false
+      nil
+    when :pause
+      if @playing && @paused
+        @started, @paused = now_ms - @paused_at, false
+      elsif @playing
+        @paused_at, @paused = output_time, true
+      end
+      nil
+    when :play_pause          then handle(@playing ? :pause : :play, '')
+    when :stop                then @playing = @paused = false; nil
+    when :is_playing          then int(@playing)
+    when :is_paused           then int(@paused)
+    when :get_output_time     then int(output_time)
+    when :jump_to_time        then @started, @paused_at = now_ms - a[0], a[0]; nil
+    when :get_info            then int(128_000, 44_100, 2)
+    when :get_volume          then int(*@volume)
+    when :set_volume          then @volume = a; nil
+    when :get_balance         then int(@balance)
+    when :get_skin            then str(@skin)
+    when :set_skin            then @skin = data.unpack('Z*')[0]; nil
+    when :toggle_repeat       then @repeat = !@repeat; nil
+    when :toggle_shuffle      then @shuffle = !@shuffle; nil
+    when :is_repeat           then int(@repeat)
+    when :is_shuffle          then int(@shuffle)
+    when :is_main_win, :is_pl_win, :is_eq_win then int(true)
+    when :get_eq              then float(*@eq)
+    when :get_eq_preamp       then float(@eq[0])
+    when :get_eq_band         then float(a[0] >= 0 && @eq[a[0] + 1] || 0.0)
+    when :set_eq              then @eq = data.unpack('f11'); nil
+    when :set_eq_preamp       then @eq[0] = data.unpack('f')[0]; nil
+    when :set_eq_band
+      @eq[a[0] + 1] = data[4, 4].unpack('f')[0] if a[0] >= 0 && a[0] < 10
+      nil
+    when :quit                then @stop = true; nil
+    end
+  end
+end
+
+if __FILE__ == $0
+  session, path = nil, nil
+
+  OptionParser.new do |o|
+    o.banner = 'Usage: fake_xmms.rb [options]'
+    o.on('-s', '--session N', Integer, 'session to listen as (default: first free)') { |v| session = v }
+    o.on('-p', '--path PATH', 'socket path to listen on instead') { |v| path = v }
+    o.on_tail('-h', '--help', 'show this message') { puts o; exit }
+  end.parse!
+
+  begin
+    xmms = FakeXmms.new(session, path)
+  rescue RuntimeError, SystemCallError => e
+    $stderr.puts "fake_xmms.rb: #{e.message}"
+    exit 1
+  end
+
+  at_exit { xmms.stop }
+  %w{INT TERM HUP}.each { |sig| trap(sig) { exit } }
+
+  puts xmms.session ? "session #{xmms.session} (#{xmms.path})" : "listening on #{xmms.path}"
+  $stdout.flush
+  xmms.run
+end
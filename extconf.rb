@@ -1,10 +1,147 @@
 require 'mkmf'
+require 'fileutils'
 
 xmms_config = with_config("xmms-config", "xmms-config")
 
 $CFLAGS << ' ' << `#{xmms_config} --cflags`.chomp
 $LDFLAGS << ' ' << `#{xmms_config} --libs`.chomp
 
-have_library("xmms", "xmms_remote_get_version") and
-  create_makefile("xmms")
+# optional ruby features (checked for, not required)
+have_header("ruby/thread.h") and
+  have_func("rb_thread_call_without_gvl", "ruby/thread.h")
+have_func("rb_thread_check_ints")
+have_header("ruby/encoding.h")
+have_func("rb_ext_ractor_safe", "ruby.h")
+have_func("rb_gc_mark_movable", "ruby.h")
 
+# pipelined mode runs a native I/O thread
+have_library("pthread", "pthread_create")
+
+# Xmms.watch_sessions
+have_header("sys/inotify.h")
+
+#
+# Optimized builds (both off by default):
+#
+#   --enable-lto        compile and link with link-time optimization
+#   --with-pgo[=TESTS]  profile-guided optimization: build an
+#                       instrumented copy first, train it by running
+#                       examples/benchmark.rb TESTS (comma-separated;
+#                       "bench" means PGO_TESTS) against a fake XMMS
+#                       (examples/fake_xmms.rb), then build with the
+#                       profile, reporting how much faster it runs
+#
+# The training builds and their logs go in pgo/, next to the Makefile.
+#
+PGO_TESTS = %w{snapshot pool eq}
+PGO_GEN = '-fprofile-generate -fprofile-update=atomic'
+PGO_USE = '-fprofile-use -fprofile-correction -Wno-missing-profile'
+
+# how many times to time each build
+PGO_RUNS = 3
+
+def try_flags(flags)
+  checking_for("whether #{flags} is accepted") do
+    try_link(MAIN_DOES_NOTHING, flags)
+  end
+end
+
+#
+# Build a copy of the extension with the given PGO_FLAGS, and move it to
+# dir.  It's built here rather than in dir, since the profile is keyed
+# on the source paths as the compiler was given them.
+#
+def pgo_make(dir, flags)
+  make = ENV['MAKE'] || 'make'
+  log = [File.join('pgo', 'make.log'), 'a']
+
+  FileUtils.mkdir_p(dir)
+  ok = system(make, "PGO_FLAGS=#{flags}", [:out, :err] => log)
+  FileUtils.cp("xmms.#{CONFIG['DLEXT']}", dir) if ok
+  system(make, 'clean', [:out, :err] => log)
+  ok
+end
+
+# run the training workload against the copy in dir; returns the CPU
+# time it took (in seconds), or nil if it failed
+def pgo_run(dir, tests)
+  examples = File.join(File.expand_path($srcdir), 'examples')
+  xmms = IO.popen([RbConfig.ruby, File.join(examples, 'fake_xmms.rb')])
+  session = xmms.gets.to_s[/^session (\d+)/, 1] or return nil
+
+  before = Process.times
+  ok = system({ 'XMMS_SESSION' => session },
+              RbConfig.ruby, '-I', dir, File.join(examples, 'benchmark.rb'), *tests,
+              [:out, :err] => [File.join('pgo', 'train.log'), 'a'])
+  after = Process.times
+
+  ok ? after.cutime + after.cstime - before.cutime - before.cstime : nil
+ensure
+  if xmms
+    Process.kill('TERM', xmms.pid) rescue nil
+    xmms.close
+  end
+end
+
+#
+# Train a profile, leaving it where the final build will find it (next
+# to the objects).  Returns false if anything went wrong.
+#
+def pgo_train(tests)
+  message "training with: benchmark.rb #{tests.join(' ')}\n"
+  FileUtils.rm_rf('pgo')
+  FileUtils.rm_f(Dir['*.gcda'])
+  return false unless pgo_make('pgo/gen', PGO_GEN) && pgo_run('pgo/gen', tests)
+  return false if Dir['*.gcda'].empty?
+
+  # time the plain and profiled builds, alternately, keeping the best
+  # run of each
+  return false unless pgo_make('pgo/plain', '') && pgo_make('pgo/use', PGO_USE)
+  plain = use = nil
+  PGO_RUNS.times do
+    t = pgo_run('pgo/plain', tests) or return false
+    plain = t if !plain || t < plain
+    t = pgo_run('pgo/use', tests) or return false
+    use = t if !use || t < use
+  end
+
+  message "profile-guided build: workload took %.2fs of CPU, %.2fs without the profile (%+.1f%%)\n",
+          use, plain, (use - plain) * 100 / plain
+  true
+end
+
+if have_library("xmms", "xmms_remote_get_version")
+  if enable_config("lto", false) && try_flags("-flto")
+    $CFLAGS << ' -flto'
+    $DLDFLAGS << ' -flto'
+  end
+
+  pgo = with_config("pgo", false)
+  if pgo
+    pgo = (pgo == true || pgo == 'bench') ? PGO_TESTS : pgo.split(',')
+    unless try_flags(PGO_GEN) && try_flags(PGO_USE)
+      message "profile-guided optimization isn't supported by this compiler\n"
+      pgo = nil
+    end
+  end
+
+  # set in the Makefile (and overridden for the training builds)
+  $CFLAGS << ' $(PGO_FLAGS)'
+  $DLDFLAGS << ' $(PGO_FLAGS)'
+  $distcleanfiles << '*.gcda'
+  $distcleandirs << 'pgo'
+  create_makefile("xmms") { |conf| conf << "PGO_FLAGS =\n" }
+
+  if pgo
+    if pgo_train(pgo)
+      File.open('Makefile', 'r+') do |f|
+        mk = f.read.sub(/^PGO_FLAGS =$/, "PGO_FLAGS = #{PGO_USE}")
+        f.rewind
+        f.write(mk)
+      end
+    else
+      message "profile-guided build failed (see the logs in pgo/); building without it\n"
+      FileUtils.rm_f(Dir['*.gcda'])
+    end
+  end
+end
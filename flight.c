@@ -0,0 +1,495 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Single-flight reads.
+ *
+ * When several threads make the same read of the same session at the
+ * same time (twenty threads polling Xmms::Remote#time, say), only the
+ * first one goes to XMMS; the rest wait for it and share its answer.
+ * Whole-playlist reads (Xmms::Remote#playlist) are shared the same
+ * way, as one native snapshot.
+ *
+ * A read only joins a fetch that started after the last write to the
+ * session from this process, so a thread always sees its own changes.
+ * Writes are never shared.
+ *
+ * It's off by default, and turned on per remote, and per method, with
+ * Xmms::Remote#single_flight=.
+ */
+#include <pthread.h>
+#include <time.h>
+#include "xmms_ruby.h"
+
+/* the playlist's bit in a remote's mask (the rest are xr_cmd_ops) */
+#define PLAYLIST_BIT XR_NUM_CMDS
+
+/* size of the write generation table */
+#define NUM_GENS 64
+
+/* longest wait without checking for interrupts, in seconds */
+#define WAIT_SLICE 0.1
+
+struct xr_flight {
+  struct xr_flight *next;
+  int session,
+      gen,                        /* write generation it started in */
+      cols,                       /* playlist columns (0 for a command) */
+      done,                       /* 1 if landed, -1 if it failed */
+      refs;
+  xr_cmd cmd;
+  xr_snap snap;
+  pthread_cond_t cond;
+};
+
+static xr_flight *flights;
+static pthread_mutex_t flight_lock = PTHREAD_MUTEX_INITIALIZER;
+static int gens[NUM_GENS];
+static int num_enabled;
+
+/* statistics */
+static unsigned long num_flights,
+                     num_joined;
+
+/*
+ * Note a write to a session: fetches already in flight are too old for
+ * anyone who asks from now on.
+ */
+void xr_flight_wrote(int session) {
+  if (num_enabled)
+    __atomic_add_fetch(gens + (unsigned int) session % NUM_GENS, 1, __ATOMIC_RELAXED);
+}
+
+static int session_gen(int session) {
+  return __atomic_load_n(gens + (unsigned int) session % NUM_GENS, __ATOMIC_RELAXED);
+}
+
+/*
+ * Is single-flight on for this method of this remote?  (bit is an
+ * xr_cmd_op, or PLAYLIST_BIT)
+ */
+static int enabled(VALUE self, int bit) {
+  if (!num_enabled)
+    return 0;
+  return (xr_remote_get(self)->flight >> bit) & 1;
+}
+
+static int same(xr_flight *f, int session, int gen, int cols, xr_cmd *cmd) {
+  if (f->done || f->session != session || f->gen != gen || f->cols != cols)
+    return 0;
+  return cols || xr_cmd_same(&f->cmd, cmd);
+}
+
+/*
+ * Find an identical fetch in flight and join it, or start one.  Call
+ * with the lock held.  *leader is set if the caller has to make the
+ * fetch (and land it).
+ */
+static xr_flight *board(int session, int cols, xr_cmd *cmd, int *leader) {
+  int gen = session_gen(session);
+  xr_flight *f;
+
+  for (f = flights; f; f = f->next)
+    if (same(f, session, gen, cols, cmd)) {
+      f->refs++;
+      num_joined++;
+      *leader = 0;
+      return f;
+    }
+
+  f = malloc(sizeof(xr_flight));
+  if (!f)
+    return NULL;
+  memset(f, 0, sizeof(xr_flight));
+  f->session = session;
+  f->gen = gen;
+  f->cols = cols;
+  f->refs = 1;
+  if (cmd) {
+    f->cmd = *cmd;
+    f->cmd.str = NULL;
+    f->cmd.num_str = 0;
+    f->cmd.sret = NULL;
+  }
+  pthread_cond_init(&f->cond, NULL);
+  f->next = flights;
+  flights = f;
+  num_flights++;
+  *leader = 1;
+
+  return f;
+}
+
+/*
+ * Take a fetch out of the table (so nobody else joins it).  Call with
+ * the lock held.
+ */
+static void unlink_flight(xr_flight *f) {
+  xr_flight **p;
+
+  for (p = &flights; *p; p = &(*p)->next)
+    if (*p == f) {
+      *p = f->next;
+      break;
+    }
+}
+
+/*
+ * Land a fetch: hand the result to everyone waiting on it.
+ */
+static void land(xr_flight *f, int ok) {
+  pthread_mutex_lock(&flight_lock);
+  unlink_flight(f);
+  f->done = ok ? 1 : -1;
+  pthread_cond_broadcast(&f->cond);
+  pthread_mutex_unlock(&flight_lock);
+}
+
+static void *release(void *data) {
+  xr_flight *f = data;
+  int last;
+
+  pthread_mutex_lock(&flight_lock);
+  last = !--f->refs;
+  pthread_mutex_unlock(&flight_lock);
+
+  if (last) {
+    if (f->cmd.sret)
+      g_free(f->cmd.sret);
+    xr_snap_free(&f->snap);
+    pthread_cond_destroy(&f->cond);
+    free(f);
+  }
+
+  return NULL;
+}
+
+typedef struct {
+  xr_flight *flight;
+  volatile int cancel;
+} wait_args;
+
+static void *wait_nogvl(void *data) {
+  wait_args *args = data;
+  xr_flight *f = args->flight;
+  struct timespec ts;
+  double t;
+
+  pthread_mutex_lock(&flight_lock);
+  while (!f->done && !args->cancel) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    t = ts.tv_sec + ts.tv_nsec / 1e9 + WAIT_SLICE;
+    ts.tv_sec = (time_t) t;
+    ts.tv_nsec = (long) ((t - (time_t) t) * 1e9);
+    pthread_cond_timedwait(&f->cond, &flight_lock, &ts);
+  }
+  pthread_mutex_unlock(&flight_lock);
+
+  return NULL;
+}
+
+/*
+ * Wait for someone else's fetch.  Returns 1 if it landed; otherwise
+ * (it failed, or we were interrupted) the reference is dropped and the
+ * caller is on its own.
+ */
+static int wait_for(xr_flight *f) {
+  wait_args args;
+
+  args.flight = f;
+  args.cancel = 0;
+  xr_nogvl(wait_nogvl, &args, &args.cancel);
+
+  if (f->done > 0)
+    return 1;
+
+  release(f);
+  XR_CHECK_INTS();
+  return 0;
+}
+
+/************/
+/* COMMANDS */
+/************/
+
+/*
+ * Called by xr_call() before running a command.  If an identical read
+ * is in flight, wait for it and return 1, with the command's results
+ * filled in.  Otherwise return 0; if *flight is set, the caller is
+ * making the fetch for others too, and must hand them the results
+ * with xr_flight_land() once it has them.
+ */
+int xr_flight_board(VALUE self, xr_cmd *cmd, xr_flight **flight) {
+  int leader = 0;
+  xr_flight *f;
+
+  *flight = NULL;
+  if (!(xr_cmd_defs[cmd->op].flags & XR_CMD_READ) || cmd->num_str ||
+      !enabled(self, cmd->op))
+    return 0;
+
+  pthread_mutex_lock(&flight_lock);
+  f = board(cmd->session, 0, cmd, &leader);
+  pthread_mutex_unlock(&flight_lock);
+
+  if (!f)
+    return 0;
+  if (leader) {
+    *flight = f;
+    return 0;
+  }
+  if (!wait_for(f))
+    return 0;
+
+  xr_cmd_copy_result(cmd, &f->cmd);
+  release(f);
+  return 1;
+}
+
+void xr_flight_land(xr_flight *f, xr_cmd *cmd) {
+  xr_cmd_copy_result(&f->cmd, cmd);
+  land(f, 1);
+  release(f);
+}
+
+/************/
+/* PLAYLIST */
+/************/
+
+typedef struct {
+  xr_flight *flight;
+  VALUE ret;
+} pl_args;
+
+static VALUE pl_build(VALUE data) {
+  pl_args *args = (pl_args*) data;
+  xr_snap *snap = &args->flight->snap;
+  int block_given = rb_block_given_p(), i;
+  VALUE e = Qnil;
+
+  args->ret = block_given ? Qnil : rb_ary_new2(snap->len);
+  for (i = 0; i < snap->len; i++) {
+    /* as Xmms::Remote#playlist: one array, reused, if yielding */
+    if (!block_given || e == Qnil)
+      e = rb_ary_new();
+    else
+      e = rb_ary_clear(e);
+
+    rb_ary_push(e, xr_str_new(snap->titles[i] ? snap->titles[i] : "",
+                              snap->titles[i] ? strlen(snap->titles[i]) : 0, XR_STR_TEXT));
+    rb_ary_push(e, xr_str_new(snap->files[i] ? snap->files[i] : "",
+                              snap->files[i] ? strlen(snap->files[i]) : 0, XR_STR_PATH));
+    rb_ary_push(e, INT2FIX(snap->times[i]));
+
+    block_given ? rb_yield(e) : rb_ary_push(args->ret, e);
+  }
+
+  return args->ret;
+}
+
+static VALUE pl_release(VALUE data) {
+  release(((pl_args*) data)->flight);
+  return Qnil;
+}
+
+/*
+ * Called by Xmms::Remote#playlist.  If single-flight is on for it,
+ * fetch the playlist (or wait for a fetch already in flight), put the
+ * result in *ret (yielding each entry, if a block was given), and
+ * return 1.  Otherwise return 0.
+ */
+int xr_flight_playlist(VALUE self, VALUE *ret) {
+  int *session, leader = 0, cols = XR_COL_TITLE | XR_COL_FILE | XR_COL_TIME;
+  pl_args args;
+  xr_flight *f;
+
+  if (!enabled(self, PLAYLIST_BIT))
+    return 0;
+  session = XR_SESSION(self);
+
+  pthread_mutex_lock(&flight_lock);
+  f = board(*session, cols, NULL, &leader);
+  pthread_mutex_unlock(&flight_lock);
+  if (!f)
+    return 0;
+
+  if (leader) {
+    if (xr_snap_fetch(&f->snap, *session, cols)) {
+      land(f, 0);
+      release(f);
+      XR_CHECK_INTS();
+      rb_raise(eError, "playlist fetch interrupted");
+    }
+    land(f, 1);
+  } else if (!wait_for(f)) {
+    return 0;
+  }
+
+  args.flight = f;
+  args.ret = Qnil;
+  *ret = rb_ensure(pl_build, (VALUE) &args, pl_release, (VALUE) &args);
+  return 1;
+}
+
+/****************/
+/* RUBY METHODS */
+/****************/
+
+/*
+ * Get the op (or PLAYLIST_BIT) for a method name, which must be a
+ * read.
+ */
+static int method_bit(VALUE name) {
+  const char *s = rb_id2name(rb_to_id(name));
+  int i;
+
+  if (!strcmp(s, "playlist"))
+    return PLAYLIST_BIT;
+  for (i = 0; i < XR_NUM_CMDS; i++)
+    if (!strcmp(s, xr_cmd_defs[i].name)) {
+      if (!(xr_cmd_defs[i].flags & XR_CMD_READ))
+        rb_raise(rb_eArgError, "%s isn't a read", s);
+      return i;
+    }
+
+  rb_raise(rb_eArgError, "unknown method: %s", s);
+  return -1;
+}
+
+/*
+ * Turn single-flight reads on or off for this remote: true for every
+ * read, false for none, or a list of methods: :playlist, or the
+ * names of the reads that have *_async versions (:time, :playing?,
+ * :playlist_title, and so on; see Xmms::Future).
+ *
+ * With single-flight on, a read that's already in flight from another
+ * thread (through any remote with single-flight on for that method)
+ * isn't sent again; this thread waits for the other's answer.  Nothing
+ * changes for one thread on its own, and writes always go straight to
+ * XMMS.  A read never shares a fetch that started before this
+ * process's last write to the session.
+ *
+ * This method raises an ArgumentError exception if a method isn't a
+ * read, or isn't known.
+ *
+ * Examples:
+ *   remote.single_flight = true
+ *   remote.single_flight = [:time, :playlist]
+ *   20.times { Thread.new { loop { p remote.time } } }
+ *
+ */
+static VALUE xr_set_single_flight(VALUE self, VALUE how) {
+  unsigned LONG_LONG mask = 0;
+  xr_remote *r;
+  long i;
+
+  if (how == Qtrue) {
+    for (i = 0; i < XR_NUM_CMDS; i++)
+      if (xr_cmd_defs[i].flags & XR_CMD_READ)
+        mask |= 1ULL << i;
+    mask |= 1ULL << PLAYLIST_BIT;
+  } else if (how != Qfalse && how != Qnil) {
+    how = rb_Array(how);
+    for (i = 0; i < RARRAY_LEN(how); i++)
+      mask |= 1ULL << method_bit(rb_ary_entry(how, i));
+  }
+
+  r = xr_remote_get(self);
+  if (!r->flight != !mask)
+    __atomic_add_fetch(&num_enabled, mask ? 1 : -1, __ATOMIC_RELAXED);
+  r->flight = mask;
+
+  return how;
+}
+
+/*
+ * Get the methods single-flight reads are on for (see
+ * Xmms::Remote#single_flight=), as an array of symbols.
+ *
+ * Example:
+ *   p remote.single_flight   # => [:time, :playlist]
+ *
+ */
+static VALUE xr_single_flight(VALUE self) {
+  unsigned LONG_LONG mask;
+  VALUE ret = rb_ary_new();
+  int i;
+
+  mask = xr_remote_get(self)->flight;
+  for (i = 0; i < XR_NUM_CMDS; i++)
+    if ((mask >> i) & 1)
+      rb_ary_push(ret, ID2SYM(rb_intern(xr_cmd_defs[i].name)));
+  if ((mask >> PLAYLIST_BIT) & 1)
+    rb_ary_push(ret, ID2SYM(rb_intern("playlist")));
+
+  return ret;
+}
+
+/*
+ * Get single-flight statistics for this process, as a hash: :flights
+ * (fetches made) and :joined (reads that shared one instead).
+ *
+ * Example:
+ *   s = Xmms.single_flight_stats
+ *   puts "#{s[:joined]} reads saved"
+ *
+ */
+static VALUE xr_single_flight_stats(VALUE self) {
+  VALUE ret = rb_hash_new();
+
+  UNUSED(self);
+  pthread_mutex_lock(&flight_lock);
+  rb_hash_aset(ret, ID2SYM(rb_intern("flights")), ULONG2NUM(num_flights));
+  rb_hash_aset(ret, ID2SYM(rb_intern("joined")), ULONG2NUM(num_joined));
+  pthread_mutex_unlock(&flight_lock);
+
+  return ret;
+}
+
+/*
+ * Hold the lock across fork().  Fetches in flight in other threads
+ * never land in the child, so it starts with an empty table.
+ */
+static void flight_prepare(void) {
+  pthread_mutex_lock(&flight_lock);
+}
+
+static void flight_parent(void) {
+  pthread_mutex_unlock(&flight_lock);
+}
+
+static void flight_child(void) {
+  flights = NULL;
+  pthread_mutex_unlock(&flight_lock);
+}
+
+void Init_xmms_flight(void) {
+  rb_define_method(cRemote, "single_flight=", xr_set_single_flight, 1);
+  rb_define_method(cRemote, "single_flight", xr_single_flight, 0);
+  rb_define_module_function(mXmms, "single_flight_stats", xr_single_flight_stats, 0);
+
+  pthread_atfork(flight_prepare, flight_parent, flight_child);
+}
@@ -0,0 +1,348 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Xmms::Future and the *_async methods.
+ *
+ * Every single-request Xmms::Remote method has an asynchronous twin
+ * (e.g. Xmms::Remote#time_async for Xmms::Remote#time).  The twin
+ * calls the ordinary method with a flag set; when that method gets as
+ * far as xr_call(), its command is queued on the remote's I/O thread
+ * and an Xmms::Future is returned instead of the result.  The argument
+ * checking and result conversion are shared with the blocking methods.
+ */
+#include "xmms_ruby.h"
+
+#define ASYNC_KEY "__xmms_async__"
+
+typedef struct {
+  VALUE remote,
+        children,       /* for Xmms::Future.all */
+        value;
+  int resolved;
+  xr_job *job;
+} xr_future;
+
+VALUE cFuture;
+static ID id_async,
+          sync_ids[XR_NUM_CMDS],
+          async_ids[XR_NUM_CMDS];
+
+/*****************/
+/* ASYNC METHODS */
+/*****************/
+
+/*
+ * Is the current thread calling an async method on this remote?  The
+ * flag only covers one command, so it's cleared here.
+ */
+int xr_async_pending(VALUE self) {
+  VALUE th = rb_thread_current();
+
+  if (rb_thread_local_aref(th, id_async) != self)
+    return 0;
+
+  rb_thread_local_aset(th, id_async, Qnil);
+  return 1;
+}
+
+typedef struct {
+  VALUE self;
+  ID id;
+  int argc;
+  VALUE *argv;
+} async_call;
+
+static VALUE async_body(VALUE data) {
+  async_call *call = (async_call*) data;
+  return rb_funcall2(call->self, call->id, call->argc, call->argv);
+}
+
+static VALUE async_ensure(VALUE self) {
+  UNUSED(self);
+  rb_thread_local_aset(rb_thread_current(), id_async, Qnil);
+  return Qnil;
+}
+
+/*
+ * Shared implementation of the *_async methods: call the blocking
+ * method of the same name with the async flag set.
+ */
+static VALUE xr_async(int argc, VALUE *argv, VALUE self) {
+  ID id = rb_frame_this_func();
+  async_call call;
+  int i;
+
+  for (i = 0; i < XR_NUM_CMDS; i++)
+    if (async_ids[i] == id)
+      break;
+  if (i == XR_NUM_CMDS)
+    rb_raise(rb_eNotImpError, "unknown async method: %s", rb_id2name(id));
+
+  call.self = self;
+  call.id = sync_ids[i];
+  call.argc = argc;
+  call.argv = argv;
+
+  rb_thread_local_aset(rb_thread_current(), id_async, self);
+  return rb_ensure(async_body, (VALUE) &call, async_ensure, self);
+}
+
+/***********/
+/* FUTURES */
+/***********/
+
+static void future_mark(xr_future *f) {
+  rb_gc_mark(f->remote);
+  rb_gc_mark(f->children);
+  rb_gc_mark(f->value);
+}
+
+static void future_free(xr_future *f) {
+  if (f->job)
+    xr_job_unref(f->job);
+  xfree(f);
+}
+
+static VALUE future_alloc(VALUE remote, xr_job *job, VALUE children) {
+  xr_future *f;
+  VALUE ret;
+
+  ret = Data_Make_Struct(cFuture, xr_future, future_mark, future_free, f);
+  f->remote = remote;
+  f->children = children;
+  f->value = Qnil;
+  f->job = job;
+
+  return ret;
+}
+
+/*
+ * Wrap a queued command in a future.
+ */
+VALUE xr_future_new(VALUE self, xr_job *job) {
+  return future_alloc(self, job, Qnil);
+}
+
+static double timeout_arg(int argc, VALUE *argv) {
+  VALUE t = Qnil;
+
+  if (argc > 1)
+    rb_raise(rb_eArgError, "invalid argument count (not 0 or 1)");
+
+  if (argc == 1) {
+    if (TYPE(argv[0]) == T_HASH)
+      t = rb_hash_aref(argv[0], ID2SYM(rb_intern("timeout")));
+    else
+      t = argv[0];
+  }
+
+  if (t == Qnil)
+    return -1;
+  if (NUM2DBL(t) < 0)
+    rb_raise(rb_eArgError, "negative timeout");
+
+  return NUM2DBL(t);
+}
+
+/*
+ * Wait up to timeout seconds (forever if negative) for a future.
+ * Returns non-zero once it's ready.
+ */
+static int future_wait(xr_future *f, double timeout) {
+  double end = xr_now() + timeout, left;
+  xr_future *child;
+  long i;
+
+  if (f->resolved)
+    return 1;
+
+  if (f->job)
+    return xr_job_wait(f->job, timeout);
+
+  for (i = 0; i < RARRAY_LEN(f->children); i++) {
+    Data_Get_Struct(rb_ary_entry(f->children, i), xr_future, child);
+    if (timeout < 0)
+      left = -1;
+    else if ((left = end - xr_now()) < 0)
+      left = 0;
+
+    if (!future_wait(child, left))
+      return 0;
+  }
+
+  return 1;
+}
+
+static VALUE future_value(xr_future *f) {
+  xr_future *child;
+  VALUE ret;
+  long i;
+
+  if (f->resolved)
+    return f->value;
+
+  if (f->job) {
+    /* raises Xmms::Error if XMMS wasn't running */
+    ret = xr_cmd_result(f->remote, xr_job_cmd(f->job));
+    xr_job_unref(f->job);
+    f->job = NULL;
+  } else {
+    ret = rb_ary_new();
+    for (i = 0; i < RARRAY_LEN(f->children); i++) {
+      Data_Get_Struct(rb_ary_entry(f->children, i), xr_future, child);
+      rb_ary_push(ret, future_value(child));
+    }
+  }
+
+  f->value = ret;
+  f->resolved = 1;
+
+  return ret;
+}
+
+/*
+ * Wait for the result of an asynchronous call, and return it.  If a
+ * timeout (in seconds) is given and the result isn't ready in time,
+ * returns nil.
+ *
+ * This method raises an Xmms::Error exception if XMMS wasn't running
+ * when the command was sent.
+ *
+ * Examples:
+ *   pos = remote.playlist_pos_async
+ *   do_something_else
+ *   puts pos.value
+ *
+ *   # give up after a quarter of a second
+ *   time = remote.time_async.value(:timeout => 0.25)
+ *
+ */
+static VALUE xrf_value(int argc, VALUE *argv, VALUE self) {
+  xr_future *f;
+
+  Data_Get_Struct(self, xr_future, f);
+  if (!future_wait(f, timeout_arg(argc, argv)))
+    return Qnil;
+
+  return future_value(f);
+}
+
+/*
+ * Wait for an asynchronous call to finish.  Returns self, or nil if a
+ * timeout (in seconds) is given and expires first.  Unlike
+ * Xmms::Future#value, this doesn't raise an exception if the command
+ * failed.
+ *
+ * Example:
+ *   f = remote.play_async
+ *   f.wait
+ *
+ */
+static VALUE xrf_wait(int argc, VALUE *argv, VALUE self) {
+  xr_future *f;
+
+  Data_Get_Struct(self, xr_future, f);
+  return future_wait(f, timeout_arg(argc, argv)) ? self : Qnil;
+}
+
+/*
+ * Has this future's result arrived?  Doesn't block.
+ *
+ * Example:
+ *   f = remote.get_eq_async
+ *   redraw until f.ready?
+ *
+ */
+static VALUE xrf_ready(VALUE self) {
+  xr_future *f;
+
+  Data_Get_Struct(self, xr_future, f);
+  return future_wait(f, 0) ? Qtrue : Qfalse;
+}
+
+/*
+ * Combine several futures into one, whose value is an array of their
+ * values (in order).  Accepts futures or an array of futures.
+ *
+ * This method raises a TypeError exception if an argument isn't an
+ * Xmms::Future.
+ *
+ * Example:
+ *   # one status refresh; the requests go out together
+ *   pos, time, vol, playing = Xmms::Future.all(
+ *     remote.playlist_pos_async,
+ *     remote.time_async,
+ *     remote.main_volume_async,
+ *     remote.playing_async
+ *   ).value
+ *
+ */
+static VALUE xrf_all(int argc, VALUE *argv, VALUE klass) {
+  VALUE ary;
+  long i;
+
+  UNUSED(klass);
+
+  if (argc == 1 && TYPE(argv[0]) == T_ARRAY)
+    ary = rb_ary_dup(argv[0]);
+  else
+    ary = rb_ary_new4(argc, argv);
+
+  for (i = 0; i < RARRAY_LEN(ary); i++)
+    if (!rb_obj_is_kind_of(rb_ary_entry(ary, i), cFuture))
+      rb_raise(rb_eTypeError, "invalid argument type (not Xmms::Future)");
+
+  return future_alloc(Qnil, NULL, ary);
+}
+
+void Init_xmms_future(void) {
+  char buf[64];
+  const char *name;
+  int i;
+
+  id_async = rb_intern(ASYNC_KEY);
+
+  cFuture = rb_define_class_under(mXmms, "Future", rb_cObject);
+  rb_undef_alloc_func(cFuture);
+  rb_undef_method(CLASS_OF(cFuture), "new");
+  rb_define_singleton_method(cFuture, "all", xrf_all, -1);
+
+  rb_define_method(cFuture, "value", xrf_value, -1);
+  rb_define_method(cFuture, "wait", xrf_wait, -1);
+  rb_define_method(cFuture, "ready?", xrf_ready, 0);
+  rb_define_alias(cFuture, "done?", "ready?");
+
+  /* Xmms::Remote#time_async, #playing_async, etc */
+  for (i = 0; i < XR_NUM_CMDS; i++) {
+    name = xr_cmd_defs[i].name;
+    snprintf(buf, sizeof(buf), "%.*s_async", (int) strcspn(name, "?"), name);
+
+    sync_ids[i] = rb_intern(name);
+    async_ids[i] = rb_intern(buf);
+    rb_define_method(cRemote, buf, xr_async, -1);
+  }
+}
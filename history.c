@@ -0,0 +1,1103 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Xmms::History: a play history journal.
+ *
+ * A recorder thread watches a session (playlist position, whether it's
+ * playing, and the output time, a few times a second) and appends a
+ * record for every track played: when it started, how long it actually
+ * played (pauses and seeks don't count), its playlist position and
+ * length, and its file name.
+ *
+ * The journal is an append-only file of 32 byte slots, mapped into
+ * memory.  A play is one slot; file names are interned, and each one
+ * is written once, as a string slot plus continuation slots, before the
+ * first play that uses it.  Every slot carries a checksum, so after a
+ * crash the valid part of the file is everything up to the first bad
+ * slot; anything after that is zeroed when the journal is opened.
+ * Writes are synced to disk in batches (every second, by default).
+ *
+ * Plays are written in the order they started, so a range query is a
+ * binary search (skipping over string slots) and a scan.
+ *
+ * A journal belongs to the process that opened it; a forked child
+ * that wants one opens it again.
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "xmms_ruby.h"
+
+/* file layout */
+#define MAGIC         "XRHIST1\n"
+#define SLOT          32
+#define HEADER_SLOTS  2
+#define MIN_SLOTS     2048        /* 64k */
+#define STR_HEAD_DATA 20
+#define STR_CONT_DATA 27
+#define MAX_PATH_LEN  65535
+
+/* slot kinds (0 is an unused slot) */
+#define KIND_PLAY 1
+#define KIND_STR  2
+#define KIND_CONT 3
+
+/* how a play ended */
+#define END_NEXT    0             /* another track started */
+#define END_STOP    1             /* playback stopped */
+#define END_RECORD  2             /* the recorder was stopped */
+
+/* defaults */
+#define DEFAULT_INTERVAL 0.1
+#define DEFAULT_SYNC     1.0
+
+typedef struct {
+  char magic[8];
+  uint32_t slot_size,
+           reserved;
+  uint64_t synced;                /* slots known to be on disk */
+  char pad[SLOT * HEADER_SLOTS - 24];
+} hist_header;
+
+typedef struct {
+  uint8_t kind,
+          end;
+  uint16_t reserved;
+  uint32_t path;
+  int64_t start;                  /* microseconds since the epoch */
+  uint32_t played;                /* ms */
+  int32_t pos,
+          length;                 /* ms */
+  uint32_t sum;
+} play_slot;
+
+typedef struct {
+  uint8_t kind,
+          reserved;
+  uint16_t len;
+  uint32_t id;
+  char data[STR_HEAD_DATA];
+  uint32_t sum;
+} str_slot;
+
+typedef struct {
+  uint8_t kind;
+  char data[STR_CONT_DATA];
+  uint32_t sum;
+} cont_slot;
+
+/* a play, as read back */
+typedef struct {
+  uint32_t path;
+  int64_t start;
+  uint32_t played;
+  int32_t pos, length;
+  uint8_t end;
+} hist_play;
+
+typedef struct {
+  char *path;
+  int fd;
+
+  /* the mapping */
+  char *map;
+  size_t num_slots,               /* mapped */
+         used;                    /* slots in use (including the header) */
+  size_t synced;
+  double last_sync;
+
+  /* interned file names, by id, and a hash table of ids */
+  char **strs;
+  uint32_t num_strs,
+           cap_strs,
+           *table,                /* id + 1, or 0 for an empty bucket */
+           table_size;
+
+  /* recorder thread */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int session,
+      running,
+      stop,
+      gen;
+  double interval,
+         sync_every;
+
+  /* statistics */
+  unsigned long num_plays,
+                num_syncs;
+  double append_time;
+} xr_hist;
+
+static VALUE cHistory;
+static VALUE sym_next, sym_stop, sym_record;
+
+/*********/
+/* SLOTS */
+/*********/
+
+static uint32_t slot_sum(const void *slot) {
+  const unsigned char *p = slot;
+  uint32_t h = 2166136261U;
+  int i;
+
+  for (i = 0; i < SLOT - 4; i++)
+    h = (h ^ p[i]) * 16777619U;
+  return h;
+}
+
+static char *slot_at(xr_hist *h, size_t i) {
+  return h->map + i * SLOT;
+}
+
+static int slot_ok(xr_hist *h, size_t i) {
+  char *s = slot_at(h, i);
+  uint32_t sum;
+
+  memcpy(&sum, s + SLOT - 4, 4);
+  return s[0] >= KIND_PLAY && s[0] <= KIND_CONT && sum == slot_sum(s);
+}
+
+/*
+ * Map (or remap) the file, growing it to at least the given number of
+ * slots.  Call with the lock held.  Returns -1 (with errno set) on
+ * error.
+ */
+static int hist_map(xr_hist *h, size_t want) {
+  size_t n = h->num_slots ? h->num_slots : MIN_SLOTS;
+  char *map;
+
+  while (n < want)
+    n *= 2;
+  if (h->map && n == h->num_slots)
+    return 0;
+
+  if (ftruncate(h->fd, n * SLOT) < 0)
+    return -1;
+  map = mmap(NULL, n * SLOT, PROT_READ | PROT_WRITE, MAP_SHARED, h->fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+
+  if (h->map)
+    munmap(h->map, h->num_slots * SLOT);
+  h->map = map;
+  h->num_slots = n;
+
+  return 0;
+}
+
+/*
+ * Flush everything written so far to disk, then record that in the
+ * header.  Call with the lock held.
+ */
+static void hist_sync(xr_hist *h) {
+  hist_header *hd;
+
+  if (h->synced == h->used)
+    return;
+
+  msync(h->map, h->used * SLOT, MS_SYNC);
+  hd = (hist_header*) h->map;
+  hd->synced = h->used;
+  msync(h->map, sizeof(hist_header), MS_ASYNC);
+
+  h->synced = h->used;
+  h->last_sync = xr_now();
+  h->num_syncs++;
+}
+
+/*************/
+/* INTERNING */
+/*************/
+
+static uint32_t str_hash(const char *s) {
+  uint32_t h = 2166136261U;
+
+  for (; *s; s++)
+    h = (h ^ (unsigned char) *s) * 16777619U;
+  return h;
+}
+
+/*
+ * Add a string to the table (the id is the next one).  Returns -1 if
+ * out of memory.
+ */
+static int intern_add(xr_hist *h, char *str) {
+  uint32_t i, mask;
+
+  if (h->num_strs == h->cap_strs) {
+    uint32_t cap = h->cap_strs ? h->cap_strs * 2 : 64;
+    char **strs = realloc(h->strs, sizeof(char*) * cap);
+
+    if (!strs)
+      return -1;
+    h->strs = strs;
+    h->cap_strs = cap;
+  }
+
+  /* keep the table at most half full */
+  if ((h->num_strs + 1) * 2 > h->table_size) {
+    uint32_t size = h->table_size ? h->table_size * 2 : 128, *table, j;
+
+    if ((table = calloc(size, sizeof(uint32_t))) == NULL)
+      return -1;
+    for (j = 0; j < h->num_strs; j++) {
+      for (i = str_hash(h->strs[j]) & (size - 1); table[i]; i = (i + 1) & (size - 1))
+        ;
+      table[i] = j + 1;
+    }
+    free(h->table);
+    h->table = table;
+    h->table_size = size;
+  }
+
+  mask = h->table_size - 1;
+  for (i = str_hash(str) & mask; h->table[i]; i = (i + 1) & mask)
+    ;
+  h->table[i] = h->num_strs + 1;
+  h->strs[h->num_strs++] = str;
+
+  return 0;
+}
+
+static int64_t intern_find(xr_hist *h, const char *str) {
+  uint32_t i, mask;
+
+  if (!h->table_size)
+    return -1;
+
+  mask = h->table_size - 1;
+  for (i = str_hash(str) & mask; h->table[i]; i = (i + 1) & mask)
+    if (!strcmp(h->strs[h->table[i] - 1], str))
+      return h->table[i] - 1;
+
+  return -1;
+}
+
+/*
+ * Read the string starting at slot i (a string slot).  Returns the
+ * number of slots it takes up, or 0 if they aren't all there.
+ */
+static size_t str_read(xr_hist *h, size_t i, size_t end, char **ret) {
+  str_slot *s = (str_slot*) slot_at(h, i);
+  size_t len = s->len, n, j, got;
+  char *str;
+
+  n = 1 + (len > STR_HEAD_DATA ? (len - STR_HEAD_DATA + STR_CONT_DATA - 1) / STR_CONT_DATA : 0);
+  if (i + n > end)
+    return 0;
+  for (j = 1; j < n; j++)
+    if (!slot_ok(h, i + j) || slot_at(h, i + j)[0] != KIND_CONT)
+      return 0;
+
+  if ((str = malloc(len + 1)) == NULL)
+    return 0;
+  got = len < STR_HEAD_DATA ? len : STR_HEAD_DATA;
+  memcpy(str, s->data, got);
+  for (j = 1; got < len; j++) {
+    size_t k = len - got < STR_CONT_DATA ? len - got : STR_CONT_DATA;
+
+    memcpy(str + got, ((cont_slot*) slot_at(h, i + j))->data, k);
+    got += k;
+  }
+  str[len] = '\0';
+
+  *ret = str;
+  return n;
+}
+
+/*
+ * Get the id of a file name, writing it to the journal if it's new.
+ * Call with the lock held.  Returns -1 on error.
+ */
+static int64_t intern(xr_hist *h, const char *path) {
+  size_t len = strlen(path), n, got, j;
+  int64_t id;
+  str_slot *s;
+  char *copy;
+
+  if ((id = intern_find(h, path)) >= 0)
+    return id;
+  if (len > MAX_PATH_LEN)
+    len = MAX_PATH_LEN;
+
+  n = 1 + (len > STR_HEAD_DATA ? (len - STR_HEAD_DATA + STR_CONT_DATA - 1) / STR_CONT_DATA : 0);
+  if (hist_map(h, h->used + n + 1) < 0)
+    return -1;
+  if ((copy = malloc(len + 1)) == NULL)
+    return -1;
+  memcpy(copy, path, len);
+  copy[len] = '\0';
+  id = h->num_strs;
+
+  /* the continuation slots first, so the head never points at garbage */
+  got = len < STR_HEAD_DATA ? len : STR_HEAD_DATA;
+  for (j = 1; j < n; j++) {
+    cont_slot c;
+    size_t k = len - got < STR_CONT_DATA ? len - got : STR_CONT_DATA;
+
+    memset(&c, 0, sizeof(c));
+    c.kind = KIND_CONT;
+    memcpy(c.data, path + got, k);
+    c.sum = slot_sum(&c);
+    memcpy(slot_at(h, h->used + j), &c, SLOT);
+    got += k;
+  }
+
+  s = (str_slot*) slot_at(h, h->used);
+  {
+    str_slot head;
+
+    memset(&head, 0, sizeof(head));
+    head.kind = KIND_STR;
+    head.len = len;
+    head.id = id;
+    memcpy(head.data, path, len < STR_HEAD_DATA ? len : STR_HEAD_DATA);
+    head.sum = slot_sum(&head);
+    memcpy(s, &head, SLOT);
+  }
+
+  if (intern_add(h, copy) < 0) {
+    memset(s, 0, SLOT * n);
+    free(copy);
+    return -1;
+  }
+  h->used += n;
+
+  return id;
+}
+
+/***********/
+/* APPENDS */
+/***********/
+
+/*
+ * Append a play.  Call with the lock held.  Returns -1 on error.
+ */
+static int hist_append(xr_hist *h, const char *path, int64_t start,
+                       uint32_t played, int32_t pos, int32_t length, int end) {
+  double t0 = xr_now();
+  play_slot p;
+  int64_t id;
+
+  if ((id = intern(h, path ? path : "")) < 0)
+    return -1;
+  if (hist_map(h, h->used + 1) < 0)
+    return -1;
+
+  memset(&p, 0, sizeof(p));
+  p.kind = KIND_PLAY;
+  p.end = end;
+  p.path = id;
+  p.start = start;
+  p.played = played;
+  p.pos = pos;
+  p.length = length;
+  p.sum = slot_sum(&p);
+  memcpy(slot_at(h, h->used++), &p, SLOT);
+
+  h->num_plays++;
+  if (t0 - h->last_sync >= h->sync_every)
+    hist_sync(h);
+  h->append_time += xr_now() - t0;
+
+  return 0;
+}
+
+/*
+ * Open (or create) a journal, and find the end of the valid part.
+ * Returns -1 (with errno set) on error.
+ */
+static int hist_open(xr_hist *h) {
+  struct stat st;
+  hist_header *hd;
+  size_t i, n, end;
+  char *str;
+
+  if ((h->fd = open(h->path, O_RDWR | O_CREAT, 0644)) < 0)
+    return -1;
+  if (fstat(h->fd, &st) < 0)
+    return -1;
+
+  h->num_slots = st.st_size / SLOT;
+  if (h->num_slots < MIN_SLOTS)
+    h->num_slots = 0;
+  if (hist_map(h, HEADER_SLOTS) < 0)
+    return -1;
+
+  hd = (hist_header*) h->map;
+  if (memcmp(hd->magic, MAGIC, 8)) {
+    if (st.st_size > 0 && hd->magic[0]) {
+      errno = EINVAL;
+      return -1;
+    }
+    memset(hd, 0, sizeof(*hd));
+    memcpy(hd->magic, MAGIC, 8);
+    hd->slot_size = SLOT;
+  }
+
+  /* everything up to the first bad slot is good; load the strings on
+   * the way */
+  end = HEADER_SLOTS;
+  for (i = HEADER_SLOTS; i < h->num_slots && slot_ok(h, i); i += n) {
+    char kind = slot_at(h, i)[0];
+
+    n = 1;
+    if (kind == KIND_STR) {
+      if ((n = str_read(h, i, h->num_slots, &str)) == 0)
+        break;
+      if (((str_slot*) slot_at(h, i))->id != h->num_strs || intern_add(h, str) < 0) {
+        free(str);
+        break;
+      }
+    } else if (kind != KIND_PLAY) {
+      break;
+    } else {
+      h->num_plays++;
+    }
+    end = i + n;
+  }
+
+  /* drop anything after that, so a later crash can't bring it back */
+  memset(slot_at(h, end), 0, (h->num_slots - end) * SLOT);
+  h->used = end;
+  h->synced = 0;
+  hist_sync(h);
+
+  return 0;
+}
+
+static void hist_close(xr_hist *h) {
+  uint32_t i;
+
+  if (h->map) {
+    hist_sync(h);
+    munmap(h->map, h->num_slots * SLOT);
+    h->map = NULL;
+    if (ftruncate(h->fd, h->used * SLOT) < 0) {
+      /* the zeroed tail is harmless */
+    }
+  }
+  if (h->fd >= 0) {
+    close(h->fd);
+    h->fd = -1;
+  }
+
+  for (i = 0; i < h->num_strs; i++)
+    free(h->strs[i]);
+  free(h->strs);
+  free(h->table);
+  h->strs = NULL;
+  h->table = NULL;
+  h->num_strs = h->cap_strs = h->table_size = 0;
+}
+
+/*********/
+/* READS */
+/*********/
+
+/*
+ * Find the first play slot at or after slot i (and before end).
+ */
+static size_t next_play(xr_hist *h, size_t i, size_t end) {
+  while (i < end && slot_at(h, i)[0] != KIND_PLAY)
+    i++;
+  return i;
+}
+
+/*
+ * Find the first play that started at or after t.  Call with the lock
+ * held.
+ */
+static size_t find_start(xr_hist *h, int64_t t) {
+  size_t lo = HEADER_SLOTS, hi = h->used, mid, j;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    j = next_play(h, mid, hi);
+    if (j == hi)
+      hi = mid;
+    else if (((play_slot*) slot_at(h, j))->start < t)
+      lo = j + 1;
+    else
+      hi = mid;
+  }
+
+  return next_play(h, lo, h->used);
+}
+
+/*
+ * Copy out the plays that started in [from, to).  Call with the lock
+ * held.
+ */
+static hist_play *hist_range(xr_hist *h, int64_t from, int64_t to, size_t *num) {
+  size_t i, n = 0, cap = 64;
+  hist_play *ret = malloc(sizeof(hist_play) * cap);
+  play_slot *p;
+
+  for (i = find_start(h, from); ret && i < h->used; i = next_play(h, i + 1, h->used)) {
+    p = (play_slot*) slot_at(h, i);
+    if (p->start >= to)
+      break;
+    if (n == cap) {
+      hist_play *grown = realloc(ret, sizeof(hist_play) * (cap *= 2));
+
+      if (!grown) {
+        free(ret);
+        return NULL;
+      }
+      ret = grown;
+    }
+    ret[n].path = p->path;
+    ret[n].start = p->start;
+    ret[n].played = p->played;
+    ret[n].pos = p->pos;
+    ret[n].length = p->length;
+    ret[n].end = p->end;
+    n++;
+  }
+
+  *num = n;
+  return ret;
+}
+
+/************/
+/* RECORDER */
+/************/
+
+typedef struct {
+  int active,
+      pos,
+      length,
+      last_out;
+  int64_t start;
+  uint32_t played;
+  gchar *file;
+} rec_state;
+
+static int64_t wall_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void rec_close(xr_hist *h, rec_state *r, int end) {
+  if (!r->active)
+    return;
+
+  pthread_mutex_lock(&h->lock);
+  hist_append(h, r->file, r->start, r->played, r->pos, r->length, end);
+  pthread_mutex_unlock(&h->lock);
+
+  if (r->file)
+    g_free(r->file);
+  r->file = NULL;
+  r->active = 0;
+}
+
+static void rec_poll(xr_hist *h, rec_state *r) {
+  int s = h->session, pos, out, d;
+
+  if (!xmms_remote_is_playing(s)) {
+    rec_close(h, r, END_STOP);
+    return;
+  }
+
+  pos = xmms_remote_get_playlist_pos(s);
+  out = xmms_remote_get_output_time(s);
+
+  /* a new track, or the same one started over */
+  if (r->active && (pos != r->pos || (out + 1000 < r->last_out && out < 2000)))
+    rec_close(h, r, END_NEXT);
+
+  if (!r->active) {
+    r->active = 1;
+    r->pos = pos;
+    r->file = xmms_remote_get_playlist_file(s, pos);
+    r->length = xmms_remote_get_playlist_time(s, pos);
+    r->start = wall_us() - (int64_t) out * 1000;
+    r->played = out;
+    r->last_out = out;
+    return;
+  }
+
+  /* count time that actually played: not pauses, and not seeks */
+  d = out - r->last_out;
+  if (d > 0 && d <= h->interval * 3000 + 500)
+    r->played += d;
+  r->last_out = out;
+}
+
+static void *rec_thread(void *data) {
+  xr_hist *h = data;
+  rec_state r;
+  struct timespec ts;
+  double t;
+  int stop = 0;
+
+  memset(&r, 0, sizeof(r));
+  while (!stop) {
+    rec_poll(h, &r);
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    t = ts.tv_sec + ts.tv_nsec / 1e9 + h->interval;
+    ts.tv_sec = (time_t) t;
+    ts.tv_nsec = (long) ((t - (time_t) t) * 1e9);
+
+    pthread_mutex_lock(&h->lock);
+    while (!h->stop)
+      if (pthread_cond_timedwait(&h->wake, &h->lock, &ts))
+        break;
+    stop = h->stop;
+
+    /* nothing new for a while; don't leave writes waiting for the
+     * next play */
+    if (xr_now() - h->last_sync >= h->sync_every)
+      hist_sync(h);
+    pthread_mutex_unlock(&h->lock);
+  }
+
+  rec_close(h, &r, END_RECORD);
+  return NULL;
+}
+
+static void *rec_stop(void *data) {
+  xr_hist *h = data;
+
+  /* the thread doesn't exist in a forked child */
+  if (!h->running || h->gen != xr_fork_gen) {
+    h->running = 0;
+    return NULL;
+  }
+
+  pthread_mutex_lock(&h->lock);
+  h->stop = 1;
+  pthread_cond_signal(&h->wake);
+  pthread_mutex_unlock(&h->lock);
+  pthread_join(h->thread, NULL);
+  h->running = 0;
+
+  return NULL;
+}
+
+/*
+ * Let go of a forked child's copy of the journal, which the parent
+ * owns.
+ */
+static void hist_release(xr_hist *h) {
+  if (h->map)
+    munmap(h->map, h->num_slots * SLOT);
+  if (h->fd >= 0)
+    close(h->fd);
+  h->map = NULL;
+  h->fd = -1;
+}
+
+static void hist_free(xr_hist *h) {
+  rec_stop(h);
+  if (h->gen == xr_fork_gen) {
+    hist_close(h);
+    pthread_mutex_destroy(&h->lock);
+    pthread_cond_destroy(&h->wake);
+  } else {
+    hist_release(h);
+  }
+  free(h->path);
+  xfree(h);
+}
+
+/*
+ * Get a journal.  A forked child can't use the parent's: its idea of
+ * where the journal ends goes stale as soon as the parent appends, and
+ * the two would overwrite each other's plays.
+ */
+static xr_hist *get_hist(VALUE self) {
+  xr_hist *h;
+
+  Data_Get_Struct(self, xr_hist, h);
+  if (h->gen != xr_fork_gen)
+    rb_raise(eError, "history journal belongs to the parent process");
+  if (!h->map)
+    rb_raise(eError, "history journal is closed");
+
+  return h;
+}
+
+/****************/
+/* RUBY METHODS */
+/****************/
+
+static int64_t time_us(VALUE t) {
+  if (rb_obj_is_kind_of(t, rb_cTime))
+    t = rb_funcall(t, rb_intern("to_f"), 0);
+  return (int64_t) (NUM2DBL(t) * 1e6);
+}
+
+/*
+ * Open a history journal, creating it if it doesn't exist.
+ *
+ * This method raises a SystemCallError exception if the file can't be
+ * opened or created, or isn't a history journal.
+ *
+ * Example:
+ *   history = Xmms::History.new('/var/log/xmms/plays.hist')
+ *
+ */
+static VALUE xrh_new(VALUE klass, VALUE path) {
+  VALUE self;
+  xr_hist *h;
+
+  self = Data_Make_Struct(klass, xr_hist, 0, hist_free, h);
+  h->fd = -1;
+  h->gen = xr_fork_gen;
+  h->interval = DEFAULT_INTERVAL;
+  h->sync_every = DEFAULT_SYNC;
+  pthread_mutex_init(&h->lock, NULL);
+  pthread_cond_init(&h->wake, NULL);
+  h->path = strdup(StringValueCStr(path));
+
+  if (hist_open(h) < 0) {
+    int err = errno;
+
+    hist_close(h);
+    errno = err;
+    rb_sys_fail(RSTRING_PTR(path));
+  }
+
+  rb_obj_call_init(self, 1, &path);
+  return self;
+}
+
+/*
+ * Xmms::History constructor.
+ *
+ * This function is currently just a placeholder.
+ *
+ */
+static VALUE xrh_init(VALUE self, VALUE path) {
+  UNUSED(path);
+  return self;
+}
+
+/*
+ * Start recording plays from a session (an Xmms::Remote or a session
+ * number).
+ *
+ * Options:
+ *   :interval   how often to check the session, in seconds (default 0.1)
+ *   :sync       how often to sync the journal to disk, in seconds
+ *               (default 1.0)
+ *
+ * This method raises an Xmms::Error exception if the recorder is
+ * already running, or its thread can't be created.
+ *
+ * Example:
+ *   history.record(remote)
+ *
+ */
+static VALUE xrh_record(int argc, VALUE *argv, VALUE self) {
+  xr_hist *h = get_hist(self);
+  VALUE who, opts, v;
+  sigset_t all, old;
+  int err, *session;
+
+  rb_scan_args(argc, argv, "11", &who, &opts);
+  if (h->running)
+    rb_raise(eError, "already recording");
+
+  if (rb_obj_is_kind_of(who, cRemote)) {
+    session = XR_SESSION(who);
+    h->session = *session;
+  } else {
+    h->session = NUM2INT(who);
+  }
+
+  if (opts != Qnil) {
+    Check_Type(opts, T_HASH);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("interval")))) != Qnil)
+      h->interval = NUM2DBL(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("sync")))) != Qnil)
+      h->sync_every = NUM2DBL(v);
+  }
+  if (h->interval <= 0 || h->sync_every < 0)
+    rb_raise(rb_eArgError, "invalid interval or sync (out of range)");
+
+  h->stop = 0;
+
+  /* ruby's signals are for ruby's threads */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  err = pthread_create(&h->thread, NULL, rec_thread, h);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (err)
+    rb_raise(eError, "couldn't create recorder thread: %s", strerror(err));
+  h->running = 1;
+
+  return self;
+}
+
+/*
+ * Stop recording.  A track that's still playing is written out with
+ * what it's played so far.
+ *
+ * Example:
+ *   history.stop
+ *
+ */
+static VALUE xrh_stop(VALUE self) {
+  xr_nogvl(rec_stop, get_hist(self), NULL);
+  return self;
+}
+
+/*
+ * Is the recorder running?
+ *
+ * Example:
+ *   history.record(remote) unless history.recording?
+ *
+ */
+static VALUE xrh_recording(VALUE self) {
+  return get_hist(self)->running ? Qtrue : Qfalse;
+}
+
+/*
+ * Append a play by hand (for importing older logs, say).  Plays are
+ * expected in the order they started; range queries assume it.
+ *
+ * This method raises a SystemCallError exception if the journal can't
+ * be grown.
+ *
+ * Example:
+ *   history.append('/srv/music/a.mp3', Time.now - 240, 240.0)
+ *
+ */
+static VALUE xrh_append(int argc, VALUE *argv, VALUE self) {
+  xr_hist *h = get_hist(self);
+  VALUE path, start, played, pos, length;
+  int err;
+
+  rb_scan_args(argc, argv, "32", &path, &start, &played, &pos, &length);
+
+  pthread_mutex_lock(&h->lock);
+  err = hist_append(h, StringValueCStr(path), time_us(start),
+                    (uint32_t) (NUM2DBL(played) * 1000),
+                    pos == Qnil ? -1 : NUM2INT(pos),
+                    length == Qnil ? -1 : NUM2INT(length), END_NEXT);
+  pthread_mutex_unlock(&h->lock);
+
+  if (err < 0)
+    rb_sys_fail(h->path);
+  return self;
+}
+
+static VALUE play_to_ruby(xr_hist *h, hist_play *p) {
+  const char *path = p->path < h->num_strs ? h->strs[p->path] : "";
+  VALUE end;
+
+  switch (p->end) {
+    case END_STOP:   end = sym_stop; break;
+    case END_RECORD: end = sym_record; break;
+    default:         end = sym_next; break;
+  }
+
+  return rb_ary_new3(6, xr_str_new(path, strlen(path), XR_STR_PATH),
+                     rb_time_new(p->start / 1000000, p->start % 1000000),
+                     rb_float_new(p->played / 1000.0),
+                     INT2NUM(p->pos), INT2NUM(p->length), end);
+}
+
+/*
+ * Get the plays that started in a time range (Times, or seconds since
+ * the epoch; nil for no limit), oldest first, as arrays of [file,
+ * start (a Time), seconds played, playlist position, length (ms), how
+ * it ended (:next, :stop, or :record)].  With a block, each play is
+ * yielded instead.
+ *
+ * Examples:
+ *   history.between(Time.local(2026, 10, 1), Time.local(2026, 11, 1)).each do |f, t, secs|
+ *     puts "#{t} #{f} #{secs}"
+ *   end
+ *   history.between(Time.now - 3600, nil) { |f, *| puts f }
+ *
+ */
+static VALUE xrh_between(int argc, VALUE *argv, VALUE self) {
+  xr_hist *h = get_hist(self);
+  VALUE from, to, ret, row;
+  hist_play *plays;
+  size_t i, n;
+  int64_t f, t;
+
+  rb_scan_args(argc, argv, "02", &from, &to);
+  f = (from == Qnil) ? INT64_MIN : time_us(from);
+  t = (to == Qnil) ? INT64_MAX : time_us(to);
+
+  pthread_mutex_lock(&h->lock);
+  plays = hist_range(h, f, t, &n);
+  pthread_mutex_unlock(&h->lock);
+  if (!plays)
+    rb_raise(rb_eNoMemError, "couldn't allocate plays");
+
+  ret = rb_block_given_p() ? Qnil : rb_ary_new2(n);
+  for (i = 0; i < n; i++) {
+    /* the recorder may grow the string table in the meantime */
+    pthread_mutex_lock(&h->lock);
+    row = play_to_ruby(h, &plays[i]);
+    pthread_mutex_unlock(&h->lock);
+
+    if (ret == Qnil)
+      rb_yield(row);
+    else
+      rb_ary_push(ret, row);
+  }
+  free(plays);
+
+  return ret == Qnil ? self : ret;
+}
+
+/*
+ * Iterate over every play, oldest first.  See Xmms::History#between.
+ *
+ * Example:
+ *   history.each { |file, start, secs| puts file if secs >= 30 }
+ *
+ */
+static VALUE xrh_each(VALUE self) {
+  return xrh_between(0, NULL, self);
+}
+
+/*
+ * Get the number of plays in the journal.
+ *
+ * Example:
+ *   puts "#{history.size} plays"
+ *
+ */
+static VALUE xrh_size(VALUE self) {
+  xr_hist *h = get_hist(self);
+  return ULONG2NUM(h->num_plays);
+}
+
+/*
+ * Sync the journal to disk now.
+ *
+ * Example:
+ *   history.sync
+ *
+ */
+static VALUE xrh_sync(VALUE self) {
+  xr_hist *h = get_hist(self);
+
+  pthread_mutex_lock(&h->lock);
+  hist_sync(h);
+  pthread_mutex_unlock(&h->lock);
+
+  return self;
+}
+
+/*
+ * Stop recording, sync and close the journal.  In a forked child, this
+ * just lets go of the child's copy.
+ *
+ * Example:
+ *   history.close
+ *
+ */
+static VALUE xrh_close(VALUE self) {
+  xr_hist *h;
+
+  Data_Get_Struct(self, xr_hist, h);
+  if (!h->map)
+    return Qnil;
+  if (h->gen != xr_fork_gen) {
+    hist_release(h);
+    return Qnil;
+  }
+
+  xrh_stop(self);
+  pthread_mutex_lock(&h->lock);
+  hist_close(h);
+  pthread_mutex_unlock(&h->lock);
+
+  return Qnil;
+}
+
+/*
+ * Get statistics, as a hash: :plays, :files (distinct file names),
+ * :bytes (of the journal in use), :syncs, and :append_us (the average
+ * time to append a play, in microseconds, syncs included).
+ *
+ * Example:
+ *   p history.stats
+ *
+ */
+static VALUE xrh_stats(VALUE self) {
+  xr_hist *h = get_hist(self);
+  VALUE ret = rb_hash_new();
+
+  pthread_mutex_lock(&h->lock);
+  rb_hash_aset(ret, ID2SYM(rb_intern("plays")), ULONG2NUM(h->num_plays));
+  rb_hash_aset(ret, ID2SYM(rb_intern("files")), UINT2NUM(h->num_strs));
+  rb_hash_aset(ret, ID2SYM(rb_intern("bytes")), ULONG2NUM(h->used * SLOT));
+  rb_hash_aset(ret, ID2SYM(rb_intern("syncs")), ULONG2NUM(h->num_syncs));
+  rb_hash_aset(ret, ID2SYM(rb_intern("append_us")),
+               rb_float_new(h->num_plays ? h->append_time * 1e6 / h->num_plays : 0.0));
+  pthread_mutex_unlock(&h->lock);
+
+  return ret;
+}
+
+void Init_xmms_history(void) {
+  sym_next = ID2SYM(rb_intern("next"));
+  sym_stop = ID2SYM(rb_intern("stop"));
+  sym_record = ID2SYM(rb_intern("record"));
+
+  cHistory = rb_define_class_under(mXmms, "History", rb_cObject);
+  rb_undef_alloc_func(cHistory);
+  rb_include_module(cHistory, rb_mEnumerable);
+  rb_define_singleton_method(cHistory, "new", xrh_new, 1);
+  rb_define_method(cHistory, "initialize", xrh_init, 1);
+
+  rb_define_method(cHistory, "record", xrh_record, -1);
+  rb_define_method(cHistory, "stop", xrh_stop, 0);
+  rb_define_method(cHistory, "recording?", xrh_recording, 0);
+  rb_define_method(cHistory, "append", xrh_append, -1);
+  rb_define_method(cHistory, "between", xrh_between, -1);
+  rb_define_method(cHistory, "each", xrh_each, 0);
+  rb_define_method(cHistory, "size", xrh_size, 0);
+  rb_define_alias(cHistory, "length", "size");
+  rb_define_method(cHistory, "sync", xrh_sync, 0);
+  rb_define_method(cHistory, "close", xrh_close, 0);
+  rb_define_method(cHistory, "stats", xrh_stats, 0);
+}
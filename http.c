@@ -0,0 +1,1447 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Xmms::HTTPServer: a small HTTP/JSON control endpoint.
+ *
+ * Two native threads.  The poller asks XMMS for its state every
+ * :interval seconds (a dozen or so requests, however many clients
+ * there are), and keeps it rendered as JSON, along with the playlist,
+ * one JSON object per entry (refetched when its length changes, when
+ * it's edited through the remote, and every :playlist_interval
+ * seconds).  The server thread answers every connection from a single
+ * poll() loop, from those, so a read costs a memcpy: no ruby, no
+ * interpreter lock, and no round trip to XMMS.
+ *
+ * Endpoints:
+ *   GET  /status               the current state
+ *   GET  /status?since=V       ... once its version is past V (a long
+ *                              poll, for up to ?wait= or :long_poll
+ *                              seconds)
+ *   GET  /events               the state, as server-sent events, each
+ *                              time it changes
+ *   GET  /playlist?offset=&limit=   a page of the playlist
+ *   POST /play, /pause, /stop, /play_pause, /next, /prev, /repeat,
+ *        /shuffle, /jump?pos=, /seek?time=, /volume?value=,
+ *        /balance?value=
+ *
+ * Connections are HTTP/1.1 keep-alive (and may pipeline requests).
+ * Parameters come from the query string or a urlencoded body.  With a
+ * :token, every request needs it, as "Authorization: Bearer <token>"
+ * or ?token=.
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include "xmms_ruby.h"
+
+/* defaults */
+#define DEFAULT_BIND              "127.0.0.1"
+#define DEFAULT_PORT              8080
+#define DEFAULT_INTERVAL          0.25
+#define DEFAULT_PLAYLIST_INTERVAL 10.0
+#define DEFAULT_LONG_POLL         30.0
+#define DEFAULT_PAGE              50
+#define DEFAULT_MAX_CLIENTS       1024
+
+/* largest page of the playlist */
+#define MAX_PAGE 1000
+
+/* largest request (headers and body) */
+#define MAX_REQUEST 16384
+
+/* most unsent output before a slow client is dropped */
+#define MAX_PENDING (1 << 20)
+
+/* seconds between keepalive comments on an event stream */
+#define HEARTBEAT 15.0
+
+/* how far (ms) the output time can stray from where it should be
+ * before it counts as a change (a seek) */
+#define SEEK_SLOP 2000
+
+/* connection modes */
+#define CONN_HTTP   0             /* reading requests */
+#define CONN_WAIT   1             /* a long poll */
+#define CONN_EVENTS 2             /* an event stream */
+
+typedef struct {
+  char *ptr;
+  size_t len,
+         cap;
+} buffer;
+
+typedef struct {
+  int fd,
+      mode,
+      close_after;                /* close once the output is sent */
+  buffer in,
+         out;
+  size_t sent;
+  unsigned long since;            /* CONN_WAIT */
+  double deadline,                /* CONN_WAIT */
+         beat;                    /* CONN_EVENTS: next heartbeat */
+  unsigned long seen,             /* CONN_EVENTS: versions sent */
+                pl_seen;
+} conn;
+
+/* what the poller saw */
+typedef struct {
+  int running,
+      playing,
+      paused,
+      pos,
+      time,
+      length,
+      volume,
+      balance,
+      repeat,
+      shuffle,
+      entries;
+  gchar *title,
+        *file;
+} status;
+
+typedef struct {
+  int session;
+  char bind[64];
+  int port,
+      page,
+      max_clients;
+  double interval,
+         playlist_interval,
+         long_poll;
+  char *token;
+
+  int listen_fd,
+      wake[2];
+  conn *conns;
+  int num_conns;
+  struct pollfd *fds;             /* the server thread's (max_clients + 2) */
+
+  /* state, rendered; under the lock */
+  pthread_mutex_t lock;
+  pthread_cond_t poke;
+  buffer status_json;
+  unsigned long version;
+  char **entries;
+  size_t *entry_lens;
+  int num_entries;
+  unsigned long pl_version;
+  int pl_dirty,                   /* refetch the playlist */
+      poked;                      /* refresh now */
+
+  /* the poller's own copy (only touched by the poller) */
+  status last;
+  double last_at,
+         pl_at;
+  unsigned int edits;             /* xr_late_edits() at the last refresh */
+
+  pthread_t server,
+            poller;
+  int running,
+      stop,
+      gen;
+
+  /* statistics */
+  unsigned long num_requests,
+                num_connections,
+                num_commands,
+                num_long_polls,
+                num_streams,
+                num_refreshes,
+                num_pl_fetches,
+                num_errors;
+} xr_http;
+
+static VALUE cHTTPServer;
+
+/***********/
+/* BUFFERS */
+/***********/
+
+static int buf_grow(buffer *b, size_t len) {
+  char *p;
+  size_t cap;
+
+  if (b->len + len <= b->cap)
+    return 1;
+  for (cap = b->cap ? b->cap : 256; cap < b->len + len; cap *= 2)
+    ;
+  if ((p = realloc(b->ptr, cap)) == NULL)
+    return 0;
+  b->ptr = p;
+  b->cap = cap;
+  return 1;
+}
+
+static void buf_add(buffer *b, const char *s, size_t len) {
+  if (buf_grow(b, len)) {
+    memcpy(b->ptr + b->len, s, len);
+    b->len += len;
+  }
+}
+
+static void buf_puts(buffer *b, const char *s) {
+  buf_add(b, s, strlen(s));
+}
+
+static void buf_printf(buffer *b, const char *fmt, ...)
+  __attribute__ ((format(printf, 2, 3)));
+
+static void buf_printf(buffer *b, const char *fmt, ...) {
+  va_list ap;
+  char tmp[256];
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+  va_end(ap);
+  if (n > 0)
+    buf_add(b, tmp, (size_t) n < sizeof(tmp) ? (size_t) n : sizeof(tmp) - 1);
+}
+
+/*
+ * Add a JSON string.  Bytes past ASCII are passed through as they are.
+ */
+static void buf_json_str(buffer *b, const char *s) {
+  const char *run;
+
+  buf_add(b, "\"", 1);
+  for (run = s; s && *s; s++) {
+    unsigned char c = *s;
+
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    buf_add(b, run, s - run);
+    if (c == '"' || c == '\\') {
+      char esc[2] = { '\\', c };
+      buf_add(b, esc, 2);
+    } else {
+      buf_printf(b, "\\u%04x", c);
+    }
+    run = s + 1;
+  }
+  if (s)
+    buf_add(b, run, s - run);
+  buf_add(b, "\"", 1);
+}
+
+static void buf_free(buffer *b) {
+  free(b->ptr);
+  memset(b, 0, sizeof(buffer));
+}
+
+/**********/
+/* POLLER */
+/**********/
+
+static void status_free(status *s) {
+  if (s->title)
+    g_free(s->title);
+  if (s->file)
+    g_free(s->file);
+  s->title = s->file = NULL;
+}
+
+static void status_fetch(xr_http *h, status *s, int pl_dirty) {
+  int n = h->session;
+
+  memset(s, 0, sizeof(status));
+  if (!(s->running = xmms_remote_is_running(n)))
+    return;
+
+  s->playing = xmms_remote_is_playing(n);
+  s->paused = xmms_remote_is_paused(n);
+  s->pos = xmms_remote_get_playlist_pos(n);
+  s->time = xmms_remote_get_output_time(n);
+  s->entries = xmms_remote_get_playlist_length(n);
+  s->volume = xmms_remote_get_main_volume(n);
+  s->balance = xmms_remote_get_balance(n);
+  s->repeat = xmms_remote_is_repeat(n);
+  s->shuffle = xmms_remote_is_shuffle(n);
+
+  /* the current entry, if it's not the one we already have */
+  if (h->last.running && h->last.pos == s->pos && h->last.entries == s->entries &&
+      !pl_dirty) {
+    s->title = h->last.title ? g_strdup(h->last.title) : NULL;
+    s->file = h->last.file ? g_strdup(h->last.file) : NULL;
+    s->length = h->last.length;
+  } else {
+    s->title = xmms_remote_get_playlist_title(n, s->pos);
+    s->file = xmms_remote_get_playlist_file(n, s->pos);
+    s->length = xmms_remote_get_playlist_time(n, s->pos);
+  }
+}
+
+static int str_differ(const char *a, const char *b) {
+  return (!a != !b) || (a && strcmp(a, b));
+}
+
+/*
+ * Has anything changed, apart from the output time moving along as it
+ * should?
+ */
+static int status_changed(xr_http *h, status *s, double now) {
+  status *o = &h->last;
+  int expect;
+
+  if (s->running != o->running || s->playing != o->playing ||
+      s->paused != o->paused || s->pos != o->pos || s->length != o->length ||
+      s->volume != o->volume || s->balance != o->balance ||
+      s->repeat != o->repeat || s->shuffle != o->shuffle ||
+      s->entries != o->entries || str_differ(s->title, o->title) ||
+      str_differ(s->file, o->file))
+    return 1;
+
+  expect = o->time + ((s->playing && !s->paused) ? (int) ((now - h->last_at) * 1000) : 0);
+  return s->time < expect - SEEK_SLOP || s->time > expect + SEEK_SLOP;
+}
+
+static void status_render(xr_http *h, status *s, buffer *b) {
+  buf_printf(b, "{\"version\":%lu,\"running\":%s", h->version, s->running ? "true" : "false");
+  if (s->running) {
+    buf_printf(b, ",\"playing\":%s,\"paused\":%s,\"position\":%d,\"time\":%d,\"length\":%d",
+               s->playing ? "true" : "false", s->paused ? "true" : "false",
+               s->pos, s->time, s->length);
+    buf_puts(b, ",\"title\":");
+    buf_json_str(b, s->title ? s->title : "");
+    buf_puts(b, ",\"file\":");
+    buf_json_str(b, s->file ? s->file : "");
+    buf_printf(b, ",\"volume\":%d,\"balance\":%d,\"repeat\":%s,\"shuffle\":%s,\"entries\":%d",
+               s->volume, s->balance, s->repeat ? "true" : "false",
+               s->shuffle ? "true" : "false", s->entries);
+  }
+  buf_printf(b, ",\"playlist_version\":%lu}", h->pl_version);
+}
+
+static void wake_server(xr_http *h) {
+  if (write(h->wake[1], "", 1) < 0) {
+    /* the pipe is full, so the server's awake anyway */
+  }
+}
+
+/*
+ * Fetch the whole playlist and render each entry.
+ */
+static void playlist_fetch(xr_http *h, int len) {
+  char **entries;
+  size_t *lens;
+  buffer b;
+  gchar *title, *file;
+  int i, n = h->session, old_len;
+
+  entries = calloc(len + 1, sizeof(char*));
+  lens = calloc(len + 1, sizeof(size_t));
+  if (!entries || !lens) {
+    free(entries);
+    free(lens);
+    return;
+  }
+
+  for (i = 0; i < len && !h->stop; i++) {
+    memset(&b, 0, sizeof(b));
+    title = xmms_remote_get_playlist_title(n, i);
+    file = xmms_remote_get_playlist_file(n, i);
+    buf_printf(&b, "{\"position\":%d,\"title\":", i);
+    buf_json_str(&b, title ? title : "");
+    buf_puts(&b, ",\"file\":");
+    buf_json_str(&b, file ? file : "");
+    buf_printf(&b, ",\"length\":%d}", xmms_remote_get_playlist_time(n, i));
+    if (title)
+      g_free(title);
+    if (file)
+      g_free(file);
+    entries[i] = b.ptr;
+    lens[i] = b.len;
+  }
+  len = i;
+
+  pthread_mutex_lock(&h->lock);
+  old_len = h->num_entries;
+  for (i = 0; i < old_len; i++)
+    free(h->entries[i]);
+  free(h->entries);
+  free(h->entry_lens);
+  h->entries = entries;
+  h->entry_lens = lens;
+  h->num_entries = len;
+  h->pl_version++;
+  h->num_pl_fetches++;
+  pthread_mutex_unlock(&h->lock);
+}
+
+static void refresh(xr_http *h) {
+  double now = xr_now();
+  unsigned int edits;
+  status s;
+  buffer b;
+  int changed, pl;
+
+  pthread_mutex_lock(&h->lock);
+  pl = h->pl_dirty;
+  h->pl_dirty = 0;
+  pthread_mutex_unlock(&h->lock);
+
+  /* edited by a command that ran later (see xr_late_edits())? */
+  edits = xr_late_edits(h->session);
+  if (h->edits != edits) {
+    h->edits = edits;
+    pl = 1;
+  }
+
+  status_fetch(h, &s, pl);
+
+  pl = s.running && (pl || s.entries != h->last.entries ||
+                     now - h->pl_at >= h->playlist_interval);
+  if (pl) {
+    playlist_fetch(h, s.entries);
+    h->pl_at = now;
+  }
+
+  changed = pl || status_changed(h, &s, now);
+  memset(&b, 0, sizeof(b));
+
+  pthread_mutex_lock(&h->lock);
+  if (changed)
+    h->version++;
+  status_render(h, &s, &b);
+  buf_free(&h->status_json);
+  h->status_json = b;
+  h->num_refreshes++;
+  pthread_mutex_unlock(&h->lock);
+
+  status_free(&h->last);
+  h->last = s;
+  h->last_at = now;
+
+  if (changed)
+    wake_server(h);
+}
+
+static void *poller_thread(void *data) {
+  xr_http *h = data;
+  struct timespec ts;
+  double t;
+
+  while (!h->stop) {
+    refresh(h);
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    t = ts.tv_sec + ts.tv_nsec / 1e9 + h->interval;
+    ts.tv_sec = (time_t) t;
+    ts.tv_nsec = (long) ((t - (time_t) t) * 1e9);
+
+    pthread_mutex_lock(&h->lock);
+    while (!h->stop && !h->poked)
+      if (pthread_cond_timedwait(&h->poke, &h->lock, &ts))
+        break;
+    h->poked = 0;
+    pthread_mutex_unlock(&h->lock);
+  }
+
+  status_free(&h->last);
+  return NULL;
+}
+
+/*
+ * Ask the poller for a refresh now (after a command, say).
+ */
+static void poke(xr_http *h, int playlist) {
+  pthread_mutex_lock(&h->lock);
+  h->poked = 1;
+  if (playlist)
+    h->pl_dirty = 1;
+  pthread_cond_signal(&h->poke);
+  pthread_mutex_unlock(&h->lock);
+}
+
+/************/
+/* REQUESTS */
+/************/
+
+typedef struct {
+  char method[8];
+  const char *path,
+             *query,              /* NUL-terminated, or NULL */
+             *body;
+  size_t path_len,
+         body_len;
+  int keep_alive;
+  const char *auth;
+  size_t auth_len;
+} request;
+
+static const char *reason(int code) {
+  switch (code) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 503: return "Service Unavailable";
+  }
+  return "Error";
+}
+
+static void respond(conn *c, int code, const char *type, const char *body,
+                    size_t len, int keep_alive) {
+  buf_printf(&c->out, "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n"
+                      "Content-Length: %lu\r\nCache-Control: no-cache\r\n%s\r\n",
+             code, reason(code), type, (unsigned long) len,
+             keep_alive ? "" : "Connection: close\r\n");
+  buf_add(&c->out, body, len);
+  if (!keep_alive)
+    c->close_after = 1;
+}
+
+static void respond_json(conn *c, int code, const char *json, int keep_alive) {
+  respond(c, code, "application/json", json, strlen(json), keep_alive);
+}
+
+static void respond_error(xr_http *h, conn *c, int code, const char *msg, int keep_alive) {
+  buffer b;
+
+  memset(&b, 0, sizeof(b));
+  buf_puts(&b, "{\"error\":");
+  buf_json_str(&b, msg);
+  buf_puts(&b, "}");
+  respond(c, code, "application/json", b.ptr, b.len, keep_alive);
+  buf_free(&b);
+  h->num_errors++;
+}
+
+static void respond_status(xr_http *h, conn *c, int keep_alive) {
+  pthread_mutex_lock(&h->lock);
+  respond(c, 200, "application/json", h->status_json.ptr, h->status_json.len, keep_alive);
+  pthread_mutex_unlock(&h->lock);
+}
+
+/*
+ * Find a parameter in a query string or urlencoded body (numbers only,
+ * so no decoding).  Returns 1 if found.
+ */
+static int param(const char *s, size_t len, const char *name, const char **val, size_t *vlen) {
+  size_t n = strlen(name), i = 0, j;
+
+  while (s && i < len) {
+    for (j = i; j < len && s[j] != '&'; j++)
+      ;
+    if (j - i > n && !strncmp(s + i, name, n) && s[i + n] == '=') {
+      *val = s + i + n + 1;
+      *vlen = j - i - n - 1;
+      return 1;
+    }
+    i = j + 1;
+  }
+
+  return 0;
+}
+
+static int int_param(request *r, const char *name, long *ret) {
+  const char *v;
+  char tmp[32], *end;
+  size_t len;
+
+  if (!param(r->query, r->query ? strlen(r->query) : 0, name, &v, &len) &&
+      !param(r->body, r->body_len, name, &v, &len))
+    return 0;
+  if (!len || len >= sizeof(tmp))
+    return 0;
+  memcpy(tmp, v, len);
+  tmp[len] = '\0';
+  *ret = strtol(tmp, &end, 10);
+  return *end == '\0';
+}
+
+/*
+ * Compare a client's token with ours, taking the same time however
+ * much of it is right (so it can't be guessed a byte at a time).
+ */
+static int token_match(const char *v, size_t len, const char *token, size_t n) {
+  unsigned char diff = (len != n);
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    diff |= (unsigned char) (i < len ? v[i] : 0) ^ (unsigned char) token[i];
+
+  return !diff;
+}
+
+static int authorized(xr_http *h, request *r) {
+  const char *v;
+  size_t len, n;
+
+  if (!h->token)
+    return 1;
+  n = strlen(h->token);
+
+  if (r->auth && r->auth_len > 7 && !strncasecmp(r->auth, "Bearer ", 7) &&
+      token_match(r->auth + 7, r->auth_len - 7, h->token, n))
+    return 1;
+  return param(r->query, r->query ? strlen(r->query) : 0, "token", &v, &len) &&
+         token_match(v, len, h->token, n);
+}
+
+static int path_is(request *r, const char *path) {
+  return r->path_len == strlen(path) && !memcmp(r->path, path, r->path_len);
+}
+
+/* POST commands */
+static const struct {
+  const char *path,
+             *param;              /* required parameter, or NULL */
+  xr_cmd_op op;
+  long min, max;
+} commands[] = {
+  { "/play",       NULL,    XR_CMD_PLAY,            0, 0 },
+  { "/pause",      NULL,    XR_CMD_PAUSE,           0, 0 },
+  { "/stop",       NULL,    XR_CMD_STOP,            0, 0 },
+  { "/play_pause", NULL,    XR_CMD_PLAY_PAUSE,      0, 0 },
+  { "/next",       NULL,    XR_CMD_PLAYLIST_NEXT,   0, 0 },
+  { "/prev",       NULL,    XR_CMD_PLAYLIST_PREV,   0, 0 },
+  { "/repeat",     NULL,    XR_CMD_TOGGLE_REPEAT,   0, 0 },
+  { "/shuffle",    NULL,    XR_CMD_TOGGLE_SHUFFLE,  0, 0 },
+  { "/jump",       "pos",   XR_CMD_SET_PLAYLIST_POS, 0, INT_MAX },
+  { "/seek",       "time",  XR_CMD_JUMP_TO_TIME,    0, INT_MAX },
+  { "/volume",     "value", XR_CMD_SET_MAIN_VOLUME, VOL_MIN, VOL_MAX },
+  { "/balance",    "value", XR_CMD_SET_BALANCE,     -100, 100 },
+  { NULL,          NULL,    XR_NUM_CMDS,            0, 0 }
+};
+
+static void do_command(xr_http *h, conn *c, request *r, int i) {
+  xr_cmd cmd;
+  long v = 0;
+
+  if (commands[i].param) {
+    if (!int_param(r, commands[i].param, &v) || v < commands[i].min || v > commands[i].max) {
+      char msg[64];
+
+      snprintf(msg, sizeof(msg), "missing or invalid %s", commands[i].param);
+      respond_error(h, c, 400, msg, r->keep_alive);
+      return;
+    }
+  }
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.op = commands[i].op;
+  cmd.session = h->session;
+  cmd.ttl = h->interval;
+  cmd.arg[0] = v;
+  xr_cmd_exec(&cmd);
+  xr_cmd_free(&cmd);
+  h->num_commands++;
+
+  if (!cmd.ok) {
+    respond_error(h, c, 503, "XMMS is not running", r->keep_alive);
+    return;
+  }
+
+  poke(h, 0);
+  respond_json(c, 200, "{\"ok\":true}", r->keep_alive);
+}
+
+static void do_playlist(xr_http *h, conn *c, request *r) {
+  long offset = 0, limit = h->page, i, end;
+  buffer b;
+
+  if ((int_param(r, "offset", &offset) && offset < 0) ||
+      (int_param(r, "limit", &limit) && (limit < 0 || limit > MAX_PAGE))) {
+    respond_error(h, c, 400, "invalid offset or limit", r->keep_alive);
+    return;
+  }
+
+  memset(&b, 0, sizeof(b));
+  pthread_mutex_lock(&h->lock);
+  end = offset + limit < h->num_entries ? offset + limit : h->num_entries;
+  buf_printf(&b, "{\"playlist_version\":%lu,\"total\":%d,\"offset\":%ld,\"entries\":[",
+             h->pl_version, h->num_entries, offset);
+  for (i = offset; i < end; i++) {
+    if (i > offset)
+      buf_add(&b, ",", 1);
+    buf_add(&b, h->entries[i], h->entry_lens[i]);
+  }
+  pthread_mutex_unlock(&h->lock);
+  buf_puts(&b, "]}");
+
+  respond(c, 200, "application/json", b.ptr, b.len, r->keep_alive);
+  buf_free(&b);
+}
+
+static void send_event(xr_http *h, conn *c) {
+  pthread_mutex_lock(&h->lock);
+  if (c->pl_seen != h->pl_version) {
+    buf_printf(&c->out, "event: playlist\ndata: {\"playlist_version\":%lu,\"entries\":%d}\n\n",
+               h->pl_version, h->num_entries);
+    c->pl_seen = h->pl_version;
+  }
+  buf_printf(&c->out, "id: %lu\nevent: status\ndata: ", h->version);
+  buf_add(&c->out, h->status_json.ptr, h->status_json.len);
+  buf_puts(&c->out, "\n\n");
+  c->seen = h->version;
+  pthread_mutex_unlock(&h->lock);
+}
+
+static void route(xr_http *h, conn *c, request *r) {
+  int get = !strcmp(r->method, "GET"), post = !strcmp(r->method, "POST"), i;
+  unsigned long version;
+  long since, wait;
+
+  h->num_requests++;
+
+  if (!authorized(h, r)) {
+    respond_error(h, c, 401, "missing or invalid token", r->keep_alive);
+    return;
+  }
+
+  if (path_is(r, "/status")) {
+    if (!get) {
+      respond_error(h, c, 405, "use GET", r->keep_alive);
+      return;
+    }
+
+    pthread_mutex_lock(&h->lock);
+    version = h->version;
+    pthread_mutex_unlock(&h->lock);
+
+    if (int_param(r, "since", &since) && (unsigned long) since >= version) {
+      if (!int_param(r, "wait", &wait) || wait > h->long_poll || wait < 0)
+        wait = h->long_poll;
+      c->mode = CONN_WAIT;
+      c->since = since;
+      c->deadline = xr_now() + wait;
+      c->close_after = !r->keep_alive;
+      h->num_long_polls++;
+      return;
+    }
+
+    respond_status(h, c, r->keep_alive);
+  } else if (path_is(r, "/events")) {
+    if (!get) {
+      respond_error(h, c, 405, "use GET", r->keep_alive);
+      return;
+    }
+
+    buf_puts(&c->out, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                      "Cache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n");
+    c->mode = CONN_EVENTS;
+    c->beat = xr_now() + HEARTBEAT;
+    h->num_streams++;
+    send_event(h, c);
+  } else if (path_is(r, "/playlist")) {
+    if (!get)
+      respond_error(h, c, 405, "use GET", r->keep_alive);
+    else
+      do_playlist(h, c, r);
+  } else {
+    for (i = 0; commands[i].path; i++)
+      if (path_is(r, commands[i].path))
+        break;
+
+    if (!commands[i].path)
+      respond_error(h, c, 404, "no such endpoint", r->keep_alive);
+    else if (!post)
+      respond_error(h, c, 405, "use POST", r->keep_alive);
+    else
+      do_command(h, c, r, i);
+  }
+}
+
+/*
+ * Does a header value contain a word (ignoring case)?
+ */
+static int has_word(const char *s, const char *word) {
+  size_t n = strlen(word);
+
+  for (; *s; s++)
+    if (!strncasecmp(s, word, n))
+      return 1;
+  return 0;
+}
+
+/*
+ * Find the Content-Length of a request, without touching it.
+ */
+static size_t content_length(const char *buf, const char *end) {
+  const char *line;
+
+  for (line = buf; line && line < end; line = strstr(line, "\r\n")) {
+    if (line != buf)
+      line += 2;
+    if (!strncasecmp(line, "Content-Length:", 15))
+      return strtoul(line + 15, NULL, 10);
+  }
+
+  return 0;
+}
+
+/*
+ * Parse and answer the complete requests in a connection's input.
+ */
+static void handle_input(xr_http *h, conn *c) {
+  char *buf, *end, *line, *next, *sp, *q;
+  size_t used = 0, len, clen;
+  request r;
+
+  while (c->mode == CONN_HTTP && !c->close_after) {
+    buf = c->in.ptr + used;
+    len = c->in.len - used;
+
+    /* the end of the headers */
+    end = NULL;
+    for (q = buf; len >= 4 && q <= buf + len - 4; q++)
+      if (q[0] == '\r' && q[1] == '\n' && q[2] == '\r' && q[3] == '\n') {
+        end = q;
+        break;
+      }
+    if (!end) {
+      if (len > MAX_REQUEST) {
+        respond_error(h, c, 413, "request too large", 0);
+        used = c->in.len;
+      }
+      break;
+    }
+
+    /* and of the body */
+    clen = content_length(buf, end);
+    if (clen > MAX_REQUEST) {
+      respond_error(h, c, 413, "request too large", 0);
+      used = c->in.len;
+      break;
+    }
+    if ((size_t) (end + 4 - buf) + clen > len)
+      break;
+
+    /* request line */
+    memset(&r, 0, sizeof(r));
+    *end = '\0';
+    if ((next = strstr(buf, "\r\n")) != NULL)
+      *next = '\0';
+    sp = strchr(buf, ' ');
+    if (!sp || sp - buf >= (int) sizeof(r.method) || !(q = strchr(sp + 1, ' '))) {
+      respond_error(h, c, 400, "bad request line", 0);
+      used = c->in.len;
+      break;
+    }
+    memcpy(r.method, buf, sp - buf);
+    r.path = sp + 1;
+    *q = '\0';
+    r.keep_alive = !strcmp(q + 1, "HTTP/1.1");
+    if ((sp = strchr(r.path, '?')) != NULL) {
+      *sp = '\0';
+      r.query = sp + 1;
+    }
+    r.path_len = strlen(r.path);
+
+    /* headers */
+    for (line = next ? next + 2 : end; line < end; line = next + 2) {
+      if ((next = strstr(line, "\r\n")) == NULL)
+        next = end;
+      *next = '\0';
+
+      if (!strncasecmp(line, "Connection:", 11)) {
+        if (has_word(line + 11, "close"))
+          r.keep_alive = 0;
+        else if (has_word(line + 11, "keep-alive"))
+          r.keep_alive = 1;
+      } else if (!strncasecmp(line, "Authorization:", 14)) {
+        for (r.auth = line + 14; *r.auth == ' '; r.auth++)
+          ;
+        r.auth_len = strlen(r.auth);
+      }
+      if (next == end)
+        break;
+    }
+
+    r.body = end + 4;
+    r.body_len = clen;
+    route(h, c, &r);
+    used += (end + 4 - buf) + clen;
+  }
+
+  /* keep what's left (the start of the next request) */
+  if (used) {
+    memmove(c->in.ptr, c->in.ptr + used, c->in.len - used);
+    c->in.len -= used;
+  }
+}
+
+/***************/
+/* CONNECTIONS */
+/***************/
+
+static void conn_close(xr_http *h, int i) {
+  conn *c = h->conns + i;
+
+  close(c->fd);
+  buf_free(&c->in);
+  buf_free(&c->out);
+  *c = h->conns[--h->num_conns];
+}
+
+static void accept_all(xr_http *h) {
+  int fd, one = 1;
+  conn *c;
+
+  while (h->num_conns < h->max_clients &&
+         (fd = accept(h->listen_fd, NULL, NULL)) >= 0) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    c = h->conns + h->num_conns++;
+    memset(c, 0, sizeof(conn));
+    c->fd = fd;
+    h->num_connections++;
+  }
+}
+
+/*
+ * Read what's there.  Returns 0 if the client hung up.
+ */
+static int conn_read(xr_http *h, conn *c) {
+  ssize_t n;
+
+  for (;;) {
+    /* room for a read, and for a NUL after it (see content_length()) */
+    if (!buf_grow(&c->in, 4097))
+      return 0;
+    n = read(c->fd, c->in.ptr + c->in.len, c->in.cap - c->in.len - 1);
+    if (n > 0) {
+      c->in.len += n;
+      c->in.ptr[c->in.len] = '\0';
+      if (c->in.len > 2 * MAX_REQUEST)
+        break;
+    } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+      break;
+    } else {
+      return 0;
+    }
+  }
+
+  /* anything sent on an event stream is ignored; requests behind a
+   * long poll wait for it */
+  if (c->mode == CONN_HTTP)
+    handle_input(h, c);
+  else if (c->mode == CONN_EVENTS)
+    c->in.len = 0;
+  else if (c->in.len > 2 * MAX_REQUEST)
+    return 0;
+
+  return 1;
+}
+
+/*
+ * Write what we can.  Returns 0 if the connection is finished with.
+ */
+static int conn_write(conn *c) {
+  ssize_t n;
+
+  while (c->sent < c->out.len) {
+    n = send(c->fd, c->out.ptr + c->sent, c->out.len - c->sent, MSG_NOSIGNAL);
+    if (n > 0)
+      c->sent += n;
+    else if (n < 0 && (errno == EAGAIN || errno == EINTR))
+      break;
+    else
+      return 0;
+  }
+
+  if (c->sent == c->out.len) {
+    c->out.len = c->sent = 0;
+    if (c->close_after && c->mode != CONN_WAIT)
+      return 0;
+  } else if (c->out.len - c->sent > MAX_PENDING) {
+    /* not keeping up */
+    return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Answer long polls and feed event streams: on a new version, a long
+ * poll's deadline, or a heartbeat.
+ */
+static void push(xr_http *h, double now) {
+  unsigned long version;
+  conn *c;
+  int i;
+
+  pthread_mutex_lock(&h->lock);
+  version = h->version;
+  pthread_mutex_unlock(&h->lock);
+
+  for (i = 0; i < h->num_conns; i++) {
+    c = h->conns + i;
+    if (c->mode == CONN_WAIT && (version > c->since || now >= c->deadline)) {
+      c->mode = CONN_HTTP;
+      respond_status(h, c, !c->close_after);
+
+      /* requests pipelined behind the long poll */
+      handle_input(h, c);
+    } else if (c->mode == CONN_EVENTS) {
+      if (version != c->seen)
+        send_event(h, c);
+      else if (now >= c->beat)
+        buf_puts(&c->out, ": keepalive\n\n");
+      else
+        continue;
+      c->beat = now + HEARTBEAT;
+    }
+  }
+}
+
+/*
+ * How long poll() can sleep before a long poll or heartbeat is due, in
+ * ms.
+ */
+static int next_due(xr_http *h, double now) {
+  double t = HEARTBEAT;
+  int i;
+
+  for (i = 0; i < h->num_conns; i++) {
+    if (h->conns[i].mode == CONN_WAIT && h->conns[i].deadline - now < t)
+      t = h->conns[i].deadline - now;
+    else if (h->conns[i].mode == CONN_EVENTS && h->conns[i].beat - now < t)
+      t = h->conns[i].beat - now;
+  }
+
+  return t <= 0 ? 0 : (int) (t * 1000) + 1;
+}
+
+static void *server_thread(void *data) {
+  xr_http *h = data;
+  struct pollfd *fds = h->fds;
+  char junk[256];
+  int i, n;
+
+  while (!h->stop) {
+    fds[0].fd = h->wake[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = h->listen_fd;
+    fds[1].events = h->num_conns < h->max_clients ? POLLIN : 0;
+    for (i = 0; i < h->num_conns; i++) {
+      fds[i + 2].fd = h->conns[i].fd;
+      fds[i + 2].events = POLLIN | (h->conns[i].sent < h->conns[i].out.len ? POLLOUT : 0);
+      fds[i + 2].revents = 0;
+    }
+    n = h->num_conns;
+
+    if (poll(fds, n + 2, next_due(h, xr_now())) < 0)
+      continue;
+    if (fds[0].revents)
+      while (read(h->wake[0], junk, sizeof(junk)) > 0)
+        ;
+
+    /* downwards, so closing (which moves the last one into the gap)
+     * doesn't skip anyone */
+    for (i = n - 1; i >= 0; i--)
+      if ((fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) &&
+          !conn_read(h, h->conns + i))
+        conn_close(h, i);
+
+    push(h, xr_now());
+
+    for (i = h->num_conns - 1; i >= 0; i--)
+      if (h->conns[i].out.len && !conn_write(h->conns + i))
+        conn_close(h, i);
+
+    if (fds[1].revents)
+      accept_all(h);
+  }
+
+  while (h->num_conns)
+    conn_close(h, h->num_conns - 1);
+
+  return NULL;
+}
+
+/**********/
+/* SERVER */
+/**********/
+
+static void *server_stop(void *data) {
+  xr_http *h = data;
+
+  if (!h->running)
+    return NULL;
+  h->running = 0;
+
+  /* the threads don't exist in a forked child; just let go */
+  if (h->gen != xr_fork_gen) {
+    close(h->listen_fd);
+    close(h->wake[0]);
+    close(h->wake[1]);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&h->lock);
+  h->stop = 1;
+  pthread_cond_signal(&h->poke);
+  pthread_mutex_unlock(&h->lock);
+  wake_server(h);
+
+  pthread_join(h->poller, NULL);
+  pthread_join(h->server, NULL);
+  close(h->listen_fd);
+  close(h->wake[0]);
+  close(h->wake[1]);
+
+  return NULL;
+}
+
+static void http_free(xr_http *h) {
+  int i;
+
+  server_stop(h);
+  if (h->gen == xr_fork_gen) {
+    pthread_mutex_destroy(&h->lock);
+    pthread_cond_destroy(&h->poke);
+  }
+  for (i = 0; i < h->num_entries; i++)
+    free(h->entries[i]);
+  free(h->entries);
+  free(h->entry_lens);
+  buf_free(&h->status_json);
+  free(h->conns);
+  free(h->fds);
+  free(h->token);
+  xfree(h);
+}
+
+static xr_http *get_http(VALUE self) {
+  xr_http *h;
+  Data_Get_Struct(self, xr_http, h);
+  return h;
+}
+
+/*
+ * Playlist edits through the remote the server was started with (see
+ * xr_pl_listen()): refetch the playlist now.
+ */
+static void pl_hook(VALUE obj, xr_pl_op op, int pos, int argc, VALUE *argv) {
+  xr_http *h = get_http(obj);
+
+  UNUSED(op);
+  UNUSED(pos);
+  UNUSED(argc);
+  UNUSED(argv);
+  if (h->running && h->gen == xr_fork_gen)
+    poke(h, 1);
+}
+
+/****************/
+/* RUBY METHODS */
+/****************/
+
+/*
+ * Start an HTTP/JSON control server for an XMMS session (an
+ * Xmms::Remote or a session number).
+ *
+ * Options:
+ *   :port                port to listen on (default 8080; 0 picks one,
+ *                        see Xmms::HTTPServer#port)
+ *   :bind                address to listen on (default "127.0.0.1")
+ *   :token               require this token on every request
+ *   :interval            how often to poll XMMS, in seconds (default
+ *                        0.25)
+ *   :playlist_interval   how often to refetch the playlist anyway, in
+ *                        seconds (default 10.0)
+ *   :long_poll           longest long poll, in seconds (default 30.0)
+ *   :page                default playlist page size (default 50)
+ *   :max_clients         most connections at once (default 1024)
+ *
+ * See the top of http.c for the endpoints.  Every response is JSON
+ * (except /events, which is a text/event-stream); /status looks like
+ *   {"version":12,"running":true,"playing":true,"paused":false,
+ *    "position":3,"time":61250,"length":243000,"title":"...",
+ *    "file":"...","volume":80,"balance":0,"repeat":false,
+ *    "shuffle":false,"entries":120,"playlist_version":2}
+ * where version goes up whenever anything but the time changes (or the
+ * time jumps), and playlist_version whenever the playlist is
+ * refetched.
+ *
+ * This method raises an ArgumentError exception if an option is out of
+ * range, a SystemCallError exception if the socket can't be set up,
+ * and an Xmms::Error exception if the server's threads can't be
+ * created.
+ *
+ * Examples:
+ *   server = Xmms::HTTPServer.new(remote, :port => 8080)
+ *   # curl localhost:8080/status
+ *   # curl -X POST localhost:8080/next
+ *   # curl -N localhost:8080/events
+ *
+ *   # for phones on the local network
+ *   server = Xmms::HTTPServer.new(remote, :bind => '0.0.0.0', :token => 's3kr1t')
+ *
+ */
+static VALUE xrs_new(int argc, VALUE *argv, VALUE klass) {
+  VALUE self, who, opts, v;
+  struct sockaddr_in addr;
+  socklen_t alen = sizeof(addr);
+  sigset_t all, old;
+  xr_http *h;
+  int err, one = 1, *session;
+
+  rb_scan_args(argc, argv, "11", &who, &opts);
+  self = Data_Make_Struct(klass, xr_http, 0, http_free, h);
+  strcpy(h->bind, DEFAULT_BIND);
+  h->port = DEFAULT_PORT;
+  h->interval = DEFAULT_INTERVAL;
+  h->playlist_interval = DEFAULT_PLAYLIST_INTERVAL;
+  h->long_poll = DEFAULT_LONG_POLL;
+  h->page = DEFAULT_PAGE;
+  h->max_clients = DEFAULT_MAX_CLIENTS;
+  h->listen_fd = h->wake[0] = h->wake[1] = -1;
+  h->gen = xr_fork_gen;
+  pthread_mutex_init(&h->lock, NULL);
+  pthread_cond_init(&h->poke, NULL);
+
+  if (rb_obj_is_kind_of(who, cRemote)) {
+    session = XR_SESSION(who);
+    h->session = *session;
+  } else {
+    h->session = NUM2INT(who);
+  }
+
+  if (opts != Qnil) {
+    Check_Type(opts, T_HASH);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("port")))) != Qnil)
+      h->port = NUM2INT(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("bind")))) != Qnil) {
+      StringValue(v);
+      if ((size_t) RSTRING_LEN(v) >= sizeof(h->bind))
+        rb_raise(rb_eArgError, "invalid bind address");
+      strcpy(h->bind, StringValueCStr(v));
+    }
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("token")))) != Qnil)
+      h->token = strdup(StringValueCStr(v));
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("interval")))) != Qnil)
+      h->interval = NUM2DBL(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("playlist_interval")))) != Qnil)
+      h->playlist_interval = NUM2DBL(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("long_poll")))) != Qnil)
+      h->long_poll = NUM2DBL(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("page")))) != Qnil)
+      h->page = NUM2INT(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("max_clients")))) != Qnil)
+      h->max_clients = NUM2INT(v);
+  }
+  if (h->port < 0 || h->port > 65535 || h->interval <= 0 ||
+      h->playlist_interval <= 0 || h->long_poll < 0 || h->page < 1 ||
+      h->page > MAX_PAGE || h->max_clients < 1)
+    rb_raise(rb_eArgError, "invalid option (out of range)");
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(h->port);
+  if (inet_pton(AF_INET, h->bind, &addr.sin_addr) != 1)
+    rb_raise(rb_eArgError, "invalid bind address: %s", h->bind);
+
+  if ((h->conns = malloc(sizeof(conn) * h->max_clients)) == NULL ||
+      (h->fds = malloc(sizeof(struct pollfd) * (h->max_clients + 2))) == NULL)
+    rb_raise(rb_eNoMemError, "couldn't allocate connections");
+
+  if ((h->listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    rb_sys_fail("socket");
+  setsockopt(h->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(h->listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+      listen(h->listen_fd, 128) < 0 ||
+      getsockname(h->listen_fd, (struct sockaddr*) &addr, &alen) < 0) {
+    err = errno;
+    close(h->listen_fd);
+    h->listen_fd = -1;
+    errno = err;
+    rb_sys_fail(h->bind);
+  }
+  h->port = ntohs(addr.sin_port);
+  if (pipe(h->wake) < 0) {
+    close(h->listen_fd);
+    rb_sys_fail("pipe");
+  }
+  fcntl(h->listen_fd, F_SETFL, fcntl(h->listen_fd, F_GETFL) | O_NONBLOCK);
+  fcntl(h->wake[0], F_SETFL, fcntl(h->wake[0], F_GETFL) | O_NONBLOCK);
+  fcntl(h->wake[1], F_SETFL, fcntl(h->wake[1], F_GETFL) | O_NONBLOCK);
+
+  /* something to serve before the first refresh lands */
+  buf_puts(&h->status_json, "{\"version\":0,\"running\":false,\"playlist_version\":0}");
+
+  /* ruby's signals are for ruby's threads */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  err = pthread_create(&h->poller, NULL, poller_thread, h);
+  if (!err && (err = pthread_create(&h->server, NULL, server_thread, h)) != 0) {
+    pthread_mutex_lock(&h->lock);
+    h->stop = 1;
+    pthread_cond_signal(&h->poke);
+    pthread_mutex_unlock(&h->lock);
+    pthread_join(h->poller, NULL);
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (err) {
+    close(h->listen_fd);
+    close(h->wake[0]);
+    close(h->wake[1]);
+    rb_raise(eError, "couldn't create server threads: %s", strerror(err));
+  }
+  h->running = 1;
+
+  /* refetch the playlist when it's edited through this remote */
+  if (rb_obj_is_kind_of(who, cRemote))
+    xr_remote_set(who, XR_SLOT_HTTP, self);
+
+  rb_obj_call_init(self, argc, argv);
+  return self;
+}
+
+/*
+ * Xmms::HTTPServer constructor.
+ *
+ * This function is currently just a placeholder.
+ *
+ */
+static VALUE xrs_init(int argc, VALUE *argv, VALUE self) {
+  UNUSED(argc);
+  UNUSED(argv);
+  return self;
+}
+
+/*
+ * Stop the server.  Open connections (event streams included) are
+ * closed.
+ *
+ * Example:
+ *   server.stop
+ *
+ */
+static VALUE xrs_stop(VALUE self) {
+  xr_nogvl(server_stop, get_http(self), NULL);
+  return self;
+}
+
+/*
+ * Is the server running?
+ *
+ * Example:
+ *   sleep 1 while server.running?
+ *
+ */
+static VALUE xrs_running(VALUE self) {
+  xr_http *h = get_http(self);
+  return (h->running && h->gen == xr_fork_gen) ? Qtrue : Qfalse;
+}
+
+/*
+ * Get the port the server is listening on.
+ *
+ * Example:
+ *   server = Xmms::HTTPServer.new(remote, :port => 0)
+ *   puts "listening on port #{server.port}"
+ *
+ */
+static VALUE xrs_port(VALUE self) {
+  return INT2FIX(get_http(self)->port);
+}
+
+/*
+ * Get the server's base URL.
+ *
+ * Example:
+ *   puts "point your phone at #{server.url}"
+ *
+ */
+static VALUE xrs_url(VALUE self) {
+  xr_http *h = get_http(self);
+  char buf[128];
+
+  snprintf(buf, sizeof(buf), "http://%s:%d/", h->bind, h->port);
+  return rb_str_new2(buf);
+}
+
+#define STAT(h, f) ULONG2NUM(__atomic_load_n(&(h)->f, __ATOMIC_RELAXED))
+
+/*
+ * Get statistics, as a hash:
+ *   :requests        requests answered
+ *   :connections     connections accepted
+ *   :commands        commands sent to XMMS
+ *   :long_polls      long polls started
+ *   :streams         event streams started
+ *   :refreshes       times the state was polled from XMMS
+ *   :playlist_fetches times the playlist was fetched
+ *   :errors          error responses
+ *   :version         the current state version
+ *
+ * Example:
+ *   p server.stats
+ *
+ */
+static VALUE xrs_stats(VALUE self) {
+  xr_http *h = get_http(self);
+  VALUE ret = rb_hash_new();
+
+  rb_hash_aset(ret, ID2SYM(rb_intern("requests")), STAT(h, num_requests));
+  rb_hash_aset(ret, ID2SYM(rb_intern("connections")), STAT(h, num_connections));
+  rb_hash_aset(ret, ID2SYM(rb_intern("commands")), STAT(h, num_commands));
+  rb_hash_aset(ret, ID2SYM(rb_intern("long_polls")), STAT(h, num_long_polls));
+  rb_hash_aset(ret, ID2SYM(rb_intern("streams")), STAT(h, num_streams));
+  rb_hash_aset(ret, ID2SYM(rb_intern("refreshes")), STAT(h, num_refreshes));
+  rb_hash_aset(ret, ID2SYM(rb_intern("playlist_fetches")), STAT(h, num_pl_fetches));
+  rb_hash_aset(ret, ID2SYM(rb_intern("errors")), STAT(h, num_errors));
+  rb_hash_aset(ret, ID2SYM(rb_intern("version")), STAT(h, version));
+
+  return ret;
+}
+
+void Init_xmms_http(void) {
+  cHTTPServer = rb_define_class_under(mXmms, "HTTPServer", rb_cObject);
+  rb_undef_alloc_func(cHTTPServer);
+  rb_define_singleton_method(cHTTPServer, "new", xrs_new, -1);
+  rb_define_method(cHTTPServer, "initialize", xrs_init, -1);
+
+  rb_define_method(cHTTPServer, "stop", xrs_stop, 0);
+  rb_define_method(cHTTPServer, "running?", xrs_running, 0);
+  rb_define_method(cHTTPServer, "port", xrs_port, 0);
+  rb_define_method(cHTTPServer, "url", xrs_url, 0);
+  rb_define_method(cHTTPServer, "stats", xrs_stats, 0);
+
+  xr_pl_listen(XR_SLOT_HTTP, pl_hook);
+}
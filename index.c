@@ -0,0 +1,718 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+
+/*
+ * Xmms::Index: an in-memory search index over the playlist.
+ *
+ * Each entry's title and path are lowercased and stored once; every
+ * 3-byte window of that text (a trigram) and every 1 or 2 byte word
+ * maps to a posting list of entry ids.  Entry ids are stable, so
+ * inserting into or deleting from the middle of the playlist only has
+ * to shift the id <-> position maps, not rewrite the postings.
+ * Postings for deleted entries are left in place and skipped on lookup
+ * until there are enough of them to make a compaction worthwhile.
+ */
+#include <ctype.h>
+#include "xmms_ruby.h"
+
+/* keys for words have the high bit set; trigrams never do */
+#define WORD_KEY_BIT 0x80000000U
+
+/* compact once at least this many deleted entries are lying around */
+#define MIN_COMPACT 1024
+
+typedef struct {
+  unsigned int key,
+               len,
+               cap,
+               *ids;
+} posting;
+
+typedef struct {
+  int session;
+
+  /* indexed by entry id */
+  char **text;          /* lowercased "title\nfile"; NULL once deleted */
+  int *pos;             /* playlist position; -1 once deleted */
+  unsigned int num_ids,
+               ids_cap,
+               num_dead;
+
+  /* indexed by playlist position */
+  unsigned int *order;
+  int len,
+      order_cap;
+
+  /* open-addressed hash of key -> posting */
+  posting *slots;
+  unsigned int num_slots,
+               num_keys;
+
+  size_t text_bytes,
+         post_bytes;
+
+  unsigned int edits;   /* xr_late_edits() when built */
+} xr_index;
+
+static VALUE cIndex;
+
+/***********/
+/* HASHING */
+/***********/
+
+static int is_sep(int c) {
+  return c == '\n' || c == '/' || c == '.' || c == '_' || c == '-' ||
+         c == '(' || c == ')' || c == '[' || c == ']' || c == ',' ||
+         c == '&' || c == '+' || isspace(c);
+}
+
+static unsigned int trigram_key(const unsigned char *p) {
+  return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+static unsigned int word_key(const unsigned char *p, int len) {
+  unsigned int h = 2166136261U;
+  int i;
+
+  for (i = 0; i < len; i++)
+    h = (h ^ p[i]) * 16777619U;
+
+  return h | WORD_KEY_BIT;
+}
+
+static unsigned int slot_hash(unsigned int key) {
+  key ^= key >> 16;
+  key *= 0x45d9f3bU;
+  key ^= key >> 16;
+  return key;
+}
+
+/*
+ * Find the posting list for a key, optionally creating it.
+ */
+static posting *idx_posting(xr_index *idx, unsigned int key, int create) {
+  unsigned int i, mask;
+  posting *old;
+
+  if (!idx->num_slots) {
+    if (!create)
+      return NULL;
+    idx->num_slots = 1024;
+    idx->slots = ALLOC_N(posting, idx->num_slots);
+    memset(idx->slots, 0, sizeof(posting) * idx->num_slots);
+  } else if (create && (idx->num_keys + 1) * 10 >= idx->num_slots * 7) {
+    /* grow the table */
+    unsigned int j, old_num = idx->num_slots;
+
+    old = idx->slots;
+    idx->num_slots *= 2;
+    idx->slots = ALLOC_N(posting, idx->num_slots);
+    memset(idx->slots, 0, sizeof(posting) * idx->num_slots);
+    mask = idx->num_slots - 1;
+
+    for (j = 0; j < old_num; j++) {
+      if (!old[j].key)
+        continue;
+      for (i = slot_hash(old[j].key) & mask; idx->slots[i].key; i = (i + 1) & mask);
+      idx->slots[i] = old[j];
+    }
+    xfree(old);
+  }
+
+  mask = idx->num_slots - 1;
+  for (i = slot_hash(key) & mask; idx->slots[i].key; i = (i + 1) & mask)
+    if (idx->slots[i].key == key)
+      return idx->slots + i;
+
+  if (!create)
+    return NULL;
+
+  idx->slots[i].key = key;
+  idx->num_keys++;
+  return idx->slots + i;
+}
+
+static void idx_post(xr_index *idx, unsigned int key, unsigned int id) {
+  posting *p = idx_posting(idx, key, 1);
+
+  /* ids are posted in increasing order, so this catches repeats */
+  if (p->len && p->ids[p->len - 1] == id)
+    return;
+
+  if (p->len == p->cap) {
+    idx->post_bytes += sizeof(unsigned int) * (p->cap ? p->cap : 2);
+    p->cap = p->cap ? p->cap * 2 : 2;
+    REALLOC_N(p->ids, unsigned int, p->cap);
+  }
+  p->ids[p->len++] = id;
+}
+
+/*
+ * Post every trigram and every short word of an entry's text.
+ */
+static void idx_post_text(xr_index *idx, const char *text, unsigned int id) {
+  const unsigned char *p = (const unsigned char*) text, *word = p;
+
+  for (; *p; p++) {
+    if (p[1] && p[2] && p[0] != '\n' && p[1] != '\n' && p[2] != '\n')
+      idx_post(idx, trigram_key(p), id);
+
+    if (is_sep(*p)) {
+      if (p - word > 0 && p - word < 3)
+        idx_post(idx, word_key(word, p - word), id);
+      word = p + 1;
+    }
+  }
+  if (p - word > 0 && p - word < 3)
+    idx_post(idx, word_key(word, p - word), id);
+}
+
+/***********/
+/* ENTRIES */
+/***********/
+
+static void idx_clear_postings(xr_index *idx) {
+  unsigned int i;
+
+  for (i = 0; i < idx->num_slots; i++)
+    if (idx->slots[i].ids)
+      xfree(idx->slots[i].ids);
+  if (idx->slots)
+    xfree(idx->slots);
+
+  idx->slots = NULL;
+  idx->num_slots = idx->num_keys = 0;
+  idx->post_bytes = 0;
+}
+
+static void idx_clear(xr_index *idx) {
+  unsigned int i, edits = idx->edits;
+  int session = idx->session;
+
+  for (i = 0; i < idx->num_ids; i++)
+    if (idx->text[i])
+      xfree(idx->text[i]);
+  idx_clear_postings(idx);
+
+  if (idx->text)
+    xfree(idx->text);
+  if (idx->pos)
+    xfree(idx->pos);
+  if (idx->order)
+    xfree(idx->order);
+
+  memset(idx, 0, sizeof(xr_index));
+  idx->session = session;
+  idx->edits = edits;
+}
+
+/*
+ * Renumber the positions of entries from pos onwards.
+ */
+static void idx_renumber(xr_index *idx, int pos) {
+  for (; pos < idx->len; pos++)
+    idx->pos[idx->order[pos]] = pos;
+}
+
+/*
+ * Add an entry at the given playlist position (or at the end, if pos
+ * is out of range).  title and file may be NULL.
+ */
+static void idx_insert(xr_index *idx, int pos, const char *title, const char *file) {
+  unsigned int id;
+  size_t tlen, flen;
+  char *text, *p;
+
+  if (!title)
+    title = "";
+  if (!file)
+    file = "";
+
+  if (idx->num_ids == idx->ids_cap) {
+    idx->ids_cap = idx->ids_cap ? idx->ids_cap * 2 : 256;
+    REALLOC_N(idx->text, char*, idx->ids_cap);
+    REALLOC_N(idx->pos, int, idx->ids_cap);
+  }
+  if (idx->len == idx->order_cap) {
+    idx->order_cap = idx->order_cap ? idx->order_cap * 2 : 256;
+    REALLOC_N(idx->order, unsigned int, idx->order_cap);
+  }
+
+  /* lowercased "title\nfile" */
+  tlen = strlen(title);
+  flen = strlen(file);
+  text = ALLOC_N(char, tlen + flen + 2);
+  memcpy(text, title, tlen);
+  text[tlen] = '\n';
+  memcpy(text + tlen + 1, file, flen + 1);
+  for (p = text; *p; p++)
+    *p = tolower((unsigned char) *p);
+  idx->text_bytes += tlen + flen + 2;
+
+  id = idx->num_ids++;
+  idx->text[id] = text;
+  idx_post_text(idx, text, id);
+
+  if (pos < 0 || pos > idx->len)
+    pos = idx->len;
+  memmove(idx->order + pos + 1, idx->order + pos, sizeof(unsigned int) * (idx->len - pos));
+  idx->order[pos] = id;
+  idx->len++;
+  idx_renumber(idx, pos);
+}
+
+/*
+ * Rebuild the postings from the stored text, dropping deleted entries
+ * and renumbering ids to match playlist positions.
+ */
+static void idx_compact(xr_index *idx) {
+  char **text;
+  int i;
+
+  /* live entries move to id == position */
+  text = ALLOC_N(char*, idx->ids_cap);
+  for (i = 0; i < idx->len; i++) {
+    text[i] = idx->text[idx->order[i]];
+    idx->pos[i] = idx->order[i] = i;
+  }
+  xfree(idx->text);
+  idx->text = text;
+  idx->num_ids = idx->len;
+  idx->num_dead = 0;
+
+  idx_clear_postings(idx);
+  for (i = 0; i < idx->len; i++)
+    idx_post_text(idx, idx->text[i], i);
+}
+
+/*
+ * Delete the entries at the given positions (as Fixnums, numbered
+ * before any of the deletes take effect).
+ */
+static void idx_delete(xr_index *idx, int argc, VALUE *argv) {
+  unsigned int id;
+  int i, pos, first = idx->len;
+
+  /* tombstone the entries... */
+  for (i = 0; i < argc; i++) {
+    pos = FIX2INT(argv[i]);
+    if (pos < 0 || pos >= idx->len || idx->pos[id = idx->order[pos]] < 0)
+      continue;
+
+    idx->text_bytes -= strlen(idx->text[id]) + 1;
+    xfree(idx->text[id]);
+    idx->text[id] = NULL;
+    idx->pos[id] = -1;
+    idx->num_dead++;
+    if (pos < first)
+      first = pos;
+  }
+
+  /* ...then drop them from the playlist order in one pass */
+  for (i = pos = first; i < idx->len; i++)
+    if (idx->pos[idx->order[i]] >= 0)
+      idx->order[pos++] = idx->order[i];
+  idx->len = pos;
+  idx_renumber(idx, first);
+
+  if (idx->num_dead >= MIN_COMPACT && idx->num_dead > (unsigned int) idx->len)
+    idx_compact(idx);
+}
+
+/*
+ * Move entries around to match a new playlist order (see
+ * XR_PL_REORDER).  If the index is out of sync with the playlist, it's
+ * left alone (and Xmms::Index#stale? will say so).
+ */
+static void idx_reorder(xr_index *idx, int argc, VALUE *argv) {
+  unsigned int *order;
+  int i, pos;
+
+  if (argc != idx->len)
+    return;
+
+  order = ALLOC_N(unsigned int, idx->order_cap);
+  for (i = 0; i < argc; i++) {
+    pos = FIX2INT(argv[i]);
+    order[i] = idx->order[(pos >= 0 && pos < idx->len) ? pos : i];
+  }
+
+  xfree(idx->order);
+  idx->order = order;
+  idx_renumber(idx, 0);
+}
+
+/*
+ * (Re)build the index from a fresh snapshot of the playlist.
+ */
+static void idx_build(xr_index *idx) {
+  unsigned int edits = xr_late_edits(idx->session);
+  xr_snap snap;
+  int i;
+
+  if (xr_snap_fetch(&snap, idx->session, XR_COL_TITLE | XR_COL_FILE)) {
+    XR_CHECK_INTS();
+    rb_raise(eError, "playlist fetch interrupted");
+  }
+
+  idx_clear(idx);
+  idx->edits = edits;
+  for (i = 0; i < snap.len; i++)
+    idx_insert(idx, -1, snap.titles[i], snap.files[i]);
+
+  xr_snap_free(&snap);
+}
+
+/**********/
+/* LOOKUP */
+/**********/
+
+/*
+ * Does the word occur as a whole word in the text?
+ */
+static int has_word(const char *text, const char *word, int len) {
+  const char *p = text, *start = text;
+
+  for (;; p++) {
+    if (!*p || is_sep((unsigned char) *p)) {
+      if (p - start == len && !memcmp(start, word, len))
+        return 1;
+      if (!*p)
+        return 0;
+      start = p + 1;
+    }
+  }
+}
+
+static int cmp_int(const void *a, const void *b) {
+  return *((const int*) a) - *((const int*) b);
+}
+
+typedef struct {
+  char *str;
+  int len;
+} term;
+
+/*
+ * Return the smallest posting list that every match of the term must
+ * appear in, or NULL if the term can't match anything.
+ */
+static posting *term_posting(xr_index *idx, term *t) {
+  posting *best = NULL, *p;
+  int i;
+
+  if (t->len < 3)
+    return idx_posting(idx, word_key((unsigned char*) t->str, t->len), 0);
+
+  for (i = 0; i + 2 < t->len; i++) {
+    if (!(p = idx_posting(idx, trigram_key((unsigned char*) t->str + i), 0)))
+      return NULL;
+    if (!best || p->len < best->len)
+      best = p;
+  }
+
+  return best;
+}
+
+static int term_match(const char *text, term *t) {
+  return t->len < 3 ? has_word(text, t->str, t->len) : strstr(text, t->str) != NULL;
+}
+
+/*
+ * Find matching playlist positions.  Writes them (sorted) to *ret and
+ * returns the number found.
+ */
+static int idx_lookup(xr_index *idx, char *query, int **ret) {
+  term *terms;
+  posting *base = NULL, *p;
+  int i, j, num_terms = 0, num_ret = 0, *out;
+  char *s;
+  VALUE buf;
+
+  /* lowercase and split the query (which may be long: ALLOCV_N() puts
+   * big buffers on the heap) */
+  terms = ALLOCV_N(term, buf, strlen(query) / 2 + 1);
+  for (s = query; *s; s++)
+    *s = tolower((unsigned char) *s);
+  for (s = query; *s; ) {
+    if (isspace((unsigned char) *s)) {
+      *(s++) = '\0';
+      continue;
+    }
+    terms[num_terms].str = s;
+    for (; *s && !isspace((unsigned char) *s); s++);
+    terms[num_terms].len = s - terms[num_terms].str;
+    num_terms++;
+  }
+
+  *ret = NULL;
+  for (i = 0; i < num_terms; i++) {
+    if (!(p = term_posting(idx, terms + i))) {
+      base = NULL;
+      break;
+    }
+    if (!base || p->len < base->len)
+      base = p;
+  }
+  if (!base) {
+    ALLOCV_END(buf);
+    return 0;
+  }
+
+  /* verify each candidate against every term */
+  out = ALLOC_N(int, base->len);
+  for (i = 0; i < (int) base->len; i++) {
+    unsigned int id = base->ids[i];
+
+    if (idx->pos[id] < 0)
+      continue;
+    for (j = 0; j < num_terms && term_match(idx->text[id], terms + j); j++);
+    if (j == num_terms)
+      out[num_ret++] = idx->pos[id];
+  }
+  ALLOCV_END(buf);
+
+  qsort(out, num_ret, sizeof(int), cmp_int);
+  *ret = out;
+  return num_ret;
+}
+
+/****************/
+/* CHANGE HOOKS */
+/****************/
+
+static void idx_pl_hook(VALUE obj, xr_pl_op op, int pos, int argc, VALUE *argv) {
+  xr_index *idx;
+  int i;
+
+  Data_Get_Struct(obj, xr_index, idx);
+
+  switch (op) {
+    case XR_PL_ADD:
+    case XR_PL_INSERT:
+      /* the title isn't known until XMMS has read the file; index the
+       * path now and pick up the title on the next rebuild */
+      for (i = 0; i < argc; i++)
+        idx_insert(idx, (pos < 0) ? -1 : pos + i, NULL, RSTRING_PTR(argv[i]));
+      break;
+    case XR_PL_DELETE:
+      idx_delete(idx, argc, argv);
+      break;
+    case XR_PL_REORDER:
+      idx_reorder(idx, argc, argv);
+      break;
+    case XR_PL_CLEAR:
+      idx_clear(idx);
+      break;
+  }
+}
+
+/****************/
+/* RUBY METHODS */
+/****************/
+
+static void idx_free(xr_index *idx) {
+  idx_clear(idx);
+  xfree(idx);
+}
+
+/*
+ * Get the playlist index for this session, building it first if
+ * necessary.
+ *
+ * The index is kept with the Xmms::Remote object and is updated in
+ * place by Xmms::Remote#add, #add_url, #ins_url, #delete, and #clear,
+ * so it only needs to be rebuilt (see Xmms::Index#rebuild) if the
+ * playlist is changed by something else (including those methods'
+ * *_async twins, and Xmms::Scheduler cues).
+ *
+ * Building the index fetches the title and path of every entry in the
+ * playlist, which can take a while for very large playlists.
+ *
+ * This method raises an Xmms::Error exception if XMMS is not running.
+ *
+ * Examples:
+ *   # find songs by rush
+ *   remote.index.lookup('rush').each { |i| puts remote.title(i) }
+ *
+ */
+static VALUE xr_pl_index(VALUE self) {
+  xr_index *idx;
+  VALUE ret;
+  int *session;
+
+  if ((ret = xr_remote_slot(self, XR_SLOT_INDEX)) != Qnil)
+    return ret;
+
+  session = XR_SESSION(self);
+  CHECK_SESSION(session);
+
+  ret = Data_Make_Struct(cIndex, xr_index, 0, idx_free, idx);
+  idx->session = *session;
+  idx_build(idx);
+  xr_remote_set(self, XR_SLOT_INDEX, ret);
+
+  return ret;
+}
+
+/*
+ * Find playlist entries matching a query.
+ *
+ * Returns a sorted array of the positions of entries whose title or
+ * path contains every word of the query.  Matching is case-insensitive.
+ * Words shorter than three characters must match a whole word of the
+ * title or path (e.g. 'a' matches the directory "/mp3/a/", but not
+ * "/mp3/abba/").
+ *
+ * Example:
+ *   # print every live recording by the pixies
+ *   remote.index.lookup('pixies live').each do |i|
+ *     puts remote.file(i)
+ *   end
+ *
+ */
+static VALUE xri_lookup(VALUE self, VALUE query) {
+  xr_index *idx;
+  int i, len, *pos;
+  VALUE ret;
+
+  Data_Get_Struct(self, xr_index, idx);
+  query = rb_str_new(RSTRING_PTR(StringValue(query)), RSTRING_LEN(query));
+
+  len = idx_lookup(idx, RSTRING_PTR(query), &pos);
+  ret = rb_ary_new2(len);
+  for (i = 0; i < len; i++)
+    rb_ary_push(ret, INT2FIX(pos[i]));
+  if (pos)
+    xfree(pos);
+
+  return ret;
+}
+
+/*
+ * Rebuild the index from scratch.
+ *
+ * This is only necessary if the playlist was modified by something
+ * other than this Xmms::Remote object, or to pick up the titles of
+ * recently added songs.
+ *
+ * This method raises an Xmms::Error exception if XMMS is not running.
+ *
+ * Example:
+ *   remote.index.rebuild if remote.index.stale?
+ *
+ */
+static VALUE xri_rebuild(VALUE self) {
+  xr_index *idx;
+
+  Data_Get_Struct(self, xr_index, idx);
+  CHECK_SESSION(&idx->session);
+  idx_build(idx);
+
+  return self;
+}
+
+/*
+ * Does the number of entries in the index differ from the number of
+ * entries in the playlist, or has the playlist been edited by an
+ * *_async method or a scheduler cue since the index was built?
+ *
+ * This is a cheap check (a single call to XMMS), so it won't notice
+ * other edits that don't change the length of the playlist.
+ *
+ * This method raises an Xmms::Error exception if XMMS is not running.
+ *
+ * Example:
+ *   remote.index.rebuild if remote.index.stale?
+ *
+ */
+static VALUE xri_stale(VALUE self) {
+  xr_index *idx;
+
+  Data_Get_Struct(self, xr_index, idx);
+  CHECK_SESSION(&idx->session);
+
+  if (idx->edits != xr_late_edits(idx->session))
+    return Qtrue;
+  return (xmms_remote_get_playlist_length(idx->session) != idx->len) ? Qtrue : Qfalse;
+}
+
+/*
+ * Get the number of entries in the index.
+ *
+ * Examples:
+ *   puts "#{remote.index.length} entries indexed"
+ *
+ */
+static VALUE xri_length(VALUE self) {
+  xr_index *idx;
+
+  Data_Get_Struct(self, xr_index, idx);
+
+  return INT2FIX(idx->len);
+}
+
+/*
+ * Get the approximate amount of memory used by the index, in bytes.
+ *
+ * Example:
+ *   puts "index size: #{remote.index.memsize / 1024}k"
+ *
+ */
+static VALUE xri_memsize(VALUE self) {
+  xr_index *idx;
+  size_t ret;
+
+  Data_Get_Struct(self, xr_index, idx);
+  ret = sizeof(xr_index) +
+        idx->text_bytes +
+        idx->post_bytes +
+        idx->ids_cap * (sizeof(char*) + sizeof(int)) +
+        idx->order_cap * sizeof(unsigned int) +
+        idx->num_slots * sizeof(posting);
+
+  return ULONG2NUM(ret);
+}
+
+void Init_xmms_index(void) {
+  xr_pl_listen(XR_SLOT_INDEX, idx_pl_hook);
+
+  rb_define_method(cRemote, "index", xr_pl_index, 0);
+  rb_define_alias(cRemote, "playlist_index", "index");
+
+  cIndex = rb_define_class_under(mXmms, "Index", rb_cObject);
+  rb_undef_alloc_func(cIndex);
+  rb_undef_method(CLASS_OF(cIndex), "new");
+
+  rb_define_method(cIndex, "lookup", xri_lookup, 1);
+  rb_define_alias(cIndex, "find", "lookup");
+  rb_define_method(cIndex, "rebuild", xri_rebuild, 0);
+  rb_define_method(cIndex, "stale?", xri_stale, 0);
+  rb_define_method(cIndex, "length", xri_length, 0);
+  rb_define_alias(cIndex, "size", "length");
+  rb_define_method(cIndex, "memsize", xri_memsize, 0);
+}
@@ -0,0 +1,432 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * A prefix-compressed store for playlist paths.
+ *
+ * Paths are split at each '/'.  Every directory becomes a node in a
+ * trie (the root being node 0), stored once however many entries live
+ * under it, and each path is kept as its directory's node plus the
+ * remaining file name.  Names live back to back in a single string
+ * pool.  A path is decoded by walking up from its directory node.
+ *
+ * Splitting keeps empty components, so any string (URLs included)
+ * decodes to exactly what went in.
+ *
+ * For directory queries, nodes are numbered in depth-first order, so
+ * everything under a directory has a number in [pre, end), and entries
+ * are kept sorted by their directory's number.  That ordering is built
+ * the first time it's needed after an add.
+ */
+#include "xmms_ruby.h"
+
+typedef struct {
+  unsigned int parent,
+               name,              /* offset into the pool */
+               len;
+} node;
+
+typedef struct {
+  unsigned int dir,
+               name,
+               len;
+} entry;
+
+struct xr_paths {
+  char *pool;
+  size_t pool_len,
+         pool_cap;
+
+  node *nodes;
+  unsigned int num_nodes,
+               nodes_cap;
+
+  entry *entries;
+  unsigned int num_entries,
+               entries_cap;
+
+  /* open-addressed hash of (parent, name) -> node id + 1 */
+  unsigned int *slots,
+               num_slots;
+
+  /* directory order (see paths_order()) */
+  int ordered;
+  unsigned int *pre,
+               *end,
+               *by_dir;
+
+  /* decoding buffer for xr_paths_get() */
+  char *buf;
+  size_t buf_cap;
+};
+
+/***********/
+/* HASHING */
+/***********/
+
+static unsigned int name_hash(unsigned int parent, const char *name, unsigned int len) {
+  unsigned int h = 2166136261U ^ parent;
+  unsigned int i;
+
+  for (i = 0; i < len; i++)
+    h = (h ^ (unsigned char) name[i]) * 16777619U;
+
+  return h;
+}
+
+static void paths_rehash(xr_paths *p) {
+  unsigned int i, j, mask;
+
+  p->num_slots = p->num_slots ? p->num_slots * 2 : 64;
+  mask = p->num_slots - 1;
+  xfree(p->slots);
+  p->slots = ALLOC_N(unsigned int, p->num_slots);
+  memset(p->slots, 0, sizeof(unsigned int) * p->num_slots);
+
+  for (i = 1; i < p->num_nodes; i++) {
+    node *n = &p->nodes[i];
+    j = name_hash(n->parent, p->pool + n->name, n->len) & mask;
+    while (p->slots[j])
+      j = (j + 1) & mask;
+    p->slots[j] = i + 1;
+  }
+}
+
+/*
+ * Find the child of parent with the given name, returning its slot.
+ * Returns 0 if there isn't one (and, if slot is non-NULL, sets it to
+ * where the child would go).
+ */
+static unsigned int paths_find(xr_paths *p, unsigned int parent, const char *name, unsigned int len, unsigned int *slot) {
+  unsigned int j, mask = p->num_slots - 1;
+
+  for (j = name_hash(parent, name, len) & mask; p->slots[j]; j = (j + 1) & mask) {
+    node *n = &p->nodes[p->slots[j] - 1];
+    if (n->parent == parent && n->len == len &&
+        !memcmp(p->pool + n->name, name, len))
+      return p->slots[j] - 1;
+  }
+
+  if (slot)
+    *slot = j;
+  return 0;
+}
+
+/************/
+/* BUILDING */
+/************/
+
+static unsigned int paths_intern(xr_paths *p, const char *name, unsigned int len) {
+  size_t ret = p->pool_len;
+
+  if (len == 0)
+    return (unsigned int) ret;
+
+  if (p->pool_len + len > p->pool_cap) {
+    p->pool_cap = p->pool_cap ? p->pool_cap * 2 : 4096;
+    if (p->pool_cap < p->pool_len + len)
+      p->pool_cap = p->pool_len + len;
+    REALLOC_N(p->pool, char, p->pool_cap);
+  }
+
+  memcpy(p->pool + p->pool_len, name, len);
+  p->pool_len += len;
+
+  return (unsigned int) ret;
+}
+
+/*
+ * Get the directory called name under parent, creating it if
+ * necessary.
+ */
+static unsigned int paths_dir(xr_paths *p, unsigned int parent, const char *name, unsigned int len) {
+  unsigned int id, slot;
+
+  if ((id = paths_find(p, parent, name, len, &slot)) != 0)
+    return id;
+
+  if (p->num_nodes == p->nodes_cap) {
+    p->nodes_cap *= 2;
+    REALLOC_N(p->nodes, node, p->nodes_cap);
+  }
+
+  id = p->num_nodes++;
+  p->nodes[id].parent = parent;
+  p->nodes[id].name = paths_intern(p, name, len);
+  p->nodes[id].len = len;
+
+  /* keep the table at most half full */
+  if (p->num_nodes * 2 > p->num_slots)
+    paths_rehash(p);
+  else
+    p->slots[slot] = id + 1;
+
+  return id;
+}
+
+/*
+ * Create an empty path store.
+ */
+xr_paths *xr_paths_new(void) {
+  xr_paths *p = ALLOC(xr_paths);
+
+  memset(p, 0, sizeof(xr_paths));
+  p->nodes_cap = 64;
+  p->nodes = ALLOC_N(node, p->nodes_cap);
+  memset(&p->nodes[0], 0, sizeof(node));
+  p->num_nodes = 1;
+  paths_rehash(p);
+
+  return p;
+}
+
+/*
+ * Add a path (NULL is stored as an empty one).  Returns its id; ids
+ * are handed out in order, starting at 0.
+ */
+int xr_paths_add(xr_paths *p, const char *path) {
+  const char *s = path ? path : "", *slash;
+  unsigned int dir = 0;
+  entry *e;
+
+  while ((slash = strchr(s, '/')) != NULL) {
+    dir = paths_dir(p, dir, s, slash - s);
+    s = slash + 1;
+  }
+
+  if (p->num_entries == p->entries_cap) {
+    p->entries_cap = p->entries_cap ? p->entries_cap * 2 : 256;
+    REALLOC_N(p->entries, entry, p->entries_cap);
+  }
+
+  e = &p->entries[p->num_entries];
+  e->dir = dir;
+  e->len = strlen(s);
+  e->name = paths_intern(p, s, e->len);
+  p->ordered = 0;
+
+  return p->num_entries++;
+}
+
+/*
+ * Give back the memory reserved for further adds.
+ */
+void xr_paths_trim(xr_paths *p) {
+  if (p->pool_len > 0 && p->pool_cap > p->pool_len) {
+    REALLOC_N(p->pool, char, p->pool_len);
+    p->pool_cap = p->pool_len;
+  }
+  if (p->num_entries > 0 && p->entries_cap > p->num_entries) {
+    REALLOC_N(p->entries, entry, p->num_entries);
+    p->entries_cap = p->num_entries;
+  }
+  if (p->nodes_cap > p->num_nodes) {
+    REALLOC_N(p->nodes, node, p->num_nodes);
+    p->nodes_cap = p->num_nodes;
+  }
+}
+
+/*
+ * Get the number of paths in the store.
+ */
+int xr_paths_length(xr_paths *p) {
+  return p->num_entries;
+}
+
+/*
+ * Decode a path.  The result isn't NUL-terminated, and is only good
+ * until the next call.
+ */
+const char *xr_paths_get(xr_paths *p, int id, size_t *len) {
+  entry *e = &p->entries[id];
+  unsigned int d;
+  size_t n = e->len;
+  char *s;
+
+  for (d = e->dir; d; d = p->nodes[d].parent)
+    n += p->nodes[d].len + 1;
+
+  if (n >= p->buf_cap) {
+    p->buf_cap = n + 256;
+    REALLOC_N(p->buf, char, p->buf_cap);
+  }
+
+  /* fill in from the end */
+  s = p->buf + n - e->len;
+  memcpy(s, p->pool + e->name, e->len);
+  for (d = e->dir; d; d = p->nodes[d].parent) {
+    *--s = '/';
+    s -= p->nodes[d].len;
+    memcpy(s, p->pool + p->nodes[d].name, p->nodes[d].len);
+  }
+
+  *len = n;
+  return p->buf;
+}
+
+/*********************/
+/* DIRECTORY QUERIES */
+/*********************/
+
+/*
+ * Number the directories depth first, and sort the entries by
+ * directory.  Parents are always created before their children, so
+ * neither step needs to walk the tree.
+ */
+static void paths_order(xr_paths *p) {
+  unsigned int i, n = p->num_nodes, *size, *next, *count;
+
+  if (p->ordered)
+    return;
+
+  REALLOC_N(p->pre, unsigned int, n);
+  REALLOC_N(p->end, unsigned int, n);
+  REALLOC_N(p->by_dir, unsigned int, p->num_entries + 1);
+  size = ALLOC_N(unsigned int, n);
+  next = ALLOC_N(unsigned int, n + 1);
+
+  /* subtree sizes */
+  for (i = 0; i < n; i++)
+    size[i] = 1;
+  for (i = n - 1; i > 0; i--)
+    size[p->nodes[i].parent] += size[i];
+
+  /* each child takes the next range of its parent's */
+  p->pre[0] = 0;
+  next[0] = 1;
+  for (i = 1; i < n; i++) {
+    unsigned int parent = p->nodes[i].parent;
+    p->pre[i] = next[parent];
+    next[parent] += size[i];
+    next[i] = p->pre[i] + 1;
+  }
+  for (i = 0; i < n; i++)
+    p->end[i] = p->pre[i] + size[i];
+
+  /* counting sort of the entries by their directory's number (stable,
+   * so entries in the same directory stay in playlist order) */
+  count = next;
+  memset(count, 0, sizeof(unsigned int) * (n + 1));
+  for (i = 0; i < p->num_entries; i++)
+    count[p->pre[p->entries[i].dir] + 1]++;
+  for (i = 0; i < n; i++)
+    count[i + 1] += count[i];
+  for (i = 0; i < p->num_entries; i++)
+    p->by_dir[count[p->pre[p->entries[i].dir]]++] = i;
+
+  xfree(size);
+  xfree(next);
+  p->ordered = 1;
+}
+
+/*
+ * Find the first entry in directory order whose directory is numbered
+ * at least pre.
+ */
+static unsigned int paths_lower_bound(xr_paths *p, unsigned int pre) {
+  unsigned int lo = 0, hi = p->num_entries, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (p->pre[p->entries[p->by_dir[mid]].dir] < pre)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+static int cmp_uint(const void *a, const void *b) {
+  unsigned int x = *(const unsigned int*) a, y = *(const unsigned int*) b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * Find every path under a directory (at any depth).  Trailing slashes
+ * on dir are ignored.  Returns the number found, and sets *ret to a
+ * sorted, ALLOC_N()ed array of their ids (or NULL if there were none).
+ */
+int xr_paths_under(xr_paths *p, const char *dir, size_t len, unsigned int **ret) {
+  unsigned int d = 0, lo, hi;
+  const char *s = dir, *e, *slash;
+
+  *ret = NULL;
+  if (len == 0)
+    return 0;
+
+  /* "/" is the (empty) top level directory */
+  while (len > 1 && dir[len - 1] == '/')
+    len--;
+  if (len == 1 && dir[0] == '/')
+    len = 0;
+
+  for (e = dir + len; ; s = slash + 1) {
+    if ((slash = memchr(s, '/', e - s)) == NULL)
+      slash = e;
+    if ((d = paths_find(p, d, s, slash - s, NULL)) == 0)
+      return 0;
+    if (slash == e)
+      break;
+  }
+
+  paths_order(p);
+  lo = paths_lower_bound(p, p->pre[d]);
+  hi = paths_lower_bound(p, p->end[d]);
+  if (lo == hi)
+    return 0;
+
+  *ret = ALLOC_N(unsigned int, hi - lo);
+  memcpy(*ret, p->by_dir + lo, sizeof(unsigned int) * (hi - lo));
+  qsort(*ret, hi - lo, sizeof(unsigned int), cmp_uint);
+
+  return hi - lo;
+}
+
+/*
+ * Get the approximate amount of memory used by a path store, in bytes.
+ */
+size_t xr_paths_memsize(xr_paths *p) {
+  return sizeof(xr_paths) +
+         p->pool_cap +
+         p->nodes_cap * sizeof(node) +
+         p->entries_cap * sizeof(entry) +
+         p->num_slots * sizeof(unsigned int) +
+         (p->ordered ? p->num_nodes * 2 + p->num_entries + 1 : 0) * sizeof(unsigned int) +
+         p->buf_cap;
+}
+
+void xr_paths_free(xr_paths *p) {
+  xfree(p->pool);
+  xfree(p->nodes);
+  xfree(p->entries);
+  xfree(p->slots);
+  xfree(p->pre);
+  xfree(p->end);
+  xfree(p->by_dir);
+  xfree(p->buf);
+  xfree(p);
+}
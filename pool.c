@@ -0,0 +1,541 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Xmms::Pool: a bounded set of reusable Xmms::Remote objects for one
+ * XMMS session, shared between threads.
+ *
+ * libxmms doesn't keep a connection open between calls, so what the
+ * pool saves is the per-request setup: remotes (and, in pipelined
+ * mode, their I/O threads) are created once and handed out again, and
+ * because the pool health-checks the session, pooled remotes skip the
+ * "is XMMS running?" round trip that normally precedes every command
+ * (see xr_session_check()).
+ */
+#include <pthread.h>
+#include "xmms_ruby.h"
+
+/* defaults */
+#define DEFAULT_SIZE            4
+#define DEFAULT_TIMEOUT         5.0
+#define DEFAULT_IDLE_TIMEOUT    60.0
+#define DEFAULT_HEALTH_INTERVAL 1.0
+
+/* longest wait without checking for interrupts, in seconds */
+#define WAIT_SLICE 0.1
+
+typedef struct {
+  int session,
+      size,
+      pipeline;
+  double timeout,
+         idle_timeout,
+         health_interval,
+         last_check;
+
+  /* available remotes; a stack, so the most recently used remote is
+   * handed out first and the idle ones sink to the bottom */
+  VALUE *idle;
+  double *idle_since;
+  int num_idle,
+      num_out;
+
+  /* forks; gen counts pool resets, fork_gen is xr_fork_gen as of the
+   * last one */
+  int gen,
+      fork_gen;
+
+  /* protects num_idle and num_out for threads waiting without the
+   * interpreter lock */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  /* statistics */
+  unsigned long num_created,
+                num_reaped,
+                num_checkouts,
+                num_waits,
+                num_timeouts,
+                num_checks,
+                num_failures,
+                num_resets;
+  double wait_time;
+} xr_pool;
+
+static VALUE cPool;
+static ID id_set_pipeline;
+
+static void pool_mark(xr_pool *p) {
+  int i;
+
+  for (i = 0; i < p->num_idle; i++)
+    rb_gc_mark(p->idle[i]);
+}
+
+static void pool_free(xr_pool *p) {
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->cond);
+  xfree(p->idle);
+  xfree(p->idle_since);
+  xfree(p);
+}
+
+/*
+ * Forget everything inherited from the parent process: the remotes
+ * (whose I/O threads didn't survive the fork) and the lock (which
+ * another thread may have been holding).
+ */
+static void pool_check_fork(xr_pool *p) {
+  if (p->fork_gen == xr_fork_gen)
+    return;
+
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->cond, NULL);
+  p->num_idle = 0;
+  p->num_out = 0;
+  p->last_check = 0;
+  p->fork_gen = xr_fork_gen;
+  p->gen++;
+  p->num_resets++;
+}
+
+/*
+ * Take remotes that have been idle too long off the bottom of the
+ * stack.  Call with the lock held; the reaped remotes are returned in
+ * ary so they can be shut down once it's released.
+ */
+static void pool_reap(xr_pool *p, VALUE ary) {
+  double now = xr_now();
+  int i, n;
+
+  for (n = 0; n < p->num_idle; n++)
+    if (now - p->idle_since[n] < p->idle_timeout)
+      break;
+
+  if (n == 0)
+    return;
+
+  for (i = 0; i < n; i++)
+    rb_ary_push(ary, p->idle[i]);
+
+  memmove(p->idle, p->idle + n, sizeof(VALUE) * (p->num_idle - n));
+  memmove(p->idle_since, p->idle_since + n, sizeof(double) * (p->num_idle - n));
+  p->num_idle -= n;
+  p->num_reaped += n;
+}
+
+static void shutdown_remotes(VALUE ary) {
+  long i;
+
+  for (i = 0; i < RARRAY_LEN(ary); i++)
+    rb_funcall(rb_ary_entry(ary, i), id_set_pipeline, 1, Qfalse);
+}
+
+static VALUE pool_new_remote(VALUE data) {
+  xr_pool *p = (xr_pool*) data;
+  VALUE args[1], r;
+
+  args[0] = INT2FIX(p->session);
+  r = rb_funcall2(cRemote, rb_intern("new"), 1, args);
+  xr_remote_get(r)->alive_ttl = p->health_interval;
+  if (p->pipeline)
+    rb_funcall(r, id_set_pipeline, 1, Qtrue);
+
+  p->num_created++;
+  return r;
+}
+
+typedef struct {
+  xr_pool *pool;
+  double timeout;
+} wait_args;
+
+static void *wait_nogvl(void *data) {
+  wait_args *args = data;
+  xr_pool *p = args->pool;
+  struct timespec ts;
+  double t;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  t = ts.tv_sec + ts.tv_nsec / 1e9 + args->timeout;
+  ts.tv_sec = (time_t) t;
+  ts.tv_nsec = (long) ((t - (time_t) t) * 1e9);
+
+  pthread_mutex_lock(&p->lock);
+  while (p->num_idle == 0 && p->num_idle + p->num_out >= p->size)
+    if (pthread_cond_timedwait(&p->cond, &p->lock, &ts))
+      break;
+  pthread_mutex_unlock(&p->lock);
+
+  return NULL;
+}
+
+/*
+ * Make sure XMMS is running, at most once per health check interval.
+ * Returns zero if it isn't.
+ */
+static int pool_health_check(xr_pool *p) {
+  double now = xr_now();
+
+  if (p->last_check > 0 && now - p->last_check < p->health_interval)
+    return 1;
+
+  p->num_checks++;
+  if (!xr_session_check(p->session, 0)) {
+    p->num_failures++;
+    return 0;
+  }
+
+  p->last_check = now;
+  return 1;
+}
+
+/*
+ * Create a new connection pool.
+ *
+ * Options:
+ *   :size              maximum number of remotes (default 4)
+ *   :timeout           default checkout timeout, in seconds (default 5)
+ *   :idle_timeout      remotes unused for this long are dropped, in
+ *                      seconds (default 60)
+ *   :health_interval   how often to check that XMMS is running, in
+ *                      seconds (default 1); pooled remotes don't check
+ *                      before each command
+ *   :pipeline          put pooled remotes in pipelined mode (default
+ *                      false)
+ *
+ * This method raises an ArgumentError exception if the number of
+ * arguments isn't 0, 1, or 2, or if the size isn't positive.
+ *
+ * Examples:
+ *   pool = Xmms::Pool.new
+ *   pool = Xmms::Pool.new(1, :size => 16, :pipeline => true)
+ *
+ */
+static VALUE xp_new(int argc, VALUE *argv, VALUE klass) {
+  VALUE self, opts = Qnil, v;
+  xr_pool *p;
+  int n = argc;
+
+  if (argc > 2)
+    rb_raise(rb_eArgError, "invalid argument count (not 0, 1, or 2)");
+  if (argc > 0 && TYPE(argv[argc - 1]) == T_HASH)
+    opts = argv[--n];
+
+  self = Data_Make_Struct(klass, xr_pool, pool_mark, pool_free, p);
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->cond, NULL);
+  p->fork_gen = xr_fork_gen;
+
+  p->session = n > 0 ? NUM2INT(argv[0]) : 0;
+  p->size = DEFAULT_SIZE;
+  p->timeout = DEFAULT_TIMEOUT;
+  p->idle_timeout = DEFAULT_IDLE_TIMEOUT;
+  p->health_interval = DEFAULT_HEALTH_INTERVAL;
+
+  if (opts != Qnil) {
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("size")))) != Qnil)
+      p->size = NUM2INT(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("timeout")))) != Qnil)
+      p->timeout = NUM2DBL(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("idle_timeout")))) != Qnil)
+      p->idle_timeout = NUM2DBL(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("health_interval")))) != Qnil)
+      p->health_interval = NUM2DBL(v);
+    p->pipeline = RTEST(rb_hash_aref(opts, ID2SYM(rb_intern("pipeline"))));
+  }
+
+  if (p->size < 1)
+    rb_raise(rb_eArgError, "invalid pool size (not positive)");
+
+  p->idle = ALLOC_N(VALUE, p->size);
+  p->idle_since = ALLOC_N(double, p->size);
+
+  rb_obj_call_init(self, argc, argv);
+  return self;
+}
+
+/*
+ * Xmms::Pool constructor.
+ *
+ * This function is currently just a placeholder.
+ *
+ */
+static VALUE xp_init(int argc, VALUE *argv, VALUE self) {
+  UNUSED(argc);
+  UNUSED(argv);
+  return self;
+}
+
+static VALUE xp_checkin(VALUE self, VALUE r);
+
+/*
+ * Check out a remote, waiting up to timeout seconds (the pool's
+ * default timeout if none is given) for one to be checked back in if
+ * they're all in use.  Remotes must be returned with
+ * Xmms::Pool#checkin; Xmms::Pool#with does that automatically.
+ *
+ * This method raises an Xmms::Error exception if the wait times out or
+ * if XMMS is not running.
+ *
+ * Examples:
+ *   r = pool.checkout
+ *   begin
+ *     puts r.title
+ *   ensure
+ *     pool.checkin r
+ *   end
+ *
+ */
+static VALUE xp_checkout(int argc, VALUE *argv, VALUE self) {
+  xr_pool *p;
+  double timeout, start, left;
+  VALUE r = Qnil, reaped = rb_ary_new();
+  wait_args args;
+  int create = 0, waited = 0;
+
+  Data_Get_Struct(self, xr_pool, p);
+
+  if (argc > 1)
+    rb_raise(rb_eArgError, "invalid argument count (not 0 or 1)");
+  timeout = (argc == 1 && argv[0] != Qnil) ? NUM2DBL(argv[0]) : p->timeout;
+
+  pool_check_fork(p);
+  start = xr_now();
+
+  for (;;) {
+    pthread_mutex_lock(&p->lock);
+    pool_reap(p, reaped);
+    if (p->num_idle > 0) {
+      r = p->idle[--p->num_idle];
+      p->num_out++;
+    } else if (p->num_out < p->size) {
+      /* reserve a slot for a new remote */
+      create = 1;
+      p->num_out++;
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    if (r != Qnil || create)
+      break;
+
+    left = timeout - (xr_now() - start);
+    if (left <= 0) {
+      p->num_timeouts++;
+      shutdown_remotes(reaped);
+      rb_raise(eError, "timed out waiting for a remote (pool size %d)", p->size);
+    }
+
+    waited = 1;
+    args.pool = p;
+    args.timeout = left < WAIT_SLICE ? left : WAIT_SLICE;
+    xr_nogvl(wait_nogvl, &args, NULL);
+    XR_CHECK_INTS();
+  }
+
+  shutdown_remotes(reaped);
+
+  p->num_checkouts++;
+  if (waited) {
+    p->num_waits++;
+    p->wait_time += xr_now() - start;
+  }
+
+  if (create) {
+    r = rb_protect(pool_new_remote, (VALUE) p, &create);
+    if (create) {
+      /* give the slot back */
+      pthread_mutex_lock(&p->lock);
+      p->num_out--;
+      pthread_cond_signal(&p->cond);
+      pthread_mutex_unlock(&p->lock);
+      rb_jump_tag(create);
+    }
+  }
+
+  xr_remote_set(r, XR_SLOT_POOL, self);
+  xr_remote_get(r)->pool_gen = p->gen;
+
+  if (!pool_health_check(p)) {
+    xp_checkin(self, r);
+    rb_raise(eError, "XMMS is not running");
+  }
+
+  return r;
+}
+
+/*
+ * Return a remote to the pool.
+ *
+ * This method raises an ArgumentError exception if the remote wasn't
+ * checked out from this pool (or has already been checked in).
+ *
+ * Example:
+ *   pool.checkin r
+ *
+ */
+static VALUE xp_checkin(VALUE self, VALUE r) {
+  xr_pool *p;
+  VALUE reaped = rb_ary_new();
+
+  Data_Get_Struct(self, xr_pool, p);
+
+  if (!rb_obj_is_kind_of(r, cRemote) ||
+      xr_remote_slot(r, XR_SLOT_POOL) != self)
+    rb_raise(rb_eArgError, "remote isn't checked out from this pool");
+  xr_remote_set(r, XR_SLOT_POOL, Qnil);
+
+  pool_check_fork(p);
+
+  /* checked out before a fork; the pool has forgotten about it */
+  if (xr_remote_get(r)->pool_gen != p->gen)
+    return self;
+
+  pthread_mutex_lock(&p->lock);
+  p->num_out--;
+  p->idle[p->num_idle] = r;
+  p->idle_since[p->num_idle] = xr_now();
+  p->num_idle++;
+  pool_reap(p, reaped);
+  pthread_cond_signal(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+
+  shutdown_remotes(reaped);
+
+  return self;
+}
+
+static VALUE with_ensure(VALUE args) {
+  return xp_checkin(rb_ary_entry(args, 0), rb_ary_entry(args, 1));
+}
+
+/*
+ * Check out a remote, pass it to the block, and check it back in
+ * afterwards (even if the block raises an exception).  Returns the
+ * value of the block.  Takes the same timeout as Xmms::Pool#checkout.
+ *
+ * Example:
+ *   title = pool.with { |r| r.title }
+ *
+ */
+static VALUE xp_with(int argc, VALUE *argv, VALUE self) {
+  VALUE r = xp_checkout(argc, argv, self);
+
+  return rb_ensure(rb_yield, r, with_ensure, rb_ary_new3(2, self, r));
+}
+
+/*
+ * Drop remotes that have been idle longer than the idle timeout.
+ * Returns the number dropped.  (This also happens on every checkout
+ * and checkin.)
+ *
+ * Example:
+ *   pool.reap
+ *
+ */
+static VALUE xp_reap(VALUE self) {
+  xr_pool *p;
+  VALUE reaped = rb_ary_new();
+
+  Data_Get_Struct(self, xr_pool, p);
+  pool_check_fork(p);
+
+  pthread_mutex_lock(&p->lock);
+  pool_reap(p, reaped);
+  pthread_mutex_unlock(&p->lock);
+
+  shutdown_remotes(reaped);
+
+  return INT2FIX(RARRAY_LEN(reaped));
+}
+
+/*
+ * Get the maximum number of remotes in the pool.
+ *
+ * Example:
+ *   puts pool.size
+ *
+ */
+static VALUE xp_size(VALUE self) {
+  xr_pool *p;
+
+  Data_Get_Struct(self, xr_pool, p);
+  return INT2FIX(p->size);
+}
+
+#define STAT(key, val) rb_hash_aset(ret, ID2SYM(rb_intern(key)), (val))
+
+/*
+ * Get pool metrics, as a hash: :size, :idle and :checked_out (current
+ * counts), :created, :reaped, :checkouts, :waits (checkouts that had
+ * to wait), :wait_time (total, in seconds), :timeouts,
+ * :health_checks, :health_failures, and :resets (forks noticed).
+ *
+ * Example:
+ *   stats = pool.stats
+ *   puts "#{stats[:waits]} of #{stats[:checkouts]} checkouts waited"
+ *
+ */
+static VALUE xp_stats(VALUE self) {
+  xr_pool *p;
+  VALUE ret;
+
+  Data_Get_Struct(self, xr_pool, p);
+  pool_check_fork(p);
+
+  ret = rb_hash_new();
+  STAT("size", INT2FIX(p->size));
+  STAT("idle", INT2FIX(p->num_idle));
+  STAT("checked_out", INT2FIX(p->num_out));
+  STAT("created", ULONG2NUM(p->num_created));
+  STAT("reaped", ULONG2NUM(p->num_reaped));
+  STAT("checkouts", ULONG2NUM(p->num_checkouts));
+  STAT("waits", ULONG2NUM(p->num_waits));
+  STAT("wait_time", rb_float_new(p->wait_time));
+  STAT("timeouts", ULONG2NUM(p->num_timeouts));
+  STAT("health_checks", ULONG2NUM(p->num_checks));
+  STAT("health_failures", ULONG2NUM(p->num_failures));
+  STAT("resets", ULONG2NUM(p->num_resets));
+
+  return ret;
+}
+
+void Init_xmms_pool(void) {
+  id_set_pipeline = rb_intern("pipeline=");
+
+  cPool = rb_define_class_under(mXmms, "Pool", rb_cObject);
+  rb_undef_alloc_func(cPool);
+  rb_define_singleton_method(cPool, "new", xp_new, -1);
+  rb_define_method(cPool, "initialize", xp_init, -1);
+
+  rb_define_method(cPool, "checkout", xp_checkout, -1);
+  rb_define_method(cPool, "checkin", xp_checkin, 1);
+  rb_define_method(cPool, "with", xp_with, -1);
+  rb_define_alias(cPool, "with_remote", "with");
+  rb_define_method(cPool, "reap", xp_reap, 0);
+  rb_define_method(cPool, "size", xp_size, 0);
+  rb_define_method(cPool, "stats", xp_stats, 0);
+}
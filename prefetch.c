@@ -0,0 +1,696 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Xmms::Prefetcher: fetch the next few playlist entries before the
+ * current one ends.
+ *
+ * The title, file name, and length of the upcoming entry are usually
+ * wanted right at a track change, which is exactly when XMMS is busy
+ * opening the next file.  A prefetcher watches the output time from a
+ * native thread, and once the current entry is nearly over it fetches
+ * the next few entries into a cache.  While it's attached to a remote,
+ * xr_call() answers playlist_title, playlist_file, and playlist_time
+ * requests for cached entries without asking XMMS (see
+ * xr_prefetch_lookup()).
+ *
+ * XMMS doesn't tell clients its shuffle order, so with shuffle on the
+ * whole playlist is fetched instead, if it's short enough.  Edits made
+ * through the remote are applied to the cache (see prefetch_pl_hook());
+ * if the playlist length changes behind our back, or it's edited by a
+ * command that ran later (see xr_late_edits()), the cache is dropped.
+ */
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include "xmms_ruby.h"
+
+/* defaults */
+#define DEFAULT_AHEAD         3
+#define DEFAULT_LEAD          5.0
+#define DEFAULT_INTERVAL      0.25
+#define DEFAULT_SHUFFLE_LIMIT 500
+
+typedef struct {
+  int pos;
+  gchar *title,
+        *file;
+  gint time;
+} pf_entry;
+
+typedef struct {
+  int session,
+      ahead,
+      shuffle_limit;
+  double lead,
+         interval;
+
+  /* the cache (with the lock held) */
+  pf_entry *entries;
+  int num_entries,
+      length,                 /* playlist length when filled */
+      filled_for;             /* position the cache was filled for */
+  unsigned int edits;         /* xr_late_edits() when filled */
+
+  /* prefetch thread */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int running,
+      stop,
+      gen;
+
+  /* statistics */
+  unsigned long num_fills,
+                num_fetched,
+                num_hits,
+                num_misses,
+                num_flushes;
+} xr_prefetch;
+
+static VALUE cPrefetcher;
+
+/*********/
+/* CACHE */
+/*********/
+
+static void entry_free(pf_entry *e) {
+  if (e->title)
+    g_free(e->title);
+  if (e->file)
+    g_free(e->file);
+}
+
+/*
+ * Drop the cache.  Call with the lock held.
+ */
+static void cache_flush(xr_prefetch *p) {
+  int i;
+
+  for (i = 0; i < p->num_entries; i++)
+    entry_free(&p->entries[i]);
+  p->num_entries = 0;
+  p->filled_for = -1;
+  p->num_flushes++;
+}
+
+/*
+ * Find a cached entry.  Call with the lock held.
+ */
+static pf_entry *cache_find(xr_prefetch *p, int pos) {
+  int i;
+
+  for (i = 0; i < p->num_entries; i++)
+    if (p->entries[i].pos == pos)
+      return &p->entries[i];
+
+  return NULL;
+}
+
+/*
+ * Work out which positions to have cached, current one first.  Returns
+ * the number of positions, or 0 if there's nothing worth fetching.
+ */
+static int window(xr_prefetch *p, int pos, int len, int repeat,
+                  int shuffle, int *ret) {
+  int i, n = 0;
+
+  if (shuffle) {
+    if (len > p->shuffle_limit)
+      return 0;
+    ret[n++] = pos;
+    for (i = 0; i < len; i++)
+      if (i != pos)
+        ret[n++] = i;
+    return n;
+  }
+
+  ret[n++] = pos;
+  for (i = 1; i <= p->ahead && i < len; i++) {
+    if (pos + i < len)
+      ret[n++] = pos + i;
+    else if (repeat)
+      ret[n++] = (pos + i) % len;
+    else
+      break;
+  }
+
+  return n;
+}
+
+/*
+ * Fill the cache with the window around pos, keeping entries that are
+ * already there.  The lock isn't held while talking to XMMS.
+ */
+static void cache_fill(xr_prefetch *p, int pos, int len) {
+  int s = p->session, repeat, shuffle, size, n, i, *want;
+  unsigned int edits = xr_late_edits(s);
+  pf_entry *fresh, *e;
+
+  repeat = xmms_remote_is_repeat(s);
+  shuffle = xmms_remote_is_shuffle(s);
+
+  size = shuffle ? len : p->ahead + 1;
+  want = malloc(sizeof(int) * size);
+  fresh = want ? calloc(size, sizeof(pf_entry)) : NULL;
+  if (!fresh) {
+    free(want);
+    return;
+  }
+  n = window(p, pos, len, repeat, shuffle, want);
+
+  /* take over what's already cached */
+  pthread_mutex_lock(&p->lock);
+  if (p->edits != edits && p->num_entries > 0)
+    cache_flush(p);
+  for (i = 0; i < n; i++) {
+    fresh[i].pos = want[i];
+    fresh[i].time = -1;
+    if ((e = cache_find(p, want[i])) != NULL) {
+      fresh[i] = *e;
+      e->title = e->file = NULL;
+    }
+  }
+  pthread_mutex_unlock(&p->lock);
+
+  /* fetch the rest */
+  for (i = 0; i < n; i++) {
+    if (fresh[i].file)
+      continue;
+    fresh[i].title = xmms_remote_get_playlist_title(s, want[i]);
+    fresh[i].file = xmms_remote_get_playlist_file(s, want[i]);
+    fresh[i].time = xmms_remote_get_playlist_time(s, want[i]);
+    __atomic_add_fetch(&p->num_fetched, 1, __ATOMIC_RELAXED);
+  }
+
+  pthread_mutex_lock(&p->lock);
+  for (i = 0; i < p->num_entries; i++)
+    entry_free(&p->entries[i]);
+  free(p->entries);
+  p->entries = fresh;
+  p->num_entries = n;
+  p->length = len;
+  p->filled_for = pos;
+  p->edits = edits;
+  p->num_fills++;
+  pthread_mutex_unlock(&p->lock);
+
+  free(want);
+}
+
+/**********/
+/* THREAD */
+/**********/
+
+/*
+ * Check the output time, and fill the cache if the current entry is
+ * nearly over.
+ */
+static void prefetch_check(xr_prefetch *p, int force) {
+  int s = p->session, pos, len, out, total, filled;
+  unsigned int edits = xr_late_edits(s);
+  pf_entry *e;
+
+  pos = xmms_remote_get_playlist_pos(s);
+  len = xmms_remote_get_playlist_length(s);
+
+  /* libxmms says 0 when it can't reach XMMS */
+  if (len <= 0)
+    return;
+
+  pthread_mutex_lock(&p->lock);
+  if ((p->length != len || p->edits != edits) && p->num_entries > 0)
+    cache_flush(p);
+  filled = (p->filled_for == pos && p->num_entries > 0);
+  e = cache_find(p, pos);
+  total = e ? e->time : -1;
+  pthread_mutex_unlock(&p->lock);
+
+  if (filled && !force)
+    return;
+
+  if (!force) {
+    if (total < 0)
+      total = xmms_remote_get_playlist_time(s, pos);
+    out = xmms_remote_get_output_time(s);
+
+    /* streams don't have a length, so they never end */
+    if (total <= 0 || total - out > p->lead * 1000.0)
+      return;
+  }
+
+  cache_fill(p, pos, len);
+}
+
+static void *fill_nogvl(void *data) {
+  prefetch_check(data, 1);
+  return NULL;
+}
+
+static void *prefetch_thread(void *data) {
+  xr_prefetch *p = data;
+  struct timespec ts;
+  double t;
+
+  pthread_mutex_lock(&p->lock);
+  while (!p->stop) {
+    pthread_mutex_unlock(&p->lock);
+    prefetch_check(p, 0);
+    pthread_mutex_lock(&p->lock);
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    t = ts.tv_sec + ts.tv_nsec / 1e9 + p->interval;
+    ts.tv_sec = (time_t) t;
+    ts.tv_nsec = (long) ((t - (time_t) t) * 1e9);
+    while (!p->stop)
+      if (pthread_cond_timedwait(&p->wake, &p->lock, &ts))
+        break;
+  }
+  pthread_mutex_unlock(&p->lock);
+
+  return NULL;
+}
+
+static void *prefetch_stop(void *data) {
+  xr_prefetch *p = data;
+
+  /* the thread doesn't exist in a forked child */
+  if (!p->running || p->gen != xr_fork_gen) {
+    p->running = 0;
+    return NULL;
+  }
+
+  pthread_mutex_lock(&p->lock);
+  p->stop = 1;
+  pthread_cond_signal(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+  pthread_join(p->thread, NULL);
+  p->running = 0;
+
+  return NULL;
+}
+
+static void prefetch_start(xr_prefetch *p) {
+  sigset_t all, old;
+  int err;
+
+  p->stop = 0;
+
+  /* ruby's signals are for ruby's threads */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  err = pthread_create(&p->thread, NULL, prefetch_thread, p);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (err)
+    rb_raise(eError, "couldn't create prefetch thread: %s", strerror(err));
+  p->running = 1;
+}
+
+static void prefetch_free(xr_prefetch *p) {
+  prefetch_stop(p);
+  if (p->gen == xr_fork_gen) {
+    cache_flush(p);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->wake);
+  } else {
+    /* see engine_free(); the entries are ours, the lock isn't */
+    int i;
+
+    for (i = 0; i < p->num_entries; i++)
+      entry_free(&p->entries[i]);
+  }
+  free(p->entries);
+  xfree(p);
+}
+
+/*
+ * Get a prefetcher, restarting its thread in a forked child.
+ */
+static xr_prefetch *get_prefetch(VALUE self) {
+  xr_prefetch *p;
+
+  Data_Get_Struct(self, xr_prefetch, p);
+  if (p->gen != xr_fork_gen) {
+    int running = p->running;
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    p->running = 0;
+    p->gen = xr_fork_gen;
+    if (running)
+      prefetch_start(p);
+  }
+
+  return p;
+}
+
+/*****************/
+/* REMOTE LOOKUP */
+/*****************/
+
+/*
+ * Answer a playlist_title, playlist_file, or playlist_time request from
+ * the remote's prefetcher, if it has one and the entry is cached.
+ * Returns 1 if the command's result was filled in.  For the current
+ * entry, the playlist position still has to be asked for.
+ */
+int xr_prefetch_lookup(VALUE self, xr_cmd *cmd) {
+  xr_prefetch *p;
+  pf_entry *e;
+  VALUE obj;
+  int pos;
+
+  if (cmd->op != XR_CMD_GET_PLAYLIST_TITLE &&
+      cmd->op != XR_CMD_GET_PLAYLIST_FILE &&
+      cmd->op != XR_CMD_GET_PLAYLIST_TIME)
+    return 0;
+  if ((obj = xr_remote_slot(self, XR_SLOT_PREFETCH)) == Qnil)
+    return 0;
+  p = get_prefetch(obj);
+
+  if (cmd->cur) {
+    xr_cmd pc;
+
+    xr_cmd_init(&pc, self, XR_CMD_GET_PLAYLIST_POS);
+    pos = NUM2INT(xr_call(self, &pc));
+
+    /* on a miss, don't ask for the position twice */
+    cmd->cur = 0;
+    cmd->arg[0] = pos;
+  } else {
+    pos = cmd->arg[0];
+  }
+
+  pthread_mutex_lock(&p->lock);
+  if (p->edits != xr_late_edits(p->session) && p->num_entries > 0)
+    cache_flush(p);
+  if ((e = cache_find(p, pos)) != NULL && e->file) {
+    cmd->ok = 1;
+    if (cmd->op == XR_CMD_GET_PLAYLIST_TITLE)
+      cmd->sret = e->title ? g_strdup(e->title) : NULL;
+    else if (cmd->op == XR_CMD_GET_PLAYLIST_FILE)
+      cmd->sret = g_strdup(e->file);
+    else
+      cmd->ret[0] = e->time;
+    p->num_hits++;
+  } else {
+    e = NULL;
+    p->num_misses++;
+  }
+  pthread_mutex_unlock(&p->lock);
+
+  return e != NULL;
+}
+
+/*
+ * Keep the cache in step with edits made through the remote.
+ */
+static void prefetch_pl_hook(VALUE obj, xr_pl_op op, int pos, int argc, VALUE *argv) {
+  xr_prefetch *p = get_prefetch(obj);
+  int i, j, *map;
+
+  pthread_mutex_lock(&p->lock);
+
+  switch (op) {
+    case XR_PL_ADD:
+    case XR_PL_INSERT:
+      if (pos >= 0)
+        for (i = 0; i < p->num_entries; i++)
+          if (p->entries[i].pos >= pos)
+            p->entries[i].pos += argc;
+      p->length += argc;
+      break;
+
+    case XR_PL_DELETE:
+      /* descending, so each delete is in terms of the positions left by
+       * the ones before it */
+      for (j = 0; j < argc; j++) {
+        int d = FIX2INT(argv[j]);
+
+        for (i = 0; i < p->num_entries; ) {
+          if (p->entries[i].pos == d) {
+            entry_free(&p->entries[i]);
+            p->entries[i] = p->entries[--p->num_entries];
+            continue;
+          }
+          if (p->entries[i].pos > d)
+            p->entries[i].pos--;
+          i++;
+        }
+      }
+      p->length -= argc;
+      p->filled_for = -1;
+      break;
+
+    case XR_PL_REORDER:
+      if ((map = malloc(sizeof(int) * argc)) == NULL) {
+        cache_flush(p);
+        break;
+      }
+      for (i = 0; i < argc; i++)
+        map[i] = -1;
+      for (i = 0; i < argc; i++) {
+        j = FIX2INT(argv[i]);
+        if (j >= 0 && j < argc)
+          map[j] = i;
+      }
+      for (i = 0; i < p->num_entries; ) {
+        j = p->entries[i].pos;
+        if (j < argc && map[j] >= 0) {
+          p->entries[i++].pos = map[j];
+        } else {
+          entry_free(&p->entries[i]);
+          p->entries[i] = p->entries[--p->num_entries];
+        }
+      }
+      free(map);
+      p->filled_for = -1;
+      break;
+
+    case XR_PL_CLEAR:
+      cache_flush(p);
+      p->length = 0;
+      break;
+  }
+
+  pthread_mutex_unlock(&p->lock);
+}
+
+/****************/
+/* RUBY METHODS */
+/****************/
+
+/*
+ * Start prefetching upcoming playlist entries for this remote.  Once
+ * the current song is within :lead seconds of its end, the next
+ * :ahead entries (or, with shuffle on, the whole playlist, if it has
+ * no more than :shuffle_limit entries) are fetched in the background,
+ * and Xmms::Remote#playlist_title, #playlist_file, and #playlist_time
+ * answer for them without asking XMMS.  Returns the Xmms::Prefetcher;
+ * calling this again replaces it.
+ *
+ * Options:
+ *   :ahead           entries to fetch after the current one (default 3)
+ *   :lead            seconds before the end of a song to fetch
+ *                    (default 5.0)
+ *   :interval        how often to check the output time, in seconds
+ *                    (default 0.25)
+ *   :shuffle_limit   the largest playlist to fetch whole when shuffle
+ *                    is on (default 500)
+ *
+ * This method raises an ArgumentError exception if an option is out
+ * of range, and an Xmms::Error exception if the prefetch thread can't
+ * be created.
+ *
+ * Examples:
+ *   remote.prefetch
+ *   remote.prefetch(:ahead => 5, :lead => 10)
+ *
+ */
+static VALUE xr_prefetch_start(int argc, VALUE *argv, VALUE self) {
+  VALUE ret, opts, v;
+  xr_prefetch *p;
+  int *session;
+
+  rb_scan_args(argc, argv, "01", &opts);
+  session = XR_SESSION(self);
+
+  ret = Data_Make_Struct(cPrefetcher, xr_prefetch, 0, prefetch_free, p);
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->wake, NULL);
+  p->gen = xr_fork_gen;
+  p->session = *session;
+  p->ahead = DEFAULT_AHEAD;
+  p->lead = DEFAULT_LEAD;
+  p->interval = DEFAULT_INTERVAL;
+  p->shuffle_limit = DEFAULT_SHUFFLE_LIMIT;
+  p->filled_for = -1;
+
+  if (opts != Qnil) {
+    Check_Type(opts, T_HASH);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("ahead")))) != Qnil)
+      p->ahead = NUM2INT(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("lead")))) != Qnil)
+      p->lead = NUM2DBL(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("interval")))) != Qnil)
+      p->interval = NUM2DBL(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("shuffle_limit")))) != Qnil)
+      p->shuffle_limit = NUM2INT(v);
+  }
+  if (p->ahead < 0 || p->lead < 0 || p->interval <= 0 || p->shuffle_limit < 0)
+    rb_raise(rb_eArgError, "invalid option (out of range)");
+
+  /* replace any old prefetcher */
+  if ((v = xr_remote_slot(self, XR_SLOT_PREFETCH)) != Qnil)
+    xr_nogvl(prefetch_stop, get_prefetch(v), NULL);
+
+  prefetch_start(p);
+  xr_remote_set(self, XR_SLOT_PREFETCH, ret);
+
+  return ret;
+}
+
+/*
+ * Get the remote's prefetcher, or nil if it doesn't have one.
+ *
+ * Example:
+ *   p remote.prefetcher.stats if remote.prefetcher
+ *
+ */
+static VALUE xr_prefetcher(VALUE self) {
+  return xr_remote_slot(self, XR_SLOT_PREFETCH);
+}
+
+/*
+ * Stop prefetching and detach from the remote (which goes back to
+ * asking XMMS for everything).
+ *
+ * Example:
+ *   remote.stop_prefetch
+ *
+ */
+static VALUE xr_prefetch_stop(VALUE self) {
+  VALUE obj = xr_prefetcher(self);
+
+  if (obj != Qnil) {
+    xr_nogvl(prefetch_stop, get_prefetch(obj), NULL);
+    xr_remote_set(self, XR_SLOT_PREFETCH, Qnil);
+  }
+
+  return self;
+}
+
+/*
+ * Fill the cache for the current entry now, rather than waiting for
+ * it to near its end.
+ *
+ * Example:
+ *   remote.prefetcher.fill
+ *
+ */
+static VALUE xrp_fill(VALUE self) {
+  xr_prefetch *p = get_prefetch(self);
+
+  xr_nogvl(fill_nogvl, p, NULL);
+  XR_CHECK_INTS();
+  return self;
+}
+
+/*
+ * Get the cached playlist positions, in the order they'll come up.
+ *
+ * Example:
+ *   p remote.prefetcher.cached
+ *
+ */
+static VALUE xrp_cached(VALUE self) {
+  xr_prefetch *p = get_prefetch(self);
+  VALUE ret = rb_ary_new();
+  int i;
+
+  pthread_mutex_lock(&p->lock);
+  for (i = 0; i < p->num_entries; i++)
+    rb_ary_push(ret, INT2NUM(p->entries[i].pos));
+  pthread_mutex_unlock(&p->lock);
+
+  return ret;
+}
+
+/*
+ * Is the prefetcher running?
+ *
+ * Example:
+ *   puts 'prefetching' if remote.prefetcher.running?
+ *
+ */
+static VALUE xrp_running(VALUE self) {
+  return get_prefetch(self)->running ? Qtrue : Qfalse;
+}
+
+/*
+ * Get statistics, as a hash: :fills, :fetched (entries fetched),
+ * :hits and :misses (remote requests answered from the cache, or not),
+ * :flushes, and :cached (entries in the cache).
+ *
+ * Example:
+ *   s = remote.prefetcher.stats
+ *   puts "#{s[:hits]} of #{s[:hits] + s[:misses]} reads from the cache"
+ *
+ */
+static VALUE xrp_stats(VALUE self) {
+  xr_prefetch *p = get_prefetch(self);
+  VALUE ret = rb_hash_new();
+
+  pthread_mutex_lock(&p->lock);
+  rb_hash_aset(ret, ID2SYM(rb_intern("fills")), ULONG2NUM(p->num_fills));
+  rb_hash_aset(ret, ID2SYM(rb_intern("fetched")),
+               ULONG2NUM(__atomic_load_n(&p->num_fetched, __ATOMIC_RELAXED)));
+  rb_hash_aset(ret, ID2SYM(rb_intern("hits")), ULONG2NUM(p->num_hits));
+  rb_hash_aset(ret, ID2SYM(rb_intern("misses")), ULONG2NUM(p->num_misses));
+  rb_hash_aset(ret, ID2SYM(rb_intern("flushes")), ULONG2NUM(p->num_flushes));
+  rb_hash_aset(ret, ID2SYM(rb_intern("cached")), INT2FIX(p->num_entries));
+  pthread_mutex_unlock(&p->lock);
+
+  return ret;
+}
+
+void Init_xmms_prefetch(void) {
+  xr_pl_listen(XR_SLOT_PREFETCH, prefetch_pl_hook);
+
+  rb_define_method(cRemote, "prefetch", xr_prefetch_start, -1);
+  rb_define_method(cRemote, "prefetcher", xr_prefetcher, 0);
+  rb_define_method(cRemote, "stop_prefetch", xr_prefetch_stop, 0);
+
+  cPrefetcher = rb_define_class_under(mXmms, "Prefetcher", rb_cObject);
+  rb_undef_alloc_func(cPrefetcher);
+  rb_undef_method(CLASS_OF(cPrefetcher), "new");
+
+  rb_define_method(cPrefetcher, "fill", xrp_fill, 0);
+  rb_define_method(cPrefetcher, "cached", xrp_cached, 0);
+  rb_define_method(cPrefetcher, "running?", xrp_running, 0);
+  rb_define_method(cPrefetcher, "stats", xrp_stats, 0);
+}
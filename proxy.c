@@ -0,0 +1,1009 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Xmms::Proxy: a multiplexing proxy for an XMMS session.
+ *
+ * The proxy listens on a control socket of its own (by default, the
+ * socket of the first unused session number after the one it fronts)
+ * and speaks the XMMS control protocol, so anything built on libxmms,
+ * including Xmms::Remote, can talk to it unchanged.
+ *
+ * libxmms opens a connection per call, and XMMS answers them one at a
+ * time, from its main loop.  The proxy takes all that from a single
+ * native thread that polls every client at once: each time round the
+ * loop, it reads every request that's ready, answers reads from a cache
+ * (status for :ttl seconds, playlist entries for :playlist_ttl), sends
+ * identical reads in the same round to XMMS only once, and runs writes
+ * in order, dropping the cache after each.  Since only that one thread
+ * talks to XMMS, the load on XMMS stays the same however many clients
+ * there are: a slow answer just means a bigger round next time.
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "xmms_ruby.h"
+
+/* defaults */
+#define DEFAULT_TTL          0.1
+#define DEFAULT_PLAYLIST_TTL 2.0
+#define DEFAULT_MAX_CLIENTS  256
+
+/* how many sessions to try when picking one to listen as */
+#define MAX_SEARCH 64
+
+/* cache slots (a power of two) */
+#define CACHE_SIZE 4096
+
+/* largest request accepted (a playlist add can be big) */
+#define MAX_REQUEST (1 << 20)
+
+/* control protocol (see xmms/controlsocket.h) */
+#define PROTOCOL_VERSION 1
+
+enum {
+  CMD_GET_VERSION, CMD_PLAYLIST_ADD, CMD_PLAY, CMD_PAUSE, CMD_STOP,
+  CMD_IS_PLAYING, CMD_IS_PAUSED, CMD_GET_PLAYLIST_POS,
+  CMD_SET_PLAYLIST_POS, CMD_GET_PLAYLIST_LENGTH, CMD_PLAYLIST_CLEAR,
+  CMD_GET_OUTPUT_TIME, CMD_JUMP_TO_TIME, CMD_GET_VOLUME,
+  CMD_SET_VOLUME, CMD_GET_SKIN, CMD_SET_SKIN, CMD_GET_PLAYLIST_FILE,
+  CMD_GET_PLAYLIST_TITLE, CMD_GET_PLAYLIST_TIME, CMD_GET_INFO,
+  CMD_GET_EQ_DATA, CMD_SET_EQ_DATA, CMD_PL_WIN_TOGGLE,
+  CMD_EQ_WIN_TOGGLE, CMD_SHOW_PREFS_BOX, CMD_TOGGLE_AOT,
+  CMD_SHOW_ABOUT_BOX, CMD_EJECT, CMD_PLAYLIST_PREV, CMD_PLAYLIST_NEXT,
+  CMD_PING, CMD_GET_BALANCE, CMD_TOGGLE_REPEAT, CMD_TOGGLE_SHUFFLE,
+  CMD_MAIN_WIN_TOGGLE, CMD_PLAYLIST_ADD_URL_STRING,
+  CMD_IS_EQ_WIN, CMD_IS_PL_WIN, CMD_IS_MAIN_WIN, CMD_PLAYLIST_DELETE,
+  CMD_IS_REPEAT, CMD_IS_SHUFFLE,
+  CMD_GET_EQ, CMD_GET_EQ_PREAMP, CMD_GET_EQ_BAND,
+  CMD_SET_EQ, CMD_SET_EQ_PREAMP, CMD_SET_EQ_BAND,
+  CMD_QUIT, CMD_PLAYLIST_INS_URL_STRING, CMD_PLAYLIST_INS, CMD_PLAY_PAUSE,
+  NUM_WIRE_CMDS
+};
+
+typedef struct {
+  uint16_t version,
+           command;
+  uint32_t length;
+} client_header;
+
+typedef struct {
+  uint16_t version;
+  uint32_t length;
+} server_header;
+
+/* request argument formats */
+typedef enum {
+  ARG_NONE,
+  ARG_INT,                        /* arg[0] */
+  ARG_INT2,                       /* arg[0], arg[1] */
+  ARG_STR,                        /* str[0] */
+  ARG_INT_STR,                    /* arg[0], str[0] */
+  ARG_LIST,                       /* str[], each length-prefixed */
+  ARG_FLOAT,                      /* farg[0] */
+  ARG_EQ,                         /* farg[0 .. NUM_BANDS] */
+  ARG_INT_FLOAT                   /* arg[0], farg[0] */
+} arg_type;
+
+/* what a request on the wire turns into; unsupported requests (-1)
+ * are just acknowledged, as XMMS does with ones it doesn't know */
+static const struct {
+  int op;
+  arg_type args;
+} wire_cmds[NUM_WIRE_CMDS] = {
+  { XR_CMD_GET_VERSION,         ARG_NONE },      /* GET_VERSION */
+  { XR_CMD_PLAYLIST_ADD,        ARG_LIST },      /* PLAYLIST_ADD */
+  { XR_CMD_PLAY,                ARG_NONE },      /* PLAY */
+  { XR_CMD_PAUSE,               ARG_NONE },      /* PAUSE */
+  { XR_CMD_STOP,                ARG_NONE },      /* STOP */
+  { XR_CMD_IS_PLAYING,          ARG_NONE },      /* IS_PLAYING */
+  { XR_CMD_IS_PAUSED,           ARG_NONE },      /* IS_PAUSED */
+  { XR_CMD_GET_PLAYLIST_POS,    ARG_NONE },      /* GET_PLAYLIST_POS */
+  { XR_CMD_SET_PLAYLIST_POS,    ARG_INT },       /* SET_PLAYLIST_POS */
+  { XR_CMD_GET_PLAYLIST_LENGTH, ARG_NONE },      /* GET_PLAYLIST_LENGTH */
+  { XR_CMD_PLAYLIST_CLEAR,      ARG_NONE },      /* PLAYLIST_CLEAR */
+  { XR_CMD_GET_OUTPUT_TIME,     ARG_NONE },      /* GET_OUTPUT_TIME */
+  { XR_CMD_JUMP_TO_TIME,        ARG_INT },       /* JUMP_TO_TIME */
+  { XR_CMD_GET_VOLUME,          ARG_NONE },      /* GET_VOLUME */
+  { XR_CMD_SET_VOLUME,          ARG_INT2 },      /* SET_VOLUME */
+  { XR_CMD_GET_SKIN,            ARG_NONE },      /* GET_SKIN */
+  { XR_CMD_SET_SKIN,            ARG_STR },       /* SET_SKIN */
+  { XR_CMD_GET_PLAYLIST_FILE,   ARG_INT },       /* GET_PLAYLIST_FILE */
+  { XR_CMD_GET_PLAYLIST_TITLE,  ARG_INT },       /* GET_PLAYLIST_TITLE */
+  { XR_CMD_GET_PLAYLIST_TIME,   ARG_INT },       /* GET_PLAYLIST_TIME */
+  { XR_CMD_GET_INFO,            ARG_NONE },      /* GET_INFO */
+  { -1,                         ARG_NONE },      /* GET_EQ_DATA */
+  { -1,                         ARG_NONE },      /* SET_EQ_DATA */
+  { XR_CMD_PL_WIN_TOGGLE,       ARG_INT },       /* PL_WIN_TOGGLE */
+  { XR_CMD_EQ_WIN_TOGGLE,       ARG_INT },       /* EQ_WIN_TOGGLE */
+  { XR_CMD_SHOW_PREFS_BOX,      ARG_NONE },      /* SHOW_PREFS_BOX */
+  { XR_CMD_TOGGLE_AOT,          ARG_INT },       /* TOGGLE_AOT */
+  { -1,                         ARG_NONE },      /* SHOW_ABOUT_BOX */
+  { XR_CMD_EJECT,               ARG_NONE },      /* EJECT */
+  { XR_CMD_PLAYLIST_PREV,       ARG_NONE },      /* PLAYLIST_PREV */
+  { XR_CMD_PLAYLIST_NEXT,       ARG_NONE },      /* PLAYLIST_NEXT */
+  { -1,                         ARG_NONE },      /* PING */
+  { XR_CMD_GET_BALANCE,         ARG_NONE },      /* GET_BALANCE */
+  { XR_CMD_TOGGLE_REPEAT,       ARG_NONE },      /* TOGGLE_REPEAT */
+  { XR_CMD_TOGGLE_SHUFFLE,      ARG_NONE },      /* TOGGLE_SHUFFLE */
+  { XR_CMD_MAIN_WIN_TOGGLE,     ARG_INT },       /* MAIN_WIN_TOGGLE */
+  { XR_CMD_PLAYLIST_ADD_URL,    ARG_STR },       /* PLAYLIST_ADD_URL_STRING */
+  { XR_CMD_IS_EQ_WIN,           ARG_NONE },      /* IS_EQ_WIN */
+  { XR_CMD_IS_PL_WIN,           ARG_NONE },      /* IS_PL_WIN */
+  { XR_CMD_IS_MAIN_WIN,         ARG_NONE },      /* IS_MAIN_WIN */
+  { XR_CMD_PLAYLIST_DELETE,     ARG_INT },       /* PLAYLIST_DELETE */
+  { XR_CMD_IS_REPEAT,           ARG_NONE },      /* IS_REPEAT */
+  { XR_CMD_IS_SHUFFLE,          ARG_NONE },      /* IS_SHUFFLE */
+  { XR_CMD_GET_EQ,              ARG_NONE },      /* GET_EQ */
+  { XR_CMD_GET_EQ_PREAMP,       ARG_NONE },      /* GET_EQ_PREAMP */
+  { XR_CMD_GET_EQ_BAND,         ARG_INT },       /* GET_EQ_BAND */
+  { XR_CMD_SET_EQ,              ARG_EQ },        /* SET_EQ */
+  { XR_CMD_SET_EQ_PREAMP,       ARG_FLOAT },     /* SET_EQ_PREAMP */
+  { XR_CMD_SET_EQ_BAND,         ARG_INT_FLOAT }, /* SET_EQ_BAND */
+  { XR_CMD_QUIT,                ARG_NONE },      /* QUIT */
+  { XR_CMD_PLAYLIST_INS_URL,    ARG_INT_STR },   /* PLAYLIST_INS_URL_STRING */
+  { -1,                         ARG_NONE },      /* PLAYLIST_INS */
+  { XR_CMD_PLAY_PAUSE,          ARG_NONE },      /* PLAY_PAUSE */
+};
+
+/* a cached read */
+typedef struct {
+  int op,
+      arg,
+      gen;                        /* see xr_proxy.gen */
+  unsigned long round;            /* loop round it was fetched in */
+  double expires;
+  gint ret[3];
+  gfloat fret[NUM_BANDS + 1];
+  gchar *sret;
+} cache_entry;
+
+/* a client connection; each carries one request and one reply */
+typedef struct {
+  int fd;
+  char *buf;
+  size_t len,                     /* bytes read, or of the reply */
+         cap,
+         sent;                    /* bytes of the reply written */
+  int state;
+} client;
+
+#define C_READING 0
+#define C_READY   1
+#define C_WRITING 2
+#define C_DONE    3
+
+typedef struct {
+  int upstream,                   /* the session fronted */
+      session;                    /* the one listened as (-1 with :path) */
+  char path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+  double ttl,
+         playlist_ttl;
+  int max_clients;
+
+  int listen_fd,
+      wake[2];
+  client *clients;
+  int num_clients;
+
+  /* cache; gen[0] is bumped by any write, gen[1] when the playlist
+   * changes length under us (dropping just the entries) */
+  cache_entry *cache;
+  int gen[2],
+      last_length;
+  unsigned long round;
+
+  pthread_t thread;
+  int running,
+      stop,
+      gen_fork;
+
+  /* statistics (written by the proxy thread) */
+  unsigned long num_requests,
+                num_reads,
+                num_hits,
+                num_merged,
+                num_writes,
+                num_upstream,
+                num_unsupported,
+                num_errors,
+                num_accepted,
+                num_rounds,
+                max_clients_seen;
+} xr_proxy;
+
+static VALUE cProxy;
+
+/*********/
+/* CACHE */
+/*********/
+
+static int is_entry_op(int op) {
+  return op == XR_CMD_GET_PLAYLIST_FILE || op == XR_CMD_GET_PLAYLIST_TITLE ||
+         op == XR_CMD_GET_PLAYLIST_TIME;
+}
+
+static cache_entry *cache_slot(xr_proxy *p, int op, int arg) {
+  uint32_t h = ((uint32_t) op * 2654435761U) ^ ((uint32_t) arg * 40503U);
+  return p->cache + (h & (CACHE_SIZE - 1));
+}
+
+/*
+ * Look up a read.  It's good if nothing's been written since, and it
+ * was fetched this round (an identical request from another client,
+ * which is merged) or hasn't expired.
+ */
+static cache_entry *cache_find(xr_proxy *p, xr_cmd *cmd, double now) {
+  cache_entry *e = cache_slot(p, cmd->op, cmd->arg[0]);
+
+  if (e->op != (int) cmd->op || e->arg != cmd->arg[0] ||
+      e->gen != (is_entry_op(e->op) ? p->gen[0] + p->gen[1] : p->gen[0]))
+    return NULL;
+  return (e->round == p->round || now < e->expires) ? e : NULL;
+}
+
+static void cache_put(xr_proxy *p, xr_cmd *cmd, double now) {
+  cache_entry *e = cache_slot(p, cmd->op, cmd->arg[0]);
+  int entry = is_entry_op(cmd->op);
+
+  if (e->sret)
+    g_free(e->sret);
+  e->op = cmd->op;
+  e->arg = cmd->arg[0];
+  e->gen = entry ? p->gen[0] + p->gen[1] : p->gen[0];
+  e->round = p->round;
+  e->expires = now + (entry ? p->playlist_ttl : p->ttl);
+  memcpy(e->ret, cmd->ret, sizeof(e->ret));
+  memcpy(e->fret, cmd->fret, sizeof(e->fret));
+  e->sret = cmd->sret ? g_strdup(cmd->sret) : NULL;
+}
+
+static void cache_clear(xr_proxy *p) {
+  int i;
+
+  for (i = 0; i < CACHE_SIZE; i++) {
+    if (p->cache[i].sret)
+      g_free(p->cache[i].sret);
+    memset(p->cache + i, 0, sizeof(cache_entry));
+    p->cache[i].op = -1;
+  }
+}
+
+/************/
+/* REQUESTS */
+/************/
+
+static int get_int(const char *data, size_t len, size_t at, gint *ret) {
+  if (at + sizeof(gint) > len)
+    return 0;
+  memcpy(ret, data + at, sizeof(gint));
+  return 1;
+}
+
+static int get_float(const char *data, size_t len, size_t at, gfloat *ret) {
+  if (at + sizeof(gfloat) > len)
+    return 0;
+  memcpy(ret, data + at, sizeof(gfloat));
+  return 1;
+}
+
+static void add_str(xr_cmd *cmd, const char *str, size_t len) {
+  gchar *s = g_malloc(len + 1);
+
+  memcpy(s, str, len);
+  s[len] = '\0';
+  cmd->str = g_realloc(cmd->str, sizeof(gchar*) * (cmd->num_str + 1));
+  cmd->str[cmd->num_str++] = s;
+}
+
+/*
+ * Decode a request's arguments into a command.  Returns 0 if the
+ * request is malformed.
+ */
+static int decode(xr_cmd *cmd, arg_type args, const char *data, size_t len) {
+  uint32_t n;
+  size_t at;
+  int i;
+
+  switch (args) {
+    case ARG_NONE:
+      return 1;
+    case ARG_INT:
+      return get_int(data, len, 0, cmd->arg);
+    case ARG_INT2:
+      return get_int(data, len, 0, cmd->arg) && get_int(data, len, 4, cmd->arg + 1);
+    case ARG_STR:
+      add_str(cmd, data, strnlen(data, len));
+      return 1;
+    case ARG_INT_STR:
+      if (!get_int(data, len, 0, cmd->arg))
+        return 0;
+      add_str(cmd, data + 4, strnlen(data + 4, len - 4));
+      return 1;
+    case ARG_LIST:
+      /* (length, string padded to 4 bytes) pairs, then a 0 length;
+       * clearing the playlist first is a separate request */
+      cmd->arg[0] = TRUE;
+      for (at = 0; at + 4 <= len; at += (n + 3) / 4 * 4) {
+        memcpy(&n, data + at, 4);
+        at += 4;
+        if (!n)
+          break;
+        if (n > len - at)
+          return 0;
+        add_str(cmd, data + at, strnlen(data + at, n));
+      }
+      return 1;
+    case ARG_FLOAT:
+      return get_float(data, len, 0, cmd->farg);
+    case ARG_EQ:
+      for (i = 0; i <= NUM_BANDS; i++)
+        if (!get_float(data, len, i * sizeof(gfloat), cmd->farg + i))
+          return 0;
+      return 1;
+    case ARG_INT_FLOAT:
+      return get_int(data, len, 0, cmd->arg) && get_float(data, len, 4, cmd->farg);
+  }
+
+  return 0;
+}
+
+/*
+ * Set a client's reply: a header, then the command's result (see
+ * xr_ret_type), or nothing for an acknowledgement.
+ */
+static void reply(client *c, xr_cmd *cmd) {
+  char data[sizeof(gfloat) * (NUM_BANDS + 1)];
+  const char *body = data;
+  server_header h;
+  size_t len = 0;
+  int i;
+
+  if (cmd) {
+    switch (xr_cmd_defs[cmd->op].ret) {
+      case XR_RET_BOOL:
+      case XR_RET_INT:
+        len = sizeof(gint);
+        break;
+      case XR_RET_INT2:
+        len = 2 * sizeof(gint);
+        break;
+      case XR_RET_INT3:
+        len = 3 * sizeof(gint);
+        break;
+      case XR_RET_FLOAT:
+        len = sizeof(gfloat);
+        break;
+      case XR_RET_EQ:
+        len = sizeof(gfloat) * (NUM_BANDS + 1);
+        break;
+      case XR_RET_STR:
+      case XR_RET_PATH:
+        body = cmd->sret;
+        len = cmd->sret ? strlen(cmd->sret) + 1 : 0;
+        break;
+      case XR_RET_SELF:
+        break;
+    }
+
+    if (body == data) {
+      if (xr_cmd_defs[cmd->op].ret == XR_RET_FLOAT ||
+          xr_cmd_defs[cmd->op].ret == XR_RET_EQ)
+        memcpy(data, cmd->fret, len);
+      else
+        for (i = 0; i < 3 && (size_t) i * sizeof(gint) < len; i++)
+          memcpy(data + i * sizeof(gint), cmd->ret + i, sizeof(gint));
+    }
+  }
+
+  memset(&h, 0, sizeof(h));
+  h.version = PROTOCOL_VERSION;
+  h.length = len;
+
+  if (c->cap < sizeof(h) + len) {
+    c->cap = sizeof(h) + len;
+    c->buf = realloc(c->buf, c->cap);
+  }
+  memcpy(c->buf, &h, sizeof(h));
+  if (len)
+    memcpy(c->buf + sizeof(h), body, len);
+  c->len = sizeof(h) + len;
+  c->sent = 0;
+  c->state = C_WRITING;
+}
+
+/*
+ * Handle a complete request.
+ */
+static void handle(xr_proxy *p, client *c, double now) {
+  client_header h;
+  cache_entry *e;
+  xr_cmd cmd;
+  int read;
+
+  memcpy(&h, c->buf, sizeof(h));
+  p->num_requests++;
+
+  if (h.command >= NUM_WIRE_CMDS || wire_cmds[h.command].op < 0) {
+    /* XMMS is up, as far as the client's concerned, if we are */
+    if (h.command != CMD_PING)
+      p->num_unsupported++;
+    reply(c, NULL);
+    return;
+  }
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.op = wire_cmds[h.command].op;
+  cmd.session = p->upstream;
+  cmd.ttl = p->ttl;
+  if (!decode(&cmd, wire_cmds[h.command].args, c->buf + sizeof(h), h.length)) {
+    xr_cmd_free(&cmd);
+    p->num_errors++;
+    c->state = C_DONE;
+    return;
+  }
+
+  read = xr_cmd_defs[cmd.op].flags & XR_CMD_READ;
+  if (read) {
+    p->num_reads++;
+    if ((e = cache_find(p, &cmd, now)) != NULL) {
+      if (e->round == p->round)
+        p->num_merged++;
+      else
+        p->num_hits++;
+      cmd.ok = 1;
+      memcpy(cmd.ret, e->ret, sizeof(cmd.ret));
+      memcpy(cmd.fret, e->fret, sizeof(cmd.fret));
+      cmd.sret = e->sret ? g_strdup(e->sret) : NULL;
+      reply(c, &cmd);
+      xr_cmd_free(&cmd);
+      return;
+    }
+  } else {
+    p->num_writes++;
+  }
+
+  p->num_upstream++;
+  xr_cmd_exec(&cmd);
+
+  if (!cmd.ok) {
+    /* as if XMMS weren't there: libxmms gives the caller its defaults */
+    c->state = C_DONE;
+  } else if (read) {
+    /* the playlist changed length behind our back; entries may have
+     * moved */
+    if (cmd.op == XR_CMD_GET_PLAYLIST_LENGTH) {
+      if (cmd.ret[0] != p->last_length)
+        p->gen[1]++;
+      p->last_length = cmd.ret[0];
+    }
+    cache_put(p, &cmd, xr_now());
+    reply(c, &cmd);
+  } else {
+    p->gen[0]++;
+    reply(c, &cmd);
+  }
+
+  xr_cmd_free(&cmd);
+}
+
+/***************/
+/* CONNECTIONS */
+/***************/
+
+static void client_close(xr_proxy *p, int i) {
+  close(p->clients[i].fd);
+  free(p->clients[i].buf);
+  p->clients[i] = p->clients[--p->num_clients];
+}
+
+static void accept_all(xr_proxy *p) {
+  int fd;
+
+  while (p->num_clients < p->max_clients &&
+         (fd = accept(p->listen_fd, NULL, NULL)) >= 0) {
+    client *c = p->clients + p->num_clients++;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    memset(c, 0, sizeof(client));
+    c->fd = fd;
+    c->state = C_READING;
+    p->num_accepted++;
+  }
+
+  if ((unsigned long) p->num_clients > p->max_clients_seen)
+    p->max_clients_seen = p->num_clients;
+}
+
+/*
+ * Read what's there of a request.  Returns 0 if the client hung up or
+ * sent something unusable.
+ */
+static int client_read(xr_proxy *p, client *c) {
+  client_header h;
+  size_t want = sizeof(h);
+  ssize_t n;
+
+  for (;;) {
+    if (c->len >= sizeof(h)) {
+      memcpy(&h, c->buf, sizeof(h));
+      if (h.length > MAX_REQUEST) {
+        p->num_errors++;
+        return 0;
+      }
+      want = sizeof(h) + h.length;
+      if (c->len == want) {
+        c->state = C_READY;
+        return 1;
+      }
+    }
+
+    if (c->cap < want) {
+      c->cap = want < 256 ? 256 : want;
+      c->buf = realloc(c->buf, c->cap);
+    }
+    if ((n = read(c->fd, c->buf + c->len, want - c->len)) > 0)
+      c->len += n;
+    else if (n < 0 && (errno == EAGAIN || errno == EINTR))
+      return 1;
+    else
+      return 0;
+  }
+}
+
+/*
+ * Write what we can of a reply.  Returns 0 when the client is done
+ * with (or gone).
+ */
+static int client_write(client *c) {
+  ssize_t n;
+
+  while (c->sent < c->len) {
+    if ((n = send(c->fd, c->buf + c->sent, c->len - c->sent, MSG_NOSIGNAL)) > 0)
+      c->sent += n;
+    else if (n < 0 && (errno == EAGAIN || errno == EINTR))
+      return 1;
+    else
+      return 0;
+  }
+
+  return 0;
+}
+
+/**********/
+/* THREAD */
+/**********/
+
+static void *proxy_thread(void *data) {
+  xr_proxy *p = data;
+  struct pollfd *fds = malloc(sizeof(struct pollfd) * (p->max_clients + 2));
+  int i, n, ready;
+  double now;
+  char junk[64];
+
+  while (!p->stop) {
+    fds[0].fd = p->wake[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = p->listen_fd;
+    fds[1].events = p->num_clients < p->max_clients ? POLLIN : 0;
+    for (i = 0; i < p->num_clients; i++) {
+      fds[i + 2].fd = p->clients[i].fd;
+      fds[i + 2].events = p->clients[i].state == C_WRITING ? POLLOUT : POLLIN;
+      fds[i + 2].revents = 0;
+    }
+    n = p->num_clients;
+
+    if (poll(fds, n + 2, -1) < 0)
+      continue;
+    if (fds[0].revents)
+      while (read(p->wake[0], junk, sizeof(junk)) > 0)
+        ;
+
+    /* read everything that's ready, then answer it all as one round */
+    ready = 0;
+    for (i = n - 1; i >= 0; i--) {
+      client *c = p->clients + i;
+
+      if (!fds[i + 2].revents)
+        continue;
+      if (c->state == C_WRITING ? !client_write(c) : !client_read(p, c))
+        client_close(p, i);
+      else if (c->state == C_READY)
+        ready++;
+    }
+
+    if (ready) {
+      p->round++;
+      p->num_rounds++;
+      now = xr_now();
+      for (i = p->num_clients - 1; i >= 0; i--) {
+        if (p->clients[i].state != C_READY)
+          continue;
+        handle(p, p->clients + i, now);
+
+        /* most replies fit in the socket buffer; don't wait for poll */
+        if (p->clients[i].state == C_DONE || !client_write(p->clients + i))
+          client_close(p, i);
+      }
+    }
+
+    if (fds[1].revents)
+      accept_all(p);
+  }
+
+  for (i = p->num_clients - 1; i >= 0; i--)
+    client_close(p, i);
+  free(fds);
+
+  return NULL;
+}
+
+/*
+ * Stop the thread and stop listening.  The thread doesn't exist in a
+ * forked child, and the socket is the parent's to remove.
+ */
+static void *proxy_stop(void *data) {
+  xr_proxy *p = data;
+
+  if (!p->running)
+    return NULL;
+  p->running = 0;
+  if (p->gen_fork != xr_fork_gen) {
+    close(p->listen_fd);
+    close(p->wake[0]);
+    close(p->wake[1]);
+    return NULL;
+  }
+
+  p->stop = 1;
+  if (write(p->wake[1], "", 1) < 0) {
+    /* the pipe is full, so the thread's awake anyway */
+  }
+  pthread_join(p->thread, NULL);
+
+  close(p->listen_fd);
+  close(p->wake[0]);
+  close(p->wake[1]);
+  unlink(p->path);
+
+  return NULL;
+}
+
+static void proxy_free(xr_proxy *p) {
+  proxy_stop(p);
+  if (p->cache && p->gen_fork == xr_fork_gen)
+    cache_clear(p);
+  free(p->cache);
+  free(p->clients);
+  xfree(p);
+}
+
+static xr_proxy *get_proxy(VALUE self) {
+  xr_proxy *p;
+
+  Data_Get_Struct(self, xr_proxy, p);
+  return p;
+}
+
+/*
+ * Is something already answering on a socket?
+ */
+static int in_use(const char *path) {
+  struct sockaddr_un addr;
+  int fd, ret;
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return 0;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  ret = connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0;
+  close(fd);
+
+  return ret;
+}
+
+static void session_path(char *buf, size_t len, int session) {
+  snprintf(buf, len, "%s/xmms_%s.%d", g_get_tmp_dir(), g_get_user_name(), session);
+}
+
+/****************/
+/* RUBY METHODS */
+/****************/
+
+/*
+ * Start a proxy for an XMMS session (an Xmms::Remote or a session
+ * number), listening on the control socket of another session number.
+ * Point clients at that session (Xmms::Remote.new(proxy.session), or
+ * xmms-rb-proxy's output) and they'll be served by the proxy.
+ *
+ * Options:
+ *   :session        the session number to listen as (default: the first
+ *                   unused one after the proxied session)
+ *   :path           a socket path to listen on instead
+ *   :ttl            how long status reads (is_playing, output_time,
+ *                   volume, and so on) are cached, in seconds (default
+ *                   0.1; 0 only merges identical concurrent reads)
+ *   :playlist_ttl   how long playlist entries (file, title and time)
+ *                   are cached, in seconds (default 2.0)
+ *   :max_clients    most connections at once (default 256)
+ *
+ * Any write through the proxy drops the cache, so clients always see
+ * their own (and each other's) changes.  Changes made to XMMS directly
+ * show up within the ttls (playlist entries sooner if the playlist
+ * changes length).
+ *
+ * This method raises an Xmms::Error exception if the session number is
+ * in use, or the proxy thread can't be created, and a SystemCallError
+ * exception if the socket can't be created.
+ *
+ * Examples:
+ *   proxy = Xmms::Proxy.new(Xmms::Remote.new(0))
+ *   r = Xmms::Remote.new(proxy.session)
+ *
+ *   proxy = Xmms::Proxy.new(0, :session => 5, :ttl => 0.25)
+ *
+ */
+static VALUE xrx_new(int argc, VALUE *argv, VALUE klass) {
+  VALUE self, who, opts, v;
+  struct sockaddr_un addr;
+  sigset_t all, old;
+  xr_proxy *p;
+  int err, i, *session;
+
+  rb_scan_args(argc, argv, "11", &who, &opts);
+  self = Data_Make_Struct(klass, xr_proxy, 0, proxy_free, p);
+  p->ttl = DEFAULT_TTL;
+  p->playlist_ttl = DEFAULT_PLAYLIST_TTL;
+  p->max_clients = DEFAULT_MAX_CLIENTS;
+  p->session = -1;
+  p->gen_fork = xr_fork_gen;
+
+  if (rb_obj_is_kind_of(who, cRemote)) {
+    session = XR_SESSION(who);
+    p->upstream = *session;
+  } else {
+    p->upstream = NUM2INT(who);
+  }
+
+  if (opts != Qnil) {
+    Check_Type(opts, T_HASH);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("session")))) != Qnil)
+      p->session = NUM2INT(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("path")))) != Qnil) {
+      StringValue(v);
+      if ((size_t) RSTRING_LEN(v) >= sizeof(p->path))
+        rb_raise(rb_eArgError, "socket path too long");
+      strcpy(p->path, StringValueCStr(v));
+    }
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("ttl")))) != Qnil)
+      p->ttl = NUM2DBL(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("playlist_ttl")))) != Qnil)
+      p->playlist_ttl = NUM2DBL(v);
+    if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("max_clients")))) != Qnil)
+      p->max_clients = NUM2INT(v);
+  }
+  if (p->ttl < 0 || p->playlist_ttl < 0 || p->max_clients < 1)
+    rb_raise(rb_eArgError, "invalid ttl or max_clients (out of range)");
+
+  /* pick a socket */
+  if (!*p->path) {
+    if (p->session < 0) {
+      for (i = 1; i <= MAX_SEARCH; i++) {
+        session_path(p->path, sizeof(p->path), p->upstream + i);
+        if (!in_use(p->path))
+          break;
+      }
+      if (i > MAX_SEARCH)
+        rb_raise(eError, "no free session number");
+      p->session = p->upstream + i;
+    } else {
+      if (p->session == p->upstream)
+        rb_raise(rb_eArgError, "can't proxy session %d as itself", p->session);
+      session_path(p->path, sizeof(p->path), p->session);
+    }
+  }
+  if (in_use(p->path))
+    rb_raise(eError, "%s is in use", p->path);
+
+  p->cache = malloc(sizeof(cache_entry) * CACHE_SIZE);
+  p->clients = malloc(sizeof(client) * p->max_clients);
+  if (!p->cache || !p->clients)
+    rb_raise(rb_eNoMemError, "couldn't allocate proxy");
+  memset(p->cache, 0, sizeof(cache_entry) * CACHE_SIZE);
+  cache_clear(p);
+  p->last_length = -1;
+
+  /* a stale socket (from a crash) is fair game */
+  unlink(p->path);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, p->path);
+  if ((p->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    rb_sys_fail(p->path);
+  if (bind(p->listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+      listen(p->listen_fd, 128) < 0 || pipe(p->wake) < 0) {
+    err = errno;
+    close(p->listen_fd);
+    errno = err;
+    rb_sys_fail(p->path);
+  }
+  fcntl(p->listen_fd, F_SETFL, fcntl(p->listen_fd, F_GETFL) | O_NONBLOCK);
+  fcntl(p->wake[0], F_SETFL, fcntl(p->wake[0], F_GETFL) | O_NONBLOCK);
+  fcntl(p->wake[1], F_SETFL, fcntl(p->wake[1], F_GETFL) | O_NONBLOCK);
+
+  /* ruby's signals are for ruby's threads */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  err = pthread_create(&p->thread, NULL, proxy_thread, p);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (err) {
+    close(p->listen_fd);
+    close(p->wake[0]);
+    close(p->wake[1]);
+    unlink(p->path);
+    rb_raise(eError, "couldn't create proxy thread: %s", strerror(err));
+  }
+  p->running = 1;
+
+  rb_obj_call_init(self, argc, argv);
+  return self;
+}
+
+/*
+ * Xmms::Proxy constructor.
+ *
+ * This function is currently just a placeholder.
+ *
+ */
+static VALUE xrx_init(int argc, VALUE *argv, VALUE self) {
+  UNUSED(argc);
+  UNUSED(argv);
+  return self;
+}
+
+/*
+ * Stop the proxy, and remove its socket.  Clients still connected are
+ * dropped.
+ *
+ * Example:
+ *   proxy.stop
+ *
+ */
+static VALUE xrx_stop(VALUE self) {
+  xr_nogvl(proxy_stop, get_proxy(self), NULL);
+  return self;
+}
+
+/*
+ * Is the proxy running?
+ *
+ * Example:
+ *   sleep 1 while proxy.running?
+ *
+ */
+static VALUE xrx_running(VALUE self) {
+  xr_proxy *p = get_proxy(self);
+  return (p->running && p->gen_fork == xr_fork_gen) ? Qtrue : Qfalse;
+}
+
+/*
+ * Get the session number the proxy listens as (nil if it was given a
+ * :path).
+ *
+ * Example:
+ *   r = Xmms::Remote.new(proxy.session)
+ *
+ */
+static VALUE xrx_session(VALUE self) {
+  xr_proxy *p = get_proxy(self);
+  return p->session < 0 ? Qnil : INT2FIX(p->session);
+}
+
+/*
+ * Get the session number the proxy fronts.
+ *
+ * Example:
+ *   puts "proxying session #{proxy.upstream}"
+ *
+ */
+static VALUE xrx_upstream(VALUE self) {
+  return INT2FIX(get_proxy(self)->upstream);
+}
+
+/*
+ * Get the path of the proxy's socket.
+ *
+ * Example:
+ *   puts "listening on #{proxy.path}"
+ *
+ */
+static VALUE xrx_path(VALUE self) {
+  xr_proxy *p = get_proxy(self);
+  return xr_str_new(p->path, strlen(p->path), XR_STR_PATH);
+}
+
+#define STAT(p, f) ULONG2NUM(__atomic_load_n(&(p)->f, __ATOMIC_RELAXED))
+
+/*
+ * Get statistics, as a hash:
+ *   :requests      requests handled
+ *   :reads         ... of which were reads
+ *   :hits          reads answered from the cache
+ *   :merged        reads answered by an identical read in the same round
+ *   :writes        writes (each sent to XMMS, in order)
+ *   :upstream      requests sent to XMMS
+ *   :unsupported   requests acknowledged but not understood
+ *   :errors        malformed requests
+ *   :connections   connections accepted
+ *   :rounds        times round the loop with requests to answer
+ *   :max_clients   most connections open at once
+ *
+ * Example:
+ *   s = proxy.stats
+ *   puts "#{s[:requests]} requests, #{s[:upstream]} sent to XMMS"
+ *
+ */
+static VALUE xrx_stats(VALUE self) {
+  xr_proxy *p = get_proxy(self);
+  VALUE ret = rb_hash_new();
+
+  rb_hash_aset(ret, ID2SYM(rb_intern("requests")), STAT(p, num_requests));
+  rb_hash_aset(ret, ID2SYM(rb_intern("reads")), STAT(p, num_reads));
+  rb_hash_aset(ret, ID2SYM(rb_intern("hits")), STAT(p, num_hits));
+  rb_hash_aset(ret, ID2SYM(rb_intern("merged")), STAT(p, num_merged));
+  rb_hash_aset(ret, ID2SYM(rb_intern("writes")), STAT(p, num_writes));
+  rb_hash_aset(ret, ID2SYM(rb_intern("upstream")), STAT(p, num_upstream));
+  rb_hash_aset(ret, ID2SYM(rb_intern("unsupported")), STAT(p, num_unsupported));
+  rb_hash_aset(ret, ID2SYM(rb_intern("errors")), STAT(p, num_errors));
+  rb_hash_aset(ret, ID2SYM(rb_intern("connections")), STAT(p, num_accepted));
+  rb_hash_aset(ret, ID2SYM(rb_intern("rounds")), STAT(p, num_rounds));
+  rb_hash_aset(ret, ID2SYM(rb_intern("max_clients")), STAT(p, max_clients_seen));
+
+  return ret;
+}
+
+void Init_xmms_proxy(void) {
+  cProxy = rb_define_class_under(mXmms, "Proxy", rb_cObject);
+  rb_undef_alloc_func(cProxy);
+  rb_define_singleton_method(cProxy, "new", xrx_new, -1);
+  rb_define_method(cProxy, "initialize", xrx_init, -1);
+
+  rb_define_method(cProxy, "stop", xrx_stop, 0);
+  rb_define_method(cProxy, "running?", xrx_running, 0);
+  rb_define_method(cProxy, "session", xrx_session, 0);
+  rb_define_method(cProxy, "upstream", xrx_upstream, 0);
+  rb_define_method(cProxy, "path", xrx_path, 0);
+  rb_define_method(cProxy, "stats", xrx_stats, 0);
+}
@@ -0,0 +1,957 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Xmms::Scheduler: cue lists, run at set times by a native thread.
+ *
+ * A cue is a list of commands recorded from an ordinary block of
+ * Xmms::Remote calls (while the block runs, xr_call() hands commands
+ * to xr_sched_capture() instead of running them), or a volume fade.
+ * Cues are due at a point on the monotonic clock, or when the output
+ * time of the current (or a given) track reaches some offset.
+ *
+ * Timed cues live in a hashed timing wheel: WHEEL_SLOTS buckets of
+ * WHEEL_TICK seconds each, every bucket sorted by due time, with a
+ * bitmap of the buckets that aren't empty.  The thread sleeps until the
+ * earliest head (not until the next tick), runs everything that's due
+ * without the interpreter lock, and records how late each cue ran.
+ * Track cues are watched by sampling the output time, and are moved to
+ * the wheel once they're about to come due.
+ */
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include "xmms_ruby.h"
+
+#define SCHED_KEY "__xmms_sched__"
+
+/* timing wheel geometry */
+#define WHEEL_SLOTS 256
+#define WHEEL_TICK  0.01
+
+/* how often to sample the output time while there are track cues, in
+ * seconds */
+#define TRACK_INTERVAL 0.1
+
+/* fade step, in seconds */
+#define FADE_STEP 0.05
+
+typedef enum {
+  CUE_CMDS,
+  CUE_FADE
+} cue_kind;
+
+typedef struct cue {
+  struct cue *next;
+  cue_kind kind;
+  char *name;
+
+  /* when */
+  double due,                 /* on the monotonic clock */
+         wall;                /* the same, as a wall clock time */
+  int track,                  /* due at an offset into a track? */
+      track_pos,              /* which one (-1: any) */
+      armed;                  /* seen before the offset yet? */
+  double track_ms;
+
+  /* what */
+  xr_cmd *cmds;
+  int num_cmds,
+      session;                /* for fades */
+  int from, to;               /* volume (from is -1 until the fade starts) */
+  double len, start;
+
+  /* results */
+  int done, ok;
+  double late;                /* seconds */
+} cue;
+
+/* a cue being recorded, and the thread recording it */
+typedef struct recorder {
+  VALUE thread;
+  cue *cue;
+  struct recorder *next;
+} recorder;
+
+typedef struct {
+  int session;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int running,
+      stop,
+      gen;
+
+  /* the timing wheel */
+  cue *slots[WHEEL_SLOTS];
+  unsigned int used[WHEEL_SLOTS / 32];
+  long tick;                  /* the next tick to visit */
+  int num_timed;
+
+  /* track cues, and finished ones (newest first) */
+  cue *track,
+      *done;
+  int num_done;
+
+  /* cues being recorded, innermost first (see xr_sched_capture()) */
+  recorder *recorders;
+
+  /* statistics */
+  double max_late,
+         sum_late;
+} xr_sched;
+
+static VALUE cScheduler;
+static ID id_sched, id_to_f;
+
+/********/
+/* CUES */
+/********/
+
+static double wall_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void cue_free(cue *c) {
+  int i;
+
+  for (i = 0; i < c->num_cmds; i++)
+    xr_cmd_free(&c->cmds[i]);
+  free(c->cmds);
+  free(c->name);
+  free(c);
+}
+
+static void cue_list_free(cue *c) {
+  cue *next;
+
+  for (; c; c = next) {
+    next = c->next;
+    cue_free(c);
+  }
+}
+
+/*
+ * Run a cue.  Doesn't touch any Ruby objects.  Returns 1 if a fade
+ * needs to go back on the wheel.
+ */
+static int cue_run(cue *c, double now) {
+  int i, vol;
+  double t;
+
+  switch (c->kind) {
+    case CUE_CMDS:
+      c->ok = 1;
+      for (i = 0; i < c->num_cmds; i++) {
+        xr_cmd_exec(&c->cmds[i]);
+        if (!c->cmds[i].ok)
+          c->ok = 0;
+      }
+      return 0;
+
+    case CUE_FADE:
+      if (c->from < 0) {
+        if (!xmms_remote_is_running(c->session)) {
+          c->ok = 0;
+          return 0;
+        }
+        c->from = xmms_remote_get_main_volume(c->session);
+        c->start = now;
+        c->ok = 1;
+      }
+
+      t = c->len > 0 ? (now - c->start) / c->len : 1;
+      if (t > 1)
+        t = 1;
+      vol = c->from + (int) ((c->to - c->from) * t + (c->to > c->from ? 0.5 : -0.5));
+      xmms_remote_set_main_volume(c->session, vol);
+      return t < 1;
+  }
+
+  return 0;
+}
+
+/****************/
+/* TIMING WHEEL */
+/****************/
+
+static long tick_of(double t) {
+  return (long) (t / WHEEL_TICK);
+}
+
+/*
+ * Put a cue on the wheel.  Call with the lock held.  Overdue cues go
+ * in the current bucket, since wheel_take() won't look behind it.
+ */
+static void wheel_add(xr_sched *s, cue *c) {
+  long t = tick_of(c->due);
+  int slot;
+  cue **p;
+
+  if (t < s->tick)
+    t = s->tick;
+  slot = t & (WHEEL_SLOTS - 1);
+
+  for (p = &s->slots[slot]; *p && (*p)->due <= c->due; p = &(*p)->next)
+    ;
+  c->next = *p;
+  *p = c;
+  s->used[slot / 32] |= 1u << (slot % 32);
+  s->num_timed++;
+}
+
+/*
+ * Take the cues that are due off the wheel, in order, visiting the
+ * buckets between the last tick and now.  Call with the lock held.
+ */
+static cue *wheel_take(xr_sched *s, double now) {
+  long t, end = tick_of(now);
+  cue *ret = NULL, **tail = &ret;
+
+  /* after a long sleep, every bucket needs a look */
+  if (end - s->tick >= WHEEL_SLOTS)
+    s->tick = end - WHEEL_SLOTS + 1;
+
+  for (t = s->tick; t <= end; t++) {
+    int slot = t & (WHEEL_SLOTS - 1);
+    cue *c;
+
+    while ((c = s->slots[slot]) != NULL && c->due <= now) {
+      s->slots[slot] = c->next;
+      s->num_timed--;
+      c->next = NULL;
+      *tail = c;
+      tail = &c->next;
+    }
+    if (!s->slots[slot])
+      s->used[slot / 32] &= ~(1u << (slot % 32));
+  }
+
+  /* the last bucket may still hold cues for later in this tick */
+  s->tick = end;
+  return ret;
+}
+
+/*
+ * When is the next timed cue due?  Returns 0 if there aren't any.
+ * Call with the lock held.
+ */
+static double wheel_next(xr_sched *s) {
+  double ret = 0;
+  int i, b;
+
+  for (i = 0; i < WHEEL_SLOTS / 32; i++) {
+    unsigned int bits = s->used[i];
+
+    while (bits) {
+      b = __builtin_ctz(bits);
+      bits &= bits - 1;
+      if (!ret || s->slots[i * 32 + b]->due < ret)
+        ret = s->slots[i * 32 + b]->due;
+    }
+  }
+
+  return ret;
+}
+
+/**********/
+/* THREAD */
+/**********/
+
+/*
+ * Check the track cues against the output time, moving the ones that
+ * are about to come due to the wheel.  Call with the lock held; it's
+ * dropped while talking to XMMS.
+ */
+static void track_check(xr_sched *s) {
+  int pos, playing, ms;
+  double now;
+  cue **p, *c;
+
+  pthread_mutex_unlock(&s->lock);
+  pos = xmms_remote_get_playlist_pos(s->session);
+  playing = xmms_remote_is_playing(s->session) &&
+            !xmms_remote_is_paused(s->session);
+  now = xr_now();
+  ms = xmms_remote_get_output_time(s->session);
+  pthread_mutex_lock(&s->lock);
+
+  if (!playing)
+    return;
+
+  for (p = &s->track; (c = *p) != NULL; ) {
+    double left;
+
+    if (c->track_pos >= 0 && c->track_pos != pos) {
+      c->armed = 0;
+      p = &c->next;
+      continue;
+    }
+
+    left = (c->track_ms - ms) / 1000.0;
+    if (!c->armed) {
+      /* only fire on the way past the offset, not after a jump past it */
+      c->armed = (left > 0);
+      p = &c->next;
+      continue;
+    }
+
+    if (left < TRACK_INTERVAL * 1.5) {
+      *p = c->next;
+      c->due = now + (left > 0 ? left : 0);
+      c->wall = wall_now() + (c->due - xr_now());
+      wheel_add(s, c);
+      continue;
+    }
+
+    p = &c->next;
+  }
+}
+
+static void *sched_thread(void *data) {
+  xr_sched *s = data;
+  double now, next, next_track = 0;
+  struct timespec ts;
+  cue *run, *c;
+
+  pthread_mutex_lock(&s->lock);
+  while (!s->stop) {
+    now = xr_now();
+
+    if (s->track && now >= next_track) {
+      track_check(s);
+      next_track = now + TRACK_INTERVAL;
+      now = xr_now();
+    }
+
+    if ((run = wheel_take(s, now)) != NULL) {
+      while ((c = run) != NULL) {
+        int first = !c->done, again;
+
+        run = c->next;
+        pthread_mutex_unlock(&s->lock);
+        now = xr_now();
+        if (first)
+          c->late = now - c->due;
+        again = cue_run(c, now);
+        pthread_mutex_lock(&s->lock);
+
+        c->done = 1;
+        if (first) {
+          if (c->late > s->max_late)
+            s->max_late = c->late;
+          s->sum_late += c->late;
+        }
+
+        if (again) {
+          c->due += FADE_STEP;
+          wheel_add(s, c);
+        } else {
+          c->next = s->done;
+          s->done = c;
+          s->num_done++;
+        }
+      }
+      continue;
+    }
+
+    next = wheel_next(s);
+    if (s->track && (!next || next > next_track))
+      next = next_track;
+    if (!next)
+      next = now + 60;
+
+    ts.tv_sec = (time_t) next;
+    ts.tv_nsec = (long) ((next - (time_t) next) * 1e9);
+    pthread_cond_timedwait(&s->wake, &s->lock, &ts);
+  }
+  pthread_mutex_unlock(&s->lock);
+
+  return NULL;
+}
+
+static void *sched_stop(void *data) {
+  xr_sched *s = data;
+
+  /* the thread doesn't exist in a forked child */
+  if (!s->running || s->gen != xr_fork_gen) {
+    s->running = 0;
+    return NULL;
+  }
+
+  pthread_mutex_lock(&s->lock);
+  s->stop = 1;
+  pthread_cond_signal(&s->wake);
+  pthread_mutex_unlock(&s->lock);
+  pthread_join(s->thread, NULL);
+  s->running = 0;
+
+  return NULL;
+}
+
+static void sched_init_sync(xr_sched *s) {
+  pthread_condattr_t attr;
+
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&s->wake, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+static void sched_free(xr_sched *s) {
+  int i;
+
+  sched_stop(s);
+  for (i = 0; i < WHEEL_SLOTS; i++)
+    cue_list_free(s->slots[i]);
+  cue_list_free(s->track);
+  cue_list_free(s->done);
+
+  /* see engine_free() */
+  if (s->gen == xr_fork_gen) {
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->wake);
+  }
+  xfree(s);
+}
+
+/*
+ * Get a scheduler.  In a forked child the thread is gone, and isn't
+ * restarted: the parent is still running the same cues.
+ */
+static xr_sched *get_sched(VALUE self) {
+  xr_sched *s;
+
+  Data_Get_Struct(self, xr_sched, s);
+  if (s->gen != xr_fork_gen) {
+    sched_init_sync(s);
+    s->running = 0;
+    s->gen = xr_fork_gen;
+  }
+
+  return s;
+}
+
+/*****************/
+/* CUE RECORDING */
+/*****************/
+
+/*
+ * Get the cue the current thread is recording, if any.
+ */
+static cue *recording(void) {
+  VALUE self, thread;
+  xr_sched *s;
+  recorder *r;
+
+  if (!id_sched)
+    return NULL;
+  thread = rb_thread_current();
+  if ((self = rb_thread_local_aref(thread, id_sched)) == Qnil)
+    return NULL;
+
+  /* other threads may be recording cues for the same scheduler */
+  Data_Get_Struct(self, xr_sched, s);
+  for (r = s->recorders; r; r = r->next)
+    if (r->thread == thread)
+      return r->cue;
+
+  return NULL;
+}
+
+/*
+ * Is the current thread recording a cue?  If so, add the command to it
+ * (taking its string arguments) and return 1.
+ *
+ * This raises an ArgumentError exception for commands with results.
+ */
+int xr_sched_capture(xr_cmd *cmd) {
+  xr_cmd *cmds;
+  cue *c;
+
+  if ((c = recording()) == NULL)
+    return 0;
+
+  if (xr_cmd_defs[cmd->op].flags & XR_CMD_READ) {
+    xr_cmd_free(cmd);
+    rb_raise(rb_eArgError, "can't schedule %s (it has a result)",
+             xr_cmd_defs[cmd->op].name);
+  }
+
+  if (!(cmds = realloc(c->cmds, sizeof(xr_cmd) * (c->num_cmds + 1)))) {
+    xr_cmd_free(cmd);
+    rb_raise(rb_eNoMemError, "couldn't allocate command");
+  }
+  c->cmds = cmds;
+  c->cmds[c->num_cmds++] = *cmd;
+  cmd->str = NULL;
+  cmd->num_str = 0;
+
+  return 1;
+}
+
+/*
+ * Raise an ArgumentError exception if the current thread is recording
+ * a cue.  For methods that make more than one request (and so can't be
+ * recorded), which would otherwise run right away.
+ */
+void xr_sched_refuse(const char *name) {
+  if (recording())
+    rb_raise(rb_eArgError, "can't schedule %s (it isn't a single request)", name);
+}
+
+typedef struct {
+  VALUE self,
+        remote;
+} record_args;
+
+static VALUE record_body(VALUE data) {
+  record_args *args = (record_args*) data;
+
+  rb_thread_local_aset(rb_thread_current(), id_sched, args->self);
+  return rb_yield(args->remote);
+}
+
+/*
+ * Convert a Time (or seconds since the epoch) to the monotonic clock.
+ */
+static double to_due(VALUE time, double *wall) {
+  double t = NUM2DBL(rb_obj_is_kind_of(time, rb_cTime) ? rb_funcall(time, id_to_f, 0) : time);
+
+  *wall = t;
+  return xr_now() + (t - wall_now());
+}
+
+static cue *cue_new(cue_kind kind, VALUE name) {
+  cue *c = calloc(1, sizeof(cue));
+
+  if (!c)
+    rb_raise(rb_eNoMemError, "couldn't allocate cue");
+  c->kind = kind;
+  c->from = -1;
+  c->track_pos = -1;
+  if (name != Qnil)
+    c->name = strdup(StringValueCStr(name));
+
+  return c;
+}
+
+/*
+ * Record a cue from the block, then schedule it.
+ */
+static VALUE sched_record(VALUE self, cue *c, VALUE remote) {
+  xr_sched *s = get_sched(self);
+  record_args args;
+  recorder rec, **p;
+  VALUE prev;
+  int state = 0;
+
+  if (!rb_block_given_p()) {
+    cue_free(c);
+    rb_raise(rb_eArgError, "no block given");
+  }
+
+  args.self = self;
+  args.remote = remote;
+  rec.thread = rb_thread_current();
+  rec.cue = c;
+  rec.next = s->recorders;
+  s->recorders = &rec;
+  prev = rb_thread_local_aref(rec.thread, id_sched);
+  rb_protect(record_body, (VALUE) &args, &state);
+
+  /* (a block may record cues of its own) */
+  rb_thread_local_aset(rec.thread, id_sched, prev);
+  for (p = &s->recorders; *p != &rec; p = &(*p)->next);
+  *p = rec.next;
+
+  if (state) {
+    cue_free(c);
+    rb_jump_tag(state);
+  }
+  if (!c->num_cmds) {
+    cue_free(c);
+    rb_raise(rb_eArgError, "nothing to schedule (no commands in block)");
+  }
+
+  pthread_mutex_lock(&s->lock);
+  if (c->track) {
+    c->next = s->track;
+    s->track = c;
+  } else {
+    wheel_add(s, c);
+  }
+  pthread_cond_signal(&s->wake);
+  pthread_mutex_unlock(&s->lock);
+
+  return self;
+}
+
+/****************/
+/* RUBY METHODS */
+/****************/
+
+/*
+ * Create a new (stopped) scheduler for a remote.
+ *
+ * Example:
+ *   cues = Xmms::Scheduler.new(remote)
+ *
+ */
+static VALUE xrs_new(VALUE klass, VALUE remote) {
+  VALUE self;
+  xr_sched *s;
+  int *session;
+
+  if (!rb_obj_is_kind_of(remote, cRemote))
+    rb_raise(rb_eTypeError, "invalid argument type (not Xmms::Remote)");
+  session = XR_SESSION(remote);
+
+  self = Data_Make_Struct(klass, xr_sched, 0, sched_free, s);
+  sched_init_sync(s);
+  s->gen = xr_fork_gen;
+  s->session = *session;
+  s->tick = tick_of(xr_now());
+
+  rb_iv_set(self, "@remote", remote);
+  rb_obj_call_init(self, 1, &remote);
+
+  return self;
+}
+
+/*
+ * Xmms::Scheduler constructor.
+ *
+ * This function is currently just a placeholder.
+ *
+ */
+static VALUE xrs_init(VALUE self, VALUE remote) {
+  UNUSED(remote);
+  return self;
+}
+
+/*
+ * Schedule the commands in the block (which is passed the remote) to
+ * run at the given time (a Time, or seconds since the epoch).  Only
+ * commands that don't return anything can be scheduled; they're
+ * recorded rather than run when the block is called, so don't rely on
+ * their return values in the block.  Times in the past run as soon as
+ * the scheduler is started.  An optional name is shown in #report.
+ *
+ * This method raises an ArgumentError exception if there's no block,
+ * if the block schedules nothing, or if it calls a method that returns
+ * a result.
+ *
+ * Examples:
+ *   cues.at(Time.local(2026, 10, 19, 12, 0, 5), 'track 40') do |r|
+ *     r.set_playlist_pos 40
+ *     r.play
+ *   end
+ *
+ */
+static VALUE xrs_at(int argc, VALUE *argv, VALUE self) {
+  VALUE time, name;
+  cue *c;
+
+  rb_scan_args(argc, argv, "11", &time, &name);
+  c = cue_new(CUE_CMDS, name);
+  c->due = to_due(time, &c->wall);
+
+  return sched_record(self, c, rb_iv_get(self, "@remote"));
+}
+
+/*
+ * Schedule the commands in the block to run the given number of
+ * seconds from now.  See Xmms::Scheduler#at.
+ *
+ * Example:
+ *   cues.after(3.5) { |r| r.playlist_next }
+ *
+ */
+static VALUE xrs_after(int argc, VALUE *argv, VALUE self) {
+  VALUE secs, name;
+  cue *c;
+
+  rb_scan_args(argc, argv, "11", &secs, &name);
+  c = cue_new(CUE_CMDS, name);
+  c->due = xr_now() + NUM2DBL(secs);
+  c->wall = wall_now() + NUM2DBL(secs);
+
+  return sched_record(self, c, rb_iv_get(self, "@remote"));
+}
+
+/*
+ * Schedule the commands in the block to run when the output time of
+ * the current song reaches the given number of seconds.  If a playlist
+ * position is given, the cue waits for that entry to be playing.  A
+ * track cue runs once, on the way past its offset (not if playback
+ * jumps past it); it's accurate to a few milliseconds unless there's a
+ * seek in the last tenth of a second before it.
+ *
+ * This method raises an ArgumentError exception if there's no block,
+ * if the block schedules nothing, or if it calls a method that returns
+ * a result.
+ *
+ * Examples:
+ *   cues.at_track(180) { |r| r.playlist_next }     # cut songs at 3:00
+ *   cues.at_track(12.5, 40) { |r| r.set_main_volume 100 }
+ *
+ */
+static VALUE xrs_at_track(int argc, VALUE *argv, VALUE self) {
+  VALUE secs, pos, name;
+  cue *c;
+
+  rb_scan_args(argc, argv, "12", &secs, &pos, &name);
+  c = cue_new(CUE_CMDS, name);
+  c->track = 1;
+  c->track_ms = NUM2DBL(secs) * 1000.0;
+  c->track_pos = (pos == Qnil) ? -1 : NUM2INT(pos);
+
+  return sched_record(self, c, rb_iv_get(self, "@remote"));
+}
+
+/*
+ * Fade the main volume to the given level over some number of seconds,
+ * starting at the given time (a Time, or seconds since the epoch).
+ * The fade starts from whatever the volume is at that time, and steps
+ * every 50ms.
+ *
+ * This method raises an ArgumentError exception if the volume isn't in
+ * the range 0..100.
+ *
+ * Example:
+ *   cues.fade(Time.local(2026, 10, 19, 12), 20, 5.0, 'fade to 20%')
+ *
+ */
+static VALUE xrs_fade(int argc, VALUE *argv, VALUE self) {
+  xr_sched *s = get_sched(self);
+  VALUE time, vol, secs, name;
+  cue *c;
+
+  rb_scan_args(argc, argv, "31", &time, &vol, &secs, &name);
+  if (NUM2INT(vol) < 0 || NUM2INT(vol) > 100)
+    rb_raise(rb_eArgError, "invalid volume (not in range 0..100)");
+
+  c = cue_new(CUE_FADE, name);
+  c->due = to_due(time, &c->wall);
+  c->session = s->session;
+  c->to = NUM2INT(vol);
+  c->len = NUM2DBL(secs);
+
+  pthread_mutex_lock(&s->lock);
+  wheel_add(s, c);
+  pthread_cond_signal(&s->wake);
+  pthread_mutex_unlock(&s->lock);
+
+  return self;
+}
+
+/*
+ * Start running cues.
+ *
+ * This method raises an Xmms::Error exception if the scheduler thread
+ * can't be created.
+ *
+ * Example:
+ *   cues.start
+ *
+ */
+static VALUE xrs_start(VALUE self) {
+  xr_sched *s = get_sched(self);
+  sigset_t all, old;
+  int err;
+
+  if (s->running)
+    return self;
+  s->stop = 0;
+
+  /* ruby's signals are for ruby's threads */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  err = pthread_create(&s->thread, NULL, sched_thread, s);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (err)
+    rb_raise(eError, "couldn't create scheduler thread: %s", strerror(err));
+  s->running = 1;
+
+  return self;
+}
+
+/*
+ * Stop running cues.  Pending cues stay queued for the next #start.
+ *
+ * Example:
+ *   cues.stop
+ *
+ */
+static VALUE xrs_stop(VALUE self) {
+  xr_nogvl(sched_stop, get_sched(self), NULL);
+  return self;
+}
+
+/*
+ * Is the scheduler running?
+ *
+ * Example:
+ *   cues.start unless cues.running?
+ *
+ */
+static VALUE xrs_running(VALUE self) {
+  return get_sched(self)->running ? Qtrue : Qfalse;
+}
+
+/*
+ * Get the number of cues that haven't run (or finished fading) yet.
+ *
+ * Example:
+ *   sleep 1 while cues.pending > 0
+ *
+ */
+static VALUE xrs_pending(VALUE self) {
+  xr_sched *s = get_sched(self);
+  cue *c;
+  int n;
+
+  pthread_mutex_lock(&s->lock);
+  n = s->num_timed;
+  for (c = s->track; c; c = c->next)
+    n++;
+  pthread_mutex_unlock(&s->lock);
+
+  return INT2FIX(n);
+}
+
+/*
+ * Remove all pending cues, and forget finished ones.
+ *
+ * Example:
+ *   cues.clear
+ *
+ */
+static VALUE xrs_clear(VALUE self) {
+  xr_sched *s = get_sched(self);
+  cue *lists[WHEEL_SLOTS + 2];
+  int i;
+
+  pthread_mutex_lock(&s->lock);
+  for (i = 0; i < WHEEL_SLOTS; i++) {
+    lists[i] = s->slots[i];
+    s->slots[i] = NULL;
+  }
+  memset(s->used, 0, sizeof(s->used));
+  lists[WHEEL_SLOTS] = s->track;
+  lists[WHEEL_SLOTS + 1] = s->done;
+  s->track = s->done = NULL;
+  s->num_timed = s->num_done = 0;
+  s->max_late = s->sum_late = 0;
+  pthread_mutex_unlock(&s->lock);
+
+  for (i = 0; i < WHEEL_SLOTS + 2; i++)
+    cue_list_free(lists[i]);
+
+  return self;
+}
+
+/*
+ * Get the cues that have run, oldest first, as an array of hashes:
+ * :name, :at (when it was due, as a Time), :late (how late it ran, in
+ * milliseconds), and :ok (false if XMMS wasn't running).
+ *
+ * Example:
+ *   cues.report.each { |c| printf "%-20s %6.2fms late\n", c[:name], c[:late] }
+ *
+ */
+static VALUE xrs_report(VALUE self) {
+  xr_sched *s = get_sched(self);
+  VALUE ret, h;
+  cue *c;
+
+  ret = rb_ary_new();
+  pthread_mutex_lock(&s->lock);
+  for (c = s->done; c; c = c->next) {
+    h = rb_hash_new();
+    rb_hash_aset(h, ID2SYM(rb_intern("name")), c->name ? rb_str_new2(c->name) : Qnil);
+    rb_hash_aset(h, ID2SYM(rb_intern("at")), rb_time_new((time_t) c->wall,
+                 (long) ((c->wall - (time_t) c->wall) * 1e6)));
+    rb_hash_aset(h, ID2SYM(rb_intern("late")), rb_float_new(c->late * 1000.0));
+    rb_hash_aset(h, ID2SYM(rb_intern("ok")), c->ok ? Qtrue : Qfalse);
+    rb_ary_unshift(ret, h);
+  }
+  pthread_mutex_unlock(&s->lock);
+
+  return ret;
+}
+
+/*
+ * Get statistics, as a hash: :pending, :done, and the average and
+ * largest lateness (:avg_late, :max_late, in milliseconds).
+ *
+ * Example:
+ *   p cues.stats
+ *
+ */
+static VALUE xrs_stats(VALUE self) {
+  xr_sched *s = get_sched(self);
+  VALUE ret = rb_hash_new();
+
+  rb_hash_aset(ret, ID2SYM(rb_intern("pending")), xrs_pending(self));
+  pthread_mutex_lock(&s->lock);
+  rb_hash_aset(ret, ID2SYM(rb_intern("done")), INT2FIX(s->num_done));
+  rb_hash_aset(ret, ID2SYM(rb_intern("avg_late")),
+               rb_float_new(s->num_done ? s->sum_late * 1000.0 / s->num_done : 0.0));
+  rb_hash_aset(ret, ID2SYM(rb_intern("max_late")), rb_float_new(s->max_late * 1000.0));
+  pthread_mutex_unlock(&s->lock);
+
+  return ret;
+}
+
+void Init_xmms_sched(void) {
+  id_sched = rb_intern(SCHED_KEY);
+  id_to_f = rb_intern("to_f");
+
+  cScheduler = rb_define_class_under(mXmms, "Scheduler", rb_cObject);
+  rb_undef_alloc_func(cScheduler);
+  rb_define_singleton_method(cScheduler, "new", xrs_new, 1);
+  rb_define_method(cScheduler, "initialize", xrs_init, 1);
+
+  rb_define_method(cScheduler, "at", xrs_at, -1);
+  rb_define_method(cScheduler, "after", xrs_after, -1);
+  rb_define_method(cScheduler, "at_track", xrs_at_track, -1);
+  rb_define_method(cScheduler, "fade", xrs_fade, -1);
+  rb_define_method(cScheduler, "start", xrs_start, 0);
+  rb_define_method(cScheduler, "stop", xrs_stop, 0);
+  rb_define_method(cScheduler, "running?", xrs_running, 0);
+  rb_define_method(cScheduler, "pending", xrs_pending, 0);
+  rb_define_method(cScheduler, "clear", xrs_clear, 0);
+  rb_define_method(cScheduler, "report", xrs_report, 0);
+  rb_define_method(cScheduler, "stats", xrs_stats, 0);
+}
@@ -0,0 +1,564 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Session discovery: Xmms.sessions and Xmms.watch_sessions.
+ *
+ * Every running copy of XMMS listens on a control socket named
+ * xmms_<user>.<session> in the temporary directory.  Rather than
+ * asking sessions 0 through max - 1 one at a time (each a connection
+ * attempt), we list the directory, and only probe the sessions that
+ * have a socket, in parallel, from a handful of native threads.  A
+ * probe that doesn't answer in time is abandoned (its thread finishes
+ * in the background), so one wedged XMMS can't stall the scan.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include "xmms_ruby.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+/* defaults */
+#define DEFAULT_MAX     64
+#define DEFAULT_TIMEOUT 0.5
+
+/* largest :max allowed (XMMS takes the lowest free session, so real
+ * ones are small; this just bounds what the caller can make us
+ * allocate) */
+#define MAX_MAX 4096
+
+/* most probe threads per scan */
+#define MAX_PROBERS 16
+
+/* longest wait without checking for interrupts, in seconds */
+#define WAIT_SLICE 0.1
+
+typedef struct {
+  int session,
+      done,
+      running,
+      version,
+      playing,
+      paused;
+} probe;
+
+/*
+ * One scan.  Shared by the caller and the probe threads, and freed by
+ * whichever lets go of it last.
+ */
+typedef struct {
+  probe *probes;
+  int num_probes,
+      next,
+      num_done,
+      refs;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} scan;
+
+static VALUE sym_session,
+             sym_version,
+             sym_state,
+             sym_playing,
+             sym_paused,
+             sym_stopped,
+             sym_start,
+             sym_stop;
+
+/*
+ * Parse a control socket name.  Returns the session number, or -1 if
+ * the name isn't one of ours (or the session is max or higher).
+ */
+static int socket_session(const char *name, const char *prefix, int max) {
+  size_t len = strlen(prefix);
+  const char *p;
+  int ret = 0;
+
+  if (strncmp(name, prefix, len) || !name[len])
+    return -1;
+
+  for (p = name + len; *p; p++) {
+    if (*p < '0' || *p > '9')
+      return -1;
+    ret = ret * 10 + (*p - '0');
+    if (ret >= max)
+      return -1;
+  }
+
+  return ret;
+}
+
+/*
+ * Find the sessions (less than max) that have a control socket.  Sets
+ * seen[n] for each one, and returns how many there were.
+ */
+static int list_sockets(char *seen, int max) {
+  char prefix[256], path[PATH_MAX];
+  const char *dir = g_get_tmp_dir();
+  struct dirent *ent;
+  struct stat st;
+  DIR *d;
+  int n, ret = 0;
+
+  memset(seen, 0, max);
+  snprintf(prefix, sizeof(prefix), "xmms_%s.", g_get_user_name());
+  if ((d = opendir(dir)) == NULL)
+    return 0;
+
+  while ((ent = readdir(d)) != NULL) {
+    if ((n = socket_session(ent->d_name, prefix, max)) < 0 || seen[n])
+      continue;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+    if (lstat(path, &st) || !S_ISSOCK(st.st_mode))
+      continue;
+
+    seen[n] = 1;
+    ret++;
+  }
+
+  closedir(d);
+  return ret;
+}
+
+static void scan_unref(scan *s) {
+  int left;
+
+  pthread_mutex_lock(&s->lock);
+  left = --s->refs;
+  pthread_mutex_unlock(&s->lock);
+
+  if (left)
+    return;
+
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->cond);
+  free(s->probes);
+  free(s);
+}
+
+static void *probe_thread(void *data) {
+  scan *s = data;
+  int i;
+
+  while ((i = __atomic_fetch_add(&s->next, 1, __ATOMIC_SEQ_CST)) < s->num_probes) {
+    probe *p = &s->probes[i];
+
+    if ((p->running = xmms_remote_is_running(p->session)) != 0) {
+      p->version = xmms_remote_get_version(p->session);
+      p->playing = xmms_remote_is_playing(p->session);
+      p->paused = xmms_remote_is_paused(p->session);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    __atomic_store_n(&p->done, 1, __ATOMIC_RELEASE);
+    s->num_done++;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+  }
+
+  scan_unref(s);
+  return NULL;
+}
+
+typedef struct {
+  scan *scan;
+  double timeout;
+} wait_args;
+
+static void *wait_nogvl(void *data) {
+  wait_args *args = data;
+  scan *s = args->scan;
+  struct timespec ts;
+  double t;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  t = ts.tv_sec + ts.tv_nsec / 1e9 + args->timeout;
+  ts.tv_sec = (time_t) t;
+  ts.tv_nsec = (long) ((t - (time_t) t) * 1e9);
+
+  pthread_mutex_lock(&s->lock);
+  while (s->num_done < s->num_probes)
+    if (pthread_cond_timedwait(&s->cond, &s->lock, &ts))
+      break;
+  pthread_mutex_unlock(&s->lock);
+
+  return NULL;
+}
+
+/*
+ * Start probing the sessions flagged in seen.
+ */
+static scan *scan_new(const char *seen, int max) {
+  sigset_t all, old;
+  pthread_t thread;
+  scan *s;
+  int i, n, num_threads;
+
+  if ((s = calloc(1, sizeof(scan))) == NULL ||
+      (s->probes = calloc(max, sizeof(probe))) == NULL) {
+    free(s);
+    rb_raise(rb_eNoMemError, "couldn't allocate scan");
+  }
+
+  for (i = 0; i < max; i++)
+    if (seen[i])
+      s->probes[s->num_probes++].session = i;
+
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->cond, NULL);
+  s->refs = 1;
+
+  /* the probe threads shouldn't get ruby's signals */
+  num_threads = s->num_probes < MAX_PROBERS ? s->num_probes : MAX_PROBERS;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  for (n = 0; n < num_threads; n++) {
+    pthread_mutex_lock(&s->lock);
+    s->refs++;
+    pthread_mutex_unlock(&s->lock);
+
+    if (pthread_create(&thread, NULL, probe_thread, s)) {
+      scan_unref(s);
+      break;
+    }
+    pthread_detach(thread);
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  /* couldn't start any threads; probe them here */
+  if (n == 0 && s->num_probes > 0) {
+    s->refs++;
+    xr_nogvl(probe_thread, s, NULL);
+  }
+
+  return s;
+}
+
+typedef struct {
+  scan *scan;
+  double timeout;
+} collect_args;
+
+/*
+ * Wait up to timeout seconds for a scan, and return an array of hashes
+ * describing the sessions that are running.
+ */
+static VALUE scan_collect(VALUE data) {
+  collect_args *c = (collect_args*) data;
+  scan *s = c->scan;
+  wait_args args;
+  double start = xr_now(), left;
+  int i, n;
+  VALUE ret = rb_ary_new(), h;
+
+  for (;;) {
+    pthread_mutex_lock(&s->lock);
+    n = s->num_done;
+    pthread_mutex_unlock(&s->lock);
+
+    left = c->timeout - (xr_now() - start);
+    if (n == s->num_probes || left <= 0)
+      break;
+
+    args.scan = s;
+    args.timeout = left < WAIT_SLICE ? left : WAIT_SLICE;
+    xr_nogvl(wait_nogvl, &args, NULL);
+    XR_CHECK_INTS();
+  }
+
+  /* stragglers are left out */
+  for (i = 0; i < s->num_probes; i++) {
+    probe *p = &s->probes[i];
+
+    if (!__atomic_load_n(&p->done, __ATOMIC_ACQUIRE) || !p->running)
+      continue;
+
+    h = rb_hash_new();
+    rb_hash_aset(h, sym_session, INT2FIX(p->session));
+    rb_hash_aset(h, sym_version, INT2FIX(p->version));
+    rb_hash_aset(h, sym_state, p->paused ? sym_paused :
+                               p->playing ? sym_playing : sym_stopped);
+    rb_ary_push(ret, h);
+  }
+
+  return ret;
+}
+
+static VALUE scan_release(VALUE data) {
+  scan_unref(((collect_args*) data)->scan);
+  return Qnil;
+}
+
+/*
+ * Probe the sessions flagged in seen, waiting up to timeout seconds.
+ */
+static VALUE probe_sessions(const char *seen, int max, double timeout) {
+  collect_args c;
+
+  c.scan = scan_new(seen, max);
+  c.timeout = timeout;
+  return rb_ensure(scan_collect, (VALUE) &c, scan_release, (VALUE) &c);
+}
+
+static void parse_opts(int argc, VALUE *argv, int *max, double *timeout) {
+  VALUE opts, v;
+
+  if (argc > 1)
+    rb_raise(rb_eArgError, "invalid argument count (not 0 or 1)");
+
+  *max = DEFAULT_MAX;
+  *timeout = DEFAULT_TIMEOUT;
+  if (argc == 0 || (opts = argv[0]) == Qnil)
+    return;
+
+  Check_Type(opts, T_HASH);
+  if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("max")))) != Qnil)
+    *max = NUM2INT(v);
+  if ((v = rb_hash_aref(opts, ID2SYM(rb_intern("timeout")))) != Qnil)
+    *timeout = NUM2DBL(v);
+
+  if (*max < 1 || *max > MAX_MAX)
+    rb_raise(rb_eArgError, "invalid maximum session (not 1 to %d)", MAX_MAX);
+}
+
+/*
+ * Find the running copies of XMMS (for the current user), by looking
+ * for their control sockets and asking each one, in parallel, for its
+ * version and state.  Returns an array of hashes, ordered by session,
+ * with these keys: :session, :version, and :state (one of :playing,
+ * :paused, or :stopped).
+ *
+ * Options:
+ *   :max       only look at sessions below this (default 64)
+ *   :timeout   give up on sessions that haven't answered after this
+ *              many seconds (default 0.5); they're left out
+ *
+ * This method raises an ArgumentError exception if the number of
+ * arguments isn't 0 or 1, or if the maximum isn't between 1 and 4096.
+ *
+ * Examples:
+ *   Xmms.sessions.each do |s|
+ *     puts "session #{s[:session]}: #{s[:state]}"
+ *   end
+ *
+ *   remotes = Xmms.sessions(:max => 8).map { |s| Xmms::Remote.new(s[:session]) }
+ *
+ */
+static VALUE xs_sessions(int argc, VALUE *argv, VALUE self) {
+  double timeout;
+  char *seen;
+  int max;
+  VALUE buf, ret;
+
+  UNUSED(self);
+  parse_opts(argc, argv, &max, &timeout);
+
+  /* (left to the GC if probing raises) */
+  seen = ALLOCV_N(char, buf, max);
+  list_sockets(seen, max);
+  ret = probe_sessions(seen, max, timeout);
+  ALLOCV_END(buf);
+
+  return ret;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+typedef struct {
+  int fd,
+      max;
+  double timeout;
+  char *live,
+       *seen,
+       *now;
+  char prefix[256];
+} watch;
+
+static VALUE watch_yield(watch *w, int session, int live) {
+  if (w->live[session] == live)
+    return Qnil;
+
+  w->live[session] = live;
+  return rb_yield_values(2, live ? sym_start : sym_stop, INT2FIX(session));
+}
+
+/*
+ * Compare a fresh scan with what we think is running, and report the
+ * differences.
+ */
+static void watch_rescan(watch *w) {
+  VALUE ary;
+  long i;
+
+  list_sockets(w->seen, w->max);
+  ary = probe_sessions(w->seen, w->max, w->timeout);
+
+  memset(w->now, 0, w->max);
+  for (i = 0; i < RARRAY_LEN(ary); i++)
+    w->now[FIX2INT(rb_hash_aref(rb_ary_entry(ary, i), sym_session))] = 1;
+
+  for (i = 0; i < w->max; i++)
+    watch_yield(w, i, w->now[i]);
+}
+
+static VALUE watch_loop(VALUE data) {
+  watch *w = (watch*) data;
+  char buf[4096]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  struct inotify_event *ev;
+  ssize_t len;
+  char *p;
+  int n;
+
+  watch_rescan(w);
+
+  for (;;) {
+    rb_thread_wait_fd(w->fd);
+    if ((len = read(w->fd, buf, sizeof(buf))) < 0) {
+      if (errno == EAGAIN || errno == EINTR)
+        continue;
+      rb_sys_fail("inotify");
+    }
+
+    for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+      ev = (struct inotify_event*) p;
+
+      /* we missed some; start over */
+      if (ev->mask & IN_Q_OVERFLOW) {
+        watch_rescan(w);
+        break;
+      }
+
+      if (!ev->len || (n = socket_session(ev->name, w->prefix, w->max)) < 0)
+        continue;
+
+      watch_yield(w, n, (ev->mask & (IN_CREATE | IN_MOVED_TO)) != 0);
+    }
+  }
+
+  return Qnil;
+}
+
+static VALUE watch_close(VALUE data) {
+  watch *w = (watch*) data;
+
+  close(w->fd);
+  xfree(w->live);               /* and seen and now */
+  return Qnil;
+}
+#endif
+
+/*
+ * Watch for copies of XMMS starting and stopping, yielding :start or
+ * :stop and the session number for each one.  Sessions that are
+ * already running are reported (as :start) first.  Takes the same
+ * options as Xmms.sessions.  The temporary directory is watched with
+ * inotify, so nothing is polled; the block is called from the calling
+ * thread, and the method only returns if the block breaks out of it.
+ *
+ * Note that a copy of XMMS that crashes leaves its socket behind, so
+ * its :stop isn't reported until another copy reuses the session.  And
+ * a :start is reported when the socket is created, just before XMMS
+ * starts answering on it.
+ *
+ * This method raises an ArgumentError exception if the number of
+ * arguments isn't 0 or 1, or if the maximum isn't between 1 and 4096,
+ * and a NotImplementedError exception if inotify isn't available.
+ *
+ * Examples:
+ *   Xmms.watch_sessions do |event, session|
+ *     puts "session #{session}: #{event}"
+ *   end
+ *
+ */
+static VALUE xs_watch_sessions(int argc, VALUE *argv, VALUE self) {
+#ifdef HAVE_SYS_INOTIFY_H
+  watch w;
+  int flags;
+
+  UNUSED(self);
+  parse_opts(argc, argv, &w.max, &w.timeout);
+  rb_need_block();
+
+  /* allocate first, so nothing can raise with the descriptor open */
+  w.live = ALLOC_N(char, w.max * 3);
+  w.seen = w.live + w.max;
+  w.now = w.seen + w.max;
+  memset(w.live, 0, w.max);
+
+  if ((w.fd = inotify_init()) < 0) {
+    xfree(w.live);
+    rb_sys_fail("inotify_init");
+  }
+  flags = fcntl(w.fd, F_GETFL);
+  fcntl(w.fd, F_SETFL, flags | O_NONBLOCK);
+  fcntl(w.fd, F_SETFD, FD_CLOEXEC);
+
+  if (inotify_add_watch(w.fd, g_get_tmp_dir(), IN_CREATE | IN_DELETE |
+                        IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR) < 0) {
+    int err = errno;
+    close(w.fd);
+    xfree(w.live);
+    errno = err;
+    rb_sys_fail(g_get_tmp_dir());
+  }
+
+  snprintf(w.prefix, sizeof(w.prefix), "xmms_%s.", g_get_user_name());
+
+  return rb_ensure(watch_loop, (VALUE) &w, watch_close, (VALUE) &w);
+#else
+  UNUSED(argc);
+  UNUSED(argv);
+  UNUSED(self);
+  rb_notimplement();
+  return Qnil;
+#endif
+}
+
+void Init_xmms_session(void) {
+#define SYM(var, name) var = ID2SYM(rb_intern(name))
+  SYM(sym_session, "session");
+  SYM(sym_version, "version");
+  SYM(sym_state, "state");
+  SYM(sym_playing, "playing");
+  SYM(sym_paused, "paused");
+  SYM(sym_stopped, "stopped");
+  SYM(sym_start, "start");
+  SYM(sym_stop, "stop");
+#undef SYM
+
+  rb_define_module_function(mXmms, "sessions", xs_sessions, -1);
+  rb_define_module_function(mXmms, "watch_sessions", xs_watch_sessions, -1);
+}
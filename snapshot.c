@@ -0,0 +1,437 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+
+/*
+ * Native playlist snapshots.
+ *
+ * Reading the playlist through libxmms costs one round trip per entry
+ * per column, so anything that wants more than a handful of entries
+ * goes through xr_snap_fetch(), which only fetches the columns it's
+ * asked for and does so without holding the interpreter lock.
+ *
+ * Xmms::Snapshot (Xmms::Remote#snapshot) wraps one up as a ruby
+ * object, for callers that want to hold on to the playlist.
+ */
+#include "xmms_ruby.h"
+
+typedef struct {
+  xr_snap *snap;
+  int session;
+  volatile int cancel;
+} fetch_args;
+
+static void *snap_fetch_nogvl(void *data) {
+  fetch_args *args = data;
+  xr_snap *snap = args->snap;
+  int i, session = args->session;
+
+  for (i = 0; i < snap->len && !args->cancel; i++) {
+    if (snap->cols & XR_COL_TITLE)
+      snap->titles[i] = xmms_remote_get_playlist_title(session, i);
+    if (snap->cols & XR_COL_FILE)
+      snap->files[i] = xmms_remote_get_playlist_file(session, i);
+    if (snap->cols & XR_COL_TIME)
+      snap->times[i] = xmms_remote_get_playlist_time(session, i);
+  }
+
+  return NULL;
+}
+
+/*
+ * Fetch the requested columns (a mask of XR_COL_* values) of the
+ * playlist for the given session.
+ *
+ * Returns 0 on success, or -1 if the fetch was interrupted (in which
+ * case the snapshot is left empty).  Entries which disappear while the
+ * fetch is in progress come back as NULL strings.
+ */
+int xr_snap_fetch(xr_snap *snap, int session, int cols) {
+  fetch_args args;
+
+  memset(snap, 0, sizeof(xr_snap));
+  snap->cols = cols;
+  snap->len = xmms_remote_get_playlist_length(session);
+  if (snap->len < 0)
+    snap->len = 0;
+
+  if (cols & XR_COL_TITLE)
+    snap->titles = g_malloc0(sizeof(gchar*) * (snap->len + 1));
+  if (cols & XR_COL_FILE)
+    snap->files = g_malloc0(sizeof(gchar*) * (snap->len + 1));
+  if (cols & XR_COL_TIME)
+    snap->times = g_malloc0(sizeof(gint) * (snap->len + 1));
+
+  args.snap = snap;
+  args.session = session;
+  args.cancel = 0;
+  xr_nogvl(snap_fetch_nogvl, &args, &args.cancel);
+
+  if (args.cancel) {
+    xr_snap_free(snap);
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Free a snapshot returned by xr_snap_fetch().
+ */
+void xr_snap_free(xr_snap *snap) {
+  int i;
+
+  for (i = 0; i < snap->len; i++) {
+    if (snap->titles && snap->titles[i])
+      g_free(snap->titles[i]);
+    if (snap->files && snap->files[i])
+      g_free(snap->files[i]);
+  }
+
+  if (snap->titles)
+    g_free(snap->titles);
+  if (snap->files)
+    g_free(snap->files);
+  if (snap->times)
+    g_free(snap->times);
+
+  memset(snap, 0, sizeof(xr_snap));
+}
+
+/******************/
+/* XMMS::SNAPSHOT */
+/******************/
+
+/*
+ * A snapshot kept around as a ruby object.  Paths go into a path
+ * store (see paths.c) instead of being kept as they came from libxmms.
+ */
+typedef struct {
+  int len,
+      cols;
+  gchar **titles;
+  gint *times;
+  xr_paths *files;
+  size_t title_bytes;
+} xr_snapshot;
+
+static VALUE cSnapshot;
+
+static void snapshot_free(xr_snapshot *s) {
+  int i;
+
+  if (s->titles) {
+    for (i = 0; i < s->len; i++)
+      if (s->titles[i])
+        g_free(s->titles[i]);
+    g_free(s->titles);
+  }
+  if (s->times)
+    g_free(s->times);
+  if (s->files)
+    xr_paths_free(s->files);
+  xfree(s);
+}
+
+static xr_snapshot *get_snapshot(VALUE self) {
+  xr_snapshot *s;
+  Data_Get_Struct(self, xr_snapshot, s);
+  return s;
+}
+
+/*
+ * Take a snapshot of the playlist.  Any combination of the columns
+ * :title, :file, and :time may be given (all three are fetched if none
+ * are); the others come back as nil.
+ *
+ * File names are stored prefix-compressed: each directory is kept
+ * once, however many entries it holds, which typically makes a
+ * snapshot several times smaller than the same paths as strings, and
+ * makes Xmms::Snapshot#under cheap.
+ *
+ * This method raises an Xmms::Error exception if XMMS is not running,
+ * or an ArgumentError exception if a column name isn't recognized.
+ *
+ * Examples:
+ *   snap = remote.snapshot
+ *   snap.each { |title, file, time| puts "#{title}: #{file}" }
+ *
+ *   # just the paths
+ *   files = remote.snapshot(:file)
+ *
+ */
+static VALUE xr_snapshot_new(int argc, VALUE *argv, VALUE self) {
+  xr_snapshot *s;
+  xr_snap snap;
+  int i, cols = 0, *session;
+  VALUE ret;
+
+  for (i = 0; i < argc; i++) {
+    ID col = rb_to_id(argv[i]);
+    if (col == rb_intern("title"))
+      cols |= XR_COL_TITLE;
+    else if (col == rb_intern("file"))
+      cols |= XR_COL_FILE;
+    else if (col == rb_intern("time"))
+      cols |= XR_COL_TIME;
+    else
+      rb_raise(rb_eArgError, "unknown column: %s", rb_id2name(col));
+  }
+  if (!cols)
+    cols = XR_COL_TITLE | XR_COL_FILE | XR_COL_TIME;
+
+  session = XR_SESSION(self);
+  CHECK_SESSION(session);
+
+  if (xr_snap_fetch(&snap, *session, cols)) {
+    XR_CHECK_INTS();
+    rb_raise(eError, "playlist fetch interrupted");
+  }
+
+  ret = Data_Make_Struct(cSnapshot, xr_snapshot, 0, snapshot_free, s);
+  s->len = snap.len;
+  s->cols = cols;
+
+  /* titles and times are kept as they are */
+  s->titles = snap.titles;
+  s->times = snap.times;
+  snap.titles = NULL;
+  snap.times = NULL;
+  if (s->titles)
+    for (i = 0; i < s->len; i++)
+      s->title_bytes += s->titles[i] ? strlen(s->titles[i]) + 1 : 0;
+
+  if (snap.files) {
+    s->files = xr_paths_new();
+    for (i = 0; i < snap.len; i++)
+      xr_paths_add(s->files, snap.files[i]);
+    xr_paths_trim(s->files);
+  }
+
+  xr_snap_free(&snap);
+  return ret;
+}
+
+static VALUE snapshot_title(xr_snapshot *s, int i) {
+  if (!s->titles)
+    return Qnil;
+  return xr_str_new(s->titles[i] ? s->titles[i] : "",
+                    s->titles[i] ? strlen(s->titles[i]) : 0, XR_STR_TEXT);
+}
+
+static VALUE snapshot_file(xr_snapshot *s, int i) {
+  const char *path;
+  size_t len;
+
+  if (!s->files)
+    return Qnil;
+  path = xr_paths_get(s->files, i, &len);
+  return xr_str_new(path, len, XR_STR_PATH);
+}
+
+static VALUE snapshot_time(xr_snapshot *s, int i) {
+  return s->times ? INT2FIX(s->times[i]) : Qnil;
+}
+
+/*
+ * Convert an index (which may be negative) to a position, or -1 if
+ * it's out of range.
+ */
+static int snapshot_pos(xr_snapshot *s, VALUE index) {
+  int i = NUM2INT(index);
+
+  if (i < 0)
+    i += s->len;
+  return (i < 0 || i >= s->len) ? -1 : i;
+}
+
+/*
+ * Get an entry as a [title, file, time] array (like the entries of
+ * Xmms::Remote#playlist), or nil if the index is out of range.
+ *
+ * Example:
+ *   title, file, time = snap[0]
+ *
+ */
+static VALUE xrs_aref(VALUE self, VALUE index) {
+  xr_snapshot *s = get_snapshot(self);
+  int i = snapshot_pos(s, index);
+
+  if (i < 0)
+    return Qnil;
+  return rb_ary_new3(3, snapshot_title(s, i), snapshot_file(s, i),
+                     snapshot_time(s, i));
+}
+
+/*
+ * Get the title of an entry, or nil if the index is out of range or
+ * titles weren't fetched.
+ *
+ * Example:
+ *   puts snap.title(-1)
+ *
+ */
+static VALUE xrs_title(VALUE self, VALUE index) {
+  xr_snapshot *s = get_snapshot(self);
+  int i = snapshot_pos(s, index);
+
+  return (i < 0) ? Qnil : snapshot_title(s, i);
+}
+
+/*
+ * Get the path of an entry, or nil if the index is out of range or
+ * paths weren't fetched.
+ *
+ * Example:
+ *   puts snap.file(0)
+ *
+ */
+static VALUE xrs_file(VALUE self, VALUE index) {
+  xr_snapshot *s = get_snapshot(self);
+  int i = snapshot_pos(s, index);
+
+  return (i < 0) ? Qnil : snapshot_file(s, i);
+}
+
+/*
+ * Get the length of an entry in milliseconds, or nil if the index is
+ * out of range or times weren't fetched.
+ *
+ * Example:
+ *   puts snap.time(0) / 1000
+ *
+ */
+static VALUE xrs_time(VALUE self, VALUE index) {
+  xr_snapshot *s = get_snapshot(self);
+  int i = snapshot_pos(s, index);
+
+  return (i < 0) ? Qnil : snapshot_time(s, i);
+}
+
+/*
+ * Iterate over the entries in the snapshot, yielding [title, file,
+ * time] arrays.
+ *
+ * Example:
+ *   snap.each { |title, file, time| puts "#{title} (#{time}ms)" }
+ *
+ */
+static VALUE xrs_each(VALUE self) {
+  xr_snapshot *s = get_snapshot(self);
+  int i;
+
+  for (i = 0; i < s->len; i++)
+    rb_yield(rb_ary_new3(3, snapshot_title(s, i), snapshot_file(s, i),
+                         snapshot_time(s, i)));
+
+  return self;
+}
+
+/*
+ * Find the entries under a directory (at any depth).  Returns a sorted
+ * array of positions; trailing slashes are ignored.
+ *
+ * This method raises an ArgumentError exception if the snapshot
+ * doesn't have paths.
+ *
+ * Examples:
+ *   # queue up an album
+ *   snap.under('/srv/music/Pixies/Doolittle').each do |i|
+ *     puts snap.file(i)
+ *   end
+ *
+ */
+static VALUE xrs_under(VALUE self, VALUE dir) {
+  xr_snapshot *s = get_snapshot(self);
+  unsigned int *ids;
+  int i, len;
+  VALUE ret;
+
+  if (!s->files)
+    rb_raise(rb_eArgError, "snapshot doesn't have paths");
+
+  StringValue(dir);
+  len = xr_paths_under(s->files, RSTRING_PTR(dir), RSTRING_LEN(dir), &ids);
+  ret = rb_ary_new2(len);
+  for (i = 0; i < len; i++)
+    rb_ary_push(ret, INT2FIX(ids[i]));
+  if (ids)
+    xfree(ids);
+
+  return ret;
+}
+
+/*
+ * Get the number of entries in the snapshot.
+ *
+ * Example:
+ *   puts "#{snap.length} entries"
+ *
+ */
+static VALUE xrs_length(VALUE self) {
+  return INT2FIX(get_snapshot(self)->len);
+}
+
+/*
+ * Get the approximate amount of memory used by the snapshot, in bytes.
+ *
+ * Example:
+ *   puts "snapshot size: #{snap.memsize / 1024}k"
+ *
+ */
+static VALUE xrs_memsize(VALUE self) {
+  xr_snapshot *s = get_snapshot(self);
+  size_t ret = sizeof(xr_snapshot);
+
+  if (s->titles)
+    ret += s->title_bytes + sizeof(gchar*) * (s->len + 1);
+  if (s->times)
+    ret += sizeof(gint) * (s->len + 1);
+  if (s->files)
+    ret += xr_paths_memsize(s->files);
+
+  return ULONG2NUM(ret);
+}
+
+void Init_xmms_snapshot(void) {
+  rb_define_method(cRemote, "snapshot", xr_snapshot_new, -1);
+  rb_define_alias(cRemote, "playlist_snapshot", "snapshot");
+
+  cSnapshot = rb_define_class_under(mXmms, "Snapshot", rb_cObject);
+  rb_undef_alloc_func(cSnapshot);
+  rb_undef_method(CLASS_OF(cSnapshot), "new");
+  rb_include_module(cSnapshot, rb_mEnumerable);
+
+  rb_define_method(cSnapshot, "[]", xrs_aref, 1);
+  rb_define_method(cSnapshot, "title", xrs_title, 1);
+  rb_define_method(cSnapshot, "file", xrs_file, 1);
+  rb_define_method(cSnapshot, "time", xrs_time, 1);
+  rb_define_method(cSnapshot, "each", xrs_each, 0);
+  rb_define_method(cSnapshot, "under", xrs_under, 1);
+  rb_define_method(cSnapshot, "length", xrs_length, 0);
+  rb_define_alias(cSnapshot, "size", "length");
+  rb_define_method(cSnapshot, "memsize", xrs_memsize, 0);
+}
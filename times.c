@@ -0,0 +1,436 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+
+/*
+ * Playlist duration aggregates.
+ *
+ * The durations of every playlist entry are cached (without titles or
+ * paths) in a Fenwick tree, so the total time of any range of entries
+ * is an O(log n) query once the cache is populated.  The cache is
+ * refetched when the playlist length changes behind our back, and is
+ * updated in place for edits made through the owning Xmms::Remote.
+ */
+#include "xmms_ruby.h"
+
+/* marks a duration we haven't fetched yet */
+#define UNKNOWN_TIME (-0x7fffffff - 1)
+
+/* fetches to try before settling for one that raced with an edit */
+#define MAX_TRIES 3
+
+typedef struct {
+  int session;
+  int len, cap;
+  gint *times;            /* raw durations, or UNKNOWN_TIME */
+  long long *tree;        /* fenwick tree over times (1-based) */
+  int num_unknown;
+  int gen;                /* bumped by every edit (see times_pl_hook()) */
+  int unsure;             /* raced with an edit; reload on the next sync */
+  unsigned int edits;     /* xr_late_edits() when last synced */
+} xr_times;
+
+static VALUE cTimeCache;
+
+/****************/
+/* FENWICK TREE */
+/****************/
+
+static long long clamp_time(gint t) {
+  return (t > 0) ? t : 0;
+}
+
+static void ft_add(xr_times *t, int i, long long delta) {
+  for (i++; i <= t->len; i += i & -i)
+    t->tree[i] += delta;
+}
+
+/*
+ * Sum of the first n durations.
+ */
+static long long ft_prefix(xr_times *t, int n) {
+  long long ret = 0;
+
+  for (; n > 0; n -= n & -n)
+    ret += t->tree[n];
+
+  return ret;
+}
+
+/*
+ * Rebuild the whole tree from the duration column in O(n).
+ */
+static void ft_build(xr_times *t) {
+  int i, j;
+
+  for (i = 1; i <= t->len; i++)
+    t->tree[i] = (t->times[i - 1] == UNKNOWN_TIME) ? 0 : clamp_time(t->times[i - 1]);
+  for (i = 1; i <= t->len; i++)
+    if ((j = i + (i & -i)) <= t->len)
+      t->tree[j] += t->tree[i];
+}
+
+static void times_reserve(xr_times *t, int len) {
+  if (len <= t->cap && t->tree)
+    return;
+
+  /* the tree always has a node, even for an empty playlist (see
+   * times_pl_hook()) */
+  t->cap = (len > t->cap * 2) ? len : t->cap * 2;
+  if (t->cap < 1)
+    t->cap = 1;
+  REALLOC_N(t->times, gint, t->cap);
+  REALLOC_N(t->tree, long long, t->cap + 1);
+}
+
+static void times_clear(xr_times *t) {
+  t->len = t->num_unknown = 0;
+}
+
+/**********************/
+/* FETCHING FROM XMMS */
+/**********************/
+
+/*
+ * Fetches run without the interpreter lock, so another thread can edit
+ * the cache (through times_pl_hook()) in the meantime.  They go into
+ * private buffers, and are only merged into the cache, with the lock
+ * back, if its generation hasn't moved.  Otherwise the caller tries
+ * again; so that a busy writer can't keep it from ever getting through,
+ * the last try installs a full fetch anyway (it's still what XMMS held
+ * at some point during the query) and flags the cache to be reloaded
+ * on the next sync.
+ */
+
+/*
+ * Replace the cache with a fresh copy of the duration column.  Returns
+ * 0 if the cache was edited during the fetch, unless last is set.
+ */
+static int times_load(xr_times *t, int last) {
+  int gen = t->gen;
+  xr_snap snap;
+
+  if (xr_snap_fetch(&snap, t->session, XR_COL_TIME)) {
+    XR_CHECK_INTS();
+    rb_raise(eError, "playlist fetch interrupted");
+  }
+
+  if (t->gen == gen || last) {
+    times_reserve(t, snap.len);
+    memcpy(t->times, snap.times, sizeof(gint) * snap.len);
+    t->len = snap.len;
+    t->num_unknown = 0;
+    t->unsure = (t->gen != gen);
+    ft_build(t);
+  }
+
+  xr_snap_free(&snap);
+  return t->gen == gen || last;
+}
+
+typedef struct {
+  int session, num;
+  int *pos;                       /* entries to fetch */
+  gint *got;
+  volatile int cancel;
+} resolve_args;
+
+static void *resolve_nogvl(void *data) {
+  resolve_args *args = data;
+  int i;
+
+  for (i = 0; i < args->num && !args->cancel; i++)
+    args->got[i] = xmms_remote_get_playlist_time(args->session, args->pos[i]);
+  args->num = i;
+
+  return NULL;
+}
+
+/*
+ * Fetch the unknown durations.  Returns 0 if the cache was edited
+ * during the fetch.
+ */
+static int times_resolve(xr_times *t) {
+  int gen = t->gen, i, n = 0;
+  resolve_args args;
+
+  args.pos = ALLOC_N(int, t->num_unknown);
+  args.got = ALLOC_N(gint, t->num_unknown);
+  for (i = 0; i < t->len && n < t->num_unknown; i++)
+    if (t->times[i] == UNKNOWN_TIME)
+      args.pos[n++] = i;
+
+  args.session = t->session;
+  args.num = n;
+  args.cancel = 0;
+  xr_nogvl(resolve_nogvl, &args, &args.cancel);
+
+  /* what was fetched before an interrupt is still good */
+  if (t->gen == gen)
+    for (i = 0; i < args.num; i++) {
+      t->times[args.pos[i]] = args.got[i];
+      ft_add(t, args.pos[i], clamp_time(args.got[i]));
+      t->num_unknown--;
+    }
+
+  xfree(args.pos);
+  xfree(args.got);
+  if (args.cancel) {
+    XR_CHECK_INTS();
+    rb_raise(eError, "playlist fetch interrupted");
+  }
+
+  return t->gen == gen;
+}
+
+/*
+ * Make sure the cache matches the playlist length and holds no unknown
+ * durations.
+ */
+static void times_sync(xr_times *t) {
+  unsigned int edits = xr_late_edits(t->session);
+  int tries;
+
+  /* edited behind the hooks' back, or last loaded in a race; start over */
+  if (t->edits != edits || t->unsure) {
+    t->len = -1;
+    t->edits = edits;
+  }
+
+  for (tries = 1; ; tries++) {
+    if (xmms_remote_get_playlist_length(t->session) != t->len ||
+        (tries == MAX_TRIES && t->num_unknown)) {
+      if (times_load(t, tries >= MAX_TRIES))
+        return;
+    } else if (!t->num_unknown || times_resolve(t)) {
+      return;
+    }
+  }
+}
+
+/****************/
+/* CHANGE HOOKS */
+/****************/
+
+static void times_pl_hook(VALUE obj, xr_pl_op op, int pos, int argc, VALUE *argv) {
+  xr_times *t;
+  gint *old;
+  int i;
+
+  Data_Get_Struct(obj, xr_times, t);
+  t->gen++;
+
+  /* nothing cached yet */
+  if (t->len < 0)
+    return;
+
+  switch (op) {
+    case XR_PL_ADD:
+    case XR_PL_INSERT:
+      if (pos < 0 || pos > t->len)
+        pos = t->len;
+      times_reserve(t, t->len + argc);
+      memmove(t->times + pos + argc, t->times + pos, sizeof(gint) * (t->len - pos));
+      for (i = 0; i < argc; i++)
+        t->times[pos + i] = UNKNOWN_TIME;
+      t->len += argc;
+      t->num_unknown += argc;
+      ft_build(t);
+      break;
+    case XR_PL_DELETE:
+      /* flag the deleted entries (the tree is rebuilt below, so it can
+       * be borrowed for this), then squeeze them out in one pass */
+      memset(t->tree, 0, sizeof(long long) * (t->len + 1));
+      for (i = 0; i < argc; i++) {
+        pos = FIX2INT(argv[i]);
+        if (pos >= 0 && pos < t->len)
+          t->tree[pos] = 1;
+      }
+      for (i = 0, pos = 0; i < t->len; i++) {
+        if (t->tree[i]) {
+          if (t->times[i] == UNKNOWN_TIME)
+            t->num_unknown--;
+          continue;
+        }
+        t->times[pos++] = t->times[i];
+      }
+      t->len = pos;
+      ft_build(t);
+      break;
+    case XR_PL_REORDER:
+      if (argc != t->len) {
+        /* out of sync; refetch on the next query */
+        t->len = -1;
+        break;
+      }
+      old = ALLOC_N(gint, t->len + 1);
+      memcpy(old, t->times, sizeof(gint) * t->len);
+      for (i = 0; i < t->len; i++)
+        t->times[i] = old[FIX2INT(argv[i])];
+      xfree(old);
+      ft_build(t);
+      break;
+    case XR_PL_CLEAR:
+      times_clear(t);
+      break;
+  }
+}
+
+/****************/
+/* RUBY METHODS */
+/****************/
+
+static void times_free(xr_times *t) {
+  if (t->times)
+    xfree(t->times);
+  if (t->tree)
+    xfree(t->tree);
+  xfree(t);
+}
+
+/*
+ * Get the (synced) duration cache for a remote, creating it if
+ * necessary.
+ */
+static xr_times *get_times(VALUE self) {
+  xr_times *t;
+  VALUE obj;
+  int *session;
+
+  session = XR_SESSION(self);
+  CHECK_SESSION(session);
+
+  if ((obj = xr_remote_slot(self, XR_SLOT_TIMES)) != Qnil) {
+    Data_Get_Struct(obj, xr_times, t);
+  } else {
+    obj = Data_Make_Struct(cTimeCache, xr_times, 0, times_free, t);
+    t->session = *session;
+    t->len = -1;
+    xr_remote_set(self, XR_SLOT_TIMES, obj);
+  }
+
+  times_sync(t);
+  return t;
+}
+
+/*
+ * Get the total duration of the playlist, or of a range of entries, in
+ * milliseconds.
+ *
+ * Durations are cached after the first call, so subsequent calls only
+ * cost a couple of round trips to XMMS no matter how long the playlist
+ * is.  The cache is refreshed if the length of the playlist changes.
+ * Entries with an unknown duration (e.g. streams) count as zero.
+ *
+ * This method raises an Xmms::Error exception if XMMS is not running,
+ * an ArgumentError exception if the number of arguments isn't 0, 1, or
+ * 2, or a RangeError exception if the range is out of bounds.
+ *
+ * Examples:
+ *   # get the length of the whole playlist, in minutes
+ *   mins = remote.total_time / 60000
+ *
+ *   # get the combined length of songs 10 through 19
+ *   time = remote.total_time 10..19
+ *   time = remote.total_time 10, 19
+ *
+ */
+static VALUE xr_total_time(int argc, VALUE *argv, VALUE self) {
+  xr_times *t;
+  long beg, len, last;
+
+  t = get_times(self);
+
+  switch (argc) {
+    case 0:
+      beg = 0;
+      len = t->len;
+      break;
+    case 1:
+      if (!rb_range_beg_len(argv[0], &beg, &len, t->len, 1))
+        rb_raise(rb_eTypeError, "invalid argument type (not range)");
+      break;
+    case 2:
+      beg = NUM2LONG(argv[0]);
+      last = NUM2LONG(argv[1]);
+      if (beg < 0 || last < beg || last >= t->len)
+        rb_raise(rb_eRangeError, "invalid playlist range %ld..%ld", beg, last);
+      len = last - beg + 1;
+      break;
+    default:
+      rb_raise(rb_eArgError, "invalid argument count (not 0, 1, or 2)");
+  }
+
+  if (beg + len > t->len)
+    len = t->len - beg;
+
+  return LL2NUM(ft_prefix(t, beg + len) - ft_prefix(t, beg));
+}
+
+/*
+ * Get the amount of time left in the playlist, in milliseconds.
+ *
+ * This is the remaining time in the current song plus the duration of
+ * every song after it; see Xmms::Remote#total_time for details on how
+ * durations are cached.
+ *
+ * This method raises an Xmms::Error exception if XMMS is not running.
+ *
+ * Examples:
+ *   puts "#{remote.time_remaining / 60000} minutes left"
+ *   left = remote.remaining_time
+ *
+ */
+static VALUE xr_time_remaining(VALUE self) {
+  xr_times *t;
+  long long ret;
+  int pos;
+
+  t = get_times(self);
+  pos = xmms_remote_get_playlist_pos(t->session);
+  if (pos < 0 || pos >= t->len)
+    return INT2FIX(0);
+
+  ret = ft_prefix(t, t->len) - ft_prefix(t, pos);
+  ret -= xmms_remote_get_output_time(t->session);
+
+  return LL2NUM((ret > 0) ? ret : 0);
+}
+
+void Init_xmms_times(void) {
+  xr_pl_listen(XR_SLOT_TIMES, times_pl_hook);
+
+  /* holds the duration cache; not useful from ruby */
+  cTimeCache = rb_define_class_under(cRemote, "TimeCache", rb_cObject);
+  rb_undef_alloc_func(cTimeCache);
+  rb_undef_method(CLASS_OF(cTimeCache), "new");
+
+  rb_define_method(cRemote, "total_time", xr_total_time, -1);
+  rb_define_alias(cRemote, "playlist_total_time", "total_time");
+
+  rb_define_method(cRemote, "time_remaining", xr_time_remaining, 0);
+  rb_define_alias(cRemote, "remaining_time", "time_remaining");
+}
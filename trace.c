@@ -0,0 +1,1014 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Control protocol traces.
+ *
+ * While a capture is on (Xmms::Trace.start, or XMMS_RUBY_TRACE set in
+ * the environment when the extension is loaded), every command sent
+ * through an Xmms::Remote method (in any transport mode, including
+ * queued *_async calls and Xmms::Scheduler cues), relayed by an
+ * Xmms::Proxy or posted to an Xmms::HTTPServer, and every preset an
+ * Xmms::AutoEq applies, is appended to a trace file: its arguments,
+ * the reply, when it was sent, and how long XMMS took to answer.
+ * Xmms::Trace.replay sends a trace's commands again, through a remote
+ * set up however you like, at the recorded pace (or faster), and
+ * reports the latencies it saw, so transport modes and library
+ * versions can be compared on the same traffic.
+ *
+ * Everything else goes to libxmms directly rather than as commands, and
+ * isn't traced: bulk playlist fetches (Remote#playlist, snapshots, the
+ * index, playlist times, the prefetcher), bulk edits (Remote#sort! and
+ * friends), Xmms.sessions probes, and the polling done by
+ * Xmms::AutoEq, Xmms::PositionClock, Xmms::History, crossfades,
+ * scheduler fades and track checks, and the HTTP server's status page.
+ *
+ * A trace is a header (magic, the wall clock time the capture started,
+ * and the command names, so a trace outlives changes to xr_cmd_op),
+ * then a record per command:
+ *
+ *   op, flags          a byte each
+ *   session            zigzag varint
+ *   start              zigzag varint, microseconds after the last start
+ *   latency            varint, microseconds
+ *   arg[0], arg[1]     zigzag varints (FL_ARG)
+ *   farg               11 floats (FL_FARG)
+ *   str                varint count, then varint length and bytes each
+ *                      (FL_STR)
+ *   ret[0..2]          zigzag varints (FL_RET)
+ *   fret               11 floats (FL_FRET)
+ *   sret               varint length and bytes (FL_SRET)
+ *
+ * so a poll of the output time takes about ten bytes.  Records are
+ * buffered, and written a buffer at a time (and at least once a
+ * second); a record cut short by a crash marks the end of the trace.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "xmms_ruby.h"
+
+#define MAGIC       "XRTRACE1"
+#define ENV_VAR     "XMMS_RUBY_TRACE"
+#define BUF_SIZE    65536
+#define FLUSH_EVERY 1.0           /* seconds */
+
+/* sanity limits for reading */
+#define MAX_OPS     1024
+#define MAX_STR_LEN (16 << 20)
+#define MAX_STRS    65536
+
+/* record flags */
+#define FL_CUR  (1 << 0)
+#define FL_ARG  (1 << 1)
+#define FL_FARG (1 << 2)
+#define FL_STR  (1 << 3)
+#define FL_RET  (1 << 4)
+#define FL_FRET (1 << 5)
+#define FL_SRET (1 << 6)
+
+static VALUE mTrace;
+
+/* is a capture on?  (read without the lock) */
+int xr_tracing = 0;
+
+static struct {
+  int fd, err;                    /* err: errno of a failed write */
+  char *path;
+  double t0, last_flush;          /* monotonic */
+  int64_t last_start;             /* microseconds after t0 */
+  unsigned long records;
+  size_t len;
+  unsigned char buf[BUF_SIZE];
+} cap = { -1 };
+static pthread_mutex_t cap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static ID id_speed, id_reads_only, id_max;
+
+/*************/
+/* capturing */
+/*************/
+
+static void cap_flush(void) {
+  size_t off = 0;
+  ssize_t n;
+
+  while (off < cap.len && !cap.err) {
+    if ((n = write(cap.fd, cap.buf + off, cap.len - off)) < 0) {
+      if (errno != EINTR)
+        cap.err = errno;
+      continue;
+    }
+    off += n;
+  }
+
+  cap.len = 0;
+  cap.last_flush = xr_now();
+}
+
+static void put(const void *data, size_t len) {
+  const unsigned char *p = data;
+  size_t n;
+
+  while (len > 0) {
+    if (cap.len == BUF_SIZE)
+      cap_flush();
+    n = BUF_SIZE - cap.len;
+    if (n > len)
+      n = len;
+    memcpy(cap.buf + cap.len, p, n);
+    cap.len += n;
+    p += n;
+    len -= n;
+  }
+}
+
+static void put_uint(uint64_t v) {
+  unsigned char b[10];
+  int n = 0;
+
+  do {
+    b[n] = v & 0x7f;
+    if (v >>= 7)
+      b[n] |= 0x80;
+    n++;
+  } while (v);
+
+  put(b, n);
+}
+
+static void put_int(int64_t v) {
+  put_uint(((uint64_t) v << 1) ^ (uint64_t) (v >> 63));
+}
+
+static void put_str(const char *str) {
+  size_t len = strlen(str);
+
+  put_uint(len);
+  put(str, len);
+}
+
+static int nonzero(const void *data, size_t len) {
+  const unsigned char *p = data;
+
+  while (len--)
+    if (*p++)
+      return 1;
+  return 0;
+}
+
+/*
+ * Append a command that was sent at start, and answered at end, to the
+ * trace.  Safe to call without the interpreter lock.
+ */
+void xr_trace_cmd(xr_cmd *cmd, double start, double end) {
+  unsigned char head[2];
+  int64_t us;
+  int i;
+
+  pthread_mutex_lock(&cap_lock);
+  if (cap.fd < 0) {
+    /* stopped in the meantime */
+    pthread_mutex_unlock(&cap_lock);
+    return;
+  }
+
+  head[0] = cmd->op;
+  head[1] = (cmd->cur ? FL_CUR : 0) |
+            (cmd->arg[0] || cmd->arg[1] ? FL_ARG : 0) |
+            (nonzero(cmd->farg, sizeof(cmd->farg)) ? FL_FARG : 0) |
+            (cmd->num_str ? FL_STR : 0) |
+            (nonzero(cmd->ret, sizeof(cmd->ret)) ? FL_RET : 0) |
+            (nonzero(cmd->fret, sizeof(cmd->fret)) ? FL_FRET : 0) |
+            (cmd->sret ? FL_SRET : 0);
+  put(head, 2);
+  put_int(cmd->session);
+
+  us = (int64_t) ((start - cap.t0) * 1e6);
+  put_int(us - cap.last_start);
+  cap.last_start = us;
+  put_uint((uint64_t) ((end - start) * 1e6));
+
+  if (head[1] & FL_ARG) {
+    put_int(cmd->arg[0]);
+    put_int(cmd->arg[1]);
+  }
+  if (head[1] & FL_FARG)
+    put(cmd->farg, sizeof(cmd->farg));
+  if (head[1] & FL_STR) {
+    put_uint(cmd->num_str);
+    for (i = 0; i < cmd->num_str; i++)
+      put_str(cmd->str[i]);
+  }
+  if (head[1] & FL_RET)
+    for (i = 0; i < 3; i++)
+      put_int(cmd->ret[i]);
+  if (head[1] & FL_FRET)
+    put(cmd->fret, sizeof(cmd->fret));
+  if (head[1] & FL_SRET)
+    put_str(cmd->sret);
+
+  cap.records++;
+  if (end - cap.last_flush >= FLUSH_EVERY)
+    cap_flush();
+  pthread_mutex_unlock(&cap_lock);
+}
+
+/*
+ * Start capturing to path.  Returns 0, or an errno.  Call with the
+ * interpreter lock held (which start and stop are serialized by).
+ */
+static int cap_start(const char *path) {
+  struct timeval tv;
+  double wall;
+  int fd, err, i;
+
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+    return errno;
+
+  gettimeofday(&tv, NULL);
+  wall = tv.tv_sec + tv.tv_usec / 1e6;
+
+  pthread_mutex_lock(&cap_lock);
+  cap.fd = fd;
+  cap.err = 0;
+  cap.t0 = xr_now();
+  cap.last_start = 0;
+  cap.records = 0;
+  cap.len = 0;
+
+  if ((cap.path = strdup(path)) != NULL) {
+    put(MAGIC, 8);
+    put(&wall, sizeof(wall));
+    put_uint(XR_NUM_CMDS);
+    for (i = 0; i < XR_NUM_CMDS; i++)
+      put_str(xr_cmd_defs[i].name);
+    cap_flush();
+    err = cap.err;
+  } else {
+    err = ENOMEM;
+  }
+
+  if (err) {
+    close(cap.fd);
+    free(cap.path);
+    cap.fd = -1;
+    cap.path = NULL;
+  } else {
+    xr_tracing = 1;
+  }
+  pthread_mutex_unlock(&cap_lock);
+
+  return err;
+}
+
+/*
+ * Stop capturing.  Returns 0 or the errno of a failed write, and the
+ * number of records written in *records.  The caller frees *path.
+ */
+static int cap_stop(unsigned long *records, char **path) {
+  int err;
+
+  pthread_mutex_lock(&cap_lock);
+  xr_tracing = 0;
+  cap_flush();
+  if (close(cap.fd) < 0 && !cap.err)
+    cap.err = errno;
+
+  err = cap.err;
+  *records = cap.records;
+  *path = cap.path;
+  cap.fd = -1;
+  cap.path = NULL;
+  pthread_mutex_unlock(&cap_lock);
+
+  return err;
+}
+
+static void cap_at_exit(VALUE data) {
+  unsigned long records;
+  char *path;
+
+  UNUSED(data);
+  if (cap.fd >= 0) {
+    cap_stop(&records, &path);
+    free(path);
+  }
+}
+
+/*
+ * Hold the lock across fork().  The child doesn't carry on with the
+ * parent's capture: its buffer holds the parent's records.
+ */
+static void cap_prepare(void) {
+  pthread_mutex_lock(&cap_lock);
+}
+
+static void cap_parent(void) {
+  pthread_mutex_unlock(&cap_lock);
+}
+
+static void cap_child(void) {
+  xr_tracing = 0;
+  if (cap.fd >= 0) {
+    close(cap.fd);
+    free(cap.path);
+    cap.fd = -1;
+    cap.path = NULL;
+    cap.len = 0;
+  }
+  pthread_mutex_unlock(&cap_lock);
+}
+
+/***********/
+/* reading */
+/***********/
+
+typedef struct {
+  FILE *fp;
+  VALUE path;
+  double wall;                    /* when the capture started */
+  int num_ops;
+  char **names;                   /* recorded command names */
+  int *ops;                       /* recorded op -> xr_cmd_op, or -1 */
+  int64_t last_start;
+} trace_in;
+
+typedef struct {
+  int op;                         /* as recorded (see trace_in) */
+  double start, latency;          /* seconds */
+  xr_cmd cmd;
+} trace_rec;
+
+static void in_corrupt(trace_in *in) {
+  rb_raise(eError, "%s: corrupt trace", RSTRING_PTR(in->path));
+}
+
+static int get_uint(trace_in *in, uint64_t *v) {
+  int c, shift = 0;
+
+  *v = 0;
+  do {
+    if ((c = getc(in->fp)) == EOF)
+      return 0;
+    if (shift > 63)
+      in_corrupt(in);
+    *v |= (uint64_t) (c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+
+  return 1;
+}
+
+static int get_int(trace_in *in, int64_t *v) {
+  uint64_t u;
+
+  if (!get_uint(in, &u))
+    return 0;
+  *v = (int64_t) (u >> 1) ^ -(int64_t) (u & 1);
+  return 1;
+}
+
+static int get_str(trace_in *in, gchar **str) {
+  uint64_t len;
+
+  if (!get_uint(in, &len))
+    return 0;
+  if (len > MAX_STR_LEN)
+    in_corrupt(in);
+
+  *str = g_malloc(len + 1);
+  if (fread(*str, 1, len, in->fp) != len) {
+    g_free(*str);
+    *str = NULL;
+    return 0;
+  }
+  (*str)[len] = '\0';
+
+  return 1;
+}
+
+/*
+ * Open the trace at in->path and read its header.  The caller closes it
+ * with in_close() (which is safe to call on a partly opened one).
+ */
+static void in_open(trace_in *in) {
+  VALUE path = in->path;
+  char magic[8];
+  uint64_t n;
+  int i, j;
+
+  if (!(in->fp = fopen(RSTRING_PTR(path), "rb")))
+    rb_sys_fail(RSTRING_PTR(path));
+
+  if (fread(magic, 1, 8, in->fp) != 8 || memcmp(magic, MAGIC, 8) ||
+      fread(&in->wall, sizeof(in->wall), 1, in->fp) != 1)
+    rb_raise(eError, "%s: not an Xmms-Ruby trace", RSTRING_PTR(path));
+
+  if (!get_uint(in, &n) || n > MAX_OPS)
+    in_corrupt(in);
+  in->names = g_malloc0(sizeof(char*) * n);
+  in->ops = g_malloc(sizeof(int) * n);
+  in->num_ops = (int) n;
+
+  for (i = 0; i < in->num_ops; i++) {
+    if (!get_str(in, &in->names[i]))
+      in_corrupt(in);
+
+    in->ops[i] = -1;
+    for (j = 0; j < XR_NUM_CMDS; j++)
+      if (!strcmp(in->names[i], xr_cmd_defs[j].name))
+        in->ops[i] = j;
+  }
+}
+
+static void in_close(trace_in *in) {
+  int i;
+
+  if (in->fp)
+    fclose(in->fp);
+  for (i = 0; i < in->num_ops; i++)
+    g_free(in->names[i]);
+  g_free(in->names);
+  g_free(in->ops);
+  in->fp = NULL;
+  in->names = NULL;
+  in->ops = NULL;
+  in->num_ops = 0;
+}
+
+static int get_floats(trace_in *in, gfloat *f) {
+  return fread(f, sizeof(gfloat), NUM_BANDS + 1, in->fp) == NUM_BANDS + 1;
+}
+
+/*
+ * Read the next record.  Returns 0 at the end of the trace (including a
+ * record cut short).  The caller frees rec->cmd with xr_cmd_free().
+ */
+static int in_read(trace_in *in, trace_rec *rec) {
+  unsigned char head[2];
+  int64_t v, us;
+  uint64_t n, latency;
+  int i;
+
+  memset(rec, 0, sizeof(trace_rec));
+  rec->cmd.ok = 1;
+
+  if (fread(head, 1, 2, in->fp) != 2)
+    return 0;
+  if (head[0] >= in->num_ops)
+    in_corrupt(in);
+  rec->op = head[0];
+  rec->cmd.op = in->ops[head[0]] < 0 ? XR_CMD_GET_VERSION : in->ops[head[0]];
+  rec->cmd.cur = (head[1] & FL_CUR) != 0;
+
+  if (!get_int(in, &v))
+    return 0;
+  rec->cmd.session = (int) v;
+  if (!get_int(in, &v) || !get_uint(in, &latency))
+    return 0;
+  us = in->last_start += v;
+  rec->start = us / 1e6;
+  rec->latency = latency / 1e6;
+
+  if (head[1] & FL_ARG)
+    for (i = 0; i < 2; i++) {
+      if (!get_int(in, &v))
+        return 0;
+      rec->cmd.arg[i] = (gint) v;
+    }
+  if ((head[1] & FL_FARG) && !get_floats(in, rec->cmd.farg))
+    return 0;
+  if (head[1] & FL_STR) {
+    if (!get_uint(in, &n))
+      return 0;
+    if (n > MAX_STRS)
+      in_corrupt(in);
+    rec->cmd.str = g_malloc0(sizeof(gchar*) * (n ? n : 1));
+    for (i = 0; i < (int) n; i++) {
+      if (!get_str(in, &rec->cmd.str[i]))
+        return 0;
+      rec->cmd.num_str++;
+    }
+  }
+  if (head[1] & FL_RET)
+    for (i = 0; i < 3; i++) {
+      if (!get_int(in, &v))
+        return 0;
+      rec->cmd.ret[i] = (gint) v;
+    }
+  if ((head[1] & FL_FRET) && !get_floats(in, rec->cmd.fret))
+    return 0;
+  if ((head[1] & FL_SRET) && !get_str(in, &rec->cmd.sret))
+    return 0;
+
+  return 1;
+}
+
+/* is this record's command one this version knows? */
+#define KNOWN(in, rec) ((in)->ops[(rec)->op] >= 0)
+
+/*************/
+/* latencies */
+/*************/
+
+typedef struct {
+  double *v;
+  size_t len, cap;
+} lat_set;
+
+static void lat_add(lat_set *s, double v) {
+  if (s->len == s->cap) {
+    s->cap = s->cap ? s->cap * 2 : 64;
+    s->v = g_realloc(s->v, sizeof(double) * s->cap);
+  }
+  s->v[s->len++] = v;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double*) a, y = *(const double*) b;
+  return x < y ? -1 : x > y;
+}
+
+static double pct(lat_set *s, double p) {
+  return s->v[(size_t) (p * (s->len - 1) + 0.5)] * 1000.0;
+}
+
+/*
+ * A latency distribution as a hash of milliseconds (see
+ * Xmms::Trace.summary).  Sorts the set.
+ */
+static VALUE lat_dist(lat_set *s) {
+  VALUE ret = rb_hash_new();
+  double sum = 0;
+  size_t i;
+
+  rb_hash_aset(ret, ID2SYM(rb_intern("count")), ULONG2NUM(s->len));
+  if (!s->len)
+    return ret;
+
+  qsort(s->v, s->len, sizeof(double), cmp_double);
+  for (i = 0; i < s->len; i++)
+    sum += s->v[i];
+
+  rb_hash_aset(ret, ID2SYM(rb_intern("mean")), rb_float_new(sum * 1000.0 / s->len));
+  rb_hash_aset(ret, ID2SYM(rb_intern("p50")), rb_float_new(pct(s, 0.5)));
+  rb_hash_aset(ret, ID2SYM(rb_intern("p90")), rb_float_new(pct(s, 0.9)));
+  rb_hash_aset(ret, ID2SYM(rb_intern("p99")), rb_float_new(pct(s, 0.99)));
+  rb_hash_aset(ret, ID2SYM(rb_intern("max")), rb_float_new(pct(s, 1.0)));
+
+  return ret;
+}
+
+/*
+ * A trace being read, with latencies collected per recorded command
+ * (and overall, in sets[num_ops]).  It's opened by the body of an
+ * rb_ensure(), and closed by job_close().
+ */
+typedef struct {
+  trace_in in;
+  trace_rec rec;
+  lat_set *sets;
+
+  /* replay */
+  VALUE remote;
+  double speed;
+  int reads_only;
+  xr_cmd call;
+} trace_job;
+
+static void job_init(trace_job *job, VALUE path) {
+  memset(job, 0, sizeof(trace_job));
+  job->in.path = rb_str_new_frozen(StringValue(path));
+}
+
+static void job_open(trace_job *job) {
+  in_open(&job->in);
+  job->sets = g_malloc0(sizeof(lat_set) * (job->in.num_ops + 1));
+}
+
+static VALUE job_close(VALUE data) {
+  trace_job *job = (trace_job*) data;
+  int i;
+
+  if (job->sets)
+    for (i = 0; i <= job->in.num_ops; i++)
+      g_free(job->sets[i].v);
+  g_free(job->sets);
+  job->sets = NULL;
+
+  xr_cmd_free(&job->rec.cmd);
+  xr_cmd_free(&job->call);
+  in_close(&job->in);
+
+  return Qnil;
+}
+
+static void job_add(trace_job *job, double latency) {
+  lat_add(&job->sets[job->rec.op], latency);
+  lat_add(&job->sets[job->in.num_ops], latency);
+}
+
+/*
+ * Add :latency and :methods to a summary.
+ */
+static void job_dists(trace_job *job, VALUE ret) {
+  VALUE methods = rb_hash_new();
+  int i;
+
+  rb_hash_aset(ret, ID2SYM(rb_intern("latency")), lat_dist(&job->sets[job->in.num_ops]));
+  for (i = 0; i < job->in.num_ops; i++)
+    if (job->sets[i].len)
+      rb_hash_aset(methods, ID2SYM(rb_intern(job->in.names[i])), lat_dist(&job->sets[i]));
+  rb_hash_aset(ret, ID2SYM(rb_intern("methods")), methods);
+}
+
+/****************/
+/* RUBY METHODS */
+/****************/
+
+/*
+ * Start capturing a trace of every command sent to XMMS from this
+ * process to the given file (which is replaced).  See Xmms::Trace.
+ *
+ * This method raises an Xmms::Error exception if a capture is already
+ * on, and a SystemCallError if the file can't be written.
+ *
+ * Example:
+ *   Xmms::Trace.start('/tmp/slow.trace')
+ *
+ */
+static VALUE xrt_start(VALUE self, VALUE path) {
+  int err;
+
+  UNUSED(self);
+  StringValue(path);
+  if (cap.fd >= 0)
+    rb_raise(eError, "already capturing a trace (to %s)", cap.path);
+
+  if ((err = cap_start(RSTRING_PTR(path))) != 0) {
+    errno = err;
+    rb_sys_fail(RSTRING_PTR(path));
+  }
+
+  return self;
+}
+
+/*
+ * Stop capturing, and return the number of commands captured (nil if
+ * there wasn't a capture on).
+ *
+ * This method raises a SystemCallError if writing the trace failed
+ * (the capture is stopped regardless).
+ *
+ * Example:
+ *   puts "#{Xmms::Trace.stop} commands captured"
+ *
+ */
+static VALUE xrt_stop(VALUE self) {
+  unsigned long records;
+  char *path;
+  VALUE str;
+  int err;
+
+  UNUSED(self);
+  if (cap.fd < 0)
+    return Qnil;
+
+  err = cap_stop(&records, &path);
+  str = rb_str_new2(path ? path : "");
+  free(path);
+  if (err) {
+    errno = err;
+    rb_sys_fail(RSTRING_PTR(str));
+  }
+
+  return ULONG2NUM(records);
+}
+
+/*
+ * Capture a trace to the given file while running the block, and
+ * return the block's value.  See Xmms::Trace.start.
+ *
+ * Example:
+ *   Xmms::Trace.capture('refresh.trace') { app.refresh }
+ *
+ */
+static VALUE xrt_capture(VALUE self, VALUE path) {
+  xrt_start(self, path);
+  return rb_ensure(rb_yield, Qnil, xrt_stop, self);
+}
+
+/*
+ * Is a capture on?
+ *
+ * Example:
+ *   Xmms::Trace.start(path) unless Xmms::Trace.capturing?
+ *
+ */
+static VALUE xrt_capturing(VALUE self) {
+  UNUSED(self);
+  return cap.fd >= 0 ? Qtrue : Qfalse;
+}
+
+static VALUE read_body(VALUE data) {
+  trace_job *job = (trace_job*) data;
+  trace_in *in = &job->in;
+  trace_rec *rec = &job->rec;
+  VALUE ret, row, args;
+  int i;
+
+  job_open(job);
+  ret = rb_block_given_p() ? Qnil : rb_ary_new();
+  while (in_read(in, rec)) {
+    args = rb_ary_new();
+    if (rec->cmd.cur)
+      rb_ary_push(args, ID2SYM(rb_intern("current")));
+    if (rec->cmd.arg[0] || rec->cmd.arg[1]) {
+      rb_ary_push(args, INT2NUM(rec->cmd.arg[0]));
+      rb_ary_push(args, INT2NUM(rec->cmd.arg[1]));
+    }
+    if (nonzero(rec->cmd.farg, sizeof(rec->cmd.farg)))
+      for (i = 0; i <= NUM_BANDS; i++)
+        rb_ary_push(args, rb_float_new(rec->cmd.farg[i]));
+    for (i = 0; i < rec->cmd.num_str; i++)
+      rb_ary_push(args, xr_str_new(rec->cmd.str[i], strlen(rec->cmd.str[i]), XR_STR_PATH));
+
+    row = rb_ary_new3(6, rb_float_new(rec->start), rb_float_new(rec->latency),
+                      ID2SYM(rb_intern(in->names[rec->op])), INT2NUM(rec->cmd.session),
+                      args, KNOWN(in, rec) ? xr_cmd_result(Qnil, &rec->cmd) : Qnil);
+    xr_cmd_free(&rec->cmd);
+
+    if (ret == Qnil)
+      rb_yield(row);
+    else
+      rb_ary_push(ret, row);
+  }
+
+  return ret;
+}
+
+/*
+ * Read a trace: an array of [start (seconds after the capture
+ * started), latency (seconds), method, session, arguments, reply] for
+ * each command.  The arguments are any integers (the first is
+ * :current if the command used the playlist position), equalizer
+ * values and strings it was sent with; the reply is what the method
+ * returned (nil for methods that return the remote).  With a block,
+ * each command is yielded instead.
+ *
+ * This method raises an Xmms::Error exception if the file isn't a
+ * trace, or is corrupt, and a SystemCallError if it can't be read.
+ *
+ * Examples:
+ *   Xmms::Trace.read('slow.trace') do |t, lat, meth, session, args, ret|
+ *     puts "%8.3f %-16s %6.2fms" % [t, meth, lat * 1000] if lat > 0.05
+ *   end
+ *
+ */
+static VALUE xrt_read(VALUE self, VALUE path) {
+  trace_job job;
+
+  UNUSED(self);
+  job_init(&job, path);
+  return rb_ensure(read_body, (VALUE) &job, job_close, (VALUE) &job);
+}
+
+static VALUE summary_body(VALUE data) {
+  trace_job *job = (trace_job*) data;
+  double first = 0, last = 0;
+  unsigned long n = 0;
+  VALUE ret;
+
+  job_open(job);
+  while (in_read(&job->in, &job->rec)) {
+    if (!n++ || job->rec.start < first)
+      first = job->rec.start;
+    if (job->rec.start + job->rec.latency > last)
+      last = job->rec.start + job->rec.latency;
+    job_add(job, job->rec.latency);
+    xr_cmd_free(&job->rec.cmd);
+  }
+
+  ret = rb_hash_new();
+  rb_hash_aset(ret, ID2SYM(rb_intern("requests")), ULONG2NUM(n));
+  rb_hash_aset(ret, ID2SYM(rb_intern("started")), rb_time_new((time_t) job->in.wall,
+               (long) ((job->in.wall - (time_t) job->in.wall) * 1e6)));
+  rb_hash_aset(ret, ID2SYM(rb_intern("elapsed")), rb_float_new(n ? last - first : 0.0));
+  job_dists(job, ret);
+
+  return ret;
+}
+
+/*
+ * Summarize the latencies recorded in a trace, as a hash: :requests,
+ * :started (a Time), :elapsed (seconds from the first command to the
+ * end of the last), :latency (the distribution over every command),
+ * and :methods (a distribution for each method, by name).  A
+ * distribution is a hash of :count, and :mean, :p50, :p90, :p99 and
+ * :max in milliseconds.
+ *
+ * This method raises an Xmms::Error exception if the file isn't a
+ * trace, or is corrupt, and a SystemCallError if it can't be read.
+ *
+ * Example:
+ *   s = Xmms::Trace.summary('slow.trace')
+ *   puts "#{s[:requests]} requests, p99 #{s[:latency][:p99]}ms"
+ *
+ */
+static VALUE xrt_summary(VALUE self, VALUE path) {
+  trace_job job;
+
+  UNUSED(self);
+  job_init(&job, path);
+  return rb_ensure(summary_body, (VALUE) &job, job_close, (VALUE) &job);
+}
+
+static VALUE replay_call(VALUE data) {
+  trace_job *job = (trace_job*) data;
+
+  xr_call(job->remote, &job->call);
+  return Qnil;
+}
+
+static VALUE replay_failed(VALUE data, VALUE err) {
+  UNUSED(err);
+  (*(unsigned long*) data)++;
+  return Qnil;
+}
+
+static VALUE replay_body(VALUE data) {
+  trace_job *job = (trace_job*) data;
+  trace_rec *rec = &job->rec;
+  unsigned long sent = 0, errors = 0, skipped = 0;
+  double t0, first = 0, due, now, late = 0, start;
+  struct timeval tv;
+  VALUE ret;
+
+  job_open(job);
+  t0 = xr_now();
+  while (in_read(&job->in, rec)) {
+    if (!KNOWN(&job->in, rec) ||
+        (job->reads_only && !(xr_cmd_defs[rec->cmd.op].flags & XR_CMD_READ))) {
+      skipped++;
+      xr_cmd_free(&rec->cmd);
+      continue;
+    }
+
+    /* keep to the recorded pace */
+    if (job->speed > 0) {
+      if (!sent)
+        first = rec->start;
+      due = t0 + (rec->start - first) / job->speed;
+      if ((now = xr_now()) < due) {
+        tv.tv_sec = (time_t) (due - now);
+        tv.tv_usec = (long) ((due - now - tv.tv_sec) * 1e6);
+        rb_thread_wait_for(tv);
+      } else if (now - due > late) {
+        late = now - due;
+      }
+    }
+
+    xr_cmd_init(&job->call, job->remote, rec->cmd.op);
+    job->call.cur = rec->cmd.cur;
+    memcpy(job->call.arg, rec->cmd.arg, sizeof(job->call.arg));
+    memcpy(job->call.farg, rec->cmd.farg, sizeof(job->call.farg));
+    job->call.str = rec->cmd.str;
+    job->call.num_str = rec->cmd.num_str;
+    rec->cmd.str = NULL;
+    rec->cmd.num_str = 0;
+    xr_cmd_free(&rec->cmd);
+
+    start = xr_now();
+    rb_rescue2(replay_call, (VALUE) job, replay_failed, (VALUE) &errors, eError, 0);
+    job_add(job, xr_now() - start);
+    xr_cmd_free(&job->call);
+    sent++;
+  }
+
+  ret = rb_hash_new();
+  rb_hash_aset(ret, ID2SYM(rb_intern("requests")), ULONG2NUM(sent));
+  rb_hash_aset(ret, ID2SYM(rb_intern("errors")), ULONG2NUM(errors));
+  rb_hash_aset(ret, ID2SYM(rb_intern("skipped")), ULONG2NUM(skipped));
+  rb_hash_aset(ret, ID2SYM(rb_intern("elapsed")), rb_float_new(xr_now() - t0));
+  rb_hash_aset(ret, ID2SYM(rb_intern("max_late")), rb_float_new(late * 1000.0));
+  job_dists(job, ret);
+
+  return ret;
+}
+
+/*
+ * Send the commands in a trace again, through the given remote (or a
+ * new one for a session number), and return how long they took: a hash
+ * of :requests (sent), :errors (commands that found XMMS not running),
+ * :skipped, :elapsed (seconds), :max_late (how far behind the recorded
+ * pace a command was sent, at worst, in milliseconds), and :latency and
+ * :methods as for Xmms::Trace.summary.  Latencies are measured as the
+ * caller sees them, so they include the remote's transport (pipelined
+ * mode, single-flight and so on); commands are sent one at a time.
+ * Every command goes to the remote's session, whichever one it was
+ * recorded from.
+ *
+ * Options:
+ *   :speed       how many times faster than recorded to go (default
+ *                1.0), or :max for as fast as possible
+ *   :reads_only  skip commands that change anything (default false)
+ *
+ * Commands this version doesn't know are skipped.
+ *
+ * This method raises an ArgumentError exception if :speed isn't
+ * positive, an Xmms::Error exception if the file isn't a trace, or is
+ * corrupt, and a SystemCallError if it can't be read.
+ *
+ * Examples:
+ *   r = Xmms::Remote.new
+ *   r.pipeline = true
+ *   s = Xmms::Trace.replay('slow.trace', r, :speed => 4)
+ *   puts "p99 #{s[:latency][:p99]}ms, #{s[:max_late]}ms behind at worst"
+ *
+ *   Xmms::Trace.replay('slow.trace', 0, :speed => :max, :reads_only => true)
+ *
+ */
+static VALUE xrt_replay(int argc, VALUE *argv, VALUE self) {
+  VALUE path, remote, opts, v;
+  trace_job job;
+
+  UNUSED(self);
+  rb_scan_args(argc, argv, "21", &path, &remote, &opts);
+
+  job_init(&job, path);
+  job.speed = 1.0;
+  if (opts != Qnil) {
+    Check_Type(opts, T_HASH);
+    if ((v = rb_hash_aref(opts, ID2SYM(id_speed))) == ID2SYM(id_max))
+      job.speed = 0;
+    else if (v != Qnil && (job.speed = NUM2DBL(v)) <= 0)
+      rb_raise(rb_eArgError, "speed must be positive (or :max)");
+    job.reads_only = RTEST(rb_hash_aref(opts, ID2SYM(id_reads_only)));
+  }
+
+  if (!rb_obj_is_kind_of(remote, cRemote))
+    remote = rb_funcall(cRemote, rb_intern("new"), 1, INT2NUM(NUM2INT(remote)));
+  job.remote = remote;
+
+  return rb_ensure(replay_body, (VALUE) &job, job_close, (VALUE) &job);
+}
+
+void Init_xmms_trace(void) {
+  const char *path;
+  int err;
+
+  /*
+   * Control protocol traces: capture the commands this process sends
+   * to XMMS, with their replies and timing, and replay them later
+   * against any session, at any speed.  Setting XMMS_RUBY_TRACE to a
+   * file name before the extension is loaded starts a capture to it
+   * (stopped at exit).
+   */
+  mTrace = rb_define_module_under(mXmms, "Trace");
+  rb_define_module_function(mTrace, "start", xrt_start, 1);
+  rb_define_module_function(mTrace, "stop", xrt_stop, 0);
+  rb_define_module_function(mTrace, "capture", xrt_capture, 1);
+  rb_define_module_function(mTrace, "capturing?", xrt_capturing, 0);
+  rb_define_module_function(mTrace, "read", xrt_read, 1);
+  rb_define_module_function(mTrace, "summary", xrt_summary, 1);
+  rb_define_module_function(mTrace, "replay", xrt_replay, -1);
+
+  id_speed = rb_intern("speed");
+  id_reads_only = rb_intern("reads_only");
+  id_max = rb_intern("max");
+
+  pthread_atfork(cap_prepare, cap_parent, cap_child);
+  rb_set_end_proc(cap_at_exit, Qnil);
+
+  if ((path = getenv(ENV_VAR)) != NULL && *path && cap.fd < 0 &&
+      (err = cap_start(path)) != 0)
+    rb_warn("couldn't capture a trace to %s: %s", path, strerror(err));
+}
@@ -24,25 +24,216 @@
 /* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
 /************************************************************************/
 
-#include <stdio.h>
-#include <xmms/xmmsctrl.h>
-#include <ruby.h>
+#include <time.h>
+#include <pthread.h>
+#include "xmms_ruby.h"
 
-#define UNUSED(x)  ((void) (x))
-
-#define VERSION "0.1.2"
-#define NUM_BANDS 10
-#define BAND_MAX 20.0
-#define BAND_MIN -20.0
-#define VOL_MAX 100
-#define VOL_MIN 0
+#ifdef HAVE_RUBY_ENCODING_H
+#include <ruby/encoding.h>
+#endif
 
 /****************************/
 /* CLASS AND MODULE GLOBALS */
 /****************************/
-static VALUE mXmms,
-             cRemote,
-             eError;
+VALUE mXmms,
+      cRemote,
+      eError;
+
+/*************************/
+/* PLAYLIST CHANGE HOOKS */
+/*************************/
+
+#define MAX_PL_LISTENERS 8
+
+static struct {
+  xr_slot slot;
+  xr_pl_hook hook;
+} pl_listeners[MAX_PL_LISTENERS];
+static int num_pl_listeners = 0;
+
+/*
+ * Register a playlist change hook.  Whenever a playlist edit goes
+ * through an Xmms::Remote, the object in the given slot of that remote,
+ * if any, is passed to the hook.
+ */
+void xr_pl_listen(xr_slot slot, xr_pl_hook hook) {
+  if (num_pl_listeners >= MAX_PL_LISTENERS)
+    rb_bug("too many playlist listeners");
+
+  pl_listeners[num_pl_listeners].slot = slot;
+  pl_listeners[num_pl_listeners].hook = hook;
+  num_pl_listeners++;
+}
+
+/*
+ * Broadcast a playlist edit to all registered hooks.
+ */
+void xr_pl_notify(VALUE self, xr_pl_op op, int pos, int argc, VALUE *argv) {
+  int i;
+  VALUE obj;
+
+  /* reads in flight may predate the edit (see flight.c) */
+  xr_flight_wrote(*XR_SESSION(self));
+
+  for (i = 0; i < num_pl_listeners; i++) {
+    obj = xr_remote_slot(self, pl_listeners[i].slot);
+    if (obj != Qnil)
+      pl_listeners[i].hook(obj, op, pos, argc, argv);
+  }
+}
+
+/********************/
+/* STRING UTILITIES */
+/********************/
+
+/*
+ * Convert a native string to a ruby string.  See xmms_ruby.h.
+ */
+VALUE xr_str_new(const char *ptr, long len, xr_str_type type) {
+#ifdef HAVE_RUBY_ENCODING_H
+  return rb_external_str_new_with_enc(ptr, len, type == XR_STR_PATH ?
+                                      rb_filesystem_encoding() :
+                                      rb_utf8_encoding());
+#else
+  UNUSED(type);
+  return rb_str_new(ptr, len);
+#endif
+}
+
+/*
+ * Convert a string returned by libxmms to a ruby string, and free it.
+ * See xmms_ruby.h.
+ */
+VALUE xr_str_take(gchar *str, xr_str_type type) {
+  VALUE ret = xr_str_new(str ? str : "", str ? strlen(str) : 0, type);
+
+  if (str)
+    g_free(str);
+  return ret;
+}
+
+/******************/
+/* LOCK UTILITIES */
+/******************/
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+static void nogvl_ubf(void *cancel) {
+  if (cancel)
+    *((volatile int*) cancel) = 1;
+}
+#endif
+
+/*
+ * Run fn(data) with the interpreter lock released.  See xmms_ruby.h.
+ */
+void *xr_nogvl(void *(*fn)(void *), void *data, volatile int *cancel) {
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+  return rb_thread_call_without_gvl(fn, data, nogvl_ubf, (void*) cancel);
+#else
+  UNUSED(cancel);
+  return fn(data);
+#endif
+}
+
+/*
+ * Fork generation; see xmms_ruby.h.
+ */
+volatile int xr_fork_gen = 0;
+
+static void atfork_child(void) {
+  xr_fork_gen++;
+}
+
+/*
+ * Monotonic time, in seconds.
+ */
+double xr_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/****************/
+/* XMMS::REMOTE */
+/****************/
+
+static void remote_mark(void *ptr) {
+  xr_remote *r = ptr;
+  int i;
+
+  for (i = 0; i < XR_NUM_SLOTS; i++)
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+    rb_gc_mark_movable(r->slots[i]);
+#else
+    rb_gc_mark(r->slots[i]);
+#endif
+}
+
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+/*
+ * Objects in the slots may have been moved by GC.compact; update our
+ * references to them.
+ */
+static void remote_compact(void *ptr) {
+  xr_remote *r = ptr;
+  int i;
+
+  for (i = 0; i < XR_NUM_SLOTS; i++)
+    r->slots[i] = rb_gc_location(r->slots[i]);
+}
+#endif
+
+static size_t remote_memsize(const void *ptr) {
+  UNUSED(ptr);
+  return sizeof(xr_remote);
+}
+
+/*
+ * The struct is kept out of line (not RUBY_TYPED_EMBEDDABLE) on
+ * purpose: callers hold on to pointers into it (see XR_SESSION())
+ * across allocations, and an embedded struct moves with its object.
+ */
+static const rb_data_type_t remote_type = {
+  "Xmms::Remote",
+  {
+    remote_mark,
+    RUBY_TYPED_DEFAULT_FREE,
+    remote_memsize,
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+    remote_compact,
+#endif
+  },
+  0, 0,
+#ifdef RUBY_TYPED_WB_PROTECTED
+  RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+#endif
+};
+
+/*
+ * Get the native side of an Xmms::Remote.
+ *
+ * This raises a TypeError exception if obj isn't an Xmms::Remote.
+ */
+xr_remote *xr_remote_get(VALUE obj) {
+  xr_remote *r;
+
+  TypedData_Get_Struct(obj, xr_remote, &remote_type, r);
+  return r;
+}
+
+/*
+ * Store a helper object in one of a remote's slots.
+ */
+void xr_remote_set(VALUE obj, xr_slot slot, VALUE val) {
+  xr_remote *r = xr_remote_get(obj);
+
+#ifdef RUBY_TYPED_WB_PROTECTED
+  RB_OBJ_WRITE(obj, &r->slots[slot], val);
+#else
+  r->slots[slot] = val;
+#endif
+}
 
 /*
  * Create a new Xmms::Remote object.
@@ -61,22 +252,18 @@ static VALUE mXmms,
  *
  */
 VALUE xr_new(int argc, VALUE *argv, VALUE klass) {
-  int *session;
+  xr_remote *r;
   VALUE xr;
+  int i;
   
-  session = malloc(sizeof(int));
-  switch (argc) {
-    case 0:
-      *session = 0;
-      break;
-    case 1:
-      *session = NUM2INT(argv[0]);
-      break;
-    default:
-      rb_raise(rb_eArgError, "invalid argument count (not 0 or 1)");
-  }
+  if (argc > 1)
+    rb_raise(rb_eArgError, "invalid argument count (not 0 or 1)");
+
+  xr = TypedData_Make_Struct(klass, xr_remote, &remote_type, r);
+  r->session = argc ? NUM2INT(argv[0]) : 0;
+  for (i = 0; i < XR_NUM_SLOTS; i++)
+    r->slots[i] = Qnil;
 
-  xr = Data_Wrap_Struct(klass, 0, free, session);
   rb_obj_call_init(xr, argc, argv);
   
   return xr;
@@ -107,12 +294,10 @@ static VALUE xr_init(int argc, VALUE *argv, VALUE self) {
  *   version = remote.get_version
  */
 static VALUE xr_version(VALUE self) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  
-  return INT2FIX(xmms_remote_get_version(*session));
+  xr_cmd_init(&cmd, self, XR_CMD_GET_VERSION);
+  return xr_call(self, &cmd);
 }
 
 /*************************/
@@ -129,13 +314,10 @@ static VALUE xr_version(VALUE self) {
  *
  */
 static VALUE xr_play(VALUE self) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_play(*session);
+  xr_cmd cmd;
 
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_PLAY);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -148,13 +330,10 @@ static VALUE xr_play(VALUE self) {
  *
  */
 static VALUE xr_pause(VALUE self) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_pause(*session);
+  xr_cmd cmd;
 
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_PAUSE);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -167,13 +346,10 @@ static VALUE xr_pause(VALUE self) {
  *
  */
 static VALUE xr_stop(VALUE self) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_stop(*session);
-
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_STOP);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -186,13 +362,10 @@ static VALUE xr_stop(VALUE self) {
  *
  */
 static VALUE xr_eject(VALUE self) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_eject(*session);
+  xr_cmd cmd;
 
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_EJECT);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -205,13 +378,10 @@ static VALUE xr_eject(VALUE self) {
  *
  */
 static VALUE xr_quit(VALUE self) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_quit(*session);
+  xr_cmd cmd;
 
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_QUIT);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -224,13 +394,10 @@ static VALUE xr_quit(VALUE self) {
  *
  */
 static VALUE xr_play_pause(VALUE self) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_play_pause(*session);
+  xr_cmd cmd;
 
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_PLAY_PAUSE);
+  return xr_call(self, &cmd);
 }
 
 /****************************/
@@ -248,12 +415,10 @@ static VALUE xr_play_pause(VALUE self) {
  *
  */
 static VALUE xr_playing(VALUE self) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-
-  return xmms_remote_is_playing(*session) ? Qtrue : Qfalse;
+  xr_cmd_init(&cmd, self, XR_CMD_IS_PLAYING);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -267,12 +432,10 @@ static VALUE xr_playing(VALUE self) {
  *
  */
 static VALUE xr_paused(VALUE self) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
+  xr_cmd cmd;
 
-  return xmms_remote_is_paused(*session) ? Qtrue : Qfalse;
+  xr_cmd_init(&cmd, self, XR_CMD_IS_PAUSED);
+  return xr_call(self, &cmd);
 }
 
 /********************/
@@ -306,9 +469,13 @@ static VALUE xr_pl(VALUE self) {
   VALUE e, ret;
   char block_given = 0;
   
-  Data_Get_Struct(self, int, session);
+  session = XR_SESSION(self);
   CHECK_SESSION(session);
 
+  /* shared with other threads reading it at the same time? */
+  if (xr_flight_playlist(self, &ret))
+    return ret;
+
   block_given = rb_block_given_p();
   ret = block_given ? Qnil : rb_ary_new();
   len = xmms_remote_get_playlist_length(*session);
@@ -323,8 +490,8 @@ static VALUE xr_pl(VALUE self) {
       e = rb_ary_clear(e);
 
     /* add info for current playlist element to array */
-    rb_ary_push(e, rb_str_new2(xmms_remote_get_playlist_title(*session, i)));
-    rb_ary_push(e, rb_str_new2(xmms_remote_get_playlist_file(*session, i)));
+    rb_ary_push(e, xr_str_take(xmms_remote_get_playlist_title(*session, i), XR_STR_TEXT));
+    rb_ary_push(e, xr_str_take(xmms_remote_get_playlist_file(*session, i), XR_STR_PATH));
     rb_ary_push(e, INT2FIX(xmms_remote_get_playlist_time(*session, i)));
 
     /* if block was given, yield current element; otherwise push it
@@ -354,20 +521,19 @@ static VALUE xr_pl(VALUE self) {
  *
  */
 static VALUE xr_pl_add(int argc, VALUE *argv, VALUE self) {
-  int i, max, *session;
-  VALUE enqueue = Qtrue;
-  gchar **list;
+  xr_cmd cmd;
+  int i, max;
+  VALUE enqueue = Qtrue, *paths, ret, buf;
 
   if (argc < 1)
     rb_raise(rb_eArgError, "invalid argument count (must be >= 1)");
   
-  list = g_malloc(sizeof(gchar*) * argc);
-
+  /* remote.add *files can pass any number of arguments */
+  paths = ALLOCV_N(VALUE, buf, argc);
   for (i = 0, max = 0; i < argc; i++) {
     switch (TYPE(argv[i])) {
       case T_STRING:
-        list[i] = (gchar*) RSTRING(argv[i])->ptr;
-        max++;
+        paths[max++] = argv[i];
         break;
       case T_TRUE:
       case T_FALSE:
@@ -378,14 +544,21 @@ static VALUE xr_pl_add(int argc, VALUE *argv, VALUE self) {
     }
   }
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_playlist(*session, list, max, enqueue);
-
-  /* free the list, but not the elements */
-  g_free(list);
+  xr_cmd_init(&cmd, self, XR_CMD_PLAYLIST_ADD);
+  cmd.arg[0] = (enqueue == Qtrue);
+  for (i = 0; i < max; i++)
+    xr_cmd_add_str(&cmd, paths[i]);
+  ret = xr_call(self, &cmd);
+
+  /* a non-enqueued add replaces the playlist */
+  if (!cmd.late) {
+    if (enqueue == Qfalse)
+      xr_pl_notify(self, XR_PL_CLEAR, 0, 0, NULL);
+    xr_pl_notify(self, XR_PL_ADD, -1, max, paths);
+  }
 
-  return self;
+  ALLOCV_END(buf);
+  return ret;
 }
 
 /*
@@ -398,13 +571,16 @@ static VALUE xr_pl_add(int argc, VALUE *argv, VALUE self) {
  *
  */
 static VALUE xr_pl_add_url(VALUE self, VALUE url) {
-  int *session;
+  xr_cmd cmd;
+  VALUE ret;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_playlist_add_url_string(*session, RSTRING(url)->ptr);
+  xr_cmd_init(&cmd, self, XR_CMD_PLAYLIST_ADD_URL);
+  xr_cmd_add_str(&cmd, url);
+  ret = xr_call(self, &cmd);
+  if (!cmd.late)
+    xr_pl_notify(self, XR_PL_ADD, -1, 1, &url);
 
-  return self;
+  return ret;
 }
 
 /*
@@ -418,15 +594,17 @@ static VALUE xr_pl_add_url(VALUE self, VALUE url) {
  *
  */
 static VALUE xr_pl_ins_url(VALUE self, VALUE url, VALUE pos) {
-  int *session;
+  xr_cmd cmd;
+  VALUE ret;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_playlist_ins_url_string(*session,
-                                      RSTRING(url)->ptr,
-                                      NUM2INT(pos));
+  xr_cmd_init(&cmd, self, XR_CMD_PLAYLIST_INS_URL);
+  cmd.arg[0] = NUM2INT(pos);
+  xr_cmd_add_str(&cmd, url);
+  ret = xr_call(self, &cmd);
+  if (!cmd.late)
+    xr_pl_notify(self, XR_PL_INSERT, NUM2INT(pos), 1, &url);
 
-  return self;
+  return ret;
 }
 
 /*
@@ -439,13 +617,18 @@ static VALUE xr_pl_ins_url(VALUE self, VALUE url, VALUE pos) {
  *
  */
 static VALUE xr_pl_del(VALUE self, VALUE pos) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_playlist_delete(*session, NUM2INT(pos));
+  xr_cmd cmd;
+  VALUE ret;
+
+  xr_cmd_init(&cmd, self, XR_CMD_PLAYLIST_DELETE);
+  cmd.arg[0] = NUM2INT(pos);
+  ret = xr_call(self, &cmd);
+  if (!cmd.late) {
+    pos = INT2FIX(cmd.arg[0]);
+    xr_pl_notify(self, XR_PL_DELETE, -1, 1, &pos);
+  }
 
-  return self;
+  return ret;
 }
 
 /*
@@ -456,13 +639,32 @@ static VALUE xr_pl_del(VALUE self, VALUE pos) {
  *
  */
 static VALUE xr_pl_clear(VALUE self) {
-  int *session;
+  xr_cmd cmd;
+  VALUE ret;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_playlist_clear(*session);
+  xr_cmd_init(&cmd, self, XR_CMD_PLAYLIST_CLEAR);
+  ret = xr_call(self, &cmd);
+  if (!cmd.late)
+    xr_pl_notify(self, XR_PL_CLEAR, 0, 0, NULL);
 
-  return self;
+  return ret;
+}
+
+/*
+ * Get the number of songs in the playlist.
+ *
+ * This method raises an Xmms::Error exception if XMMS is not running.
+ *
+ * Examples:
+ *   len = remote.playlist_length
+ *   len = remote.get_playlist_length
+ *
+ */
+static VALUE xr_pl_len(VALUE self) {
+  xr_cmd cmd;
+
+  xr_cmd_init(&cmd, self, XR_CMD_GET_PLAYLIST_LENGTH);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -477,12 +679,10 @@ static VALUE xr_pl_clear(VALUE self) {
  *
  */
 static VALUE xr_pl_pos(VALUE self) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
+  xr_cmd cmd;
 
-  return INT2FIX(xmms_remote_get_playlist_pos(*session));
+  xr_cmd_init(&cmd, self, XR_CMD_GET_PLAYLIST_POS);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -497,13 +697,11 @@ static VALUE xr_pl_pos(VALUE self) {
  *
  */
 static VALUE xr_pl_set_pos(VALUE self, VALUE pos) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_set_playlist_pos(*session, NUM2INT(pos));
-
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_SET_PLAYLIST_POS);
+  cmd.arg[0] = NUM2INT(pos);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -522,23 +720,22 @@ static VALUE xr_pl_set_pos(VALUE self, VALUE pos) {
  *
  */
 static VALUE xr_pl_file(int argc, VALUE *argv, VALUE self) {
-  int pos, *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
+  xr_cmd_init(&cmd, self, XR_CMD_GET_PLAYLIST_FILE);
 
   switch (argc) {
     case 0:
-      pos = xmms_remote_get_playlist_pos(*session);
+      cmd.cur = 1;
       break;
     case 1:
-      pos = NUM2INT(argv[0]);
+      cmd.arg[0] = NUM2INT(argv[0]);
       break;
     default:
       rb_raise(rb_eArgError, "invalid argument count (not 0 or 1)");
   }
-  
-  return rb_str_new2(xmms_remote_get_playlist_file(*session, pos));
+
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -557,23 +754,22 @@ static VALUE xr_pl_file(int argc, VALUE *argv, VALUE self) {
  *
  */
 static VALUE xr_pl_title(int argc, VALUE *argv, VALUE self) {
-  int pos, *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
+  xr_cmd_init(&cmd, self, XR_CMD_GET_PLAYLIST_TITLE);
 
   switch (argc) {
     case 0:
-      pos = xmms_remote_get_playlist_pos(*session);
+      cmd.cur = 1;
       break;
     case 1:
-      pos = NUM2INT(argv[0]);
+      cmd.arg[0] = NUM2INT(argv[0]);
       break;
     default:
       rb_raise(rb_eArgError, "invalid argument count (not 0 or 1)");
   }
-  
-  return rb_str_new2(xmms_remote_get_playlist_title(*session, pos));
+
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -592,23 +788,22 @@ static VALUE xr_pl_title(int argc, VALUE *argv, VALUE self) {
  *
  */
 static VALUE xr_pl_time(int argc, VALUE *argv, VALUE self) {
-  int pos, *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
+  xr_cmd_init(&cmd, self, XR_CMD_GET_PLAYLIST_TIME);
 
   switch (argc) {
     case 0:
-      pos = xmms_remote_get_playlist_pos(*session);
+      cmd.cur = 1;
       break;
     case 1:
-      pos = NUM2INT(argv[0]);
+      cmd.arg[0] = NUM2INT(argv[0]);
       break;
     default:
       rb_raise(rb_eArgError, "invalid argument count (not 0 or 1)");
   }
-  
-  return INT2FIX(xmms_remote_get_playlist_time(*session, pos));
+
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -622,17 +817,19 @@ static VALUE xr_pl_time(int argc, VALUE *argv, VALUE self) {
  *
  */
 static VALUE xr_pl_ary(VALUE self, VALUE pos) {
-  int p, *session;
+  xr_cmd cmd;
   VALUE ary;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-
-  p = NUM2INT(pos);
   ary = rb_ary_new();
-  rb_ary_push(ary, rb_str_new2(xmms_remote_get_playlist_title(*session, p)));
-  rb_ary_push(ary, rb_str_new2(xmms_remote_get_playlist_file(*session, p)));
-  rb_ary_push(ary, INT2FIX(xmms_remote_get_playlist_time(*session, p)));
+  xr_cmd_init(&cmd, self, XR_CMD_GET_PLAYLIST_TITLE);
+  cmd.arg[0] = NUM2INT(pos);
+  rb_ary_push(ary, xr_call(self, &cmd));
+
+  cmd.op = XR_CMD_GET_PLAYLIST_FILE;
+  rb_ary_push(ary, xr_call(self, &cmd));
+
+  cmd.op = XR_CMD_GET_PLAYLIST_TIME;
+  rb_ary_push(ary, xr_call(self, &cmd));
 
   return ary;
 }
@@ -652,12 +849,10 @@ static VALUE xr_pl_ary(VALUE self, VALUE pos) {
  *
  */
 static VALUE xr_time(VALUE self) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-
-  return INT2FIX(xmms_remote_get_output_time(*session));
+  xr_cmd_init(&cmd, self, XR_CMD_GET_OUTPUT_TIME);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -671,14 +866,11 @@ static VALUE xr_time(VALUE self) {
  *
  */
 static VALUE xr_jump(VALUE self, VALUE pos) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
+  xr_cmd cmd;
 
-  xmms_remote_jump_to_time(*session, NUM2INT(pos));
-
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_JUMP_TO_TIME);
+  cmd.arg[0] = NUM2INT(pos);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -691,12 +883,10 @@ static VALUE xr_jump(VALUE self, VALUE pos) {
  *
  */
 static VALUE xr_prev(VALUE self) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  xmms_remote_playlist_prev(*session);
-
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_PLAYLIST_PREV);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -709,13 +899,10 @@ static VALUE xr_prev(VALUE self) {
  *
  */
 static VALUE xr_next(VALUE self) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_playlist_next(*session);
-
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_PLAYLIST_NEXT);
+  return xr_call(self, &cmd);
 }
 
 /******************/
@@ -733,18 +920,10 @@ static VALUE xr_next(VALUE self) {
  *
  */
 static VALUE xr_stereo_vol(VALUE self) {
-  int l, r, *session;
-  VALUE ary;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_get_volume(*session, &l, &r);
-
-  ary = rb_ary_new();
-  rb_ary_push(ary, INT2FIX(l));
-  rb_ary_push(ary, INT2FIX(r));
-
-  return ary;
+  xr_cmd_init(&cmd, self, XR_CMD_GET_VOLUME);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -759,12 +938,10 @@ static VALUE xr_stereo_vol(VALUE self) {
  *
  */
 static VALUE xr_main_vol(VALUE self) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  
-  return INT2FIX(xmms_remote_get_main_volume(*session));
+  xr_cmd_init(&cmd, self, XR_CMD_GET_MAIN_VOLUME);
+  return xr_call(self, &cmd);
 }
 
 /* 
@@ -780,13 +957,12 @@ static VALUE xr_main_vol(VALUE self) {
  *   
  */
 static VALUE xr_set_stereo_vol(VALUE self, VALUE l, VALUE r) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_set_volume(*session, NUM2INT(l), NUM2INT(r));
+  xr_cmd cmd;
 
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_SET_VOLUME);
+  cmd.arg[0] = NUM2INT(l);
+  cmd.arg[1] = NUM2INT(r);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -801,13 +977,11 @@ static VALUE xr_set_stereo_vol(VALUE self, VALUE l, VALUE r) {
  *
  */
 static VALUE xr_set_main_vol(VALUE self, VALUE vol) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_set_main_volume(*session, NUM2INT(vol));
+  xr_cmd cmd;
 
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_SET_MAIN_VOLUME);
+  cmd.arg[0] = NUM2INT(vol);
+  return xr_call(self, &cmd);
 }
 
 
@@ -829,12 +1003,10 @@ static VALUE xr_set_main_vol(VALUE self, VALUE vol) {
  *
  */
 static VALUE xr_balance(VALUE self) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  
-  return INT2FIX(xmms_remote_get_balance(*session));
+  xr_cmd_init(&cmd, self, XR_CMD_GET_BALANCE);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -851,13 +1023,11 @@ static VALUE xr_balance(VALUE self) {
  *
  */
 static VALUE xr_set_balance(VALUE self, VALUE bal) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_set_balance(*session, NUM2INT(bal));
+  xr_cmd cmd;
 
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_SET_BALANCE);
+  cmd.arg[0] = NUM2INT(bal);
+  return xr_call(self, &cmd);
 }
 
 /****************/
@@ -875,12 +1045,10 @@ static VALUE xr_set_balance(VALUE self, VALUE bal) {
  *
  */
 static VALUE xr_skin(VALUE self) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
+  xr_cmd cmd;
 
-  return rb_str_new2(xmms_remote_get_skin(*session));
+  xr_cmd_init(&cmd, self, XR_CMD_GET_SKIN);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -894,13 +1062,11 @@ static VALUE xr_skin(VALUE self) {
  *
  */
 static VALUE xr_set_skin(VALUE self, VALUE skin) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_set_skin(*session, RSTRING(skin)->ptr);
-
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_SET_SKIN);
+  xr_cmd_add_str(&cmd, skin);
+  return xr_call(self, &cmd);
 }
 
 /******************/
@@ -919,13 +1085,11 @@ static VALUE xr_set_skin(VALUE self, VALUE skin) {
  *
  */
 static VALUE xr_main_toggle(VALUE self, VALUE vis) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_main_win_toggle(*session, vis);
-
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_MAIN_WIN_TOGGLE);
+  cmd.arg[0] = RTEST(vis);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -939,12 +1103,10 @@ static VALUE xr_main_toggle(VALUE self, VALUE vis) {
  *
  */
 static VALUE xr_is_main(VALUE self) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
+  xr_cmd cmd;
 
-  return xmms_remote_is_main_win(*session) ? Qtrue : Qfalse;
+  xr_cmd_init(&cmd, self, XR_CMD_IS_MAIN_WIN);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -960,13 +1122,11 @@ static VALUE xr_is_main(VALUE self) {
  *
  */
 static VALUE xr_pl_toggle(VALUE self, VALUE vis) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_pl_win_toggle(*session, vis);
-
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_PL_WIN_TOGGLE);
+  cmd.arg[0] = RTEST(vis);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -982,12 +1142,10 @@ static VALUE xr_pl_toggle(VALUE self, VALUE vis) {
  *
  */
 static VALUE xr_is_pl(VALUE self) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
+  xr_cmd cmd;
 
-  return xmms_remote_is_pl_win(*session) ? Qtrue : Qfalse;
+  xr_cmd_init(&cmd, self, XR_CMD_IS_PL_WIN);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -1003,13 +1161,11 @@ static VALUE xr_is_pl(VALUE self) {
  *
  */
 static VALUE xr_eq_toggle(VALUE self, VALUE vis) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_eq_win_toggle(*session, vis);
+  xr_cmd cmd;
 
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_EQ_WIN_TOGGLE);
+  cmd.arg[0] = RTEST(vis);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -1025,12 +1181,10 @@ static VALUE xr_eq_toggle(VALUE self, VALUE vis) {
  *
  */
 static VALUE xr_is_eq(VALUE self) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-
-  return xmms_remote_is_eq_win(*session) ? Qtrue : Qfalse;
+  xr_cmd_init(&cmd, self, XR_CMD_IS_EQ_WIN);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -1044,13 +1198,10 @@ static VALUE xr_is_eq(VALUE self) {
  *
  */
 static VALUE xr_prefs(VALUE self) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_show_prefs_box(*session);
+  xr_cmd cmd;
 
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_SHOW_PREFS_BOX);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -1065,13 +1216,11 @@ static VALUE xr_prefs(VALUE self) {
  *
  */
 static VALUE xr_set_aot(VALUE self, VALUE aot) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_toggle_aot(*session, aot);
+  xr_cmd cmd;
 
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_TOGGLE_AOT);
+  cmd.arg[0] = RTEST(aot);
+  return xr_call(self, &cmd);
 }
 
 /**************************/
@@ -1088,13 +1237,10 @@ static VALUE xr_set_aot(VALUE self, VALUE aot) {
  *
  */
 static VALUE xr_toggle_repeat(VALUE self) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_toggle_repeat(*session);
-
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_TOGGLE_REPEAT);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -1110,12 +1256,10 @@ static VALUE xr_toggle_repeat(VALUE self) {
  *
  */
 static VALUE xr_repeat(VALUE self) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
+  xr_cmd cmd;
 
-  return xmms_remote_is_repeat(*session) ? Qtrue : Qfalse;
+  xr_cmd_init(&cmd, self, XR_CMD_IS_REPEAT);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -1128,13 +1272,10 @@ static VALUE xr_repeat(VALUE self) {
  *
  */
 static VALUE xr_toggle_shuffle(VALUE self) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_toggle_shuffle(*session);
+  xr_cmd cmd;
 
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_TOGGLE_SHUFFLE);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -1150,12 +1291,10 @@ static VALUE xr_toggle_shuffle(VALUE self) {
  *
  */
 static VALUE xr_shuffle(VALUE self) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-
-  return xmms_remote_is_shuffle(*session) ? Qtrue : Qfalse;
+  xr_cmd_init(&cmd, self, XR_CMD_IS_SHUFFLE);
+  return xr_call(self, &cmd);
 }
 
 /****************/
@@ -1176,19 +1315,10 @@ static VALUE xr_shuffle(VALUE self) {
  *
  */
 static VALUE xr_info(VALUE self) {
-  int rate, freq, nch, *session;
-  VALUE ary;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_get_info(*session, &rate, &freq, &nch);
-
-  ary = rb_ary_new();
-  rb_ary_push(ary, INT2FIX(rate));
-  rb_ary_push(ary, INT2FIX(freq));
-  rb_ary_push(ary, INT2FIX(nch));
+  xr_cmd cmd;
 
-  return ary;
+  xr_cmd_init(&cmd, self, XR_CMD_GET_INFO);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -1200,11 +1330,10 @@ static VALUE xr_info(VALUE self) {
  *
  */
 static VALUE xr_running(VALUE self) {
-  int *session;
+  xr_cmd cmd;
 
-  Data_Get_Struct(self, int, session);
-
-  return xmms_remote_is_running(*session) ? Qtrue : Qfalse;
+  xr_cmd_init(&cmd, self, XR_CMD_IS_RUNNING);
+  return xr_call(self, &cmd);
 }
 
 /*********************/
@@ -1229,23 +1358,10 @@ static VALUE xr_running(VALUE self) {
  *
  */
 static VALUE xr_eq(VALUE self) {
-  int i, *session;
-  VALUE ary, band_ary;
-  gfloat preamp, *bands;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_get_eq(*session, &preamp, &bands);
+  xr_cmd cmd;
 
-  band_ary = rb_ary_new();
-  for (i = 0; i < NUM_BANDS; i++)
-    rb_ary_push(band_ary, rb_float_new(bands[i]));
-  
-  ary = rb_ary_new();
-  rb_ary_push(ary, rb_float_new(preamp));
-  rb_ary_push(ary, band_ary);
-  
-  return ary;
+  xr_cmd_init(&cmd, self, XR_CMD_GET_EQ);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -1259,12 +1375,10 @@ static VALUE xr_eq(VALUE self) {
  *
  */
 static VALUE xr_eq_preamp(VALUE self) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
+  xr_cmd cmd;
 
-  return rb_float_new(xmms_remote_get_eq_preamp(*session));
+  xr_cmd_init(&cmd, self, XR_CMD_GET_EQ_PREAMP);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -1281,58 +1395,66 @@ static VALUE xr_eq_preamp(VALUE self) {
  *
  */
 static VALUE xr_eq_band(VALUE self, VALUE band) {
-  int *session;
+  xr_cmd cmd;
   int b;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
   b = NUM2INT(band);
-
   if (b < 0 || b >= NUM_BANDS)
     rb_raise(rb_eArgError, "band index out of range (band < 0 or band >= 10)");
 
-  return rb_float_new(xmms_remote_get_eq_band(*session, b));
+  xr_cmd_init(&cmd, self, XR_CMD_GET_EQ_BAND);
+  cmd.arg[0] = b;
+  return xr_call(self, &cmd);
 }
 
 /*
  * Set the equalizer values.
  *
- * This method takes either a preamp value and 10 band values, or a
- * preamp value and an array of band values.
+ * This method takes either a preamp value and 10 band values, a preamp
+ * value and an array of band values, or an Xmms::EqPreset.
  *
  * This method raises an Xmms::Error exception if XMMS is not running,
- * and an ArgumentError exception if the number of arguments isn't 2 or
- * 11.
+ * and an ArgumentError exception if the number of arguments isn't 1, 2,
+ * or 11, or if the array doesn't have 10 band values.
  *
  * Examples:
  *   bands = [0.0, -0.5, 0.9, 0.0, 0.0, 0.0, 0.2, 0.5, -0.1, 0.0]
  *   remote.set_equalizer 0.0, bands
  *
  *   remote.set_eq 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0
+ *
+ *   remote.set_eq Xmms::EqPreset.new
  *   
  */
 static VALUE xr_set_eq(int argc, VALUE *argv, VALUE self) {
-  int i, *session;
-  gfloat bands[10];
+  xr_cmd cmd;
+  int i;
+
+  xr_cmd_init(&cmd, self, XR_CMD_SET_EQ);
 
   switch (argc) {
     case 11:
       for (i = 0; i < NUM_BANDS; i++) 
-        bands[i] = NUM2DBL(argv[i + 1]);
+        cmd.farg[i + 1] = NUM2DBL(argv[i + 1]);
       break;
     case 2:
+      Check_Type(argv[1], T_ARRAY);
+      if (RARRAY_LEN(argv[1]) != NUM_BANDS)
+        rb_raise(rb_eArgError, "invalid band count (not %d)", NUM_BANDS);
       for (i = 0; i < NUM_BANDS; i++)
-        bands[i] = NUM2DBL(rb_ary_entry(argv[1], 2));
+        cmd.farg[i + 1] = NUM2DBL(rb_ary_entry(argv[1], i));
+      break;
+    case 1:
+      memcpy(cmd.farg, xr_eq_values(argv[0]), sizeof(gfloat) * (NUM_BANDS + 1));
       break;
     default:
-      rb_raise(rb_eArgError,"invalid argument count (not 2 or 11)");
+      rb_raise(rb_eArgError,"invalid argument count (not 1, 2, or 11)");
   }
   
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_set_eq(*session, NUM2DBL(argv[0]), bands);
-
-  return self;
+  if (argc > 1)
+    cmd.farg[0] = NUM2DBL(argv[0]);
+  xr_eq_forget(self);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -1346,13 +1468,12 @@ static VALUE xr_set_eq(int argc, VALUE *argv, VALUE self) {
  *
  */
 static VALUE xr_eq_set_preamp(VALUE self, VALUE preamp) {
-  int *session;
-
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-  xmms_remote_set_eq_preamp(*session, NUM2DBL(preamp));
+  xr_cmd cmd;
 
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_SET_EQ_PREAMP);
+  cmd.farg[0] = NUM2DBL(preamp);
+  xr_eq_forget(self);
+  return xr_call(self, &cmd);
 }
 
 /*
@@ -1368,28 +1489,34 @@ static VALUE xr_eq_set_preamp(VALUE self, VALUE preamp) {
  *
  */
 static VALUE xr_eq_set_band(VALUE self, VALUE band, VALUE val) {
-  int *session;
+  xr_cmd cmd;
   int b;
 
-  Data_Get_Struct(self, int, session);
-  CHECK_SESSION(session);
-
   b = NUM2INT(band);
   if (b < 0 || b >= NUM_BANDS)
     rb_raise(rb_eArgError, "band index out of range (band < 0 or band >= 10)");
 
-  xmms_remote_set_eq_band(*session, b, NUM2DBL(val));
-
-  return self;
+  xr_cmd_init(&cmd, self, XR_CMD_SET_EQ_BAND);
+  cmd.arg[0] = b;
+  cmd.farg[0] = NUM2DBL(val);
+  xr_eq_forget(self);
+  return xr_call(self, &cmd);
 }
 
 void Init_xmms(void) {
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+  /* native state is either per-object or locked (see xr_remote) */
+  rb_ext_ractor_safe(true);
+#endif
+
   mXmms = rb_define_module("Xmms");
+  pthread_atfork(NULL, NULL, atfork_child);
   
   /***********************/
   /* define Remote class */
   /***********************/
   cRemote = rb_define_class_under(mXmms, "Remote", rb_cObject);
+  rb_undef_alloc_func(cRemote);
 
   rb_define_singleton_method(cRemote, "new", xr_new, -1);
   rb_define_singleton_method(cRemote, "connect", xr_new, -1);
@@ -1397,7 +1524,7 @@ void Init_xmms(void) {
   rb_define_method(cRemote, "initialize", xr_init, -1);
 
   /* initialize constants */
-  rb_define_const(cRemote, "VERSION", rb_str_new2(VERSION));
+  rb_define_const(cRemote, "VERSION", rb_obj_freeze(rb_str_new2(VERSION)));
   rb_define_const(cRemote, "NUM_BANDS", INT2FIX(NUM_BANDS));
 
   rb_define_const(cRemote, "BAND_MAX", rb_float_new(BAND_MAX));
@@ -1449,6 +1576,9 @@ void Init_xmms(void) {
   rb_define_alias(cRemote, "playlist_clear", "clear");
   rb_define_alias(cRemote, "pl_clear", "clear");
 
+  rb_define_method(cRemote, "playlist_length", xr_pl_len, 0);
+  rb_define_alias(cRemote, "get_playlist_length", "playlist_length");
+
   rb_define_method(cRemote, "playlist_pos", xr_pl_pos, 0);
   rb_define_alias(cRemote, "get_playlist_position", "playlist_pos");
   rb_define_alias(cRemote, "get_playlist_pos", "playlist_pos");
@@ -1505,7 +1635,7 @@ void Init_xmms(void) {
   rb_define_alias(cRemote, "get_volume", "get_main_volume");
   rb_define_alias(cRemote, "volume", "get_main_volume");
 
-  rb_define_method(cRemote, "set_stereo_volume", xr_set_stereo_vol, 1);
+  rb_define_method(cRemote, "set_stereo_volume", xr_set_stereo_vol, 2);
   rb_define_alias(cRemote, "stereo_volume=", "set_stereo_volume");
 
   rb_define_method(cRemote, "set_main_volume", xr_set_main_vol, 1);
@@ -1643,4 +1773,26 @@ void Init_xmms(void) {
   /* define Error class */
   /**********************/
   eError = rb_define_class_under(mXmms, "Error", rb_eStandardError);
+
+  /* native subsystems */
+  Init_xmms_command();
+  Init_xmms_snapshot();
+  Init_xmms_index();
+  Init_xmms_times();
+  Init_xmms_edit();
+  Init_xmms_engine();
+  Init_xmms_future();
+  Init_xmms_pool();
+  Init_xmms_session();
+  Init_xmms_eq();
+  Init_xmms_autoeq();
+  Init_xmms_clock();
+  Init_xmms_sched();
+  Init_xmms_prefetch();
+  Init_xmms_crossfade();
+  Init_xmms_history();
+  Init_xmms_proxy();
+  Init_xmms_flight();
+  Init_xmms_http();
+  Init_xmms_trace();
 }
@@ -0,0 +1,466 @@
+/************************************************************************/
+/* Copyright (C) 2002 - 2004 Paul Duncan                                */
+/*                                                                      */
+/* Permission is hereby granted, free of charge, to any person          */
+/* obtaining a copy of this software and associated documentation files */
+/* (the "Software"), to deal in the Software without restriction,       */
+/* including without limitation the rights to use, copy, modify, merge, */
+/* publish, distribute, sublicense, and/or sell copies of the Software, */
+/* and to permit persons to whom the Software is furnished to do so,    */
+/* subject to the following conditions:                                 */
+/*                                                                      */
+/* The above copyright notice and this permission notice shall be       */
+/* included in all copies of the Software, its documentation and        */
+/* marketing & publicity materials, and acknowledgment shall be given   */
+/* in the documentation, materials and software packages that this      */
+/* Software was used.                                                   */
+/*                                                                      */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,      */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF   */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY     */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE    */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.               */
+/************************************************************************/
+
+/*
+ * Declarations shared between the Xmms-Ruby source files.  Nothing in
+ * here is visible from Ruby.
+ */
+#ifndef XMMS_RUBY_H
+#define XMMS_RUBY_H
+
+#include <stdio.h>
+#include <string.h>
+#include <xmms/xmmsctrl.h>
+#include <ruby.h>
+
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
+
+#define UNUSED(x)  ((void) (x))
+
+#define VERSION "0.1.2"
+#define NUM_BANDS 10
+#define BAND_MAX 20.0
+#define BAND_MIN -20.0
+#define VOL_MAX 100
+#define VOL_MIN 0
+
+/* older versions of ruby don't have these */
+#ifndef RSTRING_PTR
+#define RSTRING_PTR(s) (RSTRING(s)->ptr)
+#define RSTRING_LEN(s) (RSTRING(s)->len)
+#endif
+#ifndef RARRAY_LEN
+#define RARRAY_LEN(a) (RARRAY(a)->len)
+#endif
+
+/****************************/
+/* CLASS AND MODULE GLOBALS */
+/****************************/
+extern VALUE mXmms,
+             cRemote,
+             eError;
+
+#define CHECK_SESSION(session) if (!xmms_remote_is_running(*session)) rb_raise(eError, "XMMS is not running")
+
+/****************/
+/* XMMS::REMOTE */
+/****************/
+
+/*
+ * Native helper objects hanging off of a remote (see xr_remote_slot()).
+ */
+typedef enum {
+  XR_SLOT_ENGINE,
+  XR_SLOT_HTTP,
+  XR_SLOT_INDEX,
+  XR_SLOT_POOL,
+  XR_SLOT_PREFETCH,
+  XR_SLOT_TIMES,
+  XR_NUM_SLOTS
+} xr_slot;
+
+/*
+ * The native side of an Xmms::Remote.  Per-remote state lives in here
+ * rather than in hidden instance variables: ruby keeps those for data
+ * objects in a VM-wide table, which every Ractor has to lock to reach.
+ */
+typedef struct {
+  int session;
+  int pool_gen;                   /* pool generation (pool.c) */
+  double alive_ttl;               /* liveness check ttl (default 0) */
+  unsigned LONG_LONG flight;      /* single-flight methods (flight.c) */
+  int eq_known;                   /* eq holds the last preset sent */
+  unsigned int eq_edits;          /* xr_late_edits() when it was sent */
+  gfloat eq[NUM_BANDS + 1];
+  VALUE slots[XR_NUM_SLOTS];
+} xr_remote;
+
+xr_remote *xr_remote_get(VALUE obj);
+void xr_remote_set(VALUE obj, xr_slot slot, VALUE val);
+
+#define XR_SESSION(obj) (&xr_remote_get(obj)->session)
+#define xr_remote_slot(obj, slot) (xr_remote_get(obj)->slots[slot])
+
+/*
+ * Run fn(data) with the interpreter lock released (on rubies that have
+ * one).  If ruby wants to interrupt the call, *cancel (if non-NULL) is
+ * set; long-running loops should check it and bail out early.
+ */
+void *xr_nogvl(void *(*fn)(void *), void *data, volatile int *cancel);
+
+/*
+ * Incremented in the child after every fork.  Native state that
+ * doesn't survive a fork (threads, locks that another thread might
+ * have held) remembers the generation it was created in, and is reset
+ * when it's next used in a different one.
+ */
+extern volatile int xr_fork_gen;
+
+/*
+ * Strings from libxmms are g_malloc()ed copies of the reply.
+ * xr_str_take() turns one into a ruby string, tagged as UTF-8 (text)
+ * or in the filesystem encoding (paths), and frees it.  NULL comes back
+ * as an empty string.  xr_str_new() does the same for a native string
+ * that we own.
+ */
+typedef enum {
+  XR_STR_TEXT,
+  XR_STR_PATH
+} xr_str_type;
+
+VALUE xr_str_new(const char *ptr, long len, xr_str_type type);
+VALUE xr_str_take(gchar *str, xr_str_type type);
+
+/* monotonic time, in seconds */
+double xr_now(void);
+
+/* let ruby deliver pending interrupts after an xr_nogvl() call */
+#ifdef HAVE_RB_THREAD_CHECK_INTS
+#define XR_CHECK_INTS() rb_thread_check_ints()
+#else
+#define XR_CHECK_INTS()
+#endif
+
+/************/
+/* COMMANDS */
+/************/
+
+/*
+ * Every single-request Xmms::Remote method is described by an xr_cmd,
+ * which is executed by xr_cmd_exec() (directly, or on a session's I/O
+ * thread).  Commands carry their own copies of any string arguments,
+ * so they can be executed without the interpreter lock.
+ */
+typedef enum {
+  XR_CMD_GET_VERSION,
+  XR_CMD_PLAY,
+  XR_CMD_PAUSE,
+  XR_CMD_STOP,
+  XR_CMD_EJECT,
+  XR_CMD_QUIT,
+  XR_CMD_PLAY_PAUSE,
+  XR_CMD_IS_PLAYING,
+  XR_CMD_IS_PAUSED,
+  XR_CMD_PLAYLIST_ADD,
+  XR_CMD_PLAYLIST_ADD_URL,
+  XR_CMD_PLAYLIST_INS_URL,
+  XR_CMD_PLAYLIST_DELETE,
+  XR_CMD_PLAYLIST_CLEAR,
+  XR_CMD_GET_PLAYLIST_LENGTH,
+  XR_CMD_GET_PLAYLIST_POS,
+  XR_CMD_SET_PLAYLIST_POS,
+  XR_CMD_GET_PLAYLIST_FILE,
+  XR_CMD_GET_PLAYLIST_TITLE,
+  XR_CMD_GET_PLAYLIST_TIME,
+  XR_CMD_GET_OUTPUT_TIME,
+  XR_CMD_JUMP_TO_TIME,
+  XR_CMD_PLAYLIST_PREV,
+  XR_CMD_PLAYLIST_NEXT,
+  XR_CMD_GET_VOLUME,
+  XR_CMD_GET_MAIN_VOLUME,
+  XR_CMD_SET_VOLUME,
+  XR_CMD_SET_MAIN_VOLUME,
+  XR_CMD_GET_BALANCE,
+  XR_CMD_SET_BALANCE,
+  XR_CMD_GET_SKIN,
+  XR_CMD_SET_SKIN,
+  XR_CMD_MAIN_WIN_TOGGLE,
+  XR_CMD_IS_MAIN_WIN,
+  XR_CMD_PL_WIN_TOGGLE,
+  XR_CMD_IS_PL_WIN,
+  XR_CMD_EQ_WIN_TOGGLE,
+  XR_CMD_IS_EQ_WIN,
+  XR_CMD_SHOW_PREFS_BOX,
+  XR_CMD_TOGGLE_AOT,
+  XR_CMD_TOGGLE_REPEAT,
+  XR_CMD_IS_REPEAT,
+  XR_CMD_TOGGLE_SHUFFLE,
+  XR_CMD_IS_SHUFFLE,
+  XR_CMD_GET_INFO,
+  XR_CMD_IS_RUNNING,
+  XR_CMD_GET_EQ,
+  XR_CMD_GET_EQ_PREAMP,
+  XR_CMD_GET_EQ_BAND,
+  XR_CMD_SET_EQ,
+  XR_CMD_SET_EQ_PREAMP,
+  XR_CMD_SET_EQ_BAND,
+  XR_NUM_CMDS
+} xr_cmd_op;
+
+/* command flags */
+#define XR_CMD_READ     (1 << 0)  /* no side effects */
+#define XR_CMD_NO_CHECK (1 << 1)  /* don't check that XMMS is running */
+#define XR_CMD_MOVES    (1 << 2)  /* moves the playback position */
+#define XR_CMD_EDITS    (1 << 3)  /* changes the playlist or equalizer */
+
+/* how a command's result is returned to ruby (see xr_cmd_result()) */
+typedef enum {
+  XR_RET_SELF,                    /* the remote */
+  XR_RET_BOOL,                    /* ret[0] */
+  XR_RET_INT,                     /* ret[0] */
+  XR_RET_INT2,                    /* [ret[0], ret[1]] */
+  XR_RET_INT3,                    /* [ret[0], ret[1], ret[2]] */
+  XR_RET_FLOAT,                   /* fret[0] */
+  XR_RET_EQ,                      /* [fret[0], [fret[1] .. fret[10]]] */
+  XR_RET_STR,                     /* sret, as text */
+  XR_RET_PATH                     /* sret, as a file name */
+} xr_ret_type;
+
+typedef struct {
+  const char *name;
+  int flags;
+  xr_ret_type ret;
+} xr_cmd_def;
+
+extern const xr_cmd_def xr_cmd_defs[XR_NUM_CMDS];
+
+typedef struct {
+  xr_cmd_op op;
+  int session;
+
+  /* arguments */
+  gint arg[2];
+  int cur;                        /* use the current position as arg[0] */
+  gfloat farg[NUM_BANDS + 1];     /* preamp, then bands */
+  gchar **str;                    /* g_strdup()ed */
+  int num_str;
+  int late;                       /* run after xr_call() returned */
+
+  /* results */
+  double ttl;                     /* see xr_session_check() */
+
+  int ok;                         /* was XMMS running? (-1: see engine.c) */
+  gint ret[3];
+  gfloat fret[NUM_BANDS + 1];     /* preamp, then bands */
+  gchar *sret;                    /* g_malloc()ed by libxmms */
+} xr_cmd;
+
+void xr_cmd_init(xr_cmd *cmd, VALUE self, xr_cmd_op op);
+void xr_cmd_add_str(xr_cmd *cmd, VALUE str);
+void xr_cmd_free(xr_cmd *cmd);
+int xr_cmd_same(xr_cmd *a, xr_cmd *b);
+void xr_cmd_copy_result(xr_cmd *dst, xr_cmd *src);
+void xr_cmd_run(xr_cmd *cmd);
+void xr_cmd_exec(xr_cmd *cmd);
+int xr_session_check(int session, double ttl);
+
+VALUE xr_cmd_result(VALUE self, xr_cmd *cmd);
+
+VALUE xr_call(VALUE self, xr_cmd *cmd);
+
+/*
+ * Edits made by commands run after xr_call() returned (for a scheduler
+ * cue, or a future) can't go through the playlist change hooks, so
+ * they're counted per session instead (and, harmlessly, for any
+ * session that shares its slot).  A cache that sees the count move
+ * since it was filled should drop what it holds.  Safe to call from
+ * any thread.
+ */
+unsigned int xr_late_edits(int session);
+
+/**********************/
+/* PIPELINED I/O MODE */
+/**********************/
+
+typedef struct xr_engine xr_engine;
+typedef struct xr_job xr_job;
+
+xr_engine *xr_engine_get(VALUE self);
+xr_engine *xr_engine_start(VALUE self);
+void xr_engine_call(xr_engine *engine, xr_cmd *cmd);
+
+/*
+ * Queue a command without waiting for it.  The returned job holds one
+ * reference for the caller, which must be dropped with xr_job_unref().
+ */
+xr_job *xr_engine_submit(xr_engine *engine, xr_cmd *cmd);
+int xr_job_done(xr_job *job);
+int xr_job_wait(xr_job *job, double timeout);
+xr_cmd *xr_job_cmd(xr_job *job);
+void xr_job_unref(xr_job *job);
+
+/*****************************/
+/* FUTURES AND ASYNC METHODS */
+/*****************************/
+
+extern VALUE cFuture;
+
+int xr_async_pending(VALUE self);
+VALUE xr_future_new(VALUE self, xr_job *job);
+
+/*********************/
+/* EQUALIZER PRESETS */
+/*********************/
+
+/* floats in a preset: preamp, bands, and padding (see eq.c) */
+#define XR_EQ_LEN 12
+
+extern VALUE cEqPreset;
+
+VALUE xr_eq_new(const gfloat *values);
+const gfloat *xr_eq_values(VALUE preset);
+void xr_eq_forget(VALUE remote);
+
+/******************/
+/* POSITION CLOCK */
+/******************/
+
+void xr_clock_poke(int session);
+
+/*************/
+/* SCHEDULER */
+/*************/
+
+int xr_sched_capture(xr_cmd *cmd);
+void xr_sched_refuse(const char *name);
+
+/**************/
+/* PREFETCHER */
+/**************/
+
+int xr_prefetch_lookup(VALUE self, xr_cmd *cmd);
+
+/*****************/
+/* SINGLE FLIGHT */
+/*****************/
+
+typedef struct xr_flight xr_flight;
+
+int xr_flight_board(VALUE self, xr_cmd *cmd, xr_flight **flight);
+void xr_flight_land(xr_flight *flight, xr_cmd *cmd);
+void xr_flight_wrote(int session);
+int xr_flight_playlist(VALUE self, VALUE *ret);
+
+/*********************/
+/* PLAYLIST SNAPSHOT */
+/*********************/
+
+/* columns to fetch (see xr_snap_fetch()) */
+#define XR_COL_TITLE (1 << 0)
+#define XR_COL_FILE  (1 << 1)
+#define XR_COL_TIME  (1 << 2)
+
+/*
+ * A native copy of some (or all) columns of the playlist.  Strings are
+ * the g_malloc()ed buffers returned by libxmms; xr_snap_free() frees
+ * them.
+ */
+typedef struct {
+  int len, cols;
+  gchar **titles,
+        **files;
+  gint *times;
+} xr_snap;
+
+int xr_snap_fetch(xr_snap *snap, int session, int cols);
+void xr_snap_free(xr_snap *snap);
+
+/**************/
+/* PATH STORE */
+/**************/
+
+/*
+ * Prefix-compressed storage for a list of paths, with "everything
+ * under this directory" queries (see paths.c).
+ */
+typedef struct xr_paths xr_paths;
+
+xr_paths *xr_paths_new(void);
+int xr_paths_add(xr_paths *paths, const char *path);
+void xr_paths_trim(xr_paths *paths);
+int xr_paths_length(xr_paths *paths);
+const char *xr_paths_get(xr_paths *paths, int id, size_t *len);
+int xr_paths_under(xr_paths *paths, const char *dir, size_t len, unsigned int **ret);
+size_t xr_paths_memsize(xr_paths *paths);
+void xr_paths_free(xr_paths *paths);
+
+/*************************/
+/* PLAYLIST CHANGE HOOKS */
+/*************************/
+
+/*
+ * Playlist edits made through an Xmms::Remote are broadcast to any
+ * native caches hanging off of it (in its slots), so they can be kept
+ * up to date without refetching the playlist.  Only edits that have
+ * been made are broadcast; ones that run later are counted instead
+ * (see xr_late_edits()).
+ *
+ * For XR_PL_ADD and XR_PL_INSERT, pos is the index of the first new
+ * entry (or -1 for "end of playlist") and argv holds the new paths (as
+ * Ruby strings).  For XR_PL_DELETE, argv holds the deleted positions
+ * (as Fixnums) in descending order, and pos is unused.  For
+ * XR_PL_REORDER, argv[k] is the old position of the entry now at
+ * position k (as a Fixnum).
+ */
+typedef enum {
+  XR_PL_ADD,
+  XR_PL_INSERT,
+  XR_PL_DELETE,
+  XR_PL_REORDER,
+  XR_PL_CLEAR
+} xr_pl_op;
+
+typedef void (*xr_pl_hook)(VALUE obj, xr_pl_op op, int pos, int argc, VALUE *argv);
+
+void xr_pl_listen(xr_slot slot, xr_pl_hook hook);
+void xr_pl_notify(VALUE self, xr_pl_op op, int pos, int argc, VALUE *argv);
+
+/**********/
+/* TRACES */
+/**********/
+
+/* is a capture on?  (see trace.c) */
+extern int xr_tracing;
+
+void xr_trace_cmd(xr_cmd *cmd, double start, double end);
+
+/*******************/
+/* SUBSYSTEM SETUP */
+/*******************/
+void Init_xmms_command(void);
+void Init_xmms_snapshot(void);
+void Init_xmms_index(void);
+void Init_xmms_times(void);
+void Init_xmms_edit(void);
+void Init_xmms_engine(void);
+void Init_xmms_future(void);
+void Init_xmms_pool(void);
+void Init_xmms_session(void);
+void Init_xmms_eq(void);
+void Init_xmms_autoeq(void);
+void Init_xmms_clock(void);
+void Init_xmms_sched(void);
+void Init_xmms_prefetch(void);
+void Init_xmms_crossfade(void);
+void Init_xmms_history(void);
+void Init_xmms_proxy(void);
+void Init_xmms_flight(void);
+void Init_xmms_http(void);
+void Init_xmms_trace(void);
+
+#endif /* XMMS_RUBY_H */